@@ -28,6 +28,7 @@
 #include <string>
 #include <cstdint>
 #include <vector>
+#include <array>
 #include <numeric>
 
 #include <imgui/imgui.h>
@@ -43,10 +44,15 @@
 #include <glm/vector_relational.hpp>
 
 #include "shaders/shaderio.h"           // Shared between host and device
+#include "utils/brick_cache.hpp"
+#include "utils/brick_codec.hpp"
+#include "utils/build_queue.hpp"
 #include "utils/path_utils.hpp"
 #include "utils/utils.hpp"
 #include "utils/scene.hpp"
+#include "utils/scene_editor.hpp"
 #include "utils/rng.hpp"
+#include "utils/sdf.hpp"
 #include "utils/portable-file-dialogs.h"
 
 #include "_autogen/compute_tracing.slang.h"
@@ -128,6 +134,9 @@ const char* NormalModes[] = {
     "Tethrahedron",
 };
 
+// Atlas tile rows uploaded per submit when restoring baked bricks, about 8 MB
+const uint32_t RESTORE_ROWS_PER_SUBMIT = 32;
+
 class AppElement : public nvapp::IAppElement
 {
   enum
@@ -166,6 +175,7 @@ public:
   {
     // Add run parameter example
     //m_info.parameterRegistry->add({"animate"}, &m_animate);
+    m_info.parameterRegistry->add({"brickcache", "Baked brick file, written by tfg_cli, restored on startup and on scene loads"}, &m_brickCachePath);
   }
 
   ~AppElement() override = default;
@@ -207,6 +217,7 @@ public:
     createRNGTextures();            // Creates the different rng and noise textures used in the shaders
     create3DTextures();             // Creates the different 3d textures used to store voxel grid data
     createAccelerationStructures(); // Creates the bLas and tLas needed for the rt pipeline 
+    restoreBrickCache();            // Replaces the startup build with the baked bricks, if any
     createDescriptorSetLayout();    // Create the descriptor set layout for the pipelines
     compileShaders();               // Creates and compiles the shaders modules
     createPipelines();              // Create the pipelines
@@ -278,14 +289,26 @@ public:
     
     m_alloc.destroyBuffer(m_buildJobQueue);
     m_alloc.destroyBuffer(m_brickJobQueue);
+    m_alloc.destroyBuffer(m_buildObjectsB);
    
     m_alloc.destroyBuffer(m_countersB);
     m_alloc.destroyBuffer(m_indirectB);
     m_alloc.destroyBuffer(m_freeListB);
+    m_alloc.destroyBuffer(m_brickOwnersB);
+    m_alloc.destroyBuffer(m_prefetchCellsB);
+    m_alloc.destroyBuffer(m_notResidentB);
+    m_alloc.destroyBuffer(m_countersReadbackB);
+    m_alloc.destroyBuffer(m_notResidentReadbackB);
 
     m_alloc.destroyImage(m_noiseTex);
     m_alloc.destroyBuffer(m_aoKernelsB);
     m_alloc.destroyBuffer(m_shadowKernelsB);
+    m_alloc.destroyBuffer(m_terrainLatticeB);
+    m_alloc.destroyBuffer(m_editSlotsB);
+    m_alloc.destroyBuffer(m_editValuesB);
+    m_alloc.destroyBuffer(m_volumesB);
+    m_alloc.destroyBuffer(m_volumeBricksB);
+    m_alloc.destroyBuffer(m_volumeValuesB);
 
     m_alloc.destroyImage(m_clipMap);
     m_alloc.destroyImage(m_brickAtlas);
@@ -335,9 +358,10 @@ public:
       ImGui::SliderFloat("Time dialtion", &m_pushConst.pyp.time_dilation, 0.0,10.0);
       ImGui::SliderInt("Sub steps", &m_pushConst.pyp.sub_steps, 1,30);
       ImGui::SliderFloat3("Gravity", &m_pushConst.pyp.gravity.x,-20.0f,20.0f);
+      m_sceneEditor.drawSdfCacheMenu();
     }
 
-    m_scene.drawUserActionMenu();
+    m_sceneEditor.drawUserActionMenu();
 
     if(ImGui::CollapsingHeader("Lighting data")){
       bool dirtyLight = false;
@@ -395,6 +419,11 @@ public:
       }
 
       ImGui::Text("Camera id0: %i,%i,%i",m_sceneInfo.cameraId0.x,m_sceneInfo.cameraId0.y,m_sceneInfo.cameraId0.z);
+      drawAtlasStats();
+      ImGui::SliderInt("Build budget", &m_buildBudget, 0, 1<<20, "%d bricks", ImGuiSliderFlags_Logarithmic);
+      ImGui::SliderInt("Recenter hysteresis", &m_recenterHysteresis, 0, ClipmapCenters::MAX_HYSTERESIS, "%d bricks");
+      ImGui::Checkbox("Prefetch", &m_prefetchActive);
+      ImGui::SliderFloat("Prefetch lookahead", &m_prefetchLookahead, 0.0f, 1.0f, "%.2f s");
       if(ImGui::Button("Reset TLas")){
         m_rebuildTlas = true;
       }
@@ -413,7 +442,7 @@ public:
     ImGui::End();
 
     // Draw scene tree and object tab
-    m_scene.draw();
+    m_sceneEditor.draw();
 
     ImGui::Begin("Viewport");
 
@@ -427,7 +456,7 @@ public:
       static glm::vec3 prevCamCenter = m_cameraManip->getCenter();
       static glm::vec3 prevCamEye = m_cameraManip->getEye();
       
-      if(m_scene.m_usingGuizmo){
+      if(m_sceneEditor.m_usingGuizmo){
         m_cameraManip->setCenter(prevCamCenter);
         m_cameraManip->setEye(prevCamEye);
       }else{
@@ -435,12 +464,36 @@ public:
         prevCamEye = m_cameraManip->getEye();
       }
       
-      m_scene.drawGuizmo(viewportPos, viewportSize, viewMatrix, projMatrix);
+      m_sceneEditor.drawGuizmo(viewportPos, viewportSize, viewMatrix, projMatrix);
 
       
     ImGui::End();
   }
 
+  // Occupancy and eviction counters of the brick atlas, read back from the
+  // generation pass of a few frames ago, and the bricks the build jobs cover
+  void drawAtlasStats(){
+    const uint32_t* counters = m_atlasCounters.data();
+    const uint32_t occupancy = counters[shaderio::Counters::allocCounter] - counters[shaderio::Counters::freeCounter];
+    const uint32_t failed = counters[shaderio::Counters::failedAllocs];
+    ImGui::Text("Atlas: %u / %d bricks (%.1f%%)", occupancy, int(shaderio::NUM_BRICKS_IN_ATLAS),
+      100.0f * float(occupancy) / float(shaderio::NUM_BRICKS_IN_ATLAS));
+    ImGui::Text("Atlas evicted: %u, failed: %u", counters[shaderio::Counters::evictedBricks], failed);
+    const Scene::BuildJobStats& jobStats = m_scene.getBuildJobStats();
+    ImGui::Text("Build bricks: %llu unique / %llu requested", (unsigned long long)jobStats.uniqueBricks,
+      (unsigned long long)jobStats.requestedBricks);
+    ImGui::Text("Build bricks pending: %llu", (unsigned long long)m_buildQueue.pendingBricks());
+    ImGui::Text("Prefetched: %u, committed: %u, tracked: %llu", counters[shaderio::Counters::prefetchedBricks],
+      counters[shaderio::Counters::committedBricks], (unsigned long long)m_prefetch.trackedBricks());
+  }
+
+  void warnAtlasFull(){
+    const uint32_t failed = m_atlasCounters[shaderio::Counters::failedAllocs];
+    if(failed > m_failedAllocsSeen)
+      LOGW("Brick atlas full, %u bricks without a slot\n", failed - m_failedAllocsSeen);
+    m_failedAllocsSeen = failed;
+  }
+
   //---------------------------------------------------------------------------------------------------------------
   // This renders the toolbar of the window
   // - Called when the ImGui menu is rendered
@@ -496,7 +549,8 @@ public:
     }
     if(load || ImGui::IsKeyPressed(ImGuiKey_F9)){
       LOGI("Loading from %s\n",m_saveFilePath.c_str());
-      m_scene.loadFromFile(m_saveFilePath);
+      if(m_scene.loadFromFile(m_saveFilePath))
+        restoreBrickCache();
     }
     if(reload_shaders || ImGui::IsKeyPressed(ImGuiKey_F8)){
       vkQueueWaitIdle(m_app->getQueue(0).queue);
@@ -619,7 +673,7 @@ public:
       glm::vec3 eye = m_cameraManip->getEye();
       glm::vec3 center = m_cameraManip->getCenter();
       //m_scene.simulate(deltaT);
-      m_scene.userAction(eye, glm::normalize(center-eye), m_pushConst.pyp.dts);
+      m_sceneEditor.userAction(eye, glm::normalize(center-eye), m_pushConst.pyp.dts);
     }
 
 
@@ -775,7 +829,59 @@ public:
                                     VK_IMAGE_LAYOUT_GENERAL});
   }
 
-  void executeBuildJobs(VkCommandBuffer cmd){
+  // Copies the counters and the bricks left without a slot into the readback
+  // slots of this frame cycle, every frame so no slot falls behind the others.
+  // The list starts empty for the next frame.
+  void copyCountersToHost(VkCommandBuffer cmd){
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_countersB.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                       VK_PIPELINE_STAGE_2_TRANSFER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_notResidentB.buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                                       VK_PIPELINE_STAGE_2_TRANSFER_BIT});
+    const VkBufferCopy countersCopy{
+      .dstOffset = m_app->getFrameCycleIndex()*NUM_COUNTERS*sizeof(uint32_t),
+      .size = NUM_COUNTERS*sizeof(uint32_t)
+    };
+    vkCmdCopyBuffer(cmd, m_countersB.buffer, m_countersReadbackB.buffer, 1, &countersCopy);
+    const VkBufferCopy notResidentCopy{
+      .dstOffset = m_app->getFrameCycleIndex()*MAX_NOT_RESIDENT_BRICKS*sizeof(glm::ivec4),
+      .size = MAX_NOT_RESIDENT_BRICKS*sizeof(glm::ivec4)
+    };
+    vkCmdCopyBuffer(cmd, m_notResidentB.buffer, m_notResidentReadbackB.buffer, 1, &notResidentCopy);
+    vkCmdFillBuffer(cmd, m_countersB.buffer, shaderio::Counters::notResidentBricks*sizeof(uint32_t), sizeof(uint32_t), 0);
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_countersB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_notResidentB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+  }
+
+  // The slots of this frame cycle hold the counters of the last frame that
+  // used it, the application waited for that frame before this one started
+  void readCountersFromHost(){
+    const VkDeviceSize offset = m_app->getFrameCycleIndex()*NUM_COUNTERS*sizeof(uint32_t);
+    const VkDeviceSize size = NUM_COUNTERS*sizeof(uint32_t);
+    NVVK_CHECK(vmaInvalidateAllocation(m_alloc, m_countersReadbackB.allocation, offset, size));
+    std::memcpy(m_atlasCounters.data(), static_cast<const uint8_t*>(m_countersReadbackB.mapping) + offset, size_t(size));
+
+    const uint32_t listed = std::min(m_atlasCounters[shaderio::Counters::notResidentBricks], uint32_t(MAX_NOT_RESIDENT_BRICKS));
+    if(listed == 0)
+      return;
+    const VkDeviceSize listOffset = m_app->getFrameCycleIndex()*MAX_NOT_RESIDENT_BRICKS*sizeof(glm::ivec4);
+    NVVK_CHECK(vmaInvalidateAllocation(m_alloc, m_notResidentReadbackB.allocation, listOffset, listed*sizeof(glm::ivec4)));
+    const glm::ivec4* bricks = reinterpret_cast<const glm::ivec4*>(static_cast<const uint8_t*>(m_notResidentReadbackB.mapping) + listOffset);
+    m_notResident.insert(m_notResident.end(), bricks, bricks + listed);
+  }
+
+  // Bricks left without a slot are built again once the atlas has free slots,
+  // as many as it has. The ones that fail again are listed again.
+  void requeueNotResident(){
+    const uint32_t occupancy = m_atlasCounters[shaderio::Counters::allocCounter] - m_atlasCounters[shaderio::Counters::freeCounter];
+    const uint32_t freeSlots = occupancy < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) ? shaderio::NUM_BRICKS_IN_ATLAS - occupancy : 0;
+    m_buildQueue.pushNotResident(m_notResident, freeSlots);
+  }
+
+  // Release and regular jobs, then prefetch jobs in a dispatch of their own so
+  // the bricks the regular ones commit leave the prefetch table first
+  void executeBuildJobs(VkCommandBuffer cmd, std::vector<shaderio::BuildJob> buildJobs, std::span<const shaderio::BuildJob> prefetchJobs){
     NVVK_DBG_SCOPE(cmd);
     const auto profiledSection = m_profilerGpuTimer.cmdFrameSection(cmd, "Build jobs");
 
@@ -783,6 +889,14 @@ public:
     std::vector<uint32_t> counters(1,0);
     unsigned long size = counters.size() * sizeof(uint32_t);
     vkCmdUpdateBuffer(cmd, m_countersB.buffer, 0, size, counters.data());
+
+    // Allocations in this pass only take pointers freed before it
+    const VkBufferCopy freeCounterCopy{
+      .srcOffset = shaderio::Counters::freeCounter*sizeof(uint32_t),
+      .dstOffset = shaderio::Counters::passFreeCounter*sizeof(uint32_t),
+      .size = sizeof(uint32_t)
+    };
+    vkCmdCopyBuffer(cmd, m_countersB.buffer, m_countersB.buffer, 1, &freeCounterCopy);
     nvvk::cmdBufferMemoryBarrier(cmd, {m_countersB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
 
@@ -796,30 +910,48 @@ public:
     nvvk::cmdBufferMemoryBarrier(cmd, {m_indirectB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
 
-    int num_bricks;
-    std::vector<shaderio::BuildJob> buildJobs;
-    buildJobs = m_scene.getBuildJobs(m_currCamId0,m_prevCamId0);
-    //buildJobs = m_scene.getDenseBuildJobs(m_currCamId0,m_prevCamId0);
-
-    if(buildJobs.size() > shaderio::MAX_NUM_BUILD_JOBS)
-      LOGE("Not enough space in build job queue to allocale %zu jobs\n",buildJobs.size());
+    const uint32_t numRegular = uint32_t(buildJobs.size());
+    buildJobs.insert(buildJobs.end(), prefetchJobs.begin(), prefetchJobs.end());
     
     if(buildJobs.size() <= 0){
       //LOGW("Build job queue update size is 0, skipping generation pass\n");
       return;
     }
 
+    // Brick evaluation only loops over the objects near its build job
+    std::vector<uint32_t> buildObjects = m_scene.getBuildJobObjects(buildJobs);
+
     size = buildJobs.size() * sizeof(shaderio::BuildJob);
     m_stagingUploader.appendBuffer(m_buildJobQueue,0,size,buildJobs.data());
+    size = buildObjects.size() * sizeof(uint32_t);
+    m_stagingUploader.appendBuffer(m_buildObjectsB,0,size,buildObjects.data());
     m_stagingUploader.cmdUploadAppended(cmd);
 
     nvvk::cmdBufferMemoryBarrier(cmd, {m_buildJobQueue.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_buildObjectsB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
 
     // Bind pipeline
     bindComputePipeline(cmd,&m_buildJobPipeline);
     // Dispatch
-    vkCmdDispatch(cmd, 1, 1, buildJobs.size());
+    if(numRegular > 0)
+      vkCmdDispatch(cmd, 1, 1, numRegular);
+
+    if(!prefetchJobs.empty()){
+      VkMemoryBarrier barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+      };
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+      m_pushConst.buildJobOffset = numRegular;
+      vkCmdPushConstants(cmd, m_buildJobPipeline.layout, VK_SHADER_STAGE_ALL, 0, sizeof(shaderio::PushConstant), &m_pushConst);
+      vkCmdDispatch(cmd, 1, 1, uint32_t(prefetchJobs.size()));
+      m_pushConst.buildJobOffset = 0;
+    }
   
     nvvk::cmdBufferMemoryBarrier(cmd, {m_brickJobQueue.buffer, 
                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
@@ -828,11 +960,44 @@ public:
 
   void generationPass(VkCommandBuffer cmd){
     const auto profiledSection = m_profilerGpuTimer.cmdFrameSection(cmd, "Generation");
-    const bool sceneRefresh = m_scene.m_needsRefresh || m_currCamId0 != m_prevCamId0 || m_firstFrame;
+    const bool sceneRefresh = m_scene.m_needsRefresh || m_currCenters != m_prevCenters || m_firstFrame;
+    readCountersFromHost();
     
     if(sceneRefresh){
-      genJobsPass(cmd);
+      m_buildQueue.push(m_scene.getBuildJobs(m_currCenters,m_prevCenters));
+      //m_buildQueue.push(m_scene.getDenseBuildJobs(m_currCenters,m_prevCenters));
       m_scene.m_needsRefresh = false;
+      // Prefetched bricks near an edit saw the scene before it
+      if(m_prefetch.invalidate(m_scene.getChangedRegions(), m_currCenters))
+        m_pushConst.prefetchValidFrame = m_pushConst.frameCount;
+    }
+    requeueNotResident();
+
+    // Jobs left over by the budget of earlier frames wait in the queue too
+    const glm::mat4 viewProj = m_cameraManip->getPerspectiveMatrix() * m_cameraManip->getViewMatrix();
+    std::vector<shaderio::BuildJob> buildJobs = m_buildQueue.pop(m_currCenters, viewProj, uint32_t(m_buildBudget));
+    if(m_buildQueue.empty())
+      m_prefetch.committed(m_currCenters);
+
+    // The budget left builds the bricks the camera is heading to
+    std::vector<shaderio::BuildJob> prefetchJobs;
+    uint64_t builtBricks = 0;
+    for(const shaderio::BuildJob& job : buildJobs)
+      builtBricks += uint64_t(job.num_b.x) * uint64_t(job.num_b.y) * uint64_t(job.num_b.z);
+    // Clip cells the windows gave to bricks still waiting fall back to coarser levels
+    std::vector<shaderio::BuildJob> releaseJobs = m_buildQueue.takeReleaseJobs();
+    buildJobs.insert(buildJobs.begin(), releaseJobs.begin(), releaseJobs.end());
+    if(m_prefetchActive && m_buildQueue.empty() && (m_buildBudget == 0 || builtBricks < uint64_t(m_buildBudget))){
+      const uint32_t spare = m_buildBudget == 0 ? 0 : uint32_t(uint64_t(m_buildBudget) - builtBricks);
+      ClipmapCenters predicted = m_currCenters;
+      predicted.follow(m_prefetch.predictCameraId0(m_prefetchLookahead), m_recenterHysteresis);
+      prefetchJobs = m_prefetch.jobs(m_currCenters, predicted, spare,
+                                     uint32_t(shaderio::MAX_NUM_BUILD_JOBS - buildJobs.size()));
+    }
+
+    const bool generate = !buildJobs.empty() || !prefetchJobs.empty();
+    if(generate){
+      genJobsPass(cmd, std::move(buildJobs), prefetchJobs);
     }else{
       // Empty timers so it doesn't break the profiler config
       { const auto profiledSection = m_profilerGpuTimer.cmdFrameSection(cmd, "Build jobs"); }
@@ -840,7 +1005,7 @@ public:
     }
     
     bool rtxON = m_pushConst.lp.tracingMode == int(shaderio::TracingModes::rtx);
-    if(rtxON && (m_updateTlas || sceneRefresh)){
+    if(rtxON && (m_updateTlas || generate)){
       updateTopLevelAS(cmd,m_rebuildTlas);
       m_rebuildTlas = false;
     }else{
@@ -848,15 +1013,18 @@ public:
       const auto profiledSection = m_profilerGpuTimer.cmdFrameSection(cmd, "Accel struct update");
     }
 
+    copyCountersToHost(cmd);
+    warnAtlasFull();
+
     // Post generation submit updates
-    m_prevCamId0 = m_currCamId0;
+    m_prevCenters = m_currCenters;
     m_updateTlas = !rtxON;
   }
 
-  void genJobsPass(VkCommandBuffer cmd){
+  void genJobsPass(VkCommandBuffer cmd, std::vector<shaderio::BuildJob> buildJobs, std::span<const shaderio::BuildJob> prefetchJobs){
     NVVK_DBG_SCOPE(cmd);
 
-    executeBuildJobs(cmd);
+    executeBuildJobs(cmd, std::move(buildJobs), prefetchJobs);
     executeBrickJobs(cmd);
   }
 
@@ -1004,6 +1172,8 @@ public:
     });
 #endif
 
+    // Reloaded shaders must decode the atlas the way it was allocated
+    m_slangCompiler.addMacro({"BRICK_ENCODING", BRICK_ENCODING == BRICK_ENCODING_RANGE4 ? "1" : "0"});
   }
 
   void setupGBuffers(){
@@ -1215,10 +1385,14 @@ public:
 
     // Brick atlas
     const int atlas_axis_size = BRICK_PER_ATLAS_AXIS*BRICK_SIZE;
-    extent = {atlas_axis_size,atlas_axis_size,BRICK_SIZE};  // XYZ size
+    extent = {atlas_axis_size,atlas_axis_size,BRICK_ATLAS_DEPTH};  // XYZ size
+#if BRICK_ENCODING == BRICK_ENCODING_RANGE4
+    format = VK_FORMAT_R8_UINT;  // Packed residuals and brick ranges
+    clearColor = {.uint32={255,255,255,255}};  // Range [1,1], decodes as empty space
+#else
     format = VK_FORMAT_R8_SNORM;  // Texel format
-    glm::float32 clearValueF = 1.0f;
-    clearColor = {.float32={clearValueF,clearValueF,clearValueF,clearValueF}};
+    clearColor = {.float32={1.0f,1.0f,1.0f,1.0f}};
+#endif
     create3DStorageTextureFixed(m_brickAtlas, extent, format, clearColor);
     NVVK_DBG_NAME(m_brickAtlas.image);
     size = extent.width * extent.height * extent.depth;
@@ -1227,10 +1401,9 @@ public:
     // Material atlas
     if(MAT_PER_BRICK_AXIS > 1){
       const int mat_atlas_axis_size = BRICK_PER_ATLAS_AXIS*MAT_PER_BRICK_AXIS;
-      extent = {mat_atlas_axis_size,mat_atlas_axis_size,MAT_PER_BRICK_AXIS};  // XYZ size
+      extent = {mat_atlas_axis_size,mat_atlas_axis_size,MAT_PER_BRICK_AXIS*BRICKS_PER_ATLAS_TILE};  // XYZ size
       format = VK_FORMAT_R8G8B8A8_UNORM;  // Texel format
-      clearValueF = 1.0f;
-      clearColor = {.float32={clearValueF,clearValueF,clearValueF,clearValueF}};
+      clearColor = {.float32={1.0f,1.0f,1.0f,1.0f}};
       create3DStorageTexture(m_matAtlas, extent, format, clearColor);
       NVVK_DBG_NAME(m_matAtlas.image);
     }
@@ -1457,6 +1630,148 @@ public:
     createTopLevelAS();
   }
 
+  // Replaces the clipmap, atlas, free list, instances and counters with the
+  // bricks baked in m_brickCachePath. Only the regions of the nodes that
+  // changed since the bake are built again, level windows baked away from the
+  // camera catch up through the regular shell jobs. False keeps the bricks.
+  bool restoreBrickCache(){
+    if(m_brickCachePath.empty())
+      return false;
+    SCOPED_TIMER(__FUNCTION__);
+
+    BrickCache cache;
+    if(!cache.open(m_brickCachePath))
+      return false;
+    if(MAT_PER_BRICK_AXIS > 1){
+      LOGW("%s has no material bricks, rebuilding\n", m_brickCachePath.c_str());
+      return false;
+    }
+
+    // A slot holds one brick on the GPU, deduplicated bakes can't be restored
+    std::span<const uint32_t> clipMap = cache.clipMap();
+    std::vector<shaderio::BrickOwner> owners(shaderio::NUM_BRICKS_IN_ATLAS, {.id_level = glm::ivec4(0,0,0,-1)});
+    std::vector<glm::ivec4> notResident;
+    for(size_t cell = 0; cell < clipMap.size(); cell++){
+      const uint32_t pointer = clipMap[cell];
+      if(pointer == shaderio::NOT_RESIDENT_BRICK_POINTER){
+        notResident.push_back(cache.cellBrick(cell));
+        continue;
+      }
+      if(pointer >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+        continue;
+      if(owners[pointer].id_level.w >= 0){
+        LOGW("%s shares atlas slots between bricks, rebuilding\n", m_brickCachePath.c_str());
+        return false;
+      }
+      owners[pointer] = {.id_level = cache.cellBrick(cell), .lastUse = m_pushConst.frameCount};
+    }
+
+    // Frames in flight still read and write the current bricks
+    vkDeviceWaitIdle(m_app->getDevice());
+
+    auto submitUploads = [&](){
+      VkCommandBuffer cmd = m_app->createTempCmdBuffer();
+      m_stagingUploader.cmdUploadAppended(cmd);
+      m_app->submitAndWaitTempCmdBuffer(cmd);
+      m_stagingUploader.releaseStaging();
+    };
+
+    NVVK_CHECK(m_stagingUploader.appendImage(m_clipMap, clipMap, VK_IMAGE_LAYOUT_GENERAL));
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_freeListB, 0, cache.freeList()));
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_brickOwnersB, 0, std::span(owners)));
+    std::vector<glm::ivec4> prefetchCells(shaderio::NUM_PREFETCH_CELLS, glm::ivec4(0,0,0,PREFETCH_EMPTY));
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_prefetchCellsB, 0, std::span(prefetchCells)));
+    std::array<uint32_t, NUM_COUNTERS> counters{};
+    counters[shaderio::Counters::allocCounter] = cache.allocCounter();
+    counters[shaderio::Counters::freeCounter] = cache.freeCounter();
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_countersB, 0, std::span(counters)));
+
+    // Same transform and mask build.slang gives an instance
+    std::span<const BrickCache::Instance> instances = cache.instances();
+    std::vector<VkAccelerationStructureInstanceKHR> tlasInstances(instances.size());
+    for(size_t i = 0; i < instances.size(); i++){
+      const BrickCache::Instance& in = instances[i];
+      const float s = shaderio::BRICK_SIZES[in.level];
+      const glm::vec3 pos = glm::vec3(in.brickId)*s;
+      tlasInstances[i] = {
+        .transform = {{{s,0,0,pos.x},{0,s,0,pos.y},{0,0,s,pos.z}}},
+        .instanceCustomIndex = uint32_t(in.level),
+        .mask = in.visible != 0 ? 0xFFu : 0x00u,
+        .instanceShaderBindingTableRecordOffset = 0,
+        .flags = 0,
+        .accelerationStructureReference = m_bLas.address,
+      };
+    }
+    if(!tlasInstances.empty())
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_instancesB, 0, std::span(tlasInstances)));
+    submitUploads();
+
+    // Atlas pointers run along the rows of tiles, the payload is uploaded a
+    // row at a time and submitted every few rows so the staging memory stays
+    // bounded. Cached values are R8_SNORM, RANGE4 atlases encode them here.
+    const uint32_t rowBricks = BRICK_PER_ATLAS_AXIS*BRICKS_PER_ATLAS_TILE;
+    const VkExtent3D rowExtent = {BRICK_PER_ATLAS_AXIS*BRICK_SIZE, BRICK_SIZE, BRICK_ATLAS_DEPTH};
+    const size_t rowTexels = size_t(rowExtent.width)*rowExtent.height;
+    std::vector<uint8_t> row(rowTexels*rowExtent.depth);
+    uint32_t rows = 0;
+    cache.forEachAtlasChunk(rowBricks, [&](uint32_t firstPointer, std::span<const int8_t> values){
+#if BRICK_ENCODING == BRICK_ENCODING_RANGE4
+      std::fill(row.begin(), row.end(), uint8_t(255));
+#else
+      std::fill(row.begin(), row.end(), uint8_t(127));
+#endif
+      const uint32_t count = uint32_t(values.size()/Range4Brick::NUM_VALUES);
+      for(uint32_t b = 0; b < count; b++){
+        const int8_t* brick = values.data() + size_t(b)*Range4Brick::NUM_VALUES;
+        const int tileX = int(b/BRICKS_PER_ATLAS_TILE)*BRICK_SIZE;
+        const int slotZ = int(b%BRICKS_PER_ATLAS_TILE)*BRICK_ATLAS_SLOT_DEPTH;
+#if BRICK_ENCODING == BRICK_ENCODING_RANGE4
+        std::array<float, Range4Brick::NUM_VALUES> decoded;
+        for(int i = 0; i < Range4Brick::NUM_VALUES; i++)
+          decoded[i] = glm::max(float(brick[i])/127.0f, -1.0f);
+        Range4Brick encoded;
+        encodeRange4(decoded, encoded);
+        for(int z = 0; z < BRICK_ATLAS_SLOT_DEPTH; z++)
+          for(int y = 0; y < BRICK_SIZE; y++)
+            for(int x = 0; x < BRICK_SIZE; x++)
+              row[size_t(slotZ + z)*rowTexels + size_t(y)*rowExtent.width + tileX + x] = encoded.residuals[(z*BRICK_SIZE + y)*BRICK_SIZE + x];
+        const size_t range = size_t(BRICK_ATLAS_DEPTH - 1)*rowTexels + tileX + (b%BRICKS_PER_ATLAS_TILE)*2;
+        row[range] = encoded.rangeMin;
+        row[range + 1] = encoded.rangeMax;
+#else
+        for(int z = 0; z < BRICK_SIZE; z++)
+          for(int y = 0; y < BRICK_SIZE; y++)
+            for(int x = 0; x < BRICK_SIZE; x++)
+              row[size_t(slotZ + z)*rowTexels + size_t(y)*rowExtent.width + tileX + x] = uint8_t(brick[(z*BRICK_SIZE + y)*BRICK_SIZE + x]);
+#endif
+      }
+      const VkOffset3D rowOffset = {0, int32_t(firstPointer/rowBricks)*BRICK_SIZE, 0};
+      NVVK_CHECK(m_stagingUploader.appendImageSub(m_brickAtlas, rowOffset, rowExtent, {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                                                  row.size(), row.data(), VK_IMAGE_LAYOUT_GENERAL));
+      if(++rows % RESTORE_ROWS_PER_SUBMIT == 0)
+        submitUploads();
+    });
+    submitUploads();
+
+    // Nothing read back or queued before the restore applies to these bricks
+    const size_t countersSize = m_app->getFrameCycleSize()*NUM_COUNTERS*sizeof(uint32_t);
+    std::memset(m_countersReadbackB.mapping, 0, countersSize);
+    m_atlasCounters = counters;
+    m_notResident = std::move(notResident);
+    m_failedAllocsSeen = 0;
+    m_buildQueue.clear();
+    m_prefetch.clear();
+    m_currCenters = cache.centers();
+    m_prevCenters = m_currCenters;
+    m_rebuildTlas = true;
+    m_updateTlas = true;
+
+    std::vector<nvutils::Bbox> stale = cache.staleRegions(m_scene);
+    m_scene.setRefreshRegions(stale);
+    LOGI("Restored %u bricks from %s, %zu stale regions\n", cache.numBricks(), m_brickCachePath.c_str(), stale.size());
+    return true;
+  }
+
   void updateSceneObjects(VkCommandBuffer cmd){
     NVVK_DBG_SCOPE(cmd);
 
@@ -1493,6 +1808,55 @@ public:
                                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
     nvvk::cmdBufferMemoryBarrier(cmd, {m_sceneObjectsB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                                        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+
+    updateEditLayer(cmd);
+    updateVolumes(cmd);
+  }
+
+  // Uploads the edit layer hash table and values after a user edit
+  void updateEditLayer(VkCommandBuffer cmd){
+    const EditLayer& edits = m_scene.getEdits();
+    if(!m_firstFrame && edits.version() == m_editsVersion)
+      return;
+    m_editsVersion = edits.version();
+
+    std::vector<glm::ivec4> slots;
+    edits.gpuSlots(slots);
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_editSlotsB, 0, std::span(slots)));
+    std::span<const uint32_t> values = edits.gpuValues();
+    if(!values.empty())
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_editValuesB, 0, values.size_bytes(), values.data()));
+    m_stagingUploader.cmdUploadAppended(cmd);
+
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_editSlotsB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_editValuesB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+  }
+
+  // Uploads the sampled volumes after nodes are frozen or a scene is loaded
+  void updateVolumes(VkCommandBuffer cmd){
+    const SampledVolumes& volumes = m_scene.getVolumes();
+    if(!m_firstFrame && volumes.version() == m_volumesVersion)
+      return;
+    m_volumesVersion = volumes.version();
+
+    std::vector<shaderio::VolumeInfo> infos = volumes.gpuInfos();
+    NVVK_CHECK(m_stagingUploader.appendBuffer(m_volumesB, 0, std::span(infos)));
+    std::span<const int32_t> bricks = volumes.gpuBricks();
+    if(!bricks.empty())
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_volumeBricksB, 0, bricks.size_bytes(), bricks.data()));
+    std::span<const uint32_t> values = volumes.gpuValues();
+    if(!values.empty())
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_volumeValuesB, 0, values.size_bytes(), values.data()));
+    m_stagingUploader.cmdUploadAppended(cmd);
+
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_volumesB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_volumeBricksB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
+    nvvk::cmdBufferMemoryBarrier(cmd, {m_volumeValuesB.buffer, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT});
   }
 
   void updateAOkernels(VkCommandBuffer cmd){
@@ -1681,6 +2045,14 @@ public:
                                         ));
       NVVK_DBG_NAME(m_buildJobQueue.buffer);
 
+      b_size = size_t(MAX_BUILD_JOB_OBJECTS)*sizeof(uint32_t);
+      NVVK_CHECK(allocator->createBuffer(m_buildObjectsB,
+                                     b_size,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                        ));
+      NVVK_DBG_NAME(m_buildObjectsB.buffer);
+
       b_size = shaderio::MAX_NUM_BRICK_JOBS*sizeof(shaderio::BrickJob);
       std::vector<uint8_t> zeros2(b_size, 0);
       NVVK_CHECK(allocator->createBuffer(m_brickJobQueue,
@@ -1693,15 +2065,26 @@ public:
       // ------------------
       // Counters
       // ------------------
-      std::vector<glm::uint32_t> zeros3(3, 0);
+      std::vector<glm::uint32_t> zeros3(NUM_COUNTERS, 0);
       NVVK_CHECK(allocator->createBuffer(m_countersB,
                                      zeros3.size()*sizeof(glm::uint32_t),
                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_SRC_BIT 
                                           | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
                                         ));
       NVVK_DBG_NAME(m_countersB.buffer);
       NVVK_CHECK(m_stagingUploader.appendBuffer(m_countersB, 0,std::span(zeros3)));
 
+      // Host copies of the counters for the atlas stats, one per frame cycle
+      NVVK_CHECK(allocator->createBuffer(m_countersReadbackB,
+                                     m_app->getFrameCycleSize()*zeros3.size()*sizeof(glm::uint32_t),
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VMA_MEMORY_USAGE_AUTO,
+                                      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT
+                                      | VMA_ALLOCATION_CREATE_MAPPED_BIT));
+      NVVK_DBG_NAME(m_countersReadbackB.buffer);
+      std::memset(m_countersReadbackB.mapping, 0, m_app->getFrameCycleSize()*zeros3.size()*sizeof(glm::uint32_t));
+
       // ------------------
       // Indirect dispatch group counts buffer
       // ------------------
@@ -1728,6 +2111,47 @@ public:
       NVVK_DBG_NAME(m_freeListB.buffer);
       NVVK_CHECK(m_stagingUploader.appendBuffer(m_freeListB, 0,std::span(freeList)));
 
+      // ------------------
+      // Brick owner of every atlas slot, for eviction
+      // ------------------
+      std::vector<shaderio::BrickOwner> owners(shaderio::NUM_BRICKS_IN_ATLAS, {.id_level = glm::ivec4(0,0,0,-1)});
+      NVVK_CHECK(allocator->createBuffer(m_brickOwnersB,
+                                     owners.size()*sizeof(shaderio::BrickOwner),
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                        ));
+      NVVK_DBG_NAME(m_brickOwnersB.buffer);
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_brickOwnersB, 0,std::span(owners)));
+
+      // ------------------
+      // Bricks built ahead of the clipmap, one cell per clip cell
+      // ------------------
+      std::vector<glm::ivec4> prefetchCells(shaderio::NUM_PREFETCH_CELLS, glm::ivec4(0,0,0,PREFETCH_EMPTY));
+      NVVK_CHECK(allocator->createBuffer(m_prefetchCellsB,
+                                     prefetchCells.size()*sizeof(glm::ivec4),
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                        ));
+      NVVK_DBG_NAME(m_prefetchCellsB.buffer);
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_prefetchCellsB, 0,std::span(prefetchCells)));
+
+      // ------------------
+      // Bricks a build pass left without a slot, and their host copies
+      // ------------------
+      NVVK_CHECK(allocator->createBuffer(m_notResidentB,
+                                     MAX_NOT_RESIDENT_BRICKS*sizeof(glm::ivec4),
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_SRC_BIT 
+                                        ));
+      NVVK_DBG_NAME(m_notResidentB.buffer);
+      NVVK_CHECK(allocator->createBuffer(m_notResidentReadbackB,
+                                     m_app->getFrameCycleSize()*MAX_NOT_RESIDENT_BRICKS*sizeof(glm::ivec4),
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      VMA_MEMORY_USAGE_AUTO,
+                                      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT
+                                      | VMA_ALLOCATION_CREATE_MAPPED_BIT));
+      NVVK_DBG_NAME(m_notResidentReadbackB.buffer);
+
       // ------------------
       // Random
       // ------------------
@@ -1745,6 +2169,57 @@ public:
                                       ));
       NVVK_DBG_NAME(m_shadowKernelsB.buffer);
 
+      // Same table the CPU reads, keeps GPU and CPU terrain radii identical
+      std::span<const float> lattice = terrainLattice();
+      NVVK_CHECK(m_alloc.createBuffer(m_terrainLatticeB,
+                                      lattice.size_bytes(),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_terrainLatticeB.buffer);
+      NVVK_CHECK(m_stagingUploader.appendBuffer(m_terrainLatticeB, 0, lattice.size_bytes(), lattice.data()));
+
+      // ------------------
+      // Edit layer, uploaded by updateEditLayer
+      // ------------------
+      NVVK_CHECK(m_alloc.createBuffer(m_editSlotsB,
+                                      size_t(shaderio::NUM_EDIT_SLOTS)*sizeof(glm::ivec4),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_editSlotsB.buffer);
+
+      NVVK_CHECK(m_alloc.createBuffer(m_editValuesB,
+                                      size_t(MAX_EDIT_BRICKS)*shaderio::EDIT_BRICK_WORDS*sizeof(uint32_t),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_editValuesB.buffer);
+
+      // ------------------
+      // Sampled volumes, uploaded by updateVolumes
+      // ------------------
+      NVVK_CHECK(m_alloc.createBuffer(m_volumesB,
+                                      size_t(MAX_VOLUMES)*sizeof(shaderio::VolumeInfo),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_volumesB.buffer);
+
+      NVVK_CHECK(m_alloc.createBuffer(m_volumeBricksB,
+                                      size_t(MAX_VOLUME_BRICKS)*sizeof(int32_t),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_volumeBricksB.buffer);
+
+      NVVK_CHECK(m_alloc.createBuffer(m_volumeValuesB,
+                                      size_t(MAX_VOLUME_PAYLOADS)*shaderio::VOLUME_BRICK_WORDS*sizeof(uint32_t),
+                                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
+                                          | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
+                                      ));
+      NVVK_DBG_NAME(m_volumeValuesB.buffer);
+
 
       m_stagingUploader.cmdUploadAppended(cmd);  // Upload the scene information to the GPU
 
@@ -1797,13 +2272,23 @@ public:
     
     bindings.addBinding(shaderio::BindingPoints::buildJobQ, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::brickJobQ, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::buildObjects, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::counters, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::indirectCommands, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::freeList, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::brickOwners, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::prefetchCells, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::notResidentBricks, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::editSlots, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::editValues, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::volumes, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::volumeBricks, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::volumeValues, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
 
     bindings.addBinding(shaderio::BindingPoints::noise, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::aoKernels, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
     bindings.addBinding(shaderio::BindingPoints::shadowKernels, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
+    bindings.addBinding(shaderio::BindingPoints::terrainLattice, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_ALL);
 
 
     // Creating the descriptor set and set layout from the bindings
@@ -1830,13 +2315,23 @@ public:
     
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::buildJobQ), m_buildJobQueue.buffer);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::brickJobQ), m_brickJobQueue.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::buildObjects), m_buildObjectsB.buffer);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::counters), m_countersB.buffer);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::indirectCommands), m_indirectB.buffer);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::freeList), m_freeListB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::brickOwners), m_brickOwnersB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::prefetchCells), m_prefetchCellsB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::notResidentBricks), m_notResidentB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::editSlots), m_editSlotsB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::editValues), m_editValuesB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::volumes), m_volumesB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::volumeBricks), m_volumeBricksB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::volumeValues), m_volumeValuesB.buffer);
     
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::noise), m_noiseTex.descriptor);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::aoKernels), m_aoKernelsB.buffer);
     writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::shadowKernels), m_shadowKernelsB.buffer);
+    writeContainer.append(m_descPack.makeWrite(shaderio::BindingPoints::terrainLattice), m_terrainLatticeB.buffer);
     
     vkUpdateDescriptorSets(m_app->getDevice(),  
                         static_cast<uint32_t>(writeContainer.size()),  
@@ -2074,6 +2569,7 @@ public:
     const glm::mat4& viewMatrix = m_cameraManip->getViewMatrix();
     const glm::mat4& projMatrix = m_cameraManip->getPerspectiveMatrix();
     m_currCamId0 = glm::floor(m_cameraManip->getEye()/shaderio::BRICK_SIZES[0]);
+    m_currCenters.follow(m_currCamId0, m_recenterHysteresis);
     const glm::vec3& id0Pos = glm::vec3(m_currCamId0)*shaderio::BRICK_SIZES[0];
 
     m_sceneInfo.viewMatrix = viewMatrix;
@@ -2083,6 +2579,14 @@ public:
     m_sceneInfo.cameraPosition = glm::vec4(m_cameraManip->getEye(),0.0);
     m_sceneInfo.cameraId0 = glm::ivec4(m_currCamId0,0);
     m_sceneInfo.cameraId0Pos = glm::vec4(id0Pos,0);
+    for(int level = 0; level < CLIPMAP_LEVELS; level++)
+      m_sceneInfo.levelCenters[level] = glm::ivec4(m_currCenters[level],0);
+    m_prefetch.addSample(m_cameraManip->getEye(), m_pushConst.time);
+
+    // Without edits min is above max and no point passes the bounds test
+    const nvutils::Bbox& editBounds = m_scene.getEdits().bounds();
+    m_sceneInfo.editMin = editBounds.isEmpty() ? glm::vec4(1.0f) : glm::vec4(editBounds.min(),0);
+    m_sceneInfo.editMax = editBounds.isEmpty() ? glm::vec4(-1.0f) : glm::vec4(editBounds.max(),0);
 
     m_pushConst.lp.lightDirView = glm::normalize(
       viewMatrix * glm::vec4(m_pushConst.lp.lightDir,0.0));
@@ -2181,14 +2685,38 @@ private:
   // Job queues and utils
   nvvk::Buffer m_buildJobQueue{};   // Queue for the Build jobs
   nvvk::Buffer m_brickJobQueue{};   // Queue for the Brick jobs
+  nvvk::Buffer m_buildObjectsB{};   // Object lists of the build jobs
   nvvk::Buffer m_countersB{};       // Diferent counters used by the shaders
   nvvk::Buffer m_indirectB{};       // Indirect dispatch group counts buffer
   nvvk::Buffer m_freeListB{};       // List of free pointers to the brick atlas
+  nvvk::Buffer m_brickOwnersB{};    // Brick stored in every atlas slot
+  nvvk::Buffer m_prefetchCellsB{};  // Bricks built before the clipmap windows reach them
+  nvvk::Buffer m_countersReadbackB{}; // Host visible copies of m_countersB, one per frame cycle
+  std::array<uint32_t, NUM_COUNTERS> m_atlasCounters{}; // Counters of the last completed frame read back
+  nvvk::Buffer m_notResidentB{};    // Bricks the last build pass left without a slot
+  nvvk::Buffer m_notResidentReadbackB{}; // Host visible copies of m_notResidentB, one per frame cycle
+  std::vector<glm::ivec4> m_notResident; // Bricks without a slot waiting for free slots, id and level
+  uint32_t     m_failedAllocsSeen = 0; // Failed allocations already warned about
+  BuildQueue   m_buildQueue;        // Build jobs waiting for brick budget
+  int          m_buildBudget = 65536; // Bricks built per frame at most, 0 builds every pending job
+  ClipmapPrefetch m_prefetch;       // Bricks of the windows the camera is heading to
+  bool         m_prefetchActive = true;
+  float        m_prefetchLookahead = 0.2f; // Seconds of camera motion prefetched
 
   // RNG
   nvvk::Image  m_noiseTex{};        // Rgb noise texture
   nvvk::Buffer m_aoKernelsB{};  // Buffer containing random vectors on +Y hemisphere
   nvvk::Buffer m_shadowKernelsB{};  // Buffer containing random unit vectors on +Y hemisphere
+  nvvk::Buffer m_terrainLatticeB{}; // Terrain noise radius per lattice cell
+
+  // Edit layer
+  nvvk::Buffer m_editSlotsB{};      // Hash table of the edit bricks, {id, payload} per slot
+  nvvk::Buffer m_editValuesB{};     // Carved and filled values of the edit bricks
+  nvvk::Buffer m_volumesB{};        // VolumeInfo of every volume slot
+  nvvk::Buffer m_volumeBricksB{};   // Payload of every brick cell of the volumes
+  nvvk::Buffer m_volumeValuesB{};   // Quantized values of the volume payloads
+  uint32_t     m_editsVersion = 0;  // Edit layer version last uploaded
+  uint32_t     m_volumesVersion = 0; // Sampled volumes version last uploaded
 
   // 3D textures
   nvvk::Image m_clipMap{};          // 3D map of pointers to the brick atlas
@@ -2202,8 +2730,11 @@ private:
 
   // Scene
   Scene m_scene;
+  SceneEditor m_sceneEditor{m_scene};
   glm::ivec3 m_currCamId0 = glm::ivec3(0);
-  glm::ivec3 m_prevCamId0 = glm::ivec3(0);
+  ClipmapCenters m_currCenters;     // Level windows, follow m_currCamId0 with hysteresis
+  ClipmapCenters m_prevCenters;     // Level windows of the last generation pass
+  int m_recenterHysteresis = 1;     // Bricks a level lags the camera before recentering
   float m_prevTime = -1;
 
   // UI params
@@ -2215,6 +2746,7 @@ private:
   bool m_updateTlas = false;
   bool m_firstFrame = true;
   std::string m_saveFilePath = "strand.json";
+  std::string m_brickCachePath;     // Baked bricks of the scene, none when empty
 
   // Startup managers for profiler and paramter registry
   Info m_info;
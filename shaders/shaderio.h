@@ -45,7 +45,24 @@ NAMESPACE_SHADERIO_BEGIN()
 #define MAX_SCENE_DYNAMIC_OBJECTS 512
 #define MAX_MATERIALS 32
 #define BRICK_PER_ATLAS_AXIS 512
-const static int NUM_BRICKS_IN_ATLAS = BRICK_PER_ATLAS_AXIS*BRICK_PER_ATLAS_AXIS;
+
+// Brick payload encodings, selected at build time with BRICK_ENCODING
+#define BRICK_ENCODING_SNORM8 0     // One R8_SNORM texel per value
+#define BRICK_ENCODING_RANGE4 1     // Per brick min/max and a 4 bit residual per value, two bricks per atlas tile
+#ifndef BRICK_ENCODING
+#define BRICK_ENCODING BRICK_ENCODING_SNORM8
+#endif
+
+#if BRICK_ENCODING == BRICK_ENCODING_RANGE4
+#define BRICKS_PER_ATLAS_TILE 2     // Bricks stacked in z in every BRICK_SIZE² atlas tile
+#define BRICK_ATLAS_SLOT_DEPTH (BRICK_SIZE/2)   // Atlas slices per brick, two residuals per R8_UINT texel
+#define BRICK_ATLAS_DEPTH (BRICKS_PER_ATLAS_TILE*BRICK_ATLAS_SLOT_DEPTH+1) // Plus one slice with the quantized min/max of the tile bricks
+#else
+#define BRICKS_PER_ATLAS_TILE 1
+#define BRICK_ATLAS_SLOT_DEPTH BRICK_SIZE
+#define BRICK_ATLAS_DEPTH BRICK_SIZE
+#endif
+const static int NUM_BRICKS_IN_ATLAS = BRICK_PER_ATLAS_AXIS*BRICK_PER_ATLAS_AXIS*BRICKS_PER_ATLAS_TILE;
 
 // Global grid parameters
 #define NUM_BRICKS_PER_AXIS 64  // How many bricks per axis per level in clip map
@@ -55,6 +72,12 @@ const static int NUM_BRICKS_IN_ATLAS = BRICK_PER_ATLAS_AXIS*BRICK_PER_ATLAS_AXIS
 #define MAT_PER_BRICK_AXIS  0   // How many materials are stored per brick axis. Needs to be >= 2 to work, if not it deactivates
 CHECK_GRID_ALIGNMENT(NUM_BRICKS_PER_AXIS) // Power of two needed for faster calculations
 
+// Terrain noise parameters
+#define TERRAIN_LATTICE_PERIOD 32 // Lattice cells per axis stored in the terrain radius table, read shifted per tile of that size. Power of two
+#define TERRAIN_LATTICE_EXACT  0  // 1 hashes every lattice point instead of reading the table, bit exact with the table-less noise
+CHECK_GRID_ALIGNMENT(TERRAIN_LATTICE_PERIOD)
+const static int TERRAIN_LATTICE_SIZE = TERRAIN_LATTICE_PERIOD*TERRAIN_LATTICE_PERIOD*TERRAIN_LATTICE_PERIOD;
+
 // Extent calculations
 const static int NUM_VOXELS_PER_AXIS = NUM_BRICKS_PER_AXIS*(BRICK_SIZE-1);
 const static int NUM_VALUES_PER_AXIS = NUM_BRICKS_PER_AXIS*BRICK_SIZE;
@@ -170,6 +193,12 @@ const static float MAX_BRICK_VALUES[CLIPMAP_LEVELS] = {
 #define BRICK_JOB_GROUP_X_DISPATCH_SIZE 256
 const static uint MAX_NUM_BUILD_JOBS = 512*512;
 const static uint MAX_NUM_BRICK_JOBS = MAX_NUM_BUILD_JOBS*MAX_BUILD_JOB_SIZE*MAX_BUILD_JOB_SIZE;
+#define MAX_BUILD_JOB_OBJECTS (1<<22)   // Words of the object lists of every build job
+#define ALL_OBJECTS -1                  // Object list of jobs that evaluate every object
+#define BRICK_JOB_LEVEL_BITS 4          // Brick jobs keep their build job above the level
+#define PREFETCH_JOB (1 << BRICK_JOB_LEVEL_BITS)  // Set above the level of prefetch build and brick jobs
+#define RELEASE_JOB (PREFETCH_JOB << 1) // Set above the level of build jobs that free the clip cells of bricks still waiting
+#define BRICK_JOB_INDEX_SHIFT (BRICK_JOB_LEVEL_BITS + 2)
 
 // Dirty bit definitions for mutual exclusion
 #define DIRTY_BIT 0x80000000        // Most significant bit of a 32 bit variable
@@ -178,6 +207,38 @@ const static uint MAX_NUM_BRICK_JOBS = MAX_NUM_BUILD_JOBS*MAX_BUILD_JOB_SIZE*MAX
 // Magic pointer indicating unirform values in brick (not stored in atlas)
 const static uint UNIFORM_POSITIVE_BRICK_POINTER = NUM_BRICKS_IN_ATLAS+1;
 const static uint UNIFORM_NEGATIVE_BRICK_POINTER = UNIFORM_POSITIVE_BRICK_POINTER+1;
+// Magic pointer of a brick a full atlas had no slot for, coarser levels or the scene functions stand in
+const static uint NOT_RESIDENT_BRICK_POINTER = UNIFORM_NEGATIVE_BRICK_POINTER+1;
+
+// Atlas eviction
+#define ATLAS_EVICTION_PROBES 16    // Atlas slots a failed allocation inspects for a lower priority brick
+#define ATLAS_EVICTION_AGE 600      // Frames without a rebuild after which a brick counts as stale
+#define MAX_NOT_RESIDENT_BRICKS 4096 // Bricks without a slot a build pass lists for the host to requeue
+
+// Sparse edit layer, carved and filled distances of the user edits in bricks found through a hash table
+#define EDIT_BRICK_SIZE 8           // Values per axis of an edit brick, neighbouring bricks share their border values
+#define MAX_EDIT_BRICKS 32768       // Bricks in the layer, uniform ones included
+const static int NUM_EDIT_SLOTS = 2*MAX_EDIT_BRICKS;  // Hash table slots, power of two so it is never full
+const static int EDIT_BRICK_WORDS = EDIT_BRICK_SIZE*EDIT_BRICK_SIZE*EDIT_BRICK_SIZE/2; // Two int8 channels per value
+const static float EDIT_VOXEL_SIZE = 2.0*S_VOXEL(0);
+const static float EDIT_CLAMP = (EDIT_BRICK_SIZE-1)*EDIT_VOXEL_SIZE; // Distance the int8 channels saturate at
+const static int EDIT_EMPTY_SLOT = -1;
+const static int EDIT_UNIFORM_CARVED = -2;  // Brick wholly inside a carve, no payload
+const static int EDIT_UNIFORM_FILLED = -3;  // Brick wholly inside a fill, no payload
+
+// Sampled volumes of frozen nodes, a dense grid of bricks per volume with int8 distances
+#define VOLUME_BRICK_SIZE 8         // Values per axis of a volume brick, neighbouring bricks share their border values
+#define MAX_VOLUMES 64
+#define MAX_VOLUME_BRICKS (1<<22)   // Brick grid cells of every volume, uniform ones included
+#define MAX_VOLUME_PAYLOADS 65536   // Bricks with values of every volume
+const static int VOLUME_BRICK_WORDS = VOLUME_BRICK_SIZE*VOLUME_BRICK_SIZE*VOLUME_BRICK_SIZE/4; // Four int8 values per word
+const static int VOLUME_UNIFORM_POSITIVE = -1;  // Brick farther than the clamp distance outside the surface, no payload
+const static int VOLUME_UNIFORM_NEGATIVE = -2;  // Brick farther than the clamp distance inside the surface, no payload
+
+// Clipmap prefetch, bricks the camera is about to reach are built into a table with one cell per clip cell
+#define PREFETCH_EMPTY -1                                   // Pointer of prefetch cells without a brick
+const static int PREFETCH_ATLAS_RESERVE = NUM_BRICKS_IN_ATLAS/8;       // Free atlas slots prefetching leaves to the clipmap
+const static int NUM_PREFETCH_CELLS = NUM_BRICKS_PER_AXIS*NUM_BRICKS_PER_AXIS*NUM_BRICKS_PER_AXIS*CLIPMAP_LEVELS;
 
 // Rng buffers and images sizes
 #define NOISE_TEX_SIZE 1024
@@ -222,13 +283,31 @@ enum BindingPoints{
   noise,
   aoKernels,
   shadowKernels,
+  terrainLattice,
+  brickOwners,
+  editSlots,
+  editValues,
+  volumes,
+  volumeBricks,
+  volumeValues,
+  buildObjects,
+  prefetchCells,
+  notResidentBricks,
 };
 
 enum Counters{
   nextBrickJob = 0,
   freeCounter = 1,
-  allocCounter = 2
+  allocCounter = 2,
+  passFreeCounter = 3,  // freeCounter when the build pass started, bounds allocCounter
+  evictedBricks = 4,    // Bricks that lost their slot to a higher priority one
+  failedAllocs = 5,     // Bricks left without a slot
+  evictionClock = 6,    // Next atlas slot probed for eviction
+  prefetchedBricks = 7, // Bricks built into the prefetch table
+  committedBricks = 8,  // Prefetched bricks moved into the clipmap
+  notResidentBricks = 9 // Bricks the last build pass left without a slot, listed in notResidentBricks
 };
+#define NUM_COUNTERS 10
 
 enum DebugModes{
   dmNone = 0,
@@ -246,7 +325,7 @@ enum TracingModes{
   compute=0, rtx, sphere
 };
   
-enum class PrimType { Empty=0, Box, Sphere, Torus, Snowman, Plane };
+enum class PrimType { Empty=0, Box, Sphere, Torus, Snowman, Plane, Volume };
 enum class MaterialType { Normal=0, Debug, Terrain };
 
 struct LightinParams{
@@ -294,6 +373,8 @@ struct PushConstant{
   int numObjects;
   int numDynamicObjects;
   uint frameCount = 0;
+  uint buildJobOffset = 0;      // First build job of the dispatch
+  uint prefetchValidFrame = 0;  // Prefetched bricks built before this frame are stale
 };
 
 struct SceneInfo{
@@ -304,6 +385,9 @@ struct SceneInfo{
   float4    cameraPosition;
   int4      cameraId0;
   float4    cameraId0Pos;
+  int4      levelCenters[CLIPMAP_LEVELS]; // Window center of every level in its brick ids, lags cameraId0 by the recenter hysteresis
+  float4    editMin;        // Bounds of the edit bricks, min above max without edits
+  float4    editMax;
 };
 CHECK_STRUCT_ALIGNMENT(SceneInfo)
 
@@ -313,6 +397,8 @@ struct SceneObject{
   float4 defP;
   float4 terrain;
   int4 limit_octaves;
+  float4 cellMin;       // Node space box of one copy, culls unlimited repetitions
+  float4 cellMax;
   int type;
   int combOp;
   int repOp;
@@ -324,10 +410,18 @@ struct SceneObject{
   float morph;
   uint mat;
   bool physicsActive;
-  uint _pad;
+  int volume;           // Sampled volume of PrimType::Volume nodes
 };
 CHECK_STRUCT_ALIGNMENT(SceneObject)
 
+// Sampled volume, values of brick cell i are at volumeValues[volumeBricks[bricks_first.w + i]*VOLUME_BRICK_WORDS]
+struct VolumeInfo{
+  float4 origin_voxel;  // Node space corner of the grid, voxel size
+  int4 bricks_first;    // Bricks per axis, first cell in volumeBricks
+  float4 clamp;         // x: distance the values saturate at
+};
+CHECK_STRUCT_ALIGNMENT(VolumeInfo)
+
 struct Material{
   float4 albedo_shininess;
   float2 alpha_metalness;
@@ -337,16 +431,26 @@ struct Material{
 CHECK_STRUCT_ALIGNMENT(Material)
 
 struct BuildJob{
-  int4 min_id_level;
-  int4 num_b;
+  int4 min_id_level;    // w: level, PREFETCH_JOB for jobs filling the prefetch table, RELEASE_JOB for the ones freeing clip cells
+  int4 num_b;           // w: first word of the object list in buildObjects, or ALL_OBJECTS
 };
 CHECK_STRUCT_ALIGNMENT(BuildJob)
 
 struct BrickJob{
-  int4 id_level;
+  int4 id_level;        // w: level and PREFETCH_JOB, the GPU adds the build job index << BRICK_JOB_INDEX_SHIFT
 };
 CHECK_STRUCT_ALIGNMENT(BrickJob)
 
+// Brick stored in an atlas slot, level -1 for slots never used
+struct BrickOwner{
+  int4 id_level;
+  uint lastUse;   // Frame the brick was last built
+  uint _pad0;
+  uint _pad1;
+  uint _pad2;
+};
+CHECK_STRUCT_ALIGNMENT(BrickOwner)
+
 struct DynamicObject{
   float4x4 tInv;
   float4 position;
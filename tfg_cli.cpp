@@ -0,0 +1,419 @@
+// Headless driver for the scene core. Loads a scene JSON and runs one of the
+// CPU paths for a number of frames, printing per frame timings. Meant for
+// profiling on machines without a GPU or a window.
+//
+//   tfg_cli --scene stress_sim.json --mode simulate --frames 600
+//   tfg_cli --scene super.json --mode jobs --frames 100 --camstep 1 0 0
+//   tfg_cli --scene super.json --mode bricks --frames 100 --camstep 64 0 0 --budget 65536
+//   tfg_cli --scene super.json --mode bricks --frames 100 --brickcache super.bricks
+//   tfg_cli --scene super.json --mode bricks --frames 100 --camstep 2 0 0 --budget 16384 --prefetch 1
+//   tfg_cli --scene super.json --mode jobs --frames 100 --camstep 1 0 0 --camswing 1 --hysteresis 2
+//   tfg_cli --scene strand.json --mode bake --frames 4 --out grid.raw
+//   tfg_cli --scene super.json --mode render --frames 1 --eye 0 0.5 5 --target 0 0 0 --width 640 --height 360 --out frame.pfm
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/trigonometric.hpp>
+#include <nvutils/logger.hpp>
+#include <nvutils/parameter_parser.hpp>
+#include <nvutils/parameter_registry.hpp>
+
+#include "utils/brick_builder.hpp"
+#include "utils/brick_cache.hpp"
+#include "utils/brick_codec.hpp"
+#include "utils/build_queue.hpp"
+#include "utils/cpu_renderer.hpp"
+#include "utils/rng.hpp"
+#include "utils/scene.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start){
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Options {
+  std::string scene;
+  std::string mode = "simulate";
+  std::string out;
+  std::string brickCache;
+  int frames = 100;
+  int substeps = 20;
+  float frameTime = 1.0f / 60.0f;
+  glm::ivec3 camStep = glm::ivec3(1, 0, 0);
+  bool camSwing = false;
+  bool sdfCache = false;
+  bool dedup = false;
+  bool codec = false;
+  float sdfCacheTolerance = 0.001f;
+  int budget = 0;
+  bool prefetch = false;
+  float lookahead = 0.2f;
+  int hysteresis = 0;
+  glm::vec3 eye = glm::vec3(0.0f, 0.5f, 5.0f);
+  glm::vec3 target = glm::vec3(0.0f);
+  float fov = 60.0f;
+  int width = 1280;
+  int height = 720;
+};
+
+struct Timings {
+  double totalMs = 0.0;
+  double maxMs = 0.0;
+
+  void add(double ms){
+    totalMs += ms;
+    maxMs = std::max(maxMs, ms);
+  }
+
+  void print(const char* label, int frames) const {
+    printf("%s: %d frames, %.3f ms total, %.3f ms avg, %.3f ms max\n",
+      label, frames, totalMs, frames > 0 ? totalMs / frames : 0.0, maxMs);
+  }
+};
+
+static void runSimulate(Scene& scene, const Options& opt){
+  const float dts = opt.frameTime / opt.substeps;
+  Timings t;
+  for(int f = 0; f < opt.frames; f++){
+    auto start = Clock::now();
+    scene.simulate(dts, opt.substeps);
+    t.add(elapsedMs(start));
+  }
+  t.print("simulate", opt.frames);
+
+  if(opt.sdfCache){
+    const SdfCache::Stats& stats = scene.getSdfCacheStats();
+    printf("sdf cache: %llu hits, %llu misses, %llu invalidated\n",
+      (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.invalidated);
+  }
+}
+
+// Restores the builder from the cache file, only the regions of the nodes
+// that changed since the bake are built again. False on a miss.
+static bool restoreBricks(Scene& scene, BrickBuilder& builder, const std::string& path, const ClipmapCenters& centers){
+  auto start = Clock::now();
+  BrickCache cache;
+  if(!cache.open(path))
+    return false;
+  if(cache.centers() != centers){
+    LOGW("%s was baked around another camera cell, rebuilding\n", path.c_str());
+    return false;
+  }
+
+  builder.restore(cache);
+  std::vector<nvutils::Bbox> stale = cache.staleRegions(scene);
+  scene.setRefreshRegions(stale);
+  printf("brick cache: restored %u bricks from %s in %.3f ms, %zu stale regions\n",
+    cache.numBricks(), path.c_str(), elapsedMs(start), stale.size());
+  return true;
+}
+
+// Error of the built atlas bricks after a BRICK_ENCODING_RANGE4 round trip,
+// in voxels of their level
+static void printCodecError(const BrickBuilder& builder){
+  float maxError = 0.0f;
+  double sumError = 0.0;
+  uint32_t bricks = 0;
+  float values[BrickBuilder::BRICK_VALUES];
+  std::vector<uint8_t> seen(shaderio::NUM_BRICKS_IN_ATLAS, 0);
+  for(uint32_t cell : builder.clipMap()){
+    const uint32_t pointer = cell & NOT_DIRTY_BIT;
+    if(pointer >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) || seen[pointer])
+      continue;
+    seen[pointer] = 1;
+    std::span<const int8_t> brick = builder.brick(pointer);
+    if(brick.empty())
+      continue;
+    for(int i = 0; i < BrickBuilder::BRICK_VALUES; i++)
+      values[i] = float(brick[i]) / 127.0f;
+    CodecError error = range4Error(values);
+    maxError = std::max(maxError, error.maxError);
+    sumError += error.sumError;
+    bricks++;
+  }
+  printf("range4 codec: %u bricks, %.4f max error, %.5f mean error (voxels), capacity %d bricks, snorm8 %d\n",
+    bricks, maxError, bricks > 0 ? sumError / (double(bricks) * BrickBuilder::BRICK_VALUES) : 0.0,
+    BRICK_PER_ATLAS_AXIS * BRICK_PER_ATLAS_AXIS * 2, BRICK_PER_ATLAS_AXIS * BRICK_PER_ATLAS_AXIS);
+}
+
+// Mirrors the generation pass: jobs are only requested when the scene changed
+// or a level recentered, the camera moves camStep cells every frame, or back
+// and forth with camSwing, and the levels follow it with hysteresis. They wait
+// in a queue that hands out budget bricks per frame, the budget left once it
+// is empty prefetches the windows the camera is heading to. With a builder the
+// jobs also run through the CPU build and brick passes.
+static void runJobs(Scene& scene, const Options& opt, BrickBuilder* builder){
+  const float dts = opt.frameTime / opt.substeps;
+  glm::ivec3 currCamId0(0);
+  ClipmapCenters currCenters(currCamId0), prevCenters(currCamId0);
+  Timings t, build, fill;
+  size_t totalJobs = 0, maxJobs = 0, brickJobs = 0, deduplicated = 0, evicted = 0, failed = 0;
+  size_t listedObjects = 0, jobObjects = 0, prefetched = 0, committed = 0, maxBrickJobs = 0, released = 0;
+  uint64_t maxBricks = 0;
+  int pendingFrames = 0, recenterFrames = 0;
+  BuildQueue queue;
+  ClipmapPrefetch prefetch;
+  std::vector<glm::ivec4> waitingSlot;    // Bricks without a slot waiting for free slots
+  const bool useCache = builder && !opt.brickCache.empty();
+  if(useCache)
+    restoreBricks(scene, *builder, opt.brickCache, currCenters);
+
+  for(int f = 0; f < opt.frames; f++){
+    scene.simulate(dts, opt.substeps);
+
+    auto start = Clock::now();
+    prefetch.addSample((glm::vec3(currCamId0) + 0.5f) * shaderio::BRICK_SIZES[0], float(f) * opt.frameTime);
+    recenterFrames += currCenters != prevCenters ? 1 : 0;
+    if(scene.m_needsRefresh || currCenters != prevCenters || f == 0){
+      queue.push(scene.getBuildJobs(currCenters, prevCenters));
+      scene.m_needsRefresh = false;
+      if(prefetch.invalidate(scene.getChangedRegions(), currCenters) && builder)
+        builder->invalidatePrefetch();
+    }
+    if(builder){
+      std::vector<glm::ivec4> notResident = builder->takeNotResident();
+      notResident.insert(notResident.end(), waitingSlot.begin(), waitingSlot.end());
+      queue.pushNotResident(notResident, uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) - builder->atlasUsage());
+      waitingSlot.swap(notResident);
+    }
+    std::vector<shaderio::BuildJob> jobs = queue.pop(currCenters, uint32_t(opt.budget));
+    const std::vector<shaderio::BuildJob> releaseJobs = queue.takeReleaseJobs();
+    if(queue.empty())
+      prefetch.committed(currCenters);
+    pendingFrames += queue.empty() ? 0 : 1;
+    uint64_t bricks = 0;
+    for(const shaderio::BuildJob& job : jobs)
+      bricks += uint64_t(job.num_b.x) * uint64_t(job.num_b.y) * uint64_t(job.num_b.z);
+    if(opt.prefetch && queue.empty() && (opt.budget == 0 || bricks < uint64_t(opt.budget))){
+      const uint32_t spare = opt.budget == 0 ? 0 : uint32_t(uint64_t(opt.budget) - bricks);
+      ClipmapCenters predicted = currCenters;
+      predicted.follow(prefetch.predictCameraId0(opt.lookahead), opt.hysteresis);
+      for(const shaderio::BuildJob& job : prefetch.jobs(currCenters, predicted, spare,
+                                                         uint32_t(shaderio::MAX_NUM_BUILD_JOBS - jobs.size()))){
+        jobs.push_back(job);
+        bricks += uint64_t(job.num_b.x) * uint64_t(job.num_b.y) * uint64_t(job.num_b.z);
+      }
+    }
+    if(!jobs.empty()){
+      totalJobs += jobs.size();
+      maxJobs = std::max(maxJobs, jobs.size());
+      maxBricks = std::max(maxBricks, bricks);
+      std::vector<uint32_t> objects = scene.getBuildJobObjects(jobs);
+      const size_t numObjects = scene.getAllBboxes().size();
+      for(const shaderio::BuildJob& job : jobs)
+        listedObjects += job.num_b.w == ALL_OBJECTS ? numObjects : objects[job.num_b.w];
+      jobObjects += jobs.size() * numObjects;
+
+      if(builder){
+        // Release jobs share the dispatch of the regular ones in the app
+        jobs.insert(jobs.begin(), releaseJobs.begin(), releaseJobs.end());
+        BrickBuilder::Stats stats = builder->build(scene, jobs, currCenters);
+        build.add(stats.buildMs);
+        fill.add(stats.brickMs);
+        brickJobs += stats.brickJobs;
+        maxBrickJobs = std::max(maxBrickJobs, size_t(stats.brickJobs));
+        prefetched += stats.prefetched;
+        committed += stats.committed;
+        released += stats.released;
+        deduplicated += stats.deduplicated;
+        evicted += stats.evicted;
+        failed += stats.failed;
+
+        // Bake the startup state, what a later run restores. The cache only
+        // stores the clipmap, prefetched bricks are built again.
+        if(useCache && f == 0 && stats.brickJobs > 0){
+          builder->dropPrefetched();
+          prefetch.clear();
+        }
+        if(useCache && f == 0 && stats.brickJobs > 0 && BrickCache::save(opt.brickCache, scene, *builder, currCenters))
+          printf("brick cache: saved %u bricks to %s\n", builder->atlasUsage(), opt.brickCache.c_str());
+      }
+    }
+    t.add(elapsedMs(start));
+
+    prevCenters = currCenters;
+    currCamId0 += (opt.camSwing && f % 2 == 1) ? -opt.camStep : opt.camStep;
+    currCenters.follow(currCamId0, opt.hysteresis);
+  }
+  t.print("build jobs", opt.frames);
+  printf("build jobs: %zu total, %zu max per frame, %d frames recentered a level\n", totalJobs, maxJobs, recenterFrames);
+  printf("build queue: %llu max bricks per frame, %d frames left jobs pending, %llu bricks pending\n",
+    (unsigned long long)maxBricks, pendingFrames, (unsigned long long)queue.pendingBricks());
+  printf("object lists: %.2f objects per job, %.1f%% of the scene\n",
+    totalJobs > 0 ? double(listedObjects) / double(totalJobs) : 0.0,
+    jobObjects > 0 ? 100.0 * double(listedObjects) / double(jobObjects) : 0.0);
+  const Scene::BuildJobStats& jobStats = scene.getBuildJobStats();
+  printf("build bricks: %llu requested, %llu unique, %llu redundant avoided\n",
+    (unsigned long long)jobStats.requestedBricks, (unsigned long long)jobStats.uniqueBricks,
+    (unsigned long long)(jobStats.requestedBricks - jobStats.uniqueBricks));
+
+  if(!builder)
+    return;
+
+  build.print("build pass", opt.frames);
+  fill.print("brick pass", opt.frames);
+  printf("brick jobs: %zu total, %zu max per frame, atlas %u / %d bricks\n", brickJobs, maxBrickJobs, builder->atlasUsage(), int(shaderio::NUM_BRICKS_IN_ATLAS));
+  if(opt.prefetch)
+    printf("prefetch: %zu bricks built ahead, %zu committed, %llu tracked\n", prefetched, committed, (unsigned long long)prefetch.trackedBricks());
+  if(released > 0)
+    printf("window moves: %zu clip cells released while their bricks waited\n", released);
+  if(evicted > 0 || failed > 0)
+    printf("atlas full: %zu evicted, %zu failed allocations, %u bricks not resident\n", evicted, failed, builder->nonResident());
+  if(builder->deduplication()){
+    BrickBuilder::DedupStats stats = builder->dedupStats();
+    printf("dedup (CPU only): %zu bricks joined a slot, %u references in %u slots, ratio %.3f\n",
+      deduplicated, stats.references, stats.slots, stats.slots > 0 ? double(stats.references) / stats.slots : 1.0);
+  }
+  for(int level = 0; level < CLIPMAP_LEVELS; level++){
+    BrickBuilder::LevelStats stats = builder->levelStats(level);
+    printf("  level %d: %u allocated, %u instances, %u uniform negative\n", level, stats.allocated, stats.instances, stats.uniformNegative);
+  }
+  if(opt.codec)
+    printCodecError(*builder);
+}
+
+// Times the narrow band grid, the dense grid is only streamed to --out
+static void runBake(Scene& scene, const Options& opt){
+  Timings t;
+  Scene::SparseGrid grid;
+  for(int f = 0; f < opt.frames; f++){
+    auto start = Clock::now();
+    grid = scene.generateSparseGrid();
+    t.add(elapsedMs(start));
+  }
+  t.print("sparse grid", opt.frames);
+
+  const size_t numBlocks = grid.blocks.size();
+  const size_t blockValues = size_t(Scene::SparseGrid::BLOCK_SIZE) * Scene::SparseGrid::BLOCK_SIZE * Scene::SparseGrid::BLOCK_SIZE;
+  const size_t bandBlocks = grid.values.size() / blockValues;
+  printf("sparse grid: %zu / %zu band blocks, %.2f MB (dense %.2f MB)\n", bandBlocks, numBlocks,
+    double(grid.values.size() * sizeof(float) + numBlocks * sizeof(int32_t)) / (1024.0 * 1024.0),
+    double(numBlocks * blockValues * sizeof(float)) / (1024.0 * 1024.0));
+
+  if(!opt.out.empty()){
+    std::ofstream os(opt.out, std::ios::binary);
+    if(!os){
+      LOGE("Failed to open %s for writing\n", opt.out.c_str());
+      return;
+    }
+    size_t written = 0;
+    auto start = Clock::now();
+    scene.generateDenseGrid([&](int, std::span<const float> slice){
+      os.write(reinterpret_cast<const char*>(slice.data()), std::streamsize(slice.size_bytes()));
+      written += slice.size();
+    });
+    printf("wrote %zu values to %s in %.3f ms\n", written, opt.out.c_str(), elapsedMs(start));
+  }
+}
+
+// Times the CPU reference renderer, the shaded color of the last frame goes
+// to --out
+static void runRender(Scene& scene, const Options& opt){
+  // Vulkan clip space like the app camera, the first row is the top one
+  CpuRenderer::Camera camera;
+  camera.view = glm::lookAt(opt.eye, opt.target, glm::vec3(0.0f, 1.0f, 0.0f));
+  camera.proj = glm::perspectiveRH_ZO(glm::radians(opt.fov), float(opt.width) / float(opt.height), 0.01f, 1000.0f);
+  camera.proj[1][1] *= -1.0f;
+
+  CpuRenderer::Settings settings;
+  settings.width = uint32_t(opt.width);
+  settings.height = uint32_t(opt.height);
+
+  CpuRenderer renderer;
+  CpuRenderer::Images images;
+  Timings t;
+  for(int f = 0; f < opt.frames; f++){
+    images = renderer.render(scene, camera, settings);
+    t.add(images.stats.renderMs);
+  }
+  t.print("render", opt.frames);
+  printf("render: %ux%u, %u threads, %u tiles, %llu map calls per frame
+", images.width, images.height,
+    images.stats.numThreads, images.stats.numTiles, (unsigned long long)images.stats.mapCalls);
+
+  if(!opt.out.empty() && opt.frames > 0){
+    if(CpuRenderer::savePfm(opt.out, images.color, images.width, images.height))
+      printf("wrote %ux%u color to %s\n", images.width, images.height, opt.out.c_str());
+    else
+      LOGE("Failed to write %s\n", opt.out.c_str());
+  }
+}
+
+int main(int argc, char** argv){
+  initRandom();
+
+  Options opt;
+  nvutils::ParameterRegistry parameterRegistry;
+  nvutils::ParameterParser   parameterParser;
+
+  parameterRegistry.add({"scene", "Scene JSON to load"}, &opt.scene);
+  parameterRegistry.add({"mode", "simulate, jobs, bricks, bake or render"}, &opt.mode);
+  parameterRegistry.add({"frames", "Number of frames to run"}, &opt.frames);
+  parameterRegistry.add({"substeps", "Simulation sub steps per frame"}, &opt.substeps);
+  parameterRegistry.add({"frametime", "Simulated seconds per frame"}, &opt.frameTime);
+  parameterRegistry.add({"camstep", "Camera cells moved per frame in jobs mode"}, &opt.camStep);
+  parameterRegistry.add({"camswing", "Step the camera back and forth instead of forward"}, &opt.camSwing);
+  parameterRegistry.add({"hysteresis", "Bricks the camera moves from a level center before the level recenters"}, &opt.hysteresis);
+  parameterRegistry.add({"sdfcache", "Cache the simulation distance queries"}, &opt.sdfCache);
+  parameterRegistry.add({"sdfcachetolerance", "Cell size of the distance query cache"}, &opt.sdfCacheTolerance);
+  parameterRegistry.add({"out", "Raw float file for the baked grid, PFM image in render mode"}, &opt.out);
+  parameterRegistry.add({"dedup", "CPU experiment, share atlas slots between bricks with the same payload. The app can't restore the cache it writes"}, &opt.dedup);
+  parameterRegistry.add({"codec", "Report the error of the RANGE4 brick encoding in bricks mode"}, &opt.codec);
+  parameterRegistry.add({"budget", "Bricks built per frame in jobs and bricks mode, 0 builds every pending job"}, &opt.budget);
+  parameterRegistry.add({"prefetch", "Build the windows the camera is heading to with the budget left"}, &opt.prefetch);
+  parameterRegistry.add({"lookahead", "Seconds of camera motion prefetched"}, &opt.lookahead);
+  parameterRegistry.add({"brickcache", "Baked brick file restored and updated in bricks mode"}, &opt.brickCache);
+  parameterRegistry.add({"eye", "Camera position in render mode"}, &opt.eye);
+  parameterRegistry.add({"target", "Point the camera looks at in render mode"}, &opt.target);
+  parameterRegistry.add({"fov", "Vertical field of view in degrees in render mode"}, &opt.fov);
+  parameterRegistry.add({"width", "Image width in render mode"}, &opt.width);
+  parameterRegistry.add({"height", "Image height in render mode"}, &opt.height);
+
+  parameterParser.add(parameterRegistry);
+  parameterParser.parse(argc, argv);
+
+  if(opt.frames < 0 || opt.substeps < 1 || opt.budget < 0 || opt.lookahead < 0.0f ||
+     opt.hysteresis < 0 || opt.hysteresis > ClipmapCenters::MAX_HYSTERESIS){
+    LOGE("frames must be >= 0, substeps >= 1, budget >= 0, lookahead >= 0 and hysteresis in [0, %d]\n",
+      ClipmapCenters::MAX_HYSTERESIS);
+    return 1;
+  }
+  if(opt.mode == "render" && (opt.width < 1 || opt.height < 1 || !(opt.fov > 0.0f && opt.fov < 180.0f) || opt.eye == opt.target)){
+    LOGE("render needs width and height >= 1, fov in (0, 180) and an eye away from the target\n");
+    return 1;
+  }
+
+  Scene scene;
+  if(!opt.scene.empty() && !scene.loadFromFile(opt.scene)){
+    LOGE("Failed to load scene %s\n", opt.scene.c_str());
+    return 1;
+  }
+  scene.setSdfCache(opt.sdfCache, opt.sdfCacheTolerance);
+
+  if(opt.mode == "simulate"){
+    runSimulate(scene, opt);
+  }else if(opt.mode == "jobs"){
+    runJobs(scene, opt, nullptr);
+  }else if(opt.mode == "bricks"){
+    BrickBuilder builder;
+    builder.setDeduplication(opt.dedup);
+    runJobs(scene, opt, &builder);
+  }else if(opt.mode == "bake"){
+    runBake(scene, opt);
+  }else if(opt.mode == "render"){
+    runRender(scene, opt);
+  }else{
+    LOGE("Unknown mode %s, expected simulate, jobs, bricks, bake or render\n", opt.mode.c_str());
+    return 1;
+  }
+
+  return 0;
+}
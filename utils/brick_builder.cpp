@@ -0,0 +1,686 @@
+#include "brick_builder.hpp"
+
+#include "brick_cache.hpp"
+#include "scene.hpp"
+#include "sdf_batch.hpp"
+#include "sdf_tape.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+
+#include <glm/common.hpp>
+#include <nvutils/logger.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start){
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Bricks handed to a pool worker at a time
+static const uint32_t BRICKS_PER_JOB = 64;
+
+static const int CLIP_CELLS_PER_LEVEL = NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS;
+
+// Same as id2index() in common.slang
+static glm::ivec3 id2index(glm::ivec3 x){
+  return ((x % NUM_BRICKS_PER_AXIS) + NUM_BRICKS_PER_AXIS) % NUM_BRICKS_PER_AXIS;
+}
+
+// Same as brickPriority() in common.slang
+static float brickPriority(int level, glm::ivec3 relBrickId, uint32_t age){
+  const glm::ivec3 fromCenter = glm::abs(relBrickId - NUM_BRICKS_PER_AXIS/2);
+  const float dist = float(glm::max(fromCenter.x, glm::max(fromCenter.y, fromCenter.z))) / float(NUM_BRICKS_PER_AXIS/2);
+  const float staleness = glm::min(float(age) / float(ATLAS_EVICTION_AGE), 1.0f);
+  return (1.0f - dist) + 0.25f * float(level) / float(CLIPMAP_LEVELS) - 0.25f * staleness;
+}
+
+// Vulkan float to R8_SNORM conversion
+static int8_t toSnorm8(float v){
+  return int8_t(glm::round(glm::clamp(v, -1.0f, 1.0f) * 127.0f));
+}
+
+BrickBuilder::BrickBuilder(uint32_t numThreads) : m_pool(numThreads) {
+  reset();
+}
+
+void BrickBuilder::reset(){
+  m_clipMap.assign(size_t(CLIP_CELLS_PER_LEVEL) * CLIPMAP_LEVELS, shaderio::UNIFORM_POSITIVE_BRICK_POINTER);
+  m_atlas.clear();
+  m_instances.assign(shaderio::NUM_BRICKS_IN_ATLAS, {glm::ivec3(0), 0, false});
+  m_freeList.resize(shaderio::NUM_BRICKS_IN_ATLAS);
+  std::iota(m_freeList.begin(), m_freeList.end(), 0u);
+  m_allocCounter = 0;
+  m_freeCounter = 0;
+  m_refCount.assign(shaderio::NUM_BRICKS_IN_ATLAS, 0);
+  m_visible.assign(m_clipMap.size(), 0);
+  m_owners.assign(shaderio::NUM_BRICKS_IN_ATLAS, {glm::ivec3(0), -1, 0});
+  m_prefetch.assign(shaderio::NUM_PREFETCH_CELLS, glm::ivec4(0, 0, 0, PREFETCH_EMPTY));
+  m_frame = 0;
+  m_evictionClock = 0;
+  m_prefetchValidFrame = 0;
+  m_notResident.clear();
+  rebuildSlotIndex();
+}
+
+void BrickBuilder::setDeduplication(bool enabled){
+  m_dedup = enabled;
+  rebuildSlotIndex();
+}
+
+// Atlas bricks copied per chunk on restore, 4 MB
+static const uint32_t RESTORE_CHUNK_BRICKS = 8192;
+
+void BrickBuilder::restore(const BrickCache& cache){
+  std::span<const uint32_t> clipMap = cache.clipMap();
+  std::span<const uint32_t> freeList = cache.freeList();
+  m_clipMap.assign(clipMap.begin(), clipMap.end());
+  m_freeList.assign(freeList.begin(), freeList.end());
+  m_allocCounter = cache.allocCounter();
+  m_freeCounter = cache.freeCounter();
+
+  m_instances.assign(shaderio::NUM_BRICKS_IN_ATLAS, {glm::ivec3(0), 0, false});
+  std::span<const BrickCache::Instance> instances = cache.instances();
+  for(size_t i = 0; i < instances.size(); i++)
+    m_instances[i] = {instances[i].brickId, instances[i].level, instances[i].visible != 0};
+
+  std::span<const uint8_t> visible = cache.visible();
+  m_visible.assign(visible.begin(), visible.end());
+
+  // Owners are the bricks of the clip cells inside the baked level windows,
+  // cells baked without a slot are listed to be built again
+  m_refCount.assign(shaderio::NUM_BRICKS_IN_ATLAS, 0);
+  m_owners.assign(shaderio::NUM_BRICKS_IN_ATLAS, {glm::ivec3(0), -1, 0});
+  m_notResident.clear();
+  for(size_t cell = 0; cell < m_clipMap.size(); cell++){
+    const uint32_t clip = m_clipMap[cell];
+    const bool notResident = clip == shaderio::NOT_RESIDENT_BRICK_POINTER;
+    if(clip >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) && !notResident)
+      continue;
+    if(!notResident && m_refCount[clip]++ > 0)
+      continue;
+
+    const glm::ivec4 brick = cache.cellBrick(cell);
+    if(notResident)
+      m_notResident.push_back(brick);
+    else
+      m_owners[clip] = {glm::ivec3(brick), brick.w, 0};
+  }
+  m_prefetch.assign(shaderio::NUM_PREFETCH_CELLS, glm::ivec4(0, 0, 0, PREFETCH_EMPTY));
+  m_frame = 0;
+  m_evictionClock = 0;
+  m_prefetchValidFrame = 0;
+
+  m_atlas.resize(size_t(cache.numBricks()) * BRICK_VALUES);
+  cache.forEachAtlasChunk(RESTORE_CHUNK_BRICKS, [&](uint32_t firstPointer, std::span<const int8_t> values){
+    std::copy(values.begin(), values.end(), m_atlas.begin() + size_t(firstPointer) * BRICK_VALUES);
+  });
+  rebuildSlotIndex();
+}
+
+size_t BrickBuilder::clipIndex(glm::ivec3 brickId, int level){
+  glm::ivec3 idx = id2index(brickId);
+  idx.z += NUM_BRICKS_PER_AXIS * level;
+  return size_t(idx.x) + size_t(idx.y) * NUM_BRICKS_PER_AXIS + size_t(idx.z) * NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS;
+}
+
+uint32_t BrickBuilder::clipPointer(glm::ivec3 brickId, int level) const {
+  return m_clipMap[clipIndex(brickId, level)] & NOT_DIRTY_BIT;
+}
+
+std::span<const int8_t> BrickBuilder::brick(uint32_t pointer) const {
+  const size_t begin = size_t(pointer) * BRICK_VALUES;
+  if(pointer >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) || begin + BRICK_VALUES > m_atlas.size())
+    return {};
+  return std::span<const int8_t>(m_atlas.data() + begin, BRICK_VALUES);
+}
+
+// Only the pointers freed before this build call are handed out, as on the
+// GPU. NOT_RESIDENT_BRICK_POINTER when capacity slots are in use.
+uint32_t BrickBuilder::allocPointer(uint32_t capacity){
+  if(m_allocCounter - m_passFreeCounter >= capacity)
+    return shaderio::NOT_RESIDENT_BRICK_POINTER;
+  uint32_t index = m_allocCounter++ % shaderio::NUM_BRICKS_IN_ATLAS;
+  return m_freeList[index];
+}
+
+// evictPointer() in build.slang. Cells rebuilt in this call still carry the
+// dirty bit and are never victims, prefetched bricks are. Slots shared through
+// deduplication are skipped.
+uint32_t BrickBuilder::evictPointer(float priority, const ClipmapCenters& centers){
+  for(int probe = 0; probe < ATLAS_EVICTION_PROBES; probe++){
+    const uint32_t slot = m_evictionClock++ % shaderio::NUM_BRICKS_IN_ATLAS;
+    const Owner& owner = m_owners[slot];
+    if(owner.level < 0 || m_refCount[slot] > 1)
+      continue;
+
+    const glm::ivec3 relBrickId = centers.relId(owner.brickId, owner.level);
+    if(brickPriority(owner.level, relBrickId, m_frame - owner.lastUse) >= priority)
+      continue;
+
+    const size_t cell = clipIndex(owner.brickId, owner.level);
+    const bool inClipMap = m_clipMap[cell] == slot;
+    if(inClipMap){
+      m_clipMap[cell] = shaderio::NOT_RESIDENT_BRICK_POINTER;
+      m_visible[cell] = 0;
+    }else if(m_prefetch[cell].w == int(slot)){
+      m_prefetch[cell].w = PREFETCH_EMPTY;
+    }else{
+      continue;
+    }
+
+    maskInstance(slot);
+    unregisterSlot(slot);
+    if(inClipMap){
+      showStandIn(owner.brickId, owner.level, centers);
+      m_notResident.push_back(glm::ivec4(owner.brickId, owner.level));
+    }
+    return slot;
+  }
+  return shaderio::NOT_RESIDENT_BRICK_POINTER;
+}
+
+void BrickBuilder::freePointer(uint32_t pointer){
+  // Out of range pointer
+  if(pointer >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+    return;
+
+  uint32_t index = m_freeCounter++ % shaderio::NUM_BRICKS_IN_ATLAS;
+  m_freeList[index] = pointer;
+}
+
+// Drops one reference, the pointer is freed with the last one
+bool BrickBuilder::releasePointer(uint32_t pointer){
+  if(pointer >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+    return false;
+  if(m_refCount[pointer] > 1){
+    m_refCount[pointer]--;
+    return false;
+  }
+  m_refCount[pointer] = 0;
+  unregisterSlot(pointer);
+  freePointer(pointer);
+  return true;
+}
+
+// takePrefetched() in build.slang
+uint32_t BrickBuilder::takePrefetched(size_t cell, glm::ivec3 brickId, Stats& stats){
+  glm::ivec4& prefetched = m_prefetch[cell];
+  if(glm::ivec3(prefetched) != brickId || prefetched.w < 0)
+    return shaderio::NOT_RESIDENT_BRICK_POINTER;
+
+  const uint32_t pointer = uint32_t(prefetched.w);
+  prefetched.w = PREFETCH_EMPTY;
+  if(m_owners[pointer].lastUse < m_prefetchValidFrame){
+    releasePointer(pointer);
+    stats.freed++;
+    return shaderio::NOT_RESIDENT_BRICK_POINTER;
+  }
+  return pointer;
+}
+
+void BrickBuilder::dropPrefetched(){
+  for(glm::ivec4& prefetched : m_prefetch){
+    if(prefetched.w < 0)
+      continue;
+    releasePointer(uint32_t(prefetched.w));
+    maskInstance(uint32_t(prefetched.w));
+    prefetched.w = PREFETCH_EMPTY;
+  }
+}
+
+void BrickBuilder::updateInstance(uint32_t pointer, glm::ivec3 brickId, int level){
+  m_instances[pointer] = {brickId, level, true};
+}
+
+void BrickBuilder::maskInstance(uint32_t pointer){
+  if(pointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+    m_instances[pointer].visible = false;
+}
+
+// showStandIn() in build.slang
+void BrickBuilder::showStandIn(glm::ivec3 brickId, int level, const ClipmapCenters& centers){
+  for(int coarse = level + 1; coarse < CLIPMAP_LEVELS; coarse++){
+    brickId >>= 1;
+    const size_t cell = clipIndex(brickId, coarse);
+    const uint32_t pointer = m_clipMap[cell] & NOT_DIRTY_BIT;
+    if(pointer != shaderio::NOT_RESIDENT_BRICK_POINTER){
+      if(pointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) && centers.insideHole(brickId, coarse)){
+        m_instances[pointer].visible = true;
+        m_visible[cell] = 1;
+      }
+      return;
+    }
+  }
+}
+
+// standsIn() in build.slang
+bool BrickBuilder::standsIn(glm::ivec3 brickId, int level) const {
+  for(int child = 0; child < 8; child++){
+    const glm::ivec3 childId = brickId * 2 + glm::ivec3(child & 1, (child >> 1) & 1, child >> 2);
+    if(clipPointer(childId, level - 1) == shaderio::NOT_RESIDENT_BRICK_POINTER)
+      return true;
+  }
+  return false;
+}
+
+// releaseBrick() in build.slang
+void BrickBuilder::releaseBrick(glm::ivec3 brickId, int level, const ClipmapCenters& centers, Stats& stats){
+  const size_t cell = clipIndex(brickId, level);
+  const uint32_t pointer = m_clipMap[cell] & NOT_DIRTY_BIT;
+  if(pointer == shaderio::NOT_RESIDENT_BRICK_POINTER)
+    return;
+
+  const bool brickAllocated = pointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS);
+  if(brickAllocated && m_owners[pointer].brickId == brickId && m_owners[pointer].level == level){
+    const bool visible = !centers.insideHole(brickId, level) || standsIn(brickId, level);
+    m_instances[pointer].visible = visible;
+    m_visible[cell] = visible;
+    return;
+  }
+
+  if(brickAllocated && releasePointer(pointer)){
+    maskInstance(pointer);
+    stats.freed++;
+  }
+  m_clipMap[cell] = shaderio::NOT_RESIDENT_BRICK_POINTER;
+  m_visible[cell] = 0;
+  showStandIn(brickId, level, centers);
+  stats.released++;
+}
+
+BrickBuilder::Stats BrickBuilder::build(Scene& scene, std::span<const shaderio::BuildJob> jobs, const ClipmapCenters& centers){
+  Stats stats{};
+  stats.buildJobs = uint32_t(jobs.size());
+  const SdfTape& tape = scene.getTape(true);
+  m_frame++;
+  m_passFreeCounter = m_freeCounter;
+
+  auto start = Clock::now();
+
+  for(const shaderio::BuildJob& job : jobs){
+    if((job.min_id_level.w & RELEASE_JOB) == 0)
+      continue;
+    const int level = job.min_id_level.w & ~RELEASE_JOB;
+    const glm::ivec3 minId(job.min_id_level);
+    for(int z = 0; z < job.num_b.z; z++)
+      for(int y = 0; y < job.num_b.y; y++)
+        for(int x = 0; x < job.num_b.x; x++)
+          releaseBrick(minId + glm::ivec3(x, y, z), level, centers, stats);
+  }
+
+  // Build pass. The dirty bit keeps bricks shared by several jobs to a single
+  // brick job, as the atomic OR does on the GPU. Prefetch bricks follow the
+  // regular ones and keep PREFETCH_JOB in their level.
+  std::vector<shaderio::BrickJob> brickJobs;
+  for(const shaderio::BuildJob& job : jobs){
+    const int level = job.min_id_level.w;
+    if(level & (PREFETCH_JOB | RELEASE_JOB))
+      continue;
+    const glm::ivec3 minId(job.min_id_level);
+    for(int z = 0; z < job.num_b.z; z++)
+      for(int y = 0; y < job.num_b.y; y++)
+        for(int x = 0; x < job.num_b.x; x++){
+          const glm::ivec3 brickId = minId + glm::ivec3(x, y, z);
+          uint32_t& clip = m_clipMap[clipIndex(brickId, level)];
+          if(clip & DIRTY_BIT)
+            continue;
+          clip |= DIRTY_BIT;
+          brickJobs.push_back({glm::ivec4(brickId, level)});
+        }
+  }
+  const uint32_t numRegular = uint32_t(brickJobs.size());
+  for(const shaderio::BuildJob& job : jobs){
+    if((job.min_id_level.w & PREFETCH_JOB) == 0)
+      continue;
+    const glm::ivec3 minId(job.min_id_level);
+    for(int z = 0; z < job.num_b.z; z++)
+      for(int y = 0; y < job.num_b.y; y++)
+        for(int x = 0; x < job.num_b.x; x++)
+          brickJobs.push_back({glm::ivec4(minId + glm::ivec3(x, y, z), job.min_id_level.w)});
+  }
+  stats.brickJobs = uint32_t(brickJobs.size());
+
+  // Scene distance at every brick center, the only evaluation of the build pass
+  const uint32_t numBricks = uint32_t(brickJobs.size());
+  std::vector<float> centerSDF(numBricks);
+  const uint32_t numCenterJobs = (numBricks + BRICKS_PER_JOB - 1) / BRICKS_PER_JOB;
+  m_pool.parallelFor(numCenterJobs, [&](uint32_t job){
+    const uint32_t end = std::min((job + 1) * BRICKS_PER_JOB, numBricks);
+    PointBatch point;
+    alignas(32) float dist[SDF_BATCH_WIDTH];
+    for(uint32_t base = job * BRICKS_PER_JOB; base < end; base += SDF_BATCH_WIDTH){
+      const uint32_t lanes = std::min(end - base, uint32_t(SDF_BATCH_WIDTH));
+      for(uint32_t l = 0; l < SDF_BATCH_WIDTH; l++){
+        const glm::ivec4 idLevel = brickJobs[base + std::min(l, lanes - 1)].id_level;
+        const glm::vec3 p = (glm::vec3(idLevel) + 0.5f) * shaderio::BRICK_SIZES[idLevel.w & ~PREFETCH_JOB];
+        point.x[l] = p.x;
+        point.y[l] = p.y;
+        point.z[l] = p.z;
+      }
+      tape.evalBatch(point, dist);
+      for(uint32_t l = 0; l < lanes; l++)
+        centerSDF[base + l] = dist[l];
+    }
+  });
+
+  // Allocation follows the job order so repeated runs give the same pointers
+  // Bricks the brick pass fills, committed and skipped prefetch bricks are not
+  std::vector<uint8_t> fill(numBricks, 1);
+  uint32_t maxPointer = 0;
+  bool anyAllocated = false;
+  for(uint32_t i = 0; i < numRegular; i++){
+    const glm::ivec3 brickId(brickJobs[i].id_level);
+    const int level = brickJobs[i].id_level.w;
+    uint32_t& clip = m_clipMap[clipIndex(brickId, level)];
+    const uint32_t prevClipPointer = clip & NOT_DIRTY_BIT;
+    const bool brickAllocated = prevClipPointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS);
+
+    const glm::ivec3 relBrickId = centers.relId(brickId, level);
+    const bool brickInsideHole = centers.insideHole(brickId, level);
+
+    const size_t cell = clipIndex(brickId, level);
+    const uint32_t prefetched = takePrefetched(cell, brickId, stats);
+    const bool hasPrefetched = prefetched < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS);
+
+    const float d = centerSDF[i];
+    const bool outsideMax = glm::abs(d) > shaderio::MAX_BRICK_VALUES[level];             // Atlas cull
+    const bool hasSurface = glm::abs(d) <= shaderio::MAX_BRICK_INSTANCE_VALUES[level];   // RTX Instance cull
+
+    if(hasPrefetched && outsideMax){
+      releasePointer(prefetched);
+      stats.freed++;
+    }
+
+    uint32_t instancePtr = prevClipPointer;
+    if(hasPrefetched && !outsideMax){
+      // Built ahead by a prefetch job => Only the clip cell changes
+      if(brickAllocated && releasePointer(prevClipPointer)){
+        maskInstance(prevClipPointer);
+        stats.freed++;
+      }
+      instancePtr = prefetched;
+      clip = prefetched;
+      fill[i] = 0;
+      stats.committed++;
+    }else if(outsideMax){
+      if(brickAllocated && releasePointer(prevClipPointer)){
+        maskInstance(prevClipPointer);
+        stats.freed++;
+      }
+      clip = (d < 0.0f ? shaderio::UNIFORM_NEGATIVE_BRICK_POINTER : shaderio::UNIFORM_POSITIVE_BRICK_POINTER) | DIRTY_BIT;
+    }else if(!brickAllocated || m_refCount[prevClipPointer] > 1){
+      // A shared slot is left to the other bricks and this one gets its own
+      if(brickAllocated)
+        m_refCount[prevClipPointer]--;
+      instancePtr = allocPointer();
+      if(instancePtr < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+        stats.allocated++;
+      }else{
+        // Full atlas => Take the slot of a lower priority brick
+        instancePtr = evictPointer(brickPriority(level, relBrickId, 0), centers);
+        if(instancePtr < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+          stats.evicted++;
+        }else{
+          stats.failed++;
+          showStandIn(brickId, level, centers);
+          m_notResident.push_back(glm::ivec4(brickId, level));
+        }
+      }
+      if(instancePtr < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+        m_refCount[instancePtr] = 1;
+      clip = instancePtr | DIRTY_BIT;
+    }else{
+      // The payload is about to change
+      unregisterSlot(prevClipPointer);
+    }
+
+    const bool resident = !outsideMax && instancePtr < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS);
+    if(resident)
+      m_owners[instancePtr] = {brickId, level, m_frame};
+
+    bool visible = hasSurface && resident;
+    if(resident && brickInsideHole){
+      visible = visible && standsIn(brickId, level);
+      updateInstance(instancePtr, brickId, level);
+      if(!visible)
+        maskInstance(instancePtr);
+    }else if(visible){
+      updateInstance(instancePtr, brickId, level);
+    }else if(brickAllocated && !outsideMax){
+      maskInstance(instancePtr);
+    }
+    m_visible[cell] = visible;
+
+    if(resident){
+      maxPointer = std::max(maxPointer, instancePtr);
+      anyAllocated = true;
+    }
+  }
+
+  // prefetchBrick() in build.slang, spare slots only
+  for(uint32_t i = numRegular; i < numBricks; i++){
+    fill[i] = 0;
+    const glm::ivec3 brickId(brickJobs[i].id_level);
+    const int level = brickJobs[i].id_level.w & ~PREFETCH_JOB;
+    const glm::ivec3 relBrickId = centers.relId(brickId, level);
+    const bool insideWindow = glm::all(glm::greaterThanEqual(relBrickId, glm::ivec3(0))) && glm::all(glm::lessThan(relBrickId, glm::ivec3(NUM_BRICKS_PER_AXIS)));
+    if(insideWindow)
+      continue;
+
+    glm::ivec4& prefetched = m_prefetch[clipIndex(brickId, level)];
+    int pointer = prefetched.w;
+    if(pointer >= 0 && glm::ivec3(prefetched) != brickId){
+      releasePointer(uint32_t(pointer));
+      stats.freed++;
+      pointer = PREFETCH_EMPTY;
+    }
+
+    if(glm::abs(centerSDF[i]) > shaderio::MAX_BRICK_VALUES[level]){
+      if(pointer >= 0){
+        releasePointer(uint32_t(pointer));
+        stats.freed++;
+      }
+      prefetched = glm::ivec4(brickId, PREFETCH_EMPTY);
+      continue;
+    }
+
+    if(pointer < 0){
+      const uint32_t newPointer = allocPointer(uint32_t(shaderio::NUM_BRICKS_IN_ATLAS - shaderio::PREFETCH_ATLAS_RESERVE));
+      if(newPointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+        pointer = int(newPointer);
+        m_refCount[newPointer] = 1;
+        stats.allocated++;
+      }
+    }
+    prefetched = glm::ivec4(brickId, pointer);
+    if(pointer < 0)
+      continue;
+
+    // Hidden until the clipmap takes it
+    m_owners[pointer] = {brickId, level, m_frame};
+    maskInstance(uint32_t(pointer));
+    stats.prefetched++;
+    fill[i] = 1;
+    maxPointer = std::max(maxPointer, uint32_t(pointer));
+    anyAllocated = true;
+  }
+
+  if(anyAllocated && m_atlas.size() < size_t(maxPointer + 1) * BRICK_VALUES)
+    m_atlas.resize(size_t(maxPointer + 1) * BRICK_VALUES, toSnorm8(1.0f));
+
+  stats.buildMs = elapsedMs(start);
+  start = Clock::now();
+
+  // Brick pass, bricks write disjoint parts of the atlas
+  std::vector<uint64_t> brickHash(m_dedup ? numBricks : 0);
+  m_pool.parallelFor(numCenterJobs, [&](uint32_t job){
+    const uint32_t end = std::min((job + 1) * BRICKS_PER_JOB, numBricks);
+    for(uint32_t i = job * BRICKS_PER_JOB; i < end; i++){
+      const glm::ivec3 brickId(brickJobs[i].id_level);
+      const int level = brickJobs[i].id_level.w & ~PREFETCH_JOB;
+      if(i >= numRegular){
+        if(fill[i])
+          fillBrick(tape, brickId, level, uint32_t(m_prefetch[clipIndex(brickId, level)].w));
+        continue;
+      }
+      uint32_t& clip = m_clipMap[clipIndex(brickId, level)];
+      clip &= NOT_DIRTY_BIT;
+      if(fill[i] && clip < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+        fillBrick(tape, brickId, level, clip);
+        if(m_dedup)
+          brickHash[i] = hashBrick(clip);
+      }
+    }
+  });
+
+  // Built bricks join a slot with the same payload, in job order so repeated
+  // runs share the same slots
+  if(m_dedup){
+    for(uint32_t i = 0; i < numRegular; i++){
+      uint32_t& clip = m_clipMap[clipIndex(glm::ivec3(brickJobs[i].id_level), brickJobs[i].id_level.w)];
+      if(!fill[i] || clip >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+        continue;
+
+      const uint32_t shared = findSlot(brickHash[i], clip);
+      if(shared == clip)
+        continue;
+      if(shared >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+        registerSlot(clip, brickHash[i]);
+        continue;
+      }
+
+      releasePointer(clip);
+      maskInstance(clip);
+      m_refCount[shared]++;
+      clip = shared;
+      stats.deduplicated++;
+    }
+  }
+
+  stats.brickMs = elapsedMs(start);
+  return stats;
+}
+
+// brick.slang for one brick, a row of BRICK_SIZE values per batch
+void BrickBuilder::fillBrick(const SdfTape& tape, glm::ivec3 brickId, int level, uint32_t pointer){
+  static_assert(BRICK_SIZE == SDF_BATCH_WIDTH, "One brick row per batch");
+
+  const float voxelSize = shaderio::VOXEL_SIZES[level];
+  const float invMaxVoxelValue = 1.0f / shaderio::MAX_VOXEL_VALUES[level];
+  const glm::vec3 brickPos = glm::vec3(brickId) * shaderio::BRICK_SIZES[level];
+  int8_t* out = m_atlas.data() + size_t(pointer) * BRICK_VALUES;
+
+  PointBatch point;
+  alignas(32) float dist[SDF_BATCH_WIDTH];
+  for(int x = 0; x < BRICK_SIZE; x++)
+    point.x[x] = brickPos.x + float(x) * voxelSize;
+
+  for(int z = 0; z < BRICK_SIZE; z++){
+    for(int y = 0; y < BRICK_SIZE; y++){
+      const float py = brickPos.y + float(y) * voxelSize;
+      const float pz = brickPos.z + float(z) * voxelSize;
+      for(int x = 0; x < BRICK_SIZE; x++){
+        point.y[x] = py;
+        point.z[x] = pz;
+      }
+      tape.evalBatch(point, dist);
+      for(int x = 0; x < BRICK_SIZE; x++)
+        *out++ = toSnorm8(dist[x] * invMaxVoxelValue);
+    }
+  }
+}
+
+BrickBuilder::LevelStats BrickBuilder::levelStats(int level) const {
+  LevelStats stats{};
+  const size_t begin = size_t(level) * CLIP_CELLS_PER_LEVEL;
+  for(size_t i = begin; i < begin + CLIP_CELLS_PER_LEVEL; i++){
+    const uint32_t pointer = m_clipMap[i] & NOT_DIRTY_BIT;
+    if(pointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS)){
+      stats.allocated++;
+      stats.instances += m_visible[i];
+    }else if(pointer == shaderio::UNIFORM_NEGATIVE_BRICK_POINTER){
+      stats.uniformNegative++;
+    }
+  }
+  return stats;
+}
+
+uint32_t BrickBuilder::nonResident() const {
+  uint32_t count = 0;
+  for(uint32_t clip : m_clipMap)
+    count += (clip & NOT_DIRTY_BIT) == shaderio::NOT_RESIDENT_BRICK_POINTER;
+  return count;
+}
+
+BrickBuilder::DedupStats BrickBuilder::dedupStats() const {
+  DedupStats stats{};
+  for(uint32_t count : m_refCount){
+    stats.references += count;
+    stats.slots += count > 0;
+  }
+  return stats;
+}
+
+uint64_t BrickBuilder::hashBrick(uint32_t pointer) const {
+  const int8_t* values = m_atlas.data() + size_t(pointer) * BRICK_VALUES;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for(int i = 0; i < BRICK_VALUES; i += 8){
+    uint64_t word;
+    std::memcpy(&word, values + i, sizeof(word));
+    h = (h ^ word) * 0x100000001b3ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+// Registered slot with the same payload as pointer, the pointer itself if it
+// is registered, or an out of range value
+uint32_t BrickBuilder::findSlot(uint64_t hash, uint32_t pointer) const {
+  auto [begin, end] = m_slotByHash.equal_range(hash);
+  for(auto it = begin; it != end; ++it){
+    const uint32_t slot = it->second;
+    if(slot == pointer || std::memcmp(m_atlas.data() + size_t(slot) * BRICK_VALUES, m_atlas.data() + size_t(pointer) * BRICK_VALUES, BRICK_VALUES) == 0)
+      return slot;
+  }
+  return shaderio::UNIFORM_POSITIVE_BRICK_POINTER;
+}
+
+void BrickBuilder::registerSlot(uint32_t pointer, uint64_t hash){
+  m_slotByHash.emplace(hash, pointer);
+  m_slotHash[pointer] = hash;
+  m_slotRegistered[pointer] = 1;
+}
+
+void BrickBuilder::unregisterSlot(uint32_t pointer){
+  if(!m_slotRegistered[pointer])
+    return;
+
+  auto [begin, end] = m_slotByHash.equal_range(m_slotHash[pointer]);
+  for(auto it = begin; it != end; ++it){
+    if(it->second == pointer){
+      m_slotByHash.erase(it);
+      break;
+    }
+  }
+  m_slotRegistered[pointer] = 0;
+}
+
+// Registers every slot in use, the first slot of a payload wins
+void BrickBuilder::rebuildSlotIndex(){
+  m_slotByHash.clear();
+  m_slotHash.assign(shaderio::NUM_BRICKS_IN_ATLAS, 0);
+  m_slotRegistered.assign(shaderio::NUM_BRICKS_IN_ATLAS, 0);
+  if(!m_dedup)
+    return;
+
+  for(uint32_t pointer = 0; pointer < uint32_t(shaderio::NUM_BRICKS_IN_ATLAS); pointer++){
+    if(m_refCount[pointer] == 0)
+      continue;
+    const uint64_t hash = hashBrick(pointer);
+    if(findSlot(hash, pointer) >= uint32_t(shaderio::NUM_BRICKS_IN_ATLAS))
+      registerSlot(pointer, hash);
+  }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../shaders/shaderio.h"
+#include "clipmap_centers.hpp"
+#include "thread_pool.hpp"
+
+class BrickCache;
+class Scene;
+class SdfTape;
+
+// CPU version of the sparse brick clipmap that build.slang and brick.slang
+// keep on the GPU. It consumes the build jobs of Scene::getBuildJobs and
+// allocates, frees and fills bricks with the same rules, atlas free list and
+// uniform brick pointers, so atlas usage and brick counts match the GPU.
+// Allocation runs in job order, brick evaluation runs on every core.
+// Material bricks (MAT_PER_BRICK_AXIS) are not built.
+//
+// Deduplication is a CPU and tfg_cli experiment that measures the atlas
+// capacity slot sharing would save, the GPU passes don't deduplicate. With it
+// on, bricks with the same payload share one atlas slot through a reference
+// count. A shared slot is copied before it is rebuilt and only goes back to
+// the free list when its last brick is freed. RTX instances are indexed by
+// atlas pointer, so instance(pointer) then only describes the first brick that
+// used the slot, and the app refuses brick caches baked this way.
+//
+// A full atlas hands out no pointer twice. Allocations that find no free
+// pointer take the slot of a lower priority brick (brickPriority() in
+// common.slang) or leave the brick NOT_RESIDENT_BRICK_POINTER, as build.slang
+// does. Bricks inside a hole keep their slot to stand in for them, their
+// instance only shows while a finer brick under them has none.
+//
+// PREFETCH_JOB build jobs fill the prefetch table with bricks outside the
+// clipmap, regular jobs move them into their clip cells. Prefetched slots are
+// never deduplicated. RELEASE_JOB build jobs free the clip cells a window move
+// gave to bricks the build queue still holds back.
+class BrickBuilder {
+public:
+  static constexpr int BRICK_VALUES = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+  struct LevelStats {
+    uint32_t allocated;                   // Bricks with an atlas pointer
+    uint32_t uniformNegative;             // Bricks fully inside the surface
+    uint32_t instances;                   // Allocated bricks close to the surface
+  };
+
+  struct DedupStats {
+    uint32_t references;                  // Clip cells pointing into the atlas
+    uint32_t slots;                       // Atlas slots they use, references / slots is the dedup ratio
+  };
+
+  struct Stats {
+    uint32_t buildJobs;
+    uint32_t brickJobs;                   // Bricks visited, one per clip cell
+    uint32_t allocated;                   // Pointers taken from the free list
+    uint32_t freed;                       // Pointers given back
+    uint32_t deduplicated;                // Built bricks that joined an existing slot
+    uint32_t evicted;                     // Bricks that lost their slot to a higher priority one
+    uint32_t failed;                      // Bricks left without a slot
+    uint32_t prefetched;                  // Bricks built into the prefetch table
+    uint32_t committed;                   // Prefetched bricks moved into the clipmap
+    uint32_t released;                    // Clip cells release jobs left NOT_RESIDENT_BRICK_POINTER
+    double buildMs;                       // Culling and allocation pass
+    double brickMs;                       // Atlas fill pass
+  };
+
+  struct Instance {
+    glm::ivec3 brickId;
+    int level;
+    bool visible;                         // Instance mask of the RTX pass
+  };
+
+  // 0 uses every hardware thread
+  explicit BrickBuilder(uint32_t numThreads = 0);
+
+  // Empty clipmap and atlas, as right after the GPU resources are created
+  void reset();
+
+  // Off by default, the atlas then matches the GPU one slot for slot. CPU
+  // only, see above.
+  void setDeduplication(bool enabled);
+  bool deduplication() const { return m_dedup; }
+
+  // Replaces the clipmap, atlas and free list with a baked copy. The atlas is
+  // copied in chunks so only one chunk of the mapped file is paged in at a time.
+  void restore(const BrickCache& cache);
+
+  // Runs the build and brick passes for one frame of jobs. RELEASE_JOB jobs
+  // run first, PREFETCH_JOB jobs after the regular ones, as their own
+  // dispatch does on the GPU.
+  Stats build(Scene& scene, std::span<const shaderio::BuildJob> jobs, const ClipmapCenters& centers);
+
+  // Bricks prefetched before the next build call are stale, prefetchValidFrame
+  void invalidatePrefetch() { m_prefetchValidFrame = m_frame + 1; }
+  // Frees every prefetched brick, the cache only stores the clipmap
+  void dropPrefetched();
+
+  // Atlas pointer, or a UNIFORM_*_BRICK_POINTER, stored for the brick
+  uint32_t clipPointer(glm::ivec3 brickId, int level) const;
+
+  // R8_SNORM values of an allocated brick, x fastest
+  std::span<const int8_t> brick(uint32_t pointer) const;
+
+  // Instance of an allocated brick, same index as its atlas pointer
+  const Instance& instance(uint32_t pointer) const { return m_instances[pointer]; }
+
+  LevelStats levelStats(int level) const;
+  DedupStats dedupStats() const;
+
+  // Bricks in the atlas
+  uint32_t atlasUsage() const { return m_allocCounter - m_freeCounter; }
+
+  // Clip cells left without a slot
+  uint32_t nonResident() const;
+  // Bricks left without a slot since the last call, id and level, the list
+  // the GPU build pass reads back
+  std::vector<glm::ivec4> takeNotResident() { return std::exchange(m_notResident, {}); }
+
+  // Clipmap image contents, NUM_BRICKS_PER_AXIS³ pointers per level
+  const std::vector<uint32_t>& clipMap() const { return m_clipMap; }
+
+private:
+  friend class BrickCache;
+
+  static size_t clipIndex(glm::ivec3 brickId, int level);
+
+  uint32_t allocPointer(uint32_t capacity = shaderio::NUM_BRICKS_IN_ATLAS);
+  uint32_t takePrefetched(size_t cell, glm::ivec3 brickId, Stats& stats);
+  uint32_t evictPointer(float priority, const ClipmapCenters& centers);
+  void freePointer(uint32_t pointer);
+  bool releasePointer(uint32_t pointer);
+  void updateInstance(uint32_t pointer, glm::ivec3 brickId, int level);
+  void maskInstance(uint32_t pointer);
+  void showStandIn(glm::ivec3 brickId, int level, const ClipmapCenters& centers);
+  void releaseBrick(glm::ivec3 brickId, int level, const ClipmapCenters& centers, Stats& stats);
+  bool standsIn(glm::ivec3 brickId, int level) const;
+
+  void fillBrick(const SdfTape& tape, glm::ivec3 brickId, int level, uint32_t pointer);
+
+  uint64_t hashBrick(uint32_t pointer) const;
+  uint32_t findSlot(uint64_t hash, uint32_t pointer) const;
+  void registerSlot(uint32_t pointer, uint64_t hash);
+  void unregisterSlot(uint32_t pointer);
+  void rebuildSlotIndex();
+
+  std::vector<uint32_t> m_clipMap;
+  std::vector<int8_t> m_atlas;            // Grows with the highest pointer used
+  std::vector<Instance> m_instances;
+  std::vector<uint32_t> m_freeList;
+  std::vector<uint32_t> m_refCount;       // Clip cells using each pointer
+  std::vector<uint8_t> m_visible;         // Instance visibility per clip cell
+  std::vector<glm::ivec4> m_prefetch;     // Brick id and pointer per clip cell, PREFETCH_EMPTY without a brick
+
+  // Brick stored in every slot, the victims of eviction
+  struct Owner {
+    glm::ivec3 brickId;
+    int level;                            // -1 for slots never used
+    uint32_t lastUse;                     // Build call that last built the brick
+  };
+  std::vector<Owner> m_owners;
+  uint32_t m_frame = 0;
+  uint32_t m_passFreeCounter = 0;         // m_freeCounter when the build call started
+  uint32_t m_evictionClock = 0;
+  uint32_t m_prefetchValidFrame = 0;
+  std::vector<glm::ivec4> m_notResident;  // Bricks left without a slot, see takeNotResident()
+
+  // Payload hash of every registered slot, only kept with deduplication on
+  bool m_dedup = false;
+  std::unordered_multimap<uint64_t, uint32_t> m_slotByHash;
+  std::vector<uint64_t> m_slotHash;
+  std::vector<uint8_t> m_slotRegistered;
+  uint32_t m_allocCounter = 0;
+  uint32_t m_freeCounter = 0;
+
+  ThreadPool m_pool;
+};
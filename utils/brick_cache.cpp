@@ -0,0 +1,320 @@
+#include "brick_cache.hpp"
+
+#include "brick_builder.hpp"
+#include "scene.hpp"
+#include "sdf.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <nvutils/logger.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[4] = {'T', 'F', 'G', 'B'};
+static const uint32_t VERSION = 3;
+
+static const size_t CLIP_CELLS = size_t(NUM_BRICKS_PER_AXIS) * NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS * CLIPMAP_LEVELS;
+
+struct BrickCache::Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t constantsHash;
+  glm::ivec3 centers[CLIPMAP_LEVELS];
+  uint32_t allocCounter;
+  uint32_t freeCounter;
+  uint32_t numNodes;
+  uint32_t numBricks;
+  uint32_t pad;
+};
+
+struct BrickCache::NodeRecord {
+  uint64_t hash;
+  glm::vec3 bboxMin;
+  glm::vec3 bboxMax;
+};
+
+static_assert(sizeof(BrickCache::Instance) == 20, "Instance records are written as is");
+
+enum Section { NODES, CLIP_MAP, VISIBLE, FREE_LIST, INSTANCES, ATLAS, END };
+
+static void hashBytes(uint64_t& h, const void* data, size_t size){
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for(size_t i = 0; i < size; i++){
+    h ^= bytes[i];
+    h *= 0x100000001b3ull;
+  }
+}
+
+// Everything in shaderio.h the brick contents depend on, plus the terrain noise
+static uint64_t constantsHash(){
+  uint64_t h = 0xcbf29ce484222325ull;
+  const int sizes[] = {NUM_BRICKS_PER_AXIS, CLIPMAP_LEVELS, BRICK_SIZE, shaderio::NUM_BRICKS_IN_ATLAS,
+                       int(shaderio::UNIFORM_POSITIVE_BRICK_POINTER), int(shaderio::UNIFORM_NEGATIVE_BRICK_POINTER), BRICK_ENCODING,
+                       EDIT_BRICK_SIZE, TERRAIN_LATTICE_PERIOD};
+  hashBytes(h, sizes, sizeof(sizes));
+  hashBytes(h, shaderio::BRICK_SIZES, sizeof(shaderio::BRICK_SIZES));
+  hashBytes(h, shaderio::VOXEL_SIZES, sizeof(shaderio::VOXEL_SIZES));
+  hashBytes(h, shaderio::MAX_VOXEL_VALUES, sizeof(shaderio::MAX_VOXEL_VALUES));
+  hashBytes(h, shaderio::MAX_BRICK_VALUES, sizeof(shaderio::MAX_BRICK_VALUES));
+  hashBytes(h, shaderio::MAX_BRICK_INSTANCE_VALUES, sizeof(shaderio::MAX_BRICK_INSTANCE_VALUES));
+  hashBytes(h, &shaderio::EDIT_VOXEL_SIZE, sizeof(shaderio::EDIT_VOXEL_SIZE));
+  std::span<const float> lattice = terrainLattice();
+  hashBytes(h, lattice.data(), lattice.size_bytes());
+  return h;
+}
+
+// Byte offset of every section for the given counts
+size_t BrickCache::sectionOffset(int section, uint32_t numNodes, uint32_t numBricks){
+  size_t sizes[END] = {
+    size_t(numNodes) * sizeof(NodeRecord),
+    CLIP_CELLS * sizeof(uint32_t),
+    CLIP_CELLS,
+    size_t(shaderio::NUM_BRICKS_IN_ATLAS) * sizeof(uint32_t),
+    size_t(numBricks) * sizeof(Instance),
+    size_t(numBricks) * BrickBuilder::BRICK_VALUES,
+  };
+  // Keep every section 8 byte aligned
+  size_t offset = (sizeof(Header) + 7) & ~size_t(7);
+  for(int i = 0; i < section; i++)
+    offset += (sizes[i] + 7) & ~size_t(7);
+  return offset;
+}
+
+bool BrickCache::save(const std::string& path, Scene& scene, const BrickBuilder& builder, const ClipmapCenters& centers){
+  std::vector<Scene::NodeKey> keys = scene.getNodeKeys();
+  const uint32_t numBricks = uint32_t(builder.m_atlas.size() / BrickBuilder::BRICK_VALUES);
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.constantsHash = constantsHash();
+  for(int level = 0; level < CLIPMAP_LEVELS; level++)
+    header.centers[level] = centers[level];
+  header.allocCounter = builder.m_allocCounter;
+  header.freeCounter = builder.m_freeCounter;
+  header.numNodes = uint32_t(keys.size());
+  header.numBricks = numBricks;
+
+  std::vector<NodeRecord> nodes;
+  nodes.reserve(keys.size());
+  for(const Scene::NodeKey& key : keys)
+    nodes.push_back({key.hash, key.bbox.min(), key.bbox.max()});
+
+  std::vector<Instance> instances;
+  instances.reserve(numBricks);
+  for(uint32_t i = 0; i < numBricks; i++){
+    const BrickBuilder::Instance& in = builder.m_instances[i];
+    instances.push_back({in.brickId, in.level, in.visible ? 1u : 0u});
+  }
+
+  // Written to a temporary so a failed save never leaves a broken cache
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!os){
+      LOGE("Failed to open %s for writing\n", tmpPath.c_str());
+      return false;
+    }
+
+    auto writeSection = [&](int section, const void* data, size_t size){
+      os.seekp(std::streamoff(sectionOffset(section, header.numNodes, numBricks)));
+      os.write(static_cast<const char*>(data), std::streamsize(size));
+    };
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection(NODES, nodes.data(), nodes.size() * sizeof(NodeRecord));
+    writeSection(CLIP_MAP, builder.m_clipMap.data(), builder.m_clipMap.size() * sizeof(uint32_t));
+    writeSection(VISIBLE, builder.m_visible.data(), builder.m_visible.size());
+    writeSection(FREE_LIST, builder.m_freeList.data(), builder.m_freeList.size() * sizeof(uint32_t));
+    writeSection(INSTANCES, instances.data(), instances.size() * sizeof(Instance));
+    writeSection(ATLAS, builder.m_atlas.data(), builder.m_atlas.size());
+
+    if(!os){
+      LOGE("Failed to write %s\n", tmpPath.c_str());
+      return false;
+    }
+  }
+
+  std::remove(path.c_str());
+  if(std::rename(tmpPath.c_str(), path.c_str()) != 0){
+    LOGE("Failed to rename %s to %s\n", tmpPath.c_str(), path.c_str());
+    return false;
+  }
+  return true;
+}
+
+BrickCache::~BrickCache(){
+  close();
+}
+
+bool BrickCache::open(const std::string& path){
+  close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  HANDLE mapping = nullptr;
+  if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(!mapping){
+    CloseHandle(file);
+    return false;
+  }
+  m_fileHandle = file;
+  m_mappingHandle = mapping;
+  m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  m_size = size_t(size.QuadPart);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  void* data = MAP_FAILED;
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+    data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(data == MAP_FAILED)
+    return false;
+  m_data = static_cast<const uint8_t*>(data);
+  m_size = size_t(st.st_size);
+#endif
+  if(!m_data){
+    close();
+    return false;
+  }
+
+  if(m_size < sizeof(Header) || std::memcmp(header().magic, MAGIC, sizeof(MAGIC)) != 0 || header().version != VERSION){
+    LOGW("%s is not a brick cache\n", path.c_str());
+    close();
+    return false;
+  }
+  if(header().constantsHash != constantsHash()){
+    LOGW("%s was baked with other grid constants\n", path.c_str());
+    close();
+    return false;
+  }
+  if(header().numBricks > uint32_t(shaderio::NUM_BRICKS_IN_ATLAS) || m_size < offset(END)){
+    LOGW("%s is truncated\n", path.c_str());
+    close();
+    return false;
+  }
+  return true;
+}
+
+void BrickCache::close(){
+#ifdef _WIN32
+  if(m_data)
+    UnmapViewOfFile(m_data);
+  if(m_mappingHandle)
+    CloseHandle(m_mappingHandle);
+  if(m_fileHandle)
+    CloseHandle(m_fileHandle);
+  m_mappingHandle = nullptr;
+  m_fileHandle = nullptr;
+#else
+  if(m_data)
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+  m_data = nullptr;
+  m_size = 0;
+}
+
+const BrickCache::Header& BrickCache::header() const {
+  return *reinterpret_cast<const Header*>(m_data);
+}
+
+size_t BrickCache::offset(int section) const {
+  return sectionOffset(section, header().numNodes, header().numBricks);
+}
+
+std::span<const BrickCache::NodeRecord> BrickCache::nodes() const {
+  return {reinterpret_cast<const NodeRecord*>(m_data + offset(NODES)), header().numNodes};
+}
+
+ClipmapCenters BrickCache::centers() const {
+  ClipmapCenters centers;
+  for(int level = 0; level < CLIPMAP_LEVELS; level++)
+    centers.setCenter(level, header().centers[level]);
+  return centers;
+}
+
+glm::ivec4 BrickCache::cellBrick(size_t cell) const {
+  const int cellsPerLevel = NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS;
+  const int level = int(cell / cellsPerLevel);
+  const size_t inLevel = cell % cellsPerLevel;
+  const glm::ivec3 index(int(inLevel % NUM_BRICKS_PER_AXIS), int((inLevel / NUM_BRICKS_PER_AXIS) % NUM_BRICKS_PER_AXIS), int(inLevel / (NUM_BRICKS_PER_AXIS * NUM_BRICKS_PER_AXIS)));
+  const glm::ivec3 windowMin = glm::ivec3(header().centers[level]) - NUM_BRICKS_PER_AXIS/2;
+  // Same as id2index() in common.slang
+  const glm::ivec3 offset = ((index - windowMin) % NUM_BRICKS_PER_AXIS + NUM_BRICKS_PER_AXIS) % NUM_BRICKS_PER_AXIS;
+  return glm::ivec4(windowMin + offset, level);
+}
+
+std::span<const uint32_t> BrickCache::clipMap() const {
+  return {reinterpret_cast<const uint32_t*>(m_data + offset(CLIP_MAP)), CLIP_CELLS};
+}
+
+std::span<const uint8_t> BrickCache::visible() const {
+  return {m_data + offset(VISIBLE), CLIP_CELLS};
+}
+
+std::span<const uint32_t> BrickCache::freeList() const {
+  return {reinterpret_cast<const uint32_t*>(m_data + offset(FREE_LIST)), size_t(shaderio::NUM_BRICKS_IN_ATLAS)};
+}
+
+uint32_t BrickCache::allocCounter() const {
+  return header().allocCounter;
+}
+
+uint32_t BrickCache::freeCounter() const {
+  return header().freeCounter;
+}
+
+uint32_t BrickCache::numBricks() const {
+  return header().numBricks;
+}
+
+std::span<const BrickCache::Instance> BrickCache::instances() const {
+  return {reinterpret_cast<const Instance*>(m_data + offset(INSTANCES)), header().numBricks};
+}
+
+void BrickCache::forEachAtlasChunk(uint32_t maxBricks, const std::function<void(uint32_t firstPointer, std::span<const int8_t> values)>& fn) const {
+  const int8_t* atlas = reinterpret_cast<const int8_t*>(m_data + offset(ATLAS));
+  maxBricks = std::max(maxBricks, 1u);
+  for(uint32_t first = 0; first < numBricks(); first += maxBricks){
+    const uint32_t count = std::min(maxBricks, numBricks() - first);
+    fn(first, std::span<const int8_t>(atlas + size_t(first) * BrickBuilder::BRICK_VALUES, size_t(count) * BrickBuilder::BRICK_VALUES));
+  }
+}
+
+// Nodes are compared in order, so an inserted or removed node also marks the
+// ones after it. That only costs rebuilds, never stale bricks.
+std::vector<nvutils::Bbox> BrickCache::staleRegions(Scene& scene) const {
+  std::vector<Scene::NodeKey> keys = scene.getNodeKeys();
+  std::span<const NodeRecord> baked = nodes();
+  std::vector<nvutils::Bbox> regions;
+
+  const size_t count = std::max(keys.size(), baked.size());
+  for(size_t i = 0; i < count; i++){
+    if(i < keys.size() && i < baked.size() && keys[i].hash == baked[i].hash)
+      continue;
+    if(i < baked.size())
+      regions.emplace_back(baked[i].bboxMin, baked[i].bboxMax);
+    if(i < keys.size())
+      regions.push_back(keys[i].bbox);
+  }
+  return regions;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "nvutils/bounding_box.hpp"
+#include "clipmap_centers.hpp"
+
+class BrickBuilder;
+class Scene;
+
+// On disk copy of the baked bricks of a scene: clipmap pointers and instance
+// visibility of every level, free list, instances and the atlas payload. Files written with other
+// grid constants are rejected, nodes that changed since the bake are reported
+// as regions to rebuild. The file is memory mapped, atlas pages are only read
+// when a chunk is consumed.
+class BrickCache {
+public:
+  struct Instance {
+    glm::ivec3 brickId;
+    int32_t level;
+    uint32_t visible;
+  };
+
+  BrickCache() = default;
+  ~BrickCache();
+
+  BrickCache(const BrickCache&) = delete;
+  BrickCache& operator=(const BrickCache&) = delete;
+
+  // Writes the builder state baked for scene with the level windows of centers
+  static bool save(const std::string& path, Scene& scene, const BrickBuilder& builder, const ClipmapCenters& centers);
+
+  // Maps the file, false if it is missing, truncated or baked with other
+  // grid constants
+  bool open(const std::string& path);
+  void close();
+  bool isOpen() const { return m_data != nullptr; }
+
+  // Centers of the baked level windows
+  ClipmapCenters centers() const;
+  // Brick id and level held by a clip cell of the baked level windows
+  glm::ivec4 cellBrick(size_t cell) const;
+
+  // Bounds, old and new, of the nodes that differ from the baked ones
+  std::vector<nvutils::Bbox> staleRegions(Scene& scene) const;
+
+  std::span<const uint32_t> clipMap() const;
+  std::span<const uint8_t> visible() const;
+  std::span<const uint32_t> freeList() const;
+  uint32_t allocCounter() const;
+  uint32_t freeCounter() const;
+
+  // Bricks in the payload, one more than the highest pointer used
+  uint32_t numBricks() const;
+  std::span<const Instance> instances() const;
+
+  // Calls fn over the payload in pointer order, at most maxBricks bricks at a time
+  void forEachAtlasChunk(uint32_t maxBricks, const std::function<void(uint32_t firstPointer, std::span<const int8_t> values)>& fn) const;
+
+private:
+  struct Header;
+  struct NodeRecord;
+
+  static size_t sectionOffset(int section, uint32_t numNodes, uint32_t numBricks);
+
+  const Header& header() const;
+  std::span<const NodeRecord> nodes() const;
+  size_t offset(int section) const;
+
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  void* m_fileHandle = nullptr;
+  void* m_mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,72 @@
+#include "brick_codec.hpp"
+
+#include <cassert>
+
+#include <glm/common.hpp>
+
+static int residualIndex(int x, int y, int z){
+  return ((z >> 1) * BRICK_SIZE + y) * BRICK_SIZE + x;
+}
+
+static float rangeValue(uint8_t q){
+  return float(q) / 127.5f - 1.0f;
+}
+
+void encodeRange4(std::span<const float> values, Range4Brick& out){
+  assert(values.size() == size_t(Range4Brick::NUM_VALUES));
+
+  uint32_t qmin = 255, qmax = 0;
+  for(float v : values){
+    const float q = (v + 1.0f) * 127.5f;
+    qmin = glm::min(qmin, uint32_t(glm::clamp(glm::floor(q), 0.0f, 255.0f)));
+    qmax = glm::max(qmax, uint32_t(glm::clamp(glm::ceil(q), 0.0f, 255.0f)));
+  }
+  out.rangeMin = uint8_t(qmin);
+  out.rangeMax = uint8_t(qmax);
+
+  const float lo = rangeValue(out.rangeMin);
+  const float hi = rangeValue(out.rangeMax);
+  const float invStep = hi > lo ? 15.0f / (hi - lo) : 0.0f;
+
+  for(int z = 0; z < BRICK_SIZE; z += 2){
+    for(int y = 0; y < BRICK_SIZE; y++){
+      for(int x = 0; x < BRICK_SIZE; x++){
+        const float v0 = values[(z * BRICK_SIZE + y) * BRICK_SIZE + x];
+        const float v1 = values[((z + 1) * BRICK_SIZE + y) * BRICK_SIZE + x];
+        const uint32_t r0 = uint32_t(glm::clamp(glm::round((v0 - lo) * invStep), 0.0f, 15.0f));
+        const uint32_t r1 = uint32_t(glm::clamp(glm::round((v1 - lo) * invStep), 0.0f, 15.0f));
+        out.residuals[residualIndex(x, y, z)] = uint8_t(r0 | (r1 << 4));
+      }
+    }
+  }
+}
+
+void decodeRange4(const Range4Brick& brick, std::span<float> values){
+  assert(values.size() == size_t(Range4Brick::NUM_VALUES));
+
+  const float lo = rangeValue(brick.rangeMin);
+  const float step = (rangeValue(brick.rangeMax) - lo) / 15.0f;
+  for(int z = 0; z < BRICK_SIZE; z++){
+    for(int y = 0; y < BRICK_SIZE; y++){
+      for(int x = 0; x < BRICK_SIZE; x++){
+        const uint32_t residual = (brick.residuals[residualIndex(x, y, z)] >> ((z & 1) * 4)) & 0xF;
+        values[(z * BRICK_SIZE + y) * BRICK_SIZE + x] = lo + float(residual) * step;
+      }
+    }
+  }
+}
+
+CodecError range4Error(std::span<const float> values){
+  Range4Brick brick;
+  float decoded[Range4Brick::NUM_VALUES];
+  encodeRange4(values, brick);
+  decodeRange4(brick, decoded);
+
+  CodecError error{0.0f, 0.0};
+  for(size_t i = 0; i < values.size(); i++){
+    const float e = glm::abs(decoded[i] - values[i]);
+    error.maxError = glm::max(error.maxError, e);
+    error.sumError += e;
+  }
+  return error;
+}
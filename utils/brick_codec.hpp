@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "../shaders/shaderio.h"
+
+// CPU side of the BRICK_ENCODING_RANGE4 brick payload, same quantization as
+// brick.slang and the decode in grid.slang. Values are the normalized brick
+// samples in [-1,1], x fastest then y then z.
+//
+// A decoded value is within half a residual step, (max - min) / 30, of the
+// sample. Neighbouring bricks share their border samples but each quantizes
+// them with its own range, so the two copies may decode up to the sum of both
+// half steps apart, at most 2/15 or 0.58 voxels of the level for bricks that
+// span the whole [-1,1] range, which ray marching sees as a sub-voxel step in
+// the surface.
+struct Range4Brick {
+  static constexpr int NUM_VALUES = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+  uint8_t rangeMin;                       // (v+1)*127.5 rounded down
+  uint8_t rangeMax;                       // (v+1)*127.5 rounded up
+  uint8_t residuals[NUM_VALUES / 2];      // Texels (x, y, z/2), even z in the low nibble
+};
+
+void encodeRange4(std::span<const float> values, Range4Brick& out);
+void decodeRange4(const Range4Brick& brick, std::span<float> values);
+
+// Largest and summed absolute decode error of one brick
+struct CodecError {
+  float maxError;
+  double sumError;
+};
+CodecError range4Error(std::span<const float> values);
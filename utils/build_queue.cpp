@@ -0,0 +1,430 @@
+#include "build_queue.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+#include <glm/common.hpp>
+
+// Half open box of brick ids of a level
+struct BrickBox {
+  glm::ivec3 min;
+  glm::ivec3 max;
+};
+
+static bool overlaps(const BrickBox& a, const BrickBox& b){
+  return glm::all(glm::lessThan(a.min, b.max)) && glm::all(glm::lessThan(b.min, a.max));
+}
+
+// Appends the parts of box outside cut, at most six boxes
+static void subtractBrickBox(BrickBox box, const BrickBox& cut, std::vector<BrickBox>& out){
+  if(!overlaps(box, cut)){
+    out.push_back(box);
+    return;
+  }
+  for(int axis = 0; axis < 3; axis++){
+    if(box.min[axis] < cut.min[axis]){
+      BrickBox part = box;
+      part.max[axis] = cut.min[axis];
+      out.push_back(part);
+      box.min[axis] = cut.min[axis];
+    }
+    if(cut.max[axis] < box.max[axis]){
+      BrickBox part = box;
+      part.min[axis] = cut.max[axis];
+      out.push_back(part);
+      box.max[axis] = cut.max[axis];
+    }
+  }
+}
+
+// Joins boxes that touch along axis and match on the other two
+static void mergeBrickBoxes(std::vector<BrickBox>& boxes, int axis){
+  const int a = (axis + 1) % 3;
+  const int b = (axis + 2) % 3;
+  auto key = [&](const BrickBox& box){
+    return std::make_tuple(box.min[a], box.max[a], box.min[b], box.max[b], box.min[axis]);
+  };
+  std::sort(boxes.begin(), boxes.end(), [&](const BrickBox& l, const BrickBox& r){ return key(l) < key(r); });
+
+  size_t last = 0;
+  for(size_t i = 1; i < boxes.size(); i++){
+    BrickBox& prev = boxes[last];
+    const BrickBox& box = boxes[i];
+    if(prev.min[a] == box.min[a] && prev.max[a] == box.max[a] &&
+       prev.min[b] == box.min[b] && prev.max[b] == box.max[b] && prev.max[axis] == box.min[axis])
+      prev.max[axis] = box.max[axis];
+    else
+      boxes[++last] = box;
+  }
+  if(!boxes.empty())
+    boxes.resize(last + 1);
+}
+
+static uint64_t numBricks(glm::ivec3 num_b){
+  return uint64_t(num_b.x) * uint64_t(num_b.y) * uint64_t(num_b.z);
+}
+
+static BrickBox levelWindow(const ClipmapCenters& centers, int level){
+  return {centers[level] - NUM_BRICKS_PER_AXIS/2, centers[level] + NUM_BRICKS_PER_AXIS/2};
+}
+
+// Ids the next finer level covers, same as insideHole() in common.slang
+static BrickBox levelHole(const ClipmapCenters& centers, int level){
+  const glm::ivec3 holeId = centers.holeCenter(level);
+  return {holeId - NUM_BRICKS_PER_AXIS/4 + 1, holeId + NUM_BRICKS_PER_AXIS/4};
+}
+
+// Bricks of every level whose clip cells changed meaning from prev to curr,
+// the shell a window took and the bricks that entered or left its hole
+static void movedBrickBoxes(const ClipmapCenters& curr, const ClipmapCenters& prev, std::vector<BrickBox> (&moved)[CLIPMAP_LEVELS]){
+  for(int level = 0; level < CLIPMAP_LEVELS; level++){
+    moved[level].clear();
+    if(curr[level] != prev[level])
+      subtractBrickBox(levelWindow(curr, level), levelWindow(prev, level), moved[level]);
+    if(level > 0 && curr.holeCenter(level) != prev.holeCenter(level)){
+      subtractBrickBox(levelHole(curr, level), levelHole(prev, level), moved[level]);
+      subtractBrickBox(levelHole(prev, level), levelHole(curr, level), moved[level]);
+    }
+  }
+}
+
+std::vector<shaderio::BuildJob> BuildQueue::coalesce(std::span<const shaderio::BuildJob> jobs){
+  std::vector<shaderio::BuildJob> out;
+  std::vector<BrickBox> disjoint, pieces, next;
+
+  std::vector<BrickBox> boxes;
+  for(int level = 0; level < CLIPMAP_LEVELS; level++){
+    boxes.clear();
+    for(const shaderio::BuildJob& job : jobs){
+      if(job.min_id_level.w != level || glm::any(glm::lessThanEqual(glm::ivec3(job.num_b), glm::ivec3(0))))
+        continue;
+      boxes.push_back({glm::ivec3(job.min_id_level), glm::ivec3(job.min_id_level) + glm::ivec3(job.num_b)});
+    }
+    // Jobs already split to MAX_BUILD_JOB_SIZE join back first, the
+    // subtraction below is quadratic in the number of boxes
+    for(int axis = 0; axis < 3; axis++)
+      mergeBrickBoxes(boxes, axis);
+
+    disjoint.clear();
+    for(const BrickBox& box : boxes){
+      // Only the parts no earlier box covers are kept
+      pieces.assign(1, box);
+      const size_t numDisjoint = disjoint.size();
+      for(size_t i = 0; i < numDisjoint && !pieces.empty(); i++){
+        if(!overlaps(box, disjoint[i]))
+          continue;
+        next.clear();
+        for(const BrickBox& piece : pieces)
+          subtractBrickBox(piece, disjoint[i], next);
+        pieces.swap(next);
+      }
+      disjoint.insert(disjoint.end(), pieces.begin(), pieces.end());
+    }
+
+    for(int axis = 0; axis < 3; axis++)
+      mergeBrickBoxes(disjoint, axis);
+
+    for(const BrickBox& box : disjoint){
+      out.push_back({
+        .min_id_level = glm::ivec4(box.min, level),
+        .num_b = glm::ivec4(box.max - box.min, 0)
+      });
+    }
+  }
+
+  return out;
+}
+
+void BuildQueue::push(std::span<const shaderio::BuildJob> jobs){
+  m_pending.insert(m_pending.end(), jobs.begin(), jobs.end());
+}
+
+void BuildQueue::pushNotResident(std::vector<glm::ivec4>& notResident, uint32_t freeSlots){
+  std::sort(notResident.begin(), notResident.end(), [](const glm::ivec4& a, const glm::ivec4& b){
+    return std::tie(a.w, a.z, a.y, a.x) < std::tie(b.w, b.z, b.y, b.x);
+  });
+  notResident.erase(std::unique(notResident.begin(), notResident.end()), notResident.end());
+
+  const size_t count = std::min(notResident.size(), size_t(freeSlots));
+  for(size_t i = notResident.size() - count; i < notResident.size(); i++)
+    m_pending.push_back({.min_id_level = notResident[i], .num_b = glm::ivec4(1, 1, 1, 0)});
+  notResident.resize(notResident.size() - count);
+}
+
+uint64_t BuildQueue::pendingBricks() const {
+  uint64_t bricks = 0;
+  for(const shaderio::BuildJob& job : m_pending)
+    bricks += numBricks(glm::max(glm::ivec3(job.num_b), glm::ivec3(0)));
+  return bricks;
+}
+
+std::vector<shaderio::BuildJob> BuildQueue::pop(const ClipmapCenters& centers, const glm::mat4& viewProj, uint32_t brickBudget){
+  return popJobs(centers, &viewProj, brickBudget);
+}
+
+std::vector<shaderio::BuildJob> BuildQueue::pop(const ClipmapCenters& centers, uint32_t brickBudget){
+  return popJobs(centers, nullptr, brickBudget);
+}
+
+// Box outside one of the frustum planes of viewProj. Near uses -w <= z, which
+// holds for both depth ranges.
+static bool outsideFrustum(const glm::mat4& viewProj, glm::vec3 boxMin, glm::vec3 boxMax){
+  const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+  const glm::vec4 planes[6] = {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2};
+  for(const glm::vec4& plane : planes){
+    // Corner farthest along the plane normal
+    const glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                           plane.z >= 0.0f ? boxMax.z : boxMin.z);
+    if(glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+      return true;
+  }
+  return false;
+}
+
+std::vector<shaderio::BuildJob> BuildQueue::popJobs(const ClipmapCenters& centers, const glm::mat4* viewProj, uint32_t brickBudget){
+  struct Chunk {
+    shaderio::BuildJob job;
+    float priority;                       // Lower goes first
+    bool moved;                           // Touches a brick the windows took
+  };
+  std::vector<Chunk> chunks;
+
+  std::vector<BrickBox> moved[CLIPMAP_LEVELS];
+  movedBrickBoxes(centers, m_popped ? m_poppedCenters : centers, moved);
+  m_poppedCenters = centers;
+  m_popped = true;
+
+  // Bricks that left the window would land on the clip cells of others
+  size_t kept = 0;
+  for(const shaderio::BuildJob& job : m_pending){
+    const glm::ivec3 camId = centers[job.min_id_level.w];
+    const glm::ivec3 lo = glm::max(glm::ivec3(job.min_id_level), camId - NUM_BRICKS_PER_AXIS/2);
+    const glm::ivec3 hi = glm::min(glm::ivec3(job.min_id_level) + glm::ivec3(job.num_b), camId + NUM_BRICKS_PER_AXIS/2);
+    if(glm::any(glm::lessThanEqual(hi, lo)))
+      continue;
+    m_pending[kept++] = {glm::ivec4(lo, job.min_id_level.w), glm::ivec4(hi - lo, 0)};
+  }
+  m_pending.resize(kept);
+
+  for(const shaderio::BuildJob& job : coalesce(m_pending)){
+    const int level = job.min_id_level.w;
+    const glm::ivec3 camId = centers[level];
+    const glm::ivec3 lo = glm::ivec3(job.min_id_level);
+    const glm::ivec3 hi = lo + glm::ivec3(job.num_b);
+
+    for(int z = lo.z; z < hi.z; z += MAX_BUILD_JOB_SIZE)
+    for(int y = lo.y; y < hi.y; y += MAX_BUILD_JOB_SIZE)
+    for(int x = lo.x; x < hi.x; x += MAX_BUILD_JOB_SIZE){
+      const glm::ivec3 minId(x, y, z);
+      const glm::ivec3 num_b = glm::min(hi - minId, glm::ivec3(MAX_BUILD_JOB_SIZE));
+      bool inMoved = false;
+      for(const BrickBox& box : moved[level])
+        inMoved = inMoved || overlaps({minId, minId + num_b}, box);
+
+      // Same distance as brickPriority() in common.slang
+      const glm::vec3 fromCenter = glm::abs(glm::vec3(minId) + 0.5f * glm::vec3(num_b) - glm::vec3(camId));
+      float priority = glm::max(fromCenter.x, glm::max(fromCenter.y, fromCenter.z)) / float(NUM_BRICKS_PER_AXIS/2);
+      priority -= 0.25f * float(level) / float(CLIPMAP_LEVELS);
+      if(viewProj){
+        const float brickSize = shaderio::BRICK_SIZES[level];
+        const float reach = shaderio::MAX_BRICK_VALUES[level];
+        if(outsideFrustum(*viewProj, glm::vec3(minId) * brickSize - reach, glm::vec3(minId + num_b) * brickSize + reach))
+          priority += 2.0f;
+      }
+
+      chunks.push_back({{
+        .min_id_level = glm::ivec4(minId, level),
+        .num_b = glm::ivec4(num_b, 0)
+      }, priority, inMoved});
+    }
+  }
+
+  std::stable_sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b){
+    return a.priority < b.priority;
+  });
+
+  std::vector<shaderio::BuildJob> out;
+  uint64_t bricks = 0;
+  size_t taken = 0;
+  while(taken < chunks.size() && out.size() < size_t(shaderio::MAX_NUM_BUILD_JOBS) &&
+        (brickBudget == 0 || bricks < brickBudget)){
+    out.push_back(chunks[taken].job);
+    bricks += numBricks(glm::ivec3(chunks[taken].job.num_b));
+    taken++;
+  }
+
+  // The moved bricks left waiting only get their clip cells freed
+  m_release.clear();
+  m_pending.clear();
+  for(size_t i = taken; i < chunks.size(); i++){
+    const shaderio::BuildJob& job = chunks[i].job;
+    m_pending.push_back(job);
+    if(!chunks[i].moved)
+      continue;
+    const int level = job.min_id_level.w;
+    const BrickBox box{glm::ivec3(job.min_id_level), glm::ivec3(job.min_id_level) + glm::ivec3(job.num_b)};
+    for(const BrickBox& area : moved[level]){
+      if(!overlaps(box, area) || out.size() + m_release.size() >= size_t(shaderio::MAX_NUM_BUILD_JOBS))
+        continue;
+      const glm::ivec3 lo = glm::max(box.min, area.min);
+      const glm::ivec3 hi = glm::min(box.max, area.max);
+      m_release.push_back({glm::ivec4(lo, level | RELEASE_JOB), glm::ivec4(hi - lo, 0)});
+    }
+  }
+  return out;
+}
+
+//---------------------------------------
+// Prefetch
+//---------------------------------------
+
+static BrickBox jobBox(const shaderio::BuildJob& job){
+  return {glm::ivec3(job.min_id_level), glm::ivec3(job.min_id_level) + glm::ivec3(job.num_b)};
+}
+
+void ClipmapPrefetch::addSample(glm::vec3 eye, float time){
+  // Time going back is a reset
+  if(!m_samples.empty() && time < m_samples.back().time)
+    m_samples.clear();
+  m_samples.push_back({eye, time});
+
+  size_t old = 0;
+  while(old + 1 < m_samples.size() && m_samples[old].time < time - SAMPLE_TIME)
+    old++;
+  m_samples.erase(m_samples.begin(), m_samples.begin() + old);
+}
+
+glm::ivec3 ClipmapPrefetch::predictCameraId0(float lookahead) const {
+  if(m_samples.empty())
+    return glm::ivec3(0);
+
+  const Sample& first = m_samples.front();
+  const Sample& last = m_samples.back();
+  const glm::vec3 cell = last.eye / shaderio::BRICK_SIZES[0];
+  const float dt = last.time - first.time;
+  if(m_samples.size() < 2 || !(dt > 0.0f))
+    return glm::ivec3(glm::floor(cell));
+
+  const glm::vec3 velocity = (last.eye - first.eye) / dt;
+  const glm::vec3 lead = glm::clamp(velocity * lookahead / shaderio::BRICK_SIZES[0], glm::vec3(-float(MAX_DEPTH)), glm::vec3(float(MAX_DEPTH)));
+  return glm::ivec3(glm::floor(cell + lead));
+}
+
+std::vector<shaderio::BuildJob> ClipmapPrefetch::jobs(const ClipmapCenters& centers, const ClipmapCenters& predicted, uint32_t brickBudget, uint32_t maxJobs){
+  struct Chunk {
+    shaderio::BuildJob job;
+    int distance;                         // Bricks past the current window
+  };
+  std::vector<Chunk> chunks;
+  std::vector<BrickBox> wanted, next;
+
+  for(int level = 0; level < CLIPMAP_LEVELS; level++){
+    if(predicted[level] == centers[level])
+      continue;
+
+    // Holes keep their bricks, only the shell is new
+    const BrickBox currWindow = levelWindow(centers, level);
+    const BrickBox predWindow = levelWindow(predicted, level);
+    wanted.clear();
+    subtractBrickBox(predWindow, currWindow, wanted);
+
+    for(const shaderio::BuildJob& tracked : m_prefetched){
+      if(tracked.min_id_level.w != level)
+        continue;
+      next.clear();
+      for(const BrickBox& box : wanted)
+        subtractBrickBox(box, jobBox(tracked), next);
+      wanted.swap(next);
+    }
+
+    for(const BrickBox& box : wanted){
+      for(int z = box.min.z; z < box.max.z; z += MAX_BUILD_JOB_SIZE)
+      for(int y = box.min.y; y < box.max.y; y += MAX_BUILD_JOB_SIZE)
+      for(int x = box.min.x; x < box.max.x; x += MAX_BUILD_JOB_SIZE){
+        const glm::ivec3 minId(x, y, z);
+        const glm::ivec3 num_b = glm::min(box.max - minId, glm::ivec3(MAX_BUILD_JOB_SIZE));
+        const glm::ivec3 gap = glm::max(glm::max(currWindow.min - (minId + num_b), minId - currWindow.max), glm::ivec3(-1)) + 1;
+        chunks.push_back({{
+          .min_id_level = glm::ivec4(minId, level),
+          .num_b = glm::ivec4(num_b, 0)
+        }, glm::max(gap.x, glm::max(gap.y, gap.z))});
+      }
+    }
+  }
+
+  // Levels are already in order
+  std::stable_sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b){
+    return a.job.min_id_level.w != b.job.min_id_level.w ? a.job.min_id_level.w < b.job.min_id_level.w : a.distance < b.distance;
+  });
+
+  std::vector<shaderio::BuildJob> out;
+  uint64_t bricks = 0;
+  for(const Chunk& chunk : chunks){
+    if(out.size() >= size_t(maxJobs) || (brickBudget != 0 && bricks >= brickBudget))
+      break;
+    m_prefetched.push_back(chunk.job);
+    out.push_back(chunk.job);
+    out.back().min_id_level.w |= PREFETCH_JOB;
+    bricks += numBricks(glm::ivec3(chunk.job.num_b));
+  }
+  if(!out.empty())
+    m_prefetched = BuildQueue::coalesce(m_prefetched);
+  return out;
+}
+
+void ClipmapPrefetch::committed(const ClipmapCenters& centers){
+  std::vector<shaderio::BuildJob> kept;
+  std::vector<BrickBox> pieces;
+  for(const shaderio::BuildJob& tracked : m_prefetched){
+    const int level = tracked.min_id_level.w;
+    pieces.clear();
+    subtractBrickBox(jobBox(tracked), levelWindow(centers, level), pieces);
+    for(const BrickBox& piece : pieces)
+      kept.push_back({glm::ivec4(piece.min, level), glm::ivec4(piece.max - piece.min, 0)});
+  }
+  m_prefetched.swap(kept);
+}
+
+bool ClipmapPrefetch::invalidate(std::span<const nvutils::Bbox> changed, const ClipmapCenters& centers){
+  // Large enough for any window, small enough for an int
+  const float LIMIT = 1e9f;
+  bool stale = false;
+  for(size_t t = 0; t < m_prefetched.size() && !stale; t++){
+    const int level = m_prefetched[t].min_id_level.w;
+    const BrickBox box = jobBox(m_prefetched[t]);
+
+    const BrickBox window = levelWindow(centers, level);
+    const glm::ivec3 gap = glm::max(window.min - box.max, box.min - window.max);
+    stale = glm::max(gap.x, glm::max(gap.y, gap.z)) > KEEP_DISTANCE;
+
+    const float brickSize = shaderio::BRICK_SIZES[level];
+    const float reach = shaderio::MAX_BRICK_VALUES[level];
+    for(size_t r = 0; r < changed.size() && !stale; r++){
+      const nvutils::Bbox& region = changed[r];
+      if(glm::any(glm::lessThan(region.max(), region.min())))
+        continue;
+      const glm::vec3 lo = glm::clamp(glm::floor((region.min() - reach) / brickSize), -LIMIT, LIMIT);
+      const glm::vec3 hi = glm::clamp(glm::floor((region.max() + reach) / brickSize) + 1.0f, -LIMIT, LIMIT);
+      stale = overlaps(box, {glm::ivec3(lo), glm::ivec3(hi)});
+    }
+  }
+
+  if(stale)
+    m_prefetched.clear();
+  return stale;
+}
+
+void ClipmapPrefetch::clear(){
+  m_samples.clear();
+  m_prefetched.clear();
+}
+
+uint64_t ClipmapPrefetch::trackedBricks() const {
+  uint64_t bricks = 0;
+  for(const shaderio::BuildJob& job : m_prefetched)
+    bricks += numBricks(glm::ivec3(job.num_b));
+  return bricks;
+}
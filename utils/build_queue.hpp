@@ -0,0 +1,108 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "nvutils/bounding_box.hpp"
+#include "../shaders/shaderio.h"
+#include "clipmap_centers.hpp"
+
+// Build jobs waiting for a frame with brick budget left. Bricks not built yet
+// keep their old contents, so a camera jump or a large edit spreads over
+// several frames instead of stalling one. Jobs are kept as disjoint boxes per
+// level, bricks requested again while waiting are only built once.
+class BuildQueue {
+public:
+  // Disjoint jobs covering the same bricks of every level as jobs. Jobs are
+  // not split to MAX_BUILD_JOB_SIZE.
+  static std::vector<shaderio::BuildJob> coalesce(std::span<const shaderio::BuildJob> jobs);
+
+  void push(std::span<const shaderio::BuildJob> jobs);
+  // Builds again up to freeSlots of the bricks a full atlas left without a
+  // slot, id and level. Duplicates are dropped, the bricks not taken stay in
+  // notResident for a later call.
+  void pushNotResident(std::vector<glm::ivec4>& notResident, uint32_t freeSlots);
+
+  // Jobs of at most MAX_BUILD_JOB_SIZE³ bricks to dispatch this frame, about
+  // brickBudget bricks and never more than MAX_NUM_BUILD_JOBS jobs with the
+  // release jobs. 0 takes every job. Bricks that left the level windows of
+  // centers are dropped. Jobs near the window center of their level go first,
+  // coarse levels first among equals, and jobs outside the frustum of
+  // viewProj after every visible one.
+  std::vector<shaderio::BuildJob> pop(const ClipmapCenters& centers, const glm::mat4& viewProj, uint32_t brickBudget);
+  // Same without a frustum, every job counts as visible
+  std::vector<shaderio::BuildJob> pop(const ClipmapCenters& centers, uint32_t brickBudget);
+
+  // RELEASE_JOB jobs of the last pop, dispatched with its jobs and not part of
+  // the budget. Bricks the windows and holes took since the pop before and
+  // that stay in the queue still find the bricks of the other edge of the
+  // window in their clip cells, these jobs free them.
+  std::vector<shaderio::BuildJob> takeReleaseJobs() { return std::exchange(m_release, {}); }
+
+  void clear() { m_pending.clear(); m_release.clear(); m_popped = false; }
+  bool empty() const { return m_pending.empty(); }
+  // Bricks waiting, the ones outside the level windows included
+  uint64_t pendingBricks() const;
+
+private:
+  std::vector<shaderio::BuildJob> popJobs(const ClipmapCenters& centers, const glm::mat4* viewProj, uint32_t brickBudget);
+
+  std::vector<shaderio::BuildJob> m_pending;
+  std::vector<shaderio::BuildJob> m_release;
+  ClipmapCenters m_poppedCenters;       // Centers of the last pop
+  bool m_popped = false;
+};
+
+// Picks the bricks to build before the camera reaches them. The camera
+// velocity comes from the eye samples of the last SAMPLE_TIME seconds. The
+// bricks the level windows add once they follow the predicted camera cell,
+// their outer shell, are built into the prefetch table by PREFETCH_JOB build
+// jobs, and the build pass moves them into the clipmap once the windows reach
+// them.
+//
+// Prefetched bricks are only valid while the scene around them is unchanged.
+// The boxes whose bricks may be in the table are tracked, when a changed
+// region reaches one, or one is left far behind, every prefetched brick is
+// stale and the build pass drops the ones built before prefetchValidFrame.
+class ClipmapPrefetch {
+public:
+  static constexpr float SAMPLE_TIME = 0.25f;
+  static constexpr int MAX_DEPTH = NUM_BRICKS_PER_AXIS/8;       // Level 0 bricks the prediction may lead the camera
+  static constexpr int KEEP_DISTANCE = NUM_BRICKS_PER_AXIS/4;   // Bricks of a level past its window prefetched boxes are kept at
+
+  void addSample(glm::vec3 eye, float time);
+
+  // Camera cell lookahead seconds after the last sample
+  glm::ivec3 predictCameraId0(float lookahead) const;
+
+  // PREFETCH_JOB jobs of at most MAX_BUILD_JOB_SIZE³ bricks for the bricks
+  // the level windows of predicted add to the windows of centers and were not
+  // prefetched yet, about brickBudget bricks, 0 takes every one, and
+  // at most maxJobs jobs. Fine levels go first, their windows move more often.
+  std::vector<shaderio::BuildJob> jobs(const ClipmapCenters& centers, const ClipmapCenters& predicted, uint32_t brickBudget, uint32_t maxJobs);
+
+  // Forgets the prefetched boxes inside the windows of centers, only
+  // right after every job that entered the windows went to the GPU. Those
+  // took their bricks out of the table.
+  void committed(const ClipmapCenters& centers);
+
+  // True when the prefetched bricks turned stale: a changed region is within
+  // the voxel reach of a prefetched box, or a box is KEEP_DISTANCE bricks
+  // past the window of its level in centers. The boxes are forgotten.
+  bool invalidate(std::span<const nvutils::Bbox> changed, const ClipmapCenters& centers);
+
+  void clear();
+  // Bricks of the prefetched boxes
+  uint64_t trackedBricks() const;
+
+private:
+  struct Sample {
+    glm::vec3 eye;
+    float time;
+  };
+  std::vector<Sample> m_samples;                // Oldest first
+  std::vector<shaderio::BuildJob> m_prefetched; // Disjoint boxes of every level
+};
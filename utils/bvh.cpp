@@ -0,0 +1,87 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+
+// Items per leaf, larger leaves make the tree shallower but cull less
+static const uint32_t MAX_LEAF_ITEMS = 4;
+// Deeper trees would overflow the traversal stack
+static const int MAX_DEPTH = 48;
+
+void Bvh::clear(){
+  m_nodes.clear();
+  m_items.clear();
+  m_itemBoxes.clear();
+  m_needsRefit = false;
+}
+
+void Bvh::build(std::span<const nvutils::Bbox> boxes){
+  clear();
+  if(boxes.empty())
+    return;
+
+  m_itemBoxes.assign(boxes.begin(), boxes.end());
+  m_items.resize(boxes.size());
+  for(uint32_t i = 0; i < m_items.size(); i++)
+    m_items[i] = i;
+
+  m_nodes.reserve(2 * boxes.size() / MAX_LEAF_ITEMS + 1);
+  m_nodes.push_back({});
+  buildRecursive(0, 0, uint32_t(m_items.size()), 0);
+}
+
+void Bvh::buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t count, int depth){
+  nvutils::Bbox bounds, centroids;
+  for(uint32_t i = first; i < first + count; i++){
+    const nvutils::Bbox& b = m_itemBoxes[m_items[i]];
+    bounds.insert(b);
+    centroids.insert((b.min() + b.max()) * 0.5f);
+  }
+
+  m_nodes[nodeIdx] = {.bMin = bounds.min(), .first = first, .bMax = bounds.max(), .count = count};
+
+  glm::vec3 ext = centroids.max() - centroids.min();
+  int axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+  if(count <= MAX_LEAF_ITEMS || depth >= MAX_DEPTH || ext[axis] <= 0.0f)
+    return;
+
+  // Median split along the widest centroid axis
+  uint32_t mid = first + count / 2;
+  std::nth_element(m_items.begin() + first, m_items.begin() + mid, m_items.begin() + first + count,
+    [&](uint32_t a, uint32_t b){
+      const nvutils::Bbox& ba = m_itemBoxes[a];
+      const nvutils::Bbox& bb = m_itemBoxes[b];
+      return ba.min()[axis] + ba.max()[axis] < bb.min()[axis] + bb.max()[axis];
+    });
+
+  // Siblings are stored next to each other, always after their parent
+  uint32_t left = uint32_t(m_nodes.size());
+  m_nodes.push_back({});
+  m_nodes.push_back({});
+  m_nodes[nodeIdx].first = left;
+  m_nodes[nodeIdx].count = 0;
+  buildRecursive(left, first, mid - first, depth + 1);
+  buildRecursive(left + 1, mid, first + count - mid, depth + 1);
+}
+
+void Bvh::setBox(uint32_t item, const nvutils::Bbox& box){
+  m_itemBoxes[item] = box;
+  m_needsRefit = true;
+}
+
+void Bvh::refit(){
+  // Children always come after their parent, walk backwards to go bottom up
+  for(size_t i = m_nodes.size(); i-- > 0;){
+    Node& n = m_nodes[i];
+    nvutils::Bbox bounds;
+    if(n.count > 0){
+      for(uint32_t j = 0; j < n.count; j++)
+        bounds.insert(m_itemBoxes[m_items[n.first + j]]);
+    } else {
+      bounds.insert(nvutils::Bbox(m_nodes[n.first].bMin, m_nodes[n.first].bMax));
+      bounds.insert(nvutils::Bbox(m_nodes[n.first + 1].bMin, m_nodes[n.first + 1].bMax));
+    }
+    n.bMin = bounds.min();
+    n.bMax = bounds.max();
+  }
+  m_needsRefit = false;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "nvutils/bounding_box.hpp"
+
+// Distance from p to an axis aligned box, 0 inside
+inline float boxDistance(glm::vec3 p, glm::vec3 bMin, glm::vec3 bMax){
+  glm::vec3 q = glm::max(glm::max(bMin - p, p - bMax), glm::vec3(0.0f));
+  return glm::length(q);
+}
+
+// Binary BVH over a list of boxes. Items are identified by their index in the
+// box list given to build().
+class Bvh {
+public:
+  struct Node {
+    glm::vec3 bMin;
+    uint32_t first;   // first item if leaf, left child otherwise (right = first+1)
+    glm::vec3 bMax;
+    uint32_t count;   // number of items, 0 for inner nodes
+  };
+
+  void build(std::span<const nvutils::Bbox> boxes);
+  void clear();
+
+  // Updates the box of an item, the hierarchy is fixed by the next refit()
+  void setBox(uint32_t item, const nvutils::Bbox& box);
+  void refit();
+
+  bool empty() const { return m_nodes.empty(); }
+  bool needsRefit() const { return m_needsRefit; }
+  uint32_t numItems() const { return uint32_t(m_itemBoxes.size()); }
+
+  // Depth first traversal, nearest child first. priority(bMin, bMax) returns a
+  // value to sort siblings by, or a negative value when nothing inside the box
+  // can change the query. It is re-tested when a node is popped so a query
+  // can tighten while traversing. visit(item) is called for leaf items.
+  template<typename Priority, typename Visit>
+  void traverse(Priority&& priority, Visit&& visit) const;
+
+private:
+  void buildRecursive(uint32_t nodeIdx, uint32_t first, uint32_t count, int depth);
+
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_items;          // Item ids ordered by leaf
+  std::vector<nvutils::Bbox> m_itemBoxes; // Indexed by item id
+  bool m_needsRefit = false;
+};
+
+template<typename Priority, typename Visit>
+void Bvh::traverse(Priority&& priority, Visit&& visit) const {
+  if(m_nodes.empty())
+    return;
+
+  const int MAX_STACK = 64;
+  uint32_t stack[MAX_STACK];
+  int sp = 0;
+  stack[sp++] = 0;
+
+  while(sp > 0){
+    const Node& n = m_nodes[stack[--sp]];
+    if(priority(n.bMin, n.bMax) < 0.0f)
+      continue;
+
+    if(n.count > 0){
+      for(uint32_t i = 0; i < n.count; i++)
+        visit(m_items[n.first + i]);
+      continue;
+    }
+
+    const Node& l = m_nodes[n.first];
+    const Node& r = m_nodes[n.first + 1];
+    float pl = priority(l.bMin, l.bMax);
+    float pr = priority(r.bMin, r.bMax);
+
+    // Push the farthest child first so the nearest one is visited first
+    uint32_t near = n.first, far = n.first + 1;
+    if(pr < pl || pl < 0.0f){
+      std::swap(near, far);
+      std::swap(pl, pr);
+    }
+    if(pr >= 0.0f && sp < MAX_STACK)
+      stack[sp++] = far;
+    if(pl >= 0.0f && sp < MAX_STACK)
+      stack[sp++] = near;
+  }
+}
@@ -0,0 +1,30 @@
+#include "clipmap_centers.hpp"
+
+#include <glm/common.hpp>
+
+ClipmapCenters::ClipmapCenters(glm::ivec3 cameraId0){
+  for(int level = 0; level < CLIPMAP_LEVELS; level++)
+    m_centers[level] = cameraId0 >> level;
+}
+
+bool ClipmapCenters::follow(glm::ivec3 cameraId0, int hysteresis){
+  hysteresis = glm::clamp(hysteresis, 0, MAX_HYSTERESIS);
+  bool moved = false;
+  for(int level = 0; level < CLIPMAP_LEVELS; level++){
+    const glm::ivec3 camId = cameraId0 >> level;
+    const glm::ivec3 offset = glm::abs(camId - m_centers[level]);
+    if(glm::max(offset.x, glm::max(offset.y, offset.z)) > hysteresis){
+      m_centers[level] = camId;
+      moved = true;
+    }
+  }
+  return moved;
+}
+
+bool ClipmapCenters::insideHole(glm::ivec3 brickId, int level) const {
+  if(level == 0)
+    return false;
+  const glm::ivec3 center = holeCenter(level);
+  return glm::all(glm::greaterThanEqual(brickId, center - NUM_BRICKS_PER_AXIS/4 + 1)) &&
+         glm::all(glm::lessThan(brickId, center + NUM_BRICKS_PER_AXIS/4));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+
+#include "../shaders/shaderio.h"
+
+// Window center of every clipmap level, in brick ids of the level. A window
+// spans NUM_BRICKS_PER_AXIS bricks around its center. The hole of a level > 0
+// is the part of its window the window of the level below covers completely,
+// [holeCenter - NUM_BRICKS_PER_AXIS/4 + 1, holeCenter + NUM_BRICKS_PER_AXIS/4).
+//
+// A level only recenters on the camera once the camera is more than the
+// hysteresis bricks of the level away from its center, so a camera jittering
+// around a brick boundary does not rebuild the shells of every level.
+class ClipmapCenters {
+public:
+  // Most bricks a level may lag behind the camera. A hole center is at most
+  // 3/2 of it plus one bricks from its window center, every hole stays inside
+  // its window.
+  static constexpr int MAX_HYSTERESIS = NUM_BRICKS_PER_AXIS/8;
+
+  // Every level centered on the camera cell
+  explicit ClipmapCenters(glm::ivec3 cameraId0 = glm::ivec3(0));
+
+  // Recenters the levels more than hysteresis bricks of the level away from
+  // cameraId0, clamped to MAX_HYSTERESIS. 0 keeps every level centered on the
+  // camera. True when a level moved.
+  bool follow(glm::ivec3 cameraId0, int hysteresis);
+
+  glm::ivec3 operator[](int level) const { return m_centers[level]; }
+  // Moves a level as is, for centers read back from a baked clipmap
+  void setCenter(int level, glm::ivec3 center) { m_centers[level] = center; }
+  // Center of the hole of a level > 0, the center of the level below
+  glm::ivec3 holeCenter(int level) const { return m_centers[level - 1] >> 1; }
+
+  // Id of a brick of level inside its window, in [0, NUM_BRICKS_PER_AXIS) for
+  // the bricks of the window
+  glm::ivec3 relId(glm::ivec3 brickId, int level) const { return brickId - m_centers[level] + NUM_BRICKS_PER_AXIS/2; }
+  bool insideHole(glm::ivec3 brickId, int level) const;
+
+  bool operator==(const ClipmapCenters& o) const { return m_centers == o.m_centers; }
+  bool operator!=(const ClipmapCenters& o) const { return !(*this == o); }
+
+private:
+  std::array<glm::ivec3, CLIPMAP_LEVELS> m_centers;
+};
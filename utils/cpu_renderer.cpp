@@ -0,0 +1,394 @@
+#include "cpu_renderer.hpp"
+
+#include "scene.hpp"
+#include "sdf_tape.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <glm/common.hpp>
+#include <glm/exponential.hpp>
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+#include <nvutils/logger.hpp>
+
+static const float INV_PI = 0.31830988618f;
+
+// Initial distance of the material map in the shaders
+static const float iniDMat = 1e5f;
+
+//---------------------------------------
+// Lighting, ported from lighting.slang
+//---------------------------------------
+
+// Fresnel-Schlick aproximation to reflectance
+static glm::vec3 reflectance(float cos_theta, glm::vec3 F0) {
+  return F0 + (1.0f - F0) * glm::pow(1.0f - cos_theta, 5.0f);
+}
+
+// Normal distribution function. GGX
+static float ggx_distribution(float NoH, float alpha2){
+  float b = NoH * NoH * (alpha2 - 1.0f) + 1.0f;
+  return alpha2 * INV_PI / (b * b);
+}
+
+static float G_Smith_Fast(float NoV, float NoL, float alpha) {
+  float k = alpha * 0.5f;
+  float one_k = 1.0f - k;
+  float g1_v = glm::max(NoV,1e-5f) / (NoV * one_k + k);
+  float g1_l = glm::max(NoL,1e-5f) / (NoL * one_k + k);
+  return g1_v * g1_l;
+}
+
+static glm::vec3 applyFog(glm::vec3 col, float t, glm::vec3 rd, const shaderio::LightinParams& lp){
+  float fogAmount = 1.0f - glm::exp(-t*lp.fogDensity);
+  float sunAmount = glm::max(glm::dot(rd, lp.lightDir), 0.0f);
+  glm::vec3 fogColor = glm::mix(lp.fogColor, lp.lightColor, glm::pow(sunAmount,8.0f));
+  return glm::mix(col, fogColor, fogAmount);
+}
+
+//---------------------------------------
+// Materials, ported from materials.slang
+//---------------------------------------
+
+static shaderio::Material lerpMaterial(shaderio::Material matA, shaderio::Material matB, float b){
+  matB.albedo_shininess = glm::mix(matA.albedo_shininess,matB.albedo_shininess,b);
+  matB.alpha_metalness = glm::mix(matA.alpha_metalness,matB.alpha_metalness,b);
+  matB.type = glm::min(matA.type,matB.type);
+  return matB;
+}
+
+// The shader breaks the bands up with the noise texture, here it is left at
+// its mean so the result doesn't depend on the GPU texture
+static glm::vec3 getTerrainColor(glm::vec3 p, float slope) {
+  const glm::vec3 grass1 = glm::vec3(0.15, 0.3, 0.1);
+  const glm::vec3 grass2 = glm::vec3(0.4, 0.5, 0.2);
+  const glm::vec3 snow   = glm::vec3(1.0, 1.0, 1.0);
+  const glm::vec3 rock   = glm::vec3(0.22, 0.2, 0.2);
+  const glm::vec3 sand   = glm::vec3(0.8, 0.7, 0.6);
+  const glm::vec3 water  = glm::vec3(0.122, 0.451, 0.788);
+
+  float height = p.y;
+  const float breakup01 = 0.5f;
+  const float breakup11 = breakup01*2.0f-1.0f;
+  const float breakupbig = 0.5f;
+
+  glm::vec3 grassColor = glm::mix(grass1, grass2, glm::smoothstep(0.2f, 0.8f, breakup01+height/3.0f));
+  const float snow_height_offset = 0.0f;
+  const float snow_diff = 10.0f;
+  float snow_percent = glm::smoothstep(snow_height_offset+breakupbig*snow_diff, snow_diff+snow_height_offset, height);
+  glm::vec3 grass_snow = glm::mix(grassColor, snow, snow_percent);
+  glm::vec3 water_color = water*glm::mix(0.5f,1.0f,breakupbig);
+  glm::vec3 grass_snow_rock = glm::mix(grass_snow, rock, glm::smoothstep(0.3f, 0.4f, slope+breakup11/10.0f));
+  glm::vec3 color = glm::mix(water_color, sand, glm::smoothstep(0.0f, 0.15f, height+breakup11/8.0f));
+  color = glm::mix(color, grass_snow_rock, glm::smoothstep(0.15f, 0.2f, height+breakup11/7.0f));
+  return color;
+}
+
+// Same as nearBbox() in bbox.slang
+static bool nearBbox(glm::vec3 p, const nvutils::Bbox& bbox, float nearRange){
+  return glm::all(glm::greaterThanEqual(p, bbox.min() - nearRange)) && glm::all(glm::lessThanEqual(p, bbox.max() + nearRange));
+}
+
+//---------------------------------------
+// Renderer
+//---------------------------------------
+
+CpuRenderer::Images CpuRenderer::render(Scene& scene, const Camera& camera, const Settings& settings){
+  auto start = std::chrono::steady_clock::now();
+
+  m_camera = camera;
+  m_settings = settings;
+  m_settings.tileSize = glm::max(m_settings.tileSize, 1u);
+  m_viewInv = glm::inverse(camera.view);
+  m_projInv = glm::inverse(camera.proj);
+  m_eye = glm::vec3(m_viewInv[3]);
+
+  // Everything the workers read is gathered here, the scene isn't touched
+  // again until they are done
+  const SdfTape& tape = scene.getTape(true);
+  m_objects = scene.getObjects();
+  m_materials = scene.getMaterials();
+
+  Images out;
+  out.width = m_settings.width;
+  out.height = m_settings.height;
+  size_t numPixels = size_t(out.width) * out.height;
+  out.depth.resize(numPixels);
+  out.normal.resize(numPixels);
+  out.albedo.resize(numPixels);
+  out.color.resize(numPixels);
+
+  const uint32_t ts = m_settings.tileSize;
+  const uint32_t tilesX = (out.width + ts - 1) / ts;
+  const uint32_t tilesY = (out.height + ts - 1) / ts;
+  const uint32_t numTiles = tilesX * tilesY;
+
+  uint32_t numThreads = m_settings.numThreads;
+  if(numThreads == 0)
+    numThreads = glm::max(std::thread::hardware_concurrency(), 1u);
+  numThreads = glm::min(numThreads, glm::max(numTiles, 1u));
+
+  // Work queue, every worker pulls the next tile until none are left
+  std::atomic<uint32_t> nextTile{0};
+  std::vector<uint64_t> mapCalls(numThreads, 0);
+  auto worker = [&](uint32_t t){
+    for(uint32_t tile = nextTile++; tile < numTiles; tile = nextTile++)
+      renderTile(tape, tile, out, mapCalls[t]);
+  };
+
+  std::vector<std::thread> threads;
+  for(uint32_t t = 1; t < numThreads; t++)
+    threads.emplace_back(worker, t);
+  worker(0);
+  for(auto& th : threads)
+    th.join();
+
+  out.stats.numThreads = numThreads;
+  out.stats.numTiles = numTiles;
+  out.stats.renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  out.stats.mapCalls = 0;
+  for(uint64_t c : mapCalls)
+    out.stats.mapCalls += c;
+
+  return out;
+}
+
+void CpuRenderer::renderTile(const SdfTape& tape, uint32_t tile, Images& out, uint64_t& mapCalls) const {
+  const uint32_t ts = m_settings.tileSize;
+  const uint32_t tilesX = (out.width + ts - 1) / ts;
+  const uint32_t x0 = (tile % tilesX) * ts;
+  const uint32_t y0 = (tile / tilesX) * ts;
+  const uint32_t x1 = glm::min(x0 + ts, out.width);
+  const uint32_t y1 = glm::min(y0 + ts, out.height);
+  const shaderio::LightinParams& lp = m_settings.lp;
+
+  for(uint32_t y = y0; y < y1; y++){
+    for(uint32_t x = x0; x < x1; x++){
+      size_t idx = size_t(y) * out.width + x;
+
+      // Same ray as get_ray in transforms.slang
+      glm::vec2 uv = glm::vec2(x, y) / glm::vec2(out.width, out.height);
+      glm::vec2 ndc = uv * 2.0f - 1.0f;
+      glm::vec4 view = m_projInv * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+      glm::vec3 dir = glm::normalize(glm::vec3(m_viewInv * glm::vec4(glm::normalize(glm::vec3(view)), 0.0f)));
+
+      Hit hit = trace(tape, m_eye, dir);
+      mapCalls += hit.steps;
+
+      if(hit.depth < 0.0f){
+        out.depth[idx] = -1.0f;
+        out.normal[idx] = glm::vec3(0.0f);
+        out.albedo[idx] = glm::vec3(0.0f);
+        out.color[idx] = shadeMiss(dir);
+        continue;
+      }
+
+      glm::vec3 p = m_eye + dir * hit.depth;
+      glm::vec3 grad;
+      tape.evalWithGradient(p, grad);
+      mapCalls++;
+      glm::vec3 n = grad == glm::vec3(0.0f) ? grad : glm::normalize(grad);
+
+      // Hits are on the exact surface, the finest voxel covers the tolerance
+      shaderio::Material mat = evalMaterial(tape, p, n, shaderio::VOXEL_SIZES[0]);
+
+      // Same shadow ray as compute_tracing.slang
+      float shadow = 1.0f;
+      if(lp.shadowSamples > 0){
+        shadow = glm::dot(n, lp.lightDir) > -0.3f ? traceShadow(tape, p + n * 0.03f, mapCalls) : 0.0f;
+      }
+
+      out.depth[idx] = hit.depth;
+      out.normal[idx] = n;
+      out.albedo[idx] = glm::vec3(mat.albedo_shininess);
+      out.color[idx] = shade(dir, hit.depth, n, mat, shadow);
+    }
+  }
+}
+
+// Scene::sphereTrace on the compiled tape
+CpuRenderer::Hit CpuRenderer::trace(const SdfTape& tape, glm::vec3 orig, glm::vec3 dir) const {
+  float depth = 0.0f;
+
+  for(int i = 0; i < Scene::TRACE_MAX_ITERATIONS; i++){
+    glm::vec3 p = orig + dir * depth;
+    float dist = tape.eval(p);
+
+    if(glm::abs(dist) < Scene::TRACE_MIN_DIST)
+      return {depth, uint32_t(i + 1)};  // Hit
+
+    if(depth >= Scene::TRACE_MAX_DEPTH)
+      return {-1.0f, uint32_t(i + 1)};  // No hit
+
+    depth += dist;
+  }
+
+  return {-1.0f, uint32_t(Scene::TRACE_MAX_ITERATIONS)};
+}
+
+// Soft shadow of evalShadow in evalFuncs.slang
+float CpuRenderer::traceShadow(const SdfTape& tape, glm::vec3 p, uint64_t& mapCalls) const {
+  const float k = 180.0f;
+  glm::vec3 dir = m_settings.lp.lightDir;
+  float shadow = 1.0f;
+  float depth = 0.01f;
+
+  for(int i = 0; i < Scene::TRACE_MAX_ITERATIONS; i++){
+    float dist = tape.eval(p + dir * depth);
+    mapCalls++;
+
+    if(glm::abs(dist) < Scene::TRACE_MIN_DIST)
+      return 0.0f;  // Hit
+
+    if(depth >= Scene::TRACE_MAX_DEPTH)
+      break;  // No hit
+
+    shadow = glm::min(shadow, k*dist/depth);
+    depth += dist;
+  }
+
+  return glm::clamp(shadow, 0.0f, 1.0f);
+}
+
+// Material blend of map(p, mat, nearRange) and evalMat in the shaders. Debug
+// materials keep their albedo, the debug palette is GPU only.
+shaderio::Material CpuRenderer::evalMaterial(const SdfTape& tape, glm::vec3 p, glm::vec3 n, float nearRange) const {
+  shaderio::Material mat{};
+  const std::vector<SdfTape::Segment>& segments = tape.segments();
+
+  int firstInside = -1;
+  bool severalInside = false;
+  for(size_t s = 0; s < segments.size(); s++){
+    if(!nearBbox(p, segments[s].bbox, nearRange))
+      continue;
+    if(firstInside != -1){
+      severalInside = true;
+      break;
+    }
+    firstInside = int(s);
+  }
+
+  if(firstInside != -1 && m_objects[firstInside].mat < m_materials.size())
+    mat = m_materials[m_objects[firstInside].mat];
+
+  if(severalInside){
+    float result = iniDMat;
+    for(size_t s = firstInside; s < segments.size(); s++){
+      if(!nearBbox(p, segments[s].bbox, nearRange))
+        continue;
+
+      const shaderio::SceneObject& obj = m_objects[s];
+      float next = tape.evalSegment(s, p, result);
+      if(obj.mat < m_materials.size()){
+        const shaderio::Material& objMat = m_materials[obj.mat];
+        float d = tape.evalSegment(s, p, iniDMat);
+        if(obj.combOp == 2){
+          mat = lerpMaterial(objMat, mat, d/(d+result));
+        }else if(obj.combOp != 1 && obj.combOp != 3 && d <= result){
+          mat = objMat;
+        }
+      }
+      result = next;
+    }
+  }
+
+  if(mat.type == int(shaderio::MaterialType::Terrain)){
+    float slope = 1.0f-glm::dot(n,glm::vec3(0,1,0));
+    glm::vec3 albedo = getTerrainColor(p,slope);
+    mat.albedo_shininess = glm::vec4(albedo, mat.albedo_shininess.w);
+  }
+
+  return mat;
+}
+
+glm::vec3 CpuRenderer::shade(glm::vec3 dir, float depth, glm::vec3 N, const shaderio::Material& mat, float shadow) const {
+  const shaderio::LightinParams& lp = m_settings.lp;
+  glm::vec3 albedo = glm::vec3(mat.albedo_shininess);
+  float alpha = mat.alpha_metalness.x;
+  float metalness = mat.alpha_metalness.y;
+
+  glm::vec3 V = -dir;
+  glm::vec3 L = lp.lightDir;
+  glm::vec3 H = glm::normalize(L+V);
+
+  glm::vec3 F0 = glm::mix(glm::vec3(0.04f),albedo,metalness);
+  float alpha2 = alpha*alpha;
+  float NoV = glm::dot(N, V);
+  float NoH = glm::dot(N, H);
+  float VoH = glm::dot(V, H);
+  float LoN = glm::dot(L, N);
+
+  glm::vec3 F = reflectance(VoH, F0);
+  float D = ggx_distribution(NoH,alpha2);
+  float G = G_Smith_Fast(NoV,LoN,alpha);
+
+  glm::vec3 f_specular = (F*D*G) / (4.0f * glm::max(NoV * LoN, 1e-5f));
+
+  glm::vec3 radiance = lp.lightColor * lp.lightPower;
+
+  glm::vec3 rhoD = albedo;
+  rhoD *= glm::vec3(1.0f) - F;
+  rhoD *= (1.0f - metalness);
+
+  glm::vec3 f_diffuse = rhoD * INV_PI;
+  glm::vec3 fr = f_diffuse + f_specular;
+
+  // Hemispheric ambient
+  float hemi = N.y * 0.5f + 0.5f;
+  glm::vec3 ambient = glm::mix(lp.ambientBottom, lp.ambientTop, hemi) * albedo;
+
+  // Rim lighting
+  float rim = glm::pow(1.0f - glm::clamp(glm::dot(N, V), 0.0f, 1.0f), 3.0f);
+  glm::vec3 rimLight = lp.lightColor * rim * 0.25f;
+
+  // No ambient occlusion pass, occlusion is 1
+  glm::vec3 direct = radiance * fr * glm::max(LoN,1e-5f) * shadow;
+  glm::vec3 indirect = ambient + rimLight;
+
+  return applyFog(direct + indirect, depth, dir, lp);
+}
+
+glm::vec3 CpuRenderer::shadeMiss(glm::vec3 dir) const {
+  return applyFog(glm::vec3(0.0f), 10000.0f, dir, m_settings.lp);
+}
+
+//---------------------------------------
+// Output
+//---------------------------------------
+
+// Negative scale marks little endian data, rows go bottom to top
+static bool writePfm(const std::string& path, const float* data, int channels, uint32_t width, uint32_t height){
+  FILE* f = std::fopen(path.c_str(), "wb");
+  if(!f){
+    LOGW("Could not open %s for writing\n", path.c_str());
+    return false;
+  }
+
+  std::fprintf(f, "%s\n%u %u\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+  bool ok = true;
+  for(uint32_t y = height; y-- > 0 && ok;){
+    size_t row = size_t(y) * width * channels;
+    ok = std::fwrite(data + row, sizeof(float), size_t(width) * channels, f) == size_t(width) * channels;
+  }
+  std::fclose(f);
+
+  if(!ok)
+    LOGW("Failed writing %s\n", path.c_str());
+  return ok;
+}
+
+bool CpuRenderer::savePfm(const std::string& path, const std::vector<glm::vec3>& pixels, uint32_t width, uint32_t height){
+  if(pixels.size() < size_t(width) * height)
+    return false;
+  return writePfm(path, &pixels[0].x, 3, width, height);
+}
+
+bool CpuRenderer::savePfm(const std::string& path, const std::vector<float>& pixels, uint32_t width, uint32_t height){
+  if(pixels.size() < size_t(width) * height)
+    return false;
+  return writePfm(path, pixels.data(), 1, width, height);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../shaders/shaderio.h"
+
+class Scene;
+class SdfTape;
+
+// Reference renderer that runs on the CPU only. It sphere traces the compiled
+// scene with the limits of Scene::sphereTrace and shades the hits with the
+// lighting pass of the GPU, minus the screen space effects (AO, denoise).
+// The image is split in tiles that worker threads pull from a shared counter.
+class CpuRenderer {
+public:
+  struct Camera {
+    glm::mat4 view;
+    glm::mat4 proj;
+  };
+
+  struct Settings {
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t tileSize = WORKGROUP_SIZE_2D;
+    uint32_t numThreads = 0;              // 0 uses every hardware thread
+    shaderio::LightinParams lp{};         // shadowSamples 0 disables shadows
+  };
+
+  struct Stats {
+    uint32_t numThreads;
+    uint32_t numTiles;
+    double renderMs;
+    uint64_t mapCalls;                    // SDF evaluations, shading included
+  };
+
+  struct Images {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> depth;             // Distance along the ray, -1 on miss
+    std::vector<glm::vec3> normal;        // World space, zero on miss
+    std::vector<glm::vec3> albedo;
+    std::vector<glm::vec3> color;         // Shaded linear color
+    Stats stats{};
+  };
+
+  Images render(Scene& scene, const Camera& camera, const Settings& settings);
+
+  // Portable float map, exact copy of the image for golden comparisons
+  static bool savePfm(const std::string& path, const std::vector<glm::vec3>& pixels, uint32_t width, uint32_t height);
+  static bool savePfm(const std::string& path, const std::vector<float>& pixels, uint32_t width, uint32_t height);
+
+private:
+  struct Hit {
+    float depth;
+    uint32_t steps;
+  };
+
+  Hit trace(const SdfTape& tape, glm::vec3 orig, glm::vec3 dir) const;
+  float traceShadow(const SdfTape& tape, glm::vec3 p, uint64_t& mapCalls) const;
+  shaderio::Material evalMaterial(const SdfTape& tape, glm::vec3 p, glm::vec3 n, float nearRange) const;
+  glm::vec3 shade(glm::vec3 dir, float depth, glm::vec3 n, const shaderio::Material& mat, float shadow) const;
+  glm::vec3 shadeMiss(glm::vec3 dir) const;
+
+  void renderTile(const SdfTape& tape, uint32_t tile, Images& out, uint64_t& mapCalls) const;
+
+  // Per frame state, read only while the workers run
+  Camera m_camera{};
+  Settings m_settings{};
+  glm::mat4 m_viewInv{};
+  glm::mat4 m_projInv{};
+  glm::vec3 m_eye{};
+  std::vector<shaderio::SceneObject> m_objects;
+  std::vector<shaderio::Material> m_materials;
+};
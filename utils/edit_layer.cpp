@@ -0,0 +1,475 @@
+#include "edit_layer.hpp"
+
+#include "sample_quantize.hpp"
+#include "sdf_tape.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glm/common.hpp>
+#include <nvutils/logger.hpp>
+
+static_assert(EDIT_BRICK_SIZE == SDF_BATCH_WIDTH, "One brick row per batch");
+static_assert((shaderio::NUM_EDIT_SLOTS & (shaderio::NUM_EDIT_SLOTS - 1)) == 0, "Slots are masked");
+
+static const int CELLS = EDIT_BRICK_SIZE - 1;   // Voxels per brick axis
+static const float TO_DISTANCE = shaderio::EDIT_CLAMP / float(SATURATED);
+
+// Bricks an interval query visits before it falls back to the layer range
+static const int MAX_INTERVAL_BRICKS = 64;
+
+static glm::ivec3 brickId(glm::vec3 p){
+  return glm::ivec3(glm::floor(glm::floor(p / shaderio::EDIT_VOXEL_SIZE) / float(CELLS)));
+}
+
+static nvutils::Bbox brickBox(glm::ivec3 id){
+  return {glm::vec3(id * CELLS) * shaderio::EDIT_VOXEL_SIZE, glm::vec3(id * CELLS + CELLS) * shaderio::EDIT_VOXEL_SIZE};
+}
+
+// Same hash as editSlot() in sdf.slang
+static uint32_t slotHash(glm::ivec3 id){
+  uint32_t h = uint32_t(id.x) * 73856093u ^ uint32_t(id.y) * 19349663u ^ uint32_t(id.z) * 83492791u;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  return h & uint32_t(shaderio::NUM_EDIT_SLOTS - 1);
+}
+
+void EditLayer::clear(){
+  if(m_bricks.empty())
+    return;
+  m_bricks.clear();
+  m_index.clear();
+  m_values.clear();
+  m_freePayloads.clear();
+  m_bounds = {};
+  std::fill_n(m_range, 4, SATURATED);
+  m_version++;
+}
+
+uint64_t EditLayer::hash() const {
+  uint64_t h = 0xcbf29ce484222325ull;
+  auto hashBytes = [&](const void* data, size_t size){
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; i++){
+      h ^= bytes[i];
+      h *= 0x100000001b3ull;
+    }
+  };
+  for(const Brick& b : m_bricks){
+    hashBytes(&b.id, sizeof(b.id));
+    hashBytes(&b.payload, sizeof(b.payload));
+    if(b.payload >= 0)
+      hashBytes(payloadValues(b.payload), 2 * BRICK_VALUES);
+  }
+  return h;
+}
+
+nvutils::Bbox EditLayer::carve(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene){
+  return edit(shape, bbox, scene, false);
+}
+
+nvutils::Bbox EditLayer::fill(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene){
+  return edit(shape, bbox, scene, true);
+}
+
+nvutils::Bbox EditLayer::edit(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene, bool fill){
+  nvutils::Bbox changed;
+  if(bbox.isEmpty())
+    return changed;
+
+  // Values saturate EDIT_CLAMP away from the surface. Carving air or filling
+  // solid changes nothing, those bricks are found before any is written.
+  const glm::ivec3 b0 = brickId(bbox.min() - shaderio::EDIT_CLAMP);
+  const glm::ivec3 b1 = brickId(bbox.max() + shaderio::EDIT_CLAMP);
+  std::vector<glm::ivec3> ids;
+  for(int z = b0.z; z <= b1.z; z++)
+    for(int y = b0.y; y <= b1.y; y++)
+      for(int x = b0.x; x <= b1.x; x++){
+        const nvutils::Bbox box = brickBox(glm::ivec3(x, y, z));
+        Interval d = scene.evalInterval({box.min(), box.max()});
+        const float pad = roundingPad(d);
+        if(fill ? d.hi + pad >= -shaderio::EDIT_CLAMP : d.lo - pad <= shaderio::EDIT_CLAMP)
+          ids.emplace_back(x, y, z);
+      }
+
+  const size_t numBricks = m_bricks.size();
+  bool full = false;
+  for(glm::ivec3 id : ids){
+    if(editBrick(shape, id, fill, full))
+      changed.insert(brickBox(id));
+  }
+
+  if(full)
+    LOGW("Edit layer is full (%d bricks), part of the edit was dropped\n", MAX_EDIT_BRICKS);
+  if(changed.isEmpty())
+    return changed;
+
+  // Removed bricks can shrink the bounds
+  if(m_bricks.size() < numBricks){
+    m_bounds = {};
+    for(const Brick& b : m_bricks)
+      m_bounds.insert(brickBox(b.id));
+  }else{
+    m_bounds.insert(changed);
+  }
+  updateRanges();
+  m_version++;
+  return changed;
+}
+
+// Applies the edit to one brick, true if its values changed
+bool EditLayer::editBrick(const SdfTape& shape, glm::ivec3 id, bool fill, bool& full){
+  const nvutils::Bbox box = brickBox(id);
+  Interval range = shape.evalInterval({box.min(), box.max()});
+  const float pad = roundingPad(range);
+
+  // The shape saturates over the whole brick, nothing to write
+  if(range.lo - pad >= shaderio::EDIT_CLAMP)
+    return false;
+
+  auto it = m_index.find(id);
+  const int32_t uniform = fill ? shaderio::EDIT_UNIFORM_FILLED : shaderio::EDIT_UNIFORM_CARVED;
+
+  // Wholly inside the shape, whatever was there is replaced
+  if(range.hi + pad <= -shaderio::EDIT_CLAMP){
+    if(it != m_index.end()){
+      Brick& b = m_bricks[it->second];
+      if(b.payload == uniform)
+        return false;
+      setPayload(b, uniform);
+      return true;
+    }
+    if(m_bricks.size() >= size_t(MAX_EDIT_BRICKS)){
+      full = true;
+      return false;
+    }
+    m_index[id] = uint32_t(m_bricks.size());
+    m_bricks.push_back({id, uniform, {}});
+    return true;
+  }
+
+  alignas(32) int8_t shapeValues[BRICK_VALUES];
+  PointBatch point;
+  alignas(32) float dist[SDF_BATCH_WIDTH];
+  const glm::ivec3 v0 = id * CELLS;
+  bool reaches = false;
+  for(int x = 0; x < EDIT_BRICK_SIZE; x++)
+    point.x[x] = float(v0.x + x) * shaderio::EDIT_VOXEL_SIZE;
+  for(int z = 0; z < EDIT_BRICK_SIZE; z++){
+    for(int y = 0; y < EDIT_BRICK_SIZE; y++){
+      for(int x = 0; x < EDIT_BRICK_SIZE; x++){
+        point.y[x] = float(v0.y + y) * shaderio::EDIT_VOXEL_SIZE;
+        point.z[x] = float(v0.z + z) * shaderio::EDIT_VOXEL_SIZE;
+      }
+      shape.evalBatch(point, dist);
+      int8_t* row = shapeValues + (z * EDIT_BRICK_SIZE + y) * EDIT_BRICK_SIZE;
+      for(int x = 0; x < EDIT_BRICK_SIZE; x++){
+        row[x] = quantize(dist[x], shaderio::EDIT_CLAMP);
+        reaches |= row[x] < SATURATED;
+      }
+    }
+  }
+  if(!reaches)
+    return false;
+
+  if(it == m_index.end()){
+    if(m_bricks.size() >= size_t(MAX_EDIT_BRICKS)){
+      full = true;
+      return false;
+    }
+    it = m_index.emplace(id, uint32_t(m_bricks.size())).first;
+    m_bricks.push_back({id, allocPayload(), {}});
+    std::fill_n(payloadValues(m_bricks.back().payload), 2 * BRICK_VALUES, SATURATED);
+  }else if(m_bricks[it->second].payload < 0){
+    // Uniform bricks get their values back before a partial edit
+    Brick& b = m_bricks[it->second];
+    const int8_t carved = b.payload == shaderio::EDIT_UNIFORM_CARVED ? -SATURATED : SATURATED;
+    const int32_t payload = allocPayload();
+    int8_t* values = payloadValues(payload);
+    for(int i = 0; i < BRICK_VALUES; i++){
+      values[2 * i] = carved;
+      values[2 * i + 1] = -carved;
+    }
+    b.payload = payload;
+  }
+
+  // Carving takes the shape out of the filled solid, filling out of the carved one
+  Brick& b = m_bricks[it->second];
+  int8_t* values = payloadValues(b.payload);
+  const int add = fill ? 1 : 0;
+  bool modified = false;
+  bool allCarved = true, allFilled = true, allDefault = true;
+  for(int i = 0; i < BRICK_VALUES; i++){
+    int8_t& grown = values[2 * i + add];
+    int8_t& shrunk = values[2 * i + 1 - add];
+    const int8_t newGrown = std::min(grown, shapeValues[i]);
+    const int8_t newShrunk = std::max(shrunk, int8_t(-shapeValues[i]));
+    modified |= newGrown != grown || newShrunk != shrunk;
+    grown = newGrown;
+    shrunk = newShrunk;
+
+    const int8_t carved = values[2 * i], filled = values[2 * i + 1];
+    allCarved &= carved == -SATURATED && filled == SATURATED;
+    allFilled &= carved == SATURATED && filled == -SATURATED;
+    allDefault &= carved == SATURATED && filled == SATURATED;
+  }
+
+  if(allDefault)
+    removeBrick(it->second);
+  else if(allCarved)
+    setPayload(b, shaderio::EDIT_UNIFORM_CARVED);
+  else if(allFilled)
+    setPayload(b, shaderio::EDIT_UNIFORM_FILLED);
+  return modified;
+}
+
+int32_t EditLayer::allocPayload(){
+  if(!m_freePayloads.empty()){
+    int32_t payload = m_freePayloads.back();
+    m_freePayloads.pop_back();
+    return payload;
+  }
+  const int32_t payload = int32_t(m_values.size() / (2 * BRICK_VALUES));
+  m_values.resize(m_values.size() + 2 * BRICK_VALUES);
+  return payload;
+}
+
+void EditLayer::setPayload(Brick& b, int32_t payload){
+  if(b.payload >= 0)
+    m_freePayloads.push_back(b.payload);
+  b.payload = payload;
+}
+
+void EditLayer::removeBrick(uint32_t idx){
+  setPayload(m_bricks[idx], shaderio::EDIT_EMPTY_SLOT);
+  m_index.erase(m_bricks[idx].id);
+  if(idx + 1 != m_bricks.size()){
+    m_bricks[idx] = m_bricks.back();
+    m_index[m_bricks[idx].id] = idx;
+  }
+  m_bricks.pop_back();
+}
+
+void EditLayer::updateRanges(){
+  m_range[0] = m_range[2] = SATURATED;
+  m_range[1] = m_range[3] = -SATURATED;
+  for(Brick& b : m_bricks){
+    if(b.payload == shaderio::EDIT_UNIFORM_CARVED){
+      b.range[0] = b.range[1] = -SATURATED;
+      b.range[2] = b.range[3] = SATURATED;
+    }else if(b.payload == shaderio::EDIT_UNIFORM_FILLED){
+      b.range[0] = b.range[1] = SATURATED;
+      b.range[2] = b.range[3] = -SATURATED;
+    }else{
+      const int8_t* values = payloadValues(b.payload);
+      b.range[0] = b.range[2] = SATURATED;
+      b.range[1] = b.range[3] = -SATURATED;
+      for(int i = 0; i < BRICK_VALUES; i++){
+        for(int c = 0; c < 2; c++){
+          b.range[2 * c] = std::min(b.range[2 * c], values[2 * i + c]);
+          b.range[2 * c + 1] = std::max(b.range[2 * c + 1], values[2 * i + c]);
+        }
+      }
+    }
+    for(int c = 0; c < 2; c++){
+      m_range[2 * c] = std::min(m_range[2 * c], b.range[2 * c]);
+      m_range[2 * c + 1] = std::max(m_range[2 * c + 1], b.range[2 * c + 1]);
+    }
+  }
+}
+
+//---------------------------------------
+// Evaluation
+//---------------------------------------
+
+const EditLayer::Brick* EditLayer::findBrick(glm::vec3 p, glm::vec3& local) const {
+  const glm::vec3 bMin = m_bounds.min(), bMax = m_bounds.max();
+  if(m_bricks.empty() || p.x < bMin.x || p.y < bMin.y || p.z < bMin.z || p.x > bMax.x || p.y > bMax.y || p.z > bMax.z)
+    return nullptr;
+
+  const glm::ivec3 id = brickId(p);
+  auto it = m_index.find(id);
+  if(it == m_index.end())
+    return nullptr;
+  local = p / shaderio::EDIT_VOXEL_SIZE - glm::vec3(id * CELLS);
+  return &m_bricks[it->second];
+}
+
+// Carved and filled values at local, in [-SATURATED, SATURATED], with their
+// gradients along local when asked
+glm::vec2 EditLayer::channels(const Brick& b, glm::vec3 local, glm::vec3* gradCarved, glm::vec3* gradFilled) const {
+  if(b.payload < 0){
+    if(gradCarved)
+      *gradCarved = *gradFilled = glm::vec3(0.0f);
+    const float carved = b.payload == shaderio::EDIT_UNIFORM_CARVED ? -SATURATED : SATURATED;
+    return glm::vec2(carved, -carved);
+  }
+
+  const glm::ivec3 c = glm::clamp(glm::ivec3(local), glm::ivec3(0), glm::ivec3(CELLS - 1));
+  const glm::vec3 f = glm::clamp(local - glm::vec3(c), glm::vec3(0.0f), glm::vec3(1.0f));
+  const int8_t* values = payloadValues(b.payload);
+  glm::vec2 result;
+  for(int ch = 0; ch < 2; ch++){
+    float v[8];
+    for(int i = 0; i < 8; i++){
+      const glm::ivec3 s = c + glm::ivec3(i & 1, (i >> 1) & 1, i >> 2);
+      v[i] = float(values[2 * ((s.z * EDIT_BRICK_SIZE + s.y) * EDIT_BRICK_SIZE + s.x) + ch]);
+    }
+    const float x00 = lerpExact(v[0], v[1], f.x), x10 = lerpExact(v[2], v[3], f.x);
+    const float x01 = lerpExact(v[4], v[5], f.x), x11 = lerpExact(v[6], v[7], f.x);
+    const float y0 = lerpExact(x00, x10, f.y), y1 = lerpExact(x01, x11, f.y);
+    result[ch] = lerpExact(y0, y1, f.z);
+
+    glm::vec3* grad = ch == 0 ? gradCarved : gradFilled;
+    if(grad){
+      const float dx0 = lerpExact(v[1] - v[0], v[3] - v[2], f.y), dx1 = lerpExact(v[5] - v[4], v[7] - v[6], f.y);
+      const float dy0 = lerpExact(v[2] - v[0], v[3] - v[1], f.x), dy1 = lerpExact(v[6] - v[4], v[7] - v[5], f.x);
+      *grad = glm::vec3(lerpExact(dx0, dx1, f.z), lerpExact(dy0, dy1, f.z), y1 - y0);
+    }
+  }
+  return result;
+}
+
+float EditLayer::apply(glm::vec3 p, float d) const {
+  glm::vec3 local;
+  const Brick* b = findBrick(p, local);
+  if(!b)
+    return d;
+
+  const glm::vec2 e = channels(*b, local, nullptr, nullptr);
+  if(e.x < SATURATED)
+    d = glm::max(d, -e.x * TO_DISTANCE);
+  if(e.y < SATURATED)
+    d = glm::min(d, e.y * TO_DISTANCE);
+  return d;
+}
+
+void EditLayer::applyBatch(const PointBatch& p, float* d) const {
+  if(m_bricks.empty())
+    return;
+  for(int l = 0; l < SDF_BATCH_WIDTH; l++)
+    d[l] = apply(glm::vec3(p.x[l], p.y[l], p.z[l]), d[l]);
+}
+
+Dual EditLayer::apply(glm::vec3 p, Dual d) const {
+  glm::vec3 local;
+  const Brick* b = findBrick(p, local);
+  if(!b)
+    return d;
+
+  glm::vec3 gradCarved, gradFilled;
+  const glm::vec2 e = channels(*b, local, &gradCarved, &gradFilled);
+  // Channel gradients are per voxel and in quantized units
+  const float scale = TO_DISTANCE / shaderio::EDIT_VOXEL_SIZE;
+  if(e.x < SATURATED && -e.x * TO_DISTANCE > d.v)
+    d = {-e.x * TO_DISTANCE, -gradCarved * scale};
+  if(e.y < SATURATED && e.y * TO_DISTANCE < d.v)
+    d = {e.y * TO_DISTANCE, gradFilled * scale};
+  return d;
+}
+
+Interval EditLayer::apply(const IntervalBox& p, Interval d) const {
+  const glm::vec3 bMin = m_bounds.min(), bMax = m_bounds.max();
+  if(m_bricks.empty() || glm::any(glm::lessThan(p.hi, bMin)) || glm::any(glm::greaterThan(p.lo, bMax)))
+    return d;
+
+  // Range of the channels over the box, saturated ones included where no
+  // brick covers part of it
+  const glm::ivec3 b0 = brickId(p.lo), b1 = brickId(p.hi);
+  const glm::ivec3 count = b1 - b0 + 1;
+  int8_t range[4];
+  if(count.x * count.y * count.z > MAX_INTERVAL_BRICKS){
+    std::copy_n(m_range, 4, range);
+    range[1] = range[3] = SATURATED;
+  }else{
+    range[0] = range[2] = SATURATED;
+    range[1] = range[3] = -SATURATED;
+    for(int z = b0.z; z <= b1.z; z++)
+      for(int y = b0.y; y <= b1.y; y++)
+        for(int x = b0.x; x <= b1.x; x++){
+          auto it = m_index.find(glm::ivec3(x, y, z));
+          const int8_t* r = it == m_index.end() ? nullptr : m_bricks[it->second].range;
+          for(int c = 0; c < 2; c++){
+            range[2 * c] = std::min(range[2 * c], r ? r[2 * c] : SATURATED);
+            range[2 * c + 1] = std::max(range[2 * c + 1], r ? r[2 * c + 1] : SATURATED);
+          }
+        }
+  }
+
+  // A channel that may be saturated may also leave d untouched
+  Interval r = d;
+  if(range[0] < SATURATED){
+    Interval m = {glm::max(r.lo, -range[1] * TO_DISTANCE), glm::max(r.hi, -range[0] * TO_DISTANCE)};
+    r = range[1] >= SATURATED ? Interval{glm::min(r.lo, m.lo), glm::max(r.hi, m.hi)} : m;
+  }
+  if(range[2] < SATURATED){
+    Interval m = {glm::min(r.lo, range[2] * TO_DISTANCE), glm::min(r.hi, range[3] * TO_DISTANCE)};
+    r = range[3] >= SATURATED ? Interval{glm::min(r.lo, m.lo), glm::max(r.hi, m.hi)} : m;
+  }
+  return r;
+}
+
+//---------------------------------------
+// GPU copy and serialization
+//---------------------------------------
+
+void EditLayer::gpuSlots(std::vector<glm::ivec4>& slots) const {
+  slots.assign(size_t(shaderio::NUM_EDIT_SLOTS), glm::ivec4(0, 0, 0, shaderio::EDIT_EMPTY_SLOT));
+  for(const Brick& b : m_bricks){
+    uint32_t slot = slotHash(b.id);
+    while(slots[slot].w != shaderio::EDIT_EMPTY_SLOT)
+      slot = (slot + 1) & uint32_t(shaderio::NUM_EDIT_SLOTS - 1);
+    slots[slot] = glm::ivec4(b.id, b.payload);
+  }
+}
+
+std::span<const uint32_t> EditLayer::gpuValues() const {
+  static_assert(2 * BRICK_VALUES == shaderio::EDIT_BRICK_WORDS * sizeof(uint32_t), "Payload words");
+  return {reinterpret_cast<const uint32_t*>(m_values.data()), m_values.size() / sizeof(uint32_t)};
+}
+
+EditLayer::Snapshot EditLayer::snapshot() const {
+  Snapshot s;
+  s.bricks.reserve(m_bricks.size() * 4);
+  for(const Brick& b : m_bricks){
+    s.bricks.insert(s.bricks.end(), {b.id.x, b.id.y, b.id.z, b.payload});
+  }
+  s.values = m_values;
+  return s;
+}
+
+bool EditLayer::restore(const Snapshot& s){
+  clear();
+  m_version++;
+
+  const size_t numBricks = s.bricks.size() / 4;
+  const int32_t numPayloads = int32_t(s.values.size() / (2 * BRICK_VALUES));
+  bool valid = s.bricks.size() % 4 == 0 && s.values.size() % (2 * BRICK_VALUES) == 0 && numBricks <= size_t(MAX_EDIT_BRICKS);
+  std::vector<bool> used(size_t(numPayloads), false);
+  for(size_t i = 0; valid && i < numBricks; i++){
+    const glm::ivec3 id(s.bricks[4 * i], s.bricks[4 * i + 1], s.bricks[4 * i + 2]);
+    const int32_t payload = s.bricks[4 * i + 3];
+    valid = payload == shaderio::EDIT_UNIFORM_CARVED || payload == shaderio::EDIT_UNIFORM_FILLED
+         || (payload >= 0 && payload < numPayloads && !used[payload]);
+    valid = valid && m_index.emplace(id, uint32_t(m_bricks.size())).second;
+    if(!valid)
+      break;
+    if(payload >= 0)
+      used[payload] = true;
+    m_bricks.push_back({id, payload, {}});
+    m_bounds.insert(brickBox(id));
+  }
+  if(!valid){
+    clear();
+    return false;
+  }
+
+  m_values = s.values;
+  for(int32_t p = numPayloads - 1; p >= 0; p--){
+    if(!used[p])
+      m_freePayloads.push_back(p);
+  }
+  updateRanges();
+  return true;
+}
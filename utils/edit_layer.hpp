@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "nvutils/bounding_box.hpp"
+#include "../shaders/shaderio.h"
+#include "sdf_batch.hpp"
+#include "sdf_dual.hpp"
+#include "sdf_interval.hpp"
+
+class SdfTape;
+
+// Carves and fills made on the scene, kept apart from the nodes so evaluating
+// them costs the same however many were made. Two distance channels, carved
+// and filled solid, are sampled every EDIT_VOXEL_SIZE and quantized to int8 in
+// sparse bricks of EDIT_BRICK_SIZE³ values. Neighbouring bricks share their
+// border values so a point reads a single brick, bricks wholly inside an edit
+// store no values. The scene distance d becomes min(max(d, -carved), filled),
+// saturated channels and points outside every brick leave it untouched.
+class EditLayer {
+public:
+  // Bricks as saved with the scene: x, y, z and payload (or EDIT_UNIFORM_*)
+  // of every brick, then the values of every payload
+  struct Snapshot {
+    std::vector<int32_t> bricks;
+    std::vector<int8_t> values;
+  };
+
+  void clear();
+  bool empty() const { return m_bricks.empty(); }
+  size_t numBricks() const { return m_bricks.size(); }
+
+  // World box of every brick, empty without edits
+  const nvutils::Bbox& bounds() const { return m_bounds; }
+  // Changes with every edit, tells when the GPU copy is stale
+  uint32_t version() const { return m_version; }
+  // Hash of the bricks and their values
+  uint64_t hash() const;
+
+  // Removes (carve) or adds (fill) the solid of shape, a tape of a single
+  // node whose surface lies inside bbox. Bricks where scene, the tape this
+  // layer is applied to, has nothing to remove or add are left alone. Returns
+  // the box of the bricks that changed, empty if none did.
+  nvutils::Bbox carve(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene);
+  nvutils::Bbox fill(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene);
+
+  // Scene distance d at p with the edits applied
+  float apply(glm::vec3 p, float d) const;
+  void applyBatch(const PointBatch& p, float* d) const;
+  Dual apply(glm::vec3 p, Dual d) const;
+  // Contains apply() for every point of the box and every value of d
+  Interval apply(const IntervalBox& p, Interval d) const;
+
+  // GPU copy: open addressing table of NUM_EDIT_SLOTS {id, payload} slots,
+  // and EDIT_BRICK_WORDS words of values per payload
+  void gpuSlots(std::vector<glm::ivec4>& slots) const;
+  std::span<const uint32_t> gpuValues() const;
+
+  Snapshot snapshot() const;
+  // False, and the layer left empty, if the snapshot is inconsistent
+  bool restore(const Snapshot& snapshot);
+
+private:
+  struct Brick {
+    glm::ivec3 id;
+    int32_t payload;      // First value in m_values / 2 / BRICK_VALUES, or EDIT_UNIFORM_*
+    int8_t range[4];      // Carved min, max, filled min, max of the values
+  };
+
+  struct IdHash {
+    size_t operator()(const glm::ivec3& id) const {
+      uint64_t h = uint64_t(uint32_t(id.x)) * 73856093u
+                 ^ uint64_t(uint32_t(id.y)) * 19349663u
+                 ^ uint64_t(uint32_t(id.z)) * 83492791u;
+      return size_t(h);
+    }
+  };
+
+  nvutils::Bbox edit(const SdfTape& shape, const nvutils::Bbox& bbox, const SdfTape& scene, bool fill);
+  bool editBrick(const SdfTape& shape, glm::ivec3 id, bool fill, bool& full);
+  glm::vec2 channels(const Brick& b, glm::vec3 local, glm::vec3* gradCarved, glm::vec3* gradFilled) const;
+  const Brick* findBrick(glm::vec3 p, glm::vec3& local) const;
+  int8_t* payloadValues(int32_t payload) { return m_values.data() + size_t(payload) * 2 * BRICK_VALUES; }
+  const int8_t* payloadValues(int32_t payload) const { return m_values.data() + size_t(payload) * 2 * BRICK_VALUES; }
+  int32_t allocPayload();
+  void setPayload(Brick& b, int32_t payload);
+  void removeBrick(uint32_t idx);
+  void updateRanges();
+
+  static constexpr int BRICK_VALUES = EDIT_BRICK_SIZE * EDIT_BRICK_SIZE * EDIT_BRICK_SIZE;
+
+  std::vector<Brick> m_bricks;
+  std::unordered_map<glm::ivec3, uint32_t, IdHash> m_index;   // Brick id to m_bricks index
+  std::vector<int8_t> m_values;                             // Carved and filled value pairs, BRICK_VALUES pairs per payload
+  std::vector<int32_t> m_freePayloads;
+  nvutils::Bbox m_bounds;
+  int8_t m_range[4] = {127, 127, 127, 127};                 // Brick ranges of the whole layer
+  uint32_t m_version = 0;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/common.hpp>
+
+// Helpers shared by the int8 sampled grids, sampled volumes and the edit layer
+
+// Largest magnitude of a quantized sample, a sample at +-SATURATED is at least
+// the clamp distance away from the surface
+static constexpr int8_t SATURATED = 127;
+
+// d in [-clamp, clamp] to [-SATURATED, SATURATED], rounded to nearest
+inline int8_t quantize(float d, float clamp){
+  return int8_t(glm::round(glm::clamp(d / clamp, -1.0f, 1.0f) * float(SATURATED)));
+}
+
+// a + (b - a) * t, exactly a when both ends match so saturated values stay saturated
+inline float lerpExact(float a, float b, float t){
+  return a + (b - a) * t;
+}
@@ -0,0 +1,460 @@
+#include "sampled_volumes.hpp"
+
+#include "sample_quantize.hpp"
+#include "sdf.hpp"
+#include "sdf_batch.hpp"
+#include "sdf_tape.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <glm/common.hpp>
+
+static_assert(VOLUME_BRICK_SIZE == SDF_BATCH_WIDTH, "One brick row per batch");
+static_assert(SampledVolumes::BRICK_VALUES == shaderio::VOLUME_BRICK_WORDS * 4, "Payload words");
+
+static const int CELLS = VOLUME_BRICK_SIZE - 1;   // Voxels per brick axis
+
+// Bricks an interval query visits before it falls back to the volume range
+static const int MAX_INTERVAL_BRICKS = 64;
+
+static uint64_t hashBytes(uint64_t h, const void* data, size_t size){
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for(size_t i = 0; i < size; i++){
+    h ^= bytes[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+int SampledVolumes::freeSlot() const {
+  for(size_t i = 0; i < m_volumes.size(); i++){
+    if(!m_volumes[i].used)
+      return int(i);
+  }
+  return m_volumes.size() < size_t(MAX_VOLUMES) ? int(m_volumes.size()) : -1;
+}
+
+nvutils::Bbox SampledVolumes::bounds(int volume) const {
+  if(!valid(volume))
+    return {};
+  const Header& h = m_volumes[volume].header;
+  return {h.origin, h.origin + glm::vec3(h.bricks * CELLS) * h.voxelSize};
+}
+
+//---------------------------------------
+// Baking
+//---------------------------------------
+
+int SampledVolumes::bake(const SdfTape& tape, const nvutils::Bbox& box, float voxelSize, ThreadPool& pool, float& error){
+  error = 0.0f;
+  const int slot = freeSlot();
+  if(slot < 0 || box.isEmpty() || !(voxelSize > 0.0f))
+    return -1;
+
+  // The grid reaches past box by the clamp distance so its border values are
+  // saturated outside the surface
+  const float clamp = float(CELLS) * voxelSize;
+  const float brickSize = float(CELLS) * voxelSize;
+  const glm::vec3 center = box.center();
+  const glm::vec3 extent = box.extents() + 2.0f * (clamp + voxelSize);
+  const glm::ivec3 bricks = glm::max(glm::ivec3(glm::ceil(extent / brickSize)), glm::ivec3(1));
+  const uint64_t numBricks = uint64_t(bricks.x) * uint64_t(bricks.y) * uint64_t(bricks.z);
+  if(m_bricks.size() + numBricks > uint64_t(MAX_VOLUME_BRICKS))
+    return -1;
+
+  Volume v{};
+  v.header = {-glm::vec3(bricks) * brickSize * 0.5f, voxelSize, bricks, clamp};
+  const glm::vec3 gridMin = center + v.header.origin;
+
+  // Bricks beyond the clamp distance of the surface are uniform, 0 marks the
+  // ones that need values
+  std::vector<int32_t> cells(numBricks);
+  pool.parallelFor(uint32_t(bricks.y * bricks.z), [&](uint32_t row){
+    const int y = int(row) % bricks.y, z = int(row) / bricks.y;
+    for(int x = 0; x < bricks.x; x++){
+      const glm::vec3 lo = gridMin + glm::vec3(x, y, z) * brickSize;
+      Interval d = tape.evalInterval({lo, lo + brickSize});
+      const float pad = roundingPad(d);
+      int32_t& cell = cells[size_t(row) * bricks.x + x];
+      cell = d.lo - pad >= clamp ? shaderio::VOLUME_UNIFORM_POSITIVE : d.hi + pad <= -clamp ? shaderio::VOLUME_UNIFORM_NEGATIVE : 0;
+    }
+  });
+
+  std::vector<uint32_t> band;
+  for(uint32_t i = 0; i < uint32_t(numBricks); i++){
+    if(cells[i] == 0)
+      band.push_back(i);
+  }
+  if(m_values.size() / BRICK_VALUES + band.size() > size_t(MAX_VOLUME_PAYLOADS))
+    return -1;
+
+  auto brickId = [&](uint32_t cell){
+    return glm::ivec3(int(cell) % bricks.x, (int(cell) / bricks.x) % bricks.y, int(cell) / (bricks.x * bricks.y));
+  };
+
+  std::vector<int8_t> values(band.size() * BRICK_VALUES);
+  pool.parallelFor(uint32_t(band.size()), [&](uint32_t b){
+    const glm::vec3 lo = gridMin + glm::vec3(brickId(band[b])) * brickSize;
+    int8_t* out = values.data() + size_t(b) * BRICK_VALUES;
+    PointBatch point;
+    alignas(32) float dist[SDF_BATCH_WIDTH];
+    for(int x = 0; x < VOLUME_BRICK_SIZE; x++)
+      point.x[x] = lo.x + float(x) * voxelSize;
+    for(int z = 0; z < VOLUME_BRICK_SIZE; z++){
+      for(int y = 0; y < VOLUME_BRICK_SIZE; y++){
+        for(int x = 0; x < VOLUME_BRICK_SIZE; x++){
+          point.y[x] = lo.y + float(y) * voxelSize;
+          point.z[x] = lo.z + float(z) * voxelSize;
+        }
+        tape.evalBatch(point, dist);
+        for(int x = 0; x < VOLUME_BRICK_SIZE; x++)
+          *out++ = quantize(dist[x], clamp);
+      }
+    }
+  });
+
+  // Bricks the interval bounds kept whose values all saturate with one sign
+  // are uniform after all, the rest are packed in cell order
+  v.firstBrick = uint32_t(m_bricks.size());
+  v.numBricks = uint32_t(numBricks);
+  v.firstPayload = uint32_t(m_values.size() / BRICK_VALUES);
+  v.used = true;
+  uint32_t numPayloads = 0;
+  for(uint32_t b = 0; b < band.size(); b++){
+    const int8_t* src = values.data() + size_t(b) * BRICK_VALUES;
+    const bool positive = std::all_of(src, src + BRICK_VALUES, [](int8_t x){ return x == SATURATED; });
+    const bool negative = std::all_of(src, src + BRICK_VALUES, [](int8_t x){ return x == -SATURATED; });
+    if(positive || negative){
+      cells[band[b]] = positive ? shaderio::VOLUME_UNIFORM_POSITIVE : shaderio::VOLUME_UNIFORM_NEGATIVE;
+      continue;
+    }
+    if(numPayloads != b)
+      std::memcpy(values.data() + size_t(numPayloads) * BRICK_VALUES, src, BRICK_VALUES);
+    cells[band[b]] = int32_t(v.firstPayload + numPayloads);
+    band[numPayloads++] = band[b];
+  }
+  band.resize(numPayloads);
+  v.numPayloads = numPayloads;
+
+  m_bricks.insert(m_bricks.end(), cells.begin(), cells.end());
+  m_values.insert(m_values.end(), values.begin(), values.begin() + size_t(numPayloads) * BRICK_VALUES);
+  m_brickRange.resize(m_bricks.size() * 2);
+  updateRanges(v);
+  v.hash = hashVolume(v);
+
+  if(size_t(slot) == m_volumes.size())
+    m_volumes.push_back(v);
+  else
+    m_volumes[slot] = v;
+  m_version++;
+
+  // Largest difference to the clamped distance at the voxel centers of the
+  // bricks with values, uniform bricks are exact by their interval bound
+  std::vector<float> brickError(band.size(), 0.0f);
+  pool.parallelFor(uint32_t(band.size()), [&](uint32_t b){
+    const glm::ivec3 id = brickId(band[b]);
+    PointBatch point;
+    alignas(32) float dist[SDF_BATCH_WIDTH];
+    float maxError = 0.0f;
+    for(int z = 0; z < CELLS; z++){
+      for(int y = 0; y < CELLS; y++){
+        for(int x = 0; x < SDF_BATCH_WIDTH; x++){
+          const glm::vec3 u = glm::vec3(id * CELLS) + glm::vec3(float(std::min(x, CELLS - 1)), float(y), float(z)) + 0.5f;
+          const glm::vec3 p = gridMin + u * voxelSize;
+          point.x[x] = p.x;
+          point.y[x] = p.y;
+          point.z[x] = p.z;
+        }
+        tape.evalBatch(point, dist);
+        for(int x = 0; x < CELLS; x++){
+          const glm::vec3 u = glm::vec3(id * CELLS) + glm::vec3(float(x), float(y), float(z)) + 0.5f;
+          maxError = glm::max(maxError, glm::abs(sample(m_volumes[slot], u, nullptr) - glm::clamp(dist[x], -clamp, clamp)));
+        }
+      }
+    }
+    brickError[b] = maxError;
+  });
+  for(float e : brickError)
+    error = glm::max(error, e);
+
+  return slot;
+}
+
+void SampledVolumes::release(int volume){
+  if(!valid(volume))
+    return;
+
+  Volume& v = m_volumes[volume];
+  m_bricks.erase(m_bricks.begin() + v.firstBrick, m_bricks.begin() + v.firstBrick + v.numBricks);
+  m_brickRange.erase(m_brickRange.begin() + 2 * size_t(v.firstBrick), m_brickRange.begin() + 2 * size_t(v.firstBrick + v.numBricks));
+  m_values.erase(m_values.begin() + size_t(v.firstPayload) * BRICK_VALUES, m_values.begin() + size_t(v.firstPayload + v.numPayloads) * BRICK_VALUES);
+
+  // Later volumes move down, their payload pointers with them
+  for(Volume& other : m_volumes){
+    if(!other.used || &other == &v)
+      continue;
+    if(other.firstBrick > v.firstBrick)
+      other.firstBrick -= v.numBricks;
+    if(other.firstPayload > v.firstPayload){
+      other.firstPayload -= v.numPayloads;
+      for(uint32_t i = other.firstBrick; i < other.firstBrick + other.numBricks; i++){
+        if(m_bricks[i] >= 0)
+          m_bricks[i] -= int32_t(v.numPayloads);
+      }
+    }
+  }
+  v = {};
+  m_version++;
+}
+
+void SampledVolumes::clear(){
+  m_volumes.clear();
+  m_bricks.clear();
+  m_brickRange.clear();
+  m_values.clear();
+  m_version++;
+}
+
+void SampledVolumes::updateRanges(Volume& v){
+  v.range[0] = SATURATED;
+  v.range[1] = -SATURATED;
+  for(uint32_t i = v.firstBrick; i < v.firstBrick + v.numBricks; i++){
+    int8_t* range = m_brickRange.data() + 2 * size_t(i);
+    const int32_t payload = m_bricks[i];
+    if(payload < 0){
+      range[0] = range[1] = payload == shaderio::VOLUME_UNIFORM_POSITIVE ? SATURATED : -SATURATED;
+    }else{
+      const int8_t* values = payloadValues(payload);
+      const auto [lo, hi] = std::minmax_element(values, values + BRICK_VALUES);
+      range[0] = *lo;
+      range[1] = *hi;
+    }
+    v.range[0] = std::min(v.range[0], range[0]);
+    v.range[1] = std::max(v.range[1], range[1]);
+  }
+}
+
+uint64_t SampledVolumes::hashVolume(const Volume& v) const {
+  uint64_t h = 0xcbf29ce484222325ull;
+  h = hashBytes(h, &v.header.origin, sizeof(v.header.origin));
+  h = hashBytes(h, &v.header.voxelSize, sizeof(v.header.voxelSize));
+  h = hashBytes(h, &v.header.bricks, sizeof(v.header.bricks));
+  h = hashBytes(h, &v.header.clamp, sizeof(v.header.clamp));
+  for(uint32_t i = v.firstBrick; i < v.firstBrick + v.numBricks; i++){
+    const int32_t payload = m_bricks[i];
+    if(payload < 0)
+      h = hashBytes(h, &payload, sizeof(payload));
+    else
+      h = hashBytes(h, payloadValues(payload), BRICK_VALUES);
+  }
+  return h;
+}
+
+//---------------------------------------
+// Evaluation
+//---------------------------------------
+
+// Value at u, in voxels from the grid corner and inside the grid, with its
+// gradient along u when asked
+float SampledVolumes::sample(const Volume& v, glm::vec3 u, glm::vec3* grad) const {
+  const glm::ivec3 id = glm::min(glm::ivec3(u) / CELLS, v.header.bricks - 1);
+  const int32_t payload = brickPayload(v, id);
+  if(payload < 0){
+    if(grad)
+      *grad = glm::vec3(0.0f);
+    return payload == shaderio::VOLUME_UNIFORM_POSITIVE ? v.header.clamp : -v.header.clamp;
+  }
+
+  const glm::vec3 local = u - glm::vec3(id * CELLS);
+  const glm::ivec3 c = glm::clamp(glm::ivec3(local), glm::ivec3(0), glm::ivec3(CELLS - 1));
+  const glm::vec3 f = glm::clamp(local - glm::vec3(c), glm::vec3(0.0f), glm::vec3(1.0f));
+  const int8_t* values = payloadValues(payload);
+  float s[8];
+  for(int i = 0; i < 8; i++){
+    const glm::ivec3 q = c + glm::ivec3(i & 1, (i >> 1) & 1, i >> 2);
+    s[i] = float(values[(q.z * VOLUME_BRICK_SIZE + q.y) * VOLUME_BRICK_SIZE + q.x]);
+  }
+  const float x00 = lerpExact(s[0], s[1], f.x), x10 = lerpExact(s[2], s[3], f.x);
+  const float x01 = lerpExact(s[4], s[5], f.x), x11 = lerpExact(s[6], s[7], f.x);
+  const float y0 = lerpExact(x00, x10, f.y), y1 = lerpExact(x01, x11, f.y);
+  const float toDistance = v.header.clamp / float(SATURATED);
+
+  if(grad){
+    const float dx0 = lerpExact(s[1] - s[0], s[3] - s[2], f.y), dx1 = lerpExact(s[5] - s[4], s[7] - s[6], f.y);
+    const float dy0 = lerpExact(s[2] - s[0], s[3] - s[1], f.x), dy1 = lerpExact(s[6] - s[4], s[7] - s[5], f.x);
+    *grad = glm::vec3(lerpExact(dx0, dx1, f.z), lerpExact(dy0, dy1, f.z), y1 - y0) * toDistance;
+  }
+  return lerpExact(y0, y1, f.z) * toDistance;
+}
+
+float SampledVolumes::eval(int volume, glm::vec3 p) const {
+  if(!valid(volume))
+    return sdEmpty(p);
+
+  const Volume& v = m_volumes[volume];
+  const glm::vec3 cells = glm::vec3(v.header.bricks * CELLS);
+  const glm::vec3 u = (p - v.header.origin) / v.header.voxelSize;
+  const glm::vec3 outside = glm::max(glm::max(-u, u - cells), glm::vec3(0.0f));
+  return glm::length(outside) * v.header.voxelSize + sample(v, glm::clamp(u, glm::vec3(0.0f), cells), nullptr);
+}
+
+Dual SampledVolumes::eval(int volume, const Dual3& p) const {
+  const glm::vec3 pv(p.x.v, p.y.v, p.z.v);
+  if(!valid(volume))
+    return {sdEmpty(pv), glm::vec3(0.0f)};
+
+  const Volume& v = m_volumes[volume];
+  const glm::vec3 cells = glm::vec3(v.header.bricks * CELLS);
+  const glm::vec3 u = (pv - v.header.origin) / v.header.voxelSize;
+  const glm::vec3 outside = glm::max(glm::max(-u, u - cells), glm::vec3(0.0f));
+  const float outsideLength = glm::length(outside);
+
+  glm::vec3 grad;
+  const float d = outsideLength * v.header.voxelSize + sample(v, glm::clamp(u, glm::vec3(0.0f), cells), &grad);
+  grad /= v.header.voxelSize;
+  for(int i = 0; i < 3; i++){
+    // Clamped axes only move the point along the distance to the grid
+    if(u[i] < 0.0f || u[i] > cells[i])
+      grad[i] = (u[i] < 0.0f ? -outside[i] : outside[i]) / outsideLength;
+  }
+  return {d, grad.x * p.x.g + grad.y * p.y.g + grad.z * p.z.g};
+}
+
+Interval SampledVolumes::eval(int volume, const IntervalBox& p) const {
+  if(!valid(volume))
+    return {sdEmpty(p.lo), sdEmpty(p.lo)};
+
+  const Volume& v = m_volumes[volume];
+  const glm::vec3 cells = glm::vec3(v.header.bricks * CELLS);
+  const glm::vec3 lo = (p.lo - v.header.origin) / v.header.voxelSize;
+  const glm::vec3 hi = (p.hi - v.header.origin) / v.header.voxelSize;
+
+  // Distance to the grid, nearest and farthest point of the box
+  const float nearest = glm::length(glm::max(glm::max(-hi, lo - cells), glm::vec3(0.0f)));
+  const float farthest = glm::length(glm::max(glm::max(-lo, hi - cells), glm::vec3(0.0f)));
+
+  // Values of the bricks the box clamped to the grid reads
+  const glm::ivec3 b0 = glm::min(glm::ivec3(glm::clamp(lo, glm::vec3(0.0f), cells)) / CELLS, v.header.bricks - 1);
+  const glm::ivec3 b1 = glm::min(glm::ivec3(glm::clamp(hi, glm::vec3(0.0f), cells)) / CELLS, v.header.bricks - 1);
+  const glm::ivec3 count = b1 - b0 + 1;
+  int8_t range[2] = {v.range[0], v.range[1]};
+  if(count.x * count.y * count.z <= MAX_INTERVAL_BRICKS){
+    range[0] = SATURATED;
+    range[1] = -SATURATED;
+    for(int z = b0.z; z <= b1.z; z++)
+      for(int y = b0.y; y <= b1.y; y++)
+        for(int x = b0.x; x <= b1.x; x++){
+          const int8_t* r = m_brickRange.data() + 2 * size_t(v.firstBrick + (z * v.header.bricks.y + y) * v.header.bricks.x + x);
+          range[0] = std::min(range[0], r[0]);
+          range[1] = std::max(range[1], r[1]);
+        }
+  }
+
+  const float toDistance = v.header.clamp / float(SATURATED);
+  return {nearest * v.header.voxelSize + float(range[0]) * toDistance, farthest * v.header.voxelSize + float(range[1]) * toDistance};
+}
+
+//---------------------------------------
+// GPU copy and serialization
+//---------------------------------------
+
+std::vector<shaderio::VolumeInfo> SampledVolumes::gpuInfos() const {
+  std::vector<shaderio::VolumeInfo> infos(MAX_VOLUMES, shaderio::VolumeInfo{});
+  for(size_t i = 0; i < m_volumes.size(); i++){
+    const Volume& v = m_volumes[i];
+    if(!v.used)
+      continue;
+    infos[i].origin_voxel = glm::vec4(v.header.origin, v.header.voxelSize);
+    infos[i].bricks_first = glm::ivec4(v.header.bricks, int(v.firstBrick));
+    infos[i].clamp = glm::vec4(v.header.clamp, 0.0f, 0.0f, 0.0f);
+  }
+  return infos;
+}
+
+std::span<const uint32_t> SampledVolumes::gpuValues() const {
+  return {reinterpret_cast<const uint32_t*>(m_values.data()), m_values.size() / sizeof(uint32_t)};
+}
+
+SampledVolumes::Snapshot SampledVolumes::snapshot() const {
+  Snapshot s;
+  for(const Volume& v : m_volumes){
+    if(!v.used){
+      s.headers.push_back({glm::vec3(0.0f), 0.0f, glm::ivec3(0), 0.0f});
+      continue;
+    }
+    s.headers.push_back(v.header);
+    const int32_t offset = int32_t(s.values.size() / BRICK_VALUES) - int32_t(v.firstPayload);
+    for(uint32_t i = v.firstBrick; i < v.firstBrick + v.numBricks; i++)
+      s.bricks.push_back(m_bricks[i] >= 0 ? m_bricks[i] + offset : m_bricks[i]);
+    s.values.insert(s.values.end(), payloadValues(int32_t(v.firstPayload)), payloadValues(int32_t(v.firstPayload + v.numPayloads)));
+  }
+  return s;
+}
+
+bool SampledVolumes::restore(const Snapshot& s){
+  clear();
+
+  const size_t numPayloads = s.values.size() / BRICK_VALUES;
+  bool valid = s.headers.size() <= size_t(MAX_VOLUMES) && s.bricks.size() <= size_t(MAX_VOLUME_BRICKS) &&
+               s.values.size() % BRICK_VALUES == 0 && numPayloads <= size_t(MAX_VOLUME_PAYLOADS);
+  size_t nextBrick = 0, nextPayload = 0;
+  for(size_t i = 0; valid && i < s.headers.size(); i++){
+    const Header& h = s.headers[i];
+    Volume v{};
+    if(h.bricks == glm::ivec3(0)){
+      m_volumes.push_back(v);
+      continue;
+    }
+
+    const uint64_t numBricks = uint64_t(glm::max(h.bricks.x, 0)) * uint64_t(glm::max(h.bricks.y, 0)) * uint64_t(glm::max(h.bricks.z, 0));
+    valid = glm::all(glm::greaterThan(h.bricks, glm::ivec3(0))) && h.voxelSize > 0.0f && h.clamp > 0.0f &&
+            nextBrick + numBricks <= s.bricks.size();
+    if(!valid)
+      break;
+
+    // The payloads of a volume follow the ones of the volume before, each used once
+    v.header = h;
+    v.firstBrick = uint32_t(nextBrick);
+    v.numBricks = uint32_t(numBricks);
+    v.firstPayload = uint32_t(nextPayload);
+    v.used = true;
+    std::vector<bool> seen;
+    for(size_t b = nextBrick; valid && b < nextBrick + numBricks; b++){
+      const int32_t payload = s.bricks[b];
+      if(payload == shaderio::VOLUME_UNIFORM_POSITIVE || payload == shaderio::VOLUME_UNIFORM_NEGATIVE)
+        continue;
+      const size_t local = size_t(payload) - nextPayload;
+      valid = payload >= 0 && size_t(payload) >= nextPayload && size_t(payload) < numPayloads;
+      if(valid){
+        if(seen.size() <= local)
+          seen.resize(local + 1, false);
+        valid = !seen[local];
+        seen[local] = true;
+      }
+    }
+    valid = valid && std::all_of(seen.begin(), seen.end(), [](bool b){ return b; });
+    v.numPayloads = uint32_t(seen.size());
+    nextBrick += numBricks;
+    nextPayload += seen.size();
+    m_volumes.push_back(v);
+  }
+  valid = valid && nextBrick == s.bricks.size() && nextPayload == numPayloads;
+  if(!valid){
+    clear();
+    return false;
+  }
+
+  m_bricks = s.bricks;
+  m_values = s.values;
+  m_brickRange.resize(m_bricks.size() * 2);
+  for(Volume& v : m_volumes){
+    if(!v.used)
+      continue;
+    updateRanges(v);
+    v.hash = hashVolume(v);
+  }
+  return true;
+}
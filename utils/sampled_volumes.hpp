@@ -0,0 +1,99 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "nvutils/bounding_box.hpp"
+#include "../shaders/shaderio.h"
+#include "sdf_dual.hpp"
+#include "sdf_interval.hpp"
+
+class SdfTape;
+class ThreadPool;
+
+// Distance fields baked from the tape for frozen nodes. Every volume is a
+// dense grid of VOLUME_BRICK_SIZE³ bricks in node space, values are sampled
+// every voxel and quantized to int8 up to the clamp distance. Bricks sharing
+// a sign beyond the clamp store no values. Outside the grid the distance to it
+// is added to the border value, which is the clamp distance, so sphere
+// tracing never overshoots the baked surface.
+class SampledVolumes {
+public:
+  // Volume slots as saved with the scene, slots not in use have no bricks
+  struct Header {
+    glm::vec3 origin;
+    float voxelSize;
+    glm::ivec3 bricks;
+    float clamp;
+  };
+
+  // Brick cells of every volume in use, in slot order, then the values of
+  // every payload
+  struct Snapshot {
+    std::vector<Header> headers;
+    std::vector<int32_t> bricks;
+    std::vector<int8_t> values;
+  };
+
+  // Samples tape over box every voxelSize into a free slot. The node space of
+  // the volume is tape space moved so the center of box is at the origin.
+  // error receives the largest difference to the clamped tape distance at the
+  // voxel centers of the surface bricks. Returns the slot, -1 when the volume
+  // doesn't fit in the GPU buffers.
+  int bake(const SdfTape& tape, const nvutils::Bbox& box, float voxelSize, ThreadPool& pool, float& error);
+  void release(int volume);
+  void clear();
+
+  bool valid(int volume) const { return volume >= 0 && volume < int(m_volumes.size()) && m_volumes[volume].used; }
+  // Node space box of the grid
+  nvutils::Bbox bounds(int volume) const;
+  // Hash of the grid and values, 0 for slots not in use
+  uint64_t hash(int volume) const { return valid(volume) ? m_volumes[volume].hash : 0; }
+  // Changes whenever a volume is baked or released, tells when the GPU copy is stale
+  uint32_t version() const { return m_version; }
+
+  // Distance at node space point p, slots not in use read as empty space
+  float eval(int volume, glm::vec3 p) const;
+  Dual eval(int volume, const Dual3& p) const;
+  // Contains eval() for every point of the box
+  Interval eval(int volume, const IntervalBox& p) const;
+
+  // GPU copy: MAX_VOLUMES infos, the brick cells and VOLUME_BRICK_WORDS words
+  // of values per payload
+  std::vector<shaderio::VolumeInfo> gpuInfos() const;
+  std::span<const int32_t> gpuBricks() const { return m_bricks; }
+  std::span<const uint32_t> gpuValues() const;
+
+  Snapshot snapshot() const;
+  // False, and every slot released, if the snapshot is inconsistent
+  bool restore(const Snapshot& snapshot);
+
+  static constexpr int BRICK_VALUES = VOLUME_BRICK_SIZE * VOLUME_BRICK_SIZE * VOLUME_BRICK_SIZE;
+
+private:
+  struct Volume {
+    Header header;
+    uint32_t firstBrick;
+    uint32_t numBricks;
+    uint32_t firstPayload;
+    uint32_t numPayloads;
+    int8_t range[2];        // Min and max value of every brick
+    uint64_t hash;
+    bool used;
+  };
+
+  int32_t brickPayload(const Volume& v, glm::ivec3 id) const { return m_bricks[v.firstBrick + (id.z * v.header.bricks.y + id.y) * v.header.bricks.x + id.x]; }
+  const int8_t* payloadValues(int32_t payload) const { return m_values.data() + size_t(payload) * BRICK_VALUES; }
+  float sample(const Volume& v, glm::vec3 u, glm::vec3* grad) const;
+  void updateRanges(Volume& v);
+  uint64_t hashVolume(const Volume& v) const;
+  int freeSlot() const;
+
+  std::vector<Volume> m_volumes;
+  std::vector<int32_t> m_bricks;        // Payload or VOLUME_UNIFORM_* of every brick cell, volume by volume
+  std::vector<int8_t> m_brickRange;     // Min and max value of every brick cell
+  std::vector<int8_t> m_values;         // BRICK_VALUES per payload, payloads of a volume are contiguous
+  uint32_t m_version = 0;
+};
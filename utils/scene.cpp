@@ -1,13 +1,16 @@
 #include "scene.hpp"
 
+#include "build_queue.hpp"
 #include "rng.hpp"
 #include "sdf.hpp"
+#include "sdf_tape.hpp"
 
-#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <queue>
 #include <string>
 #include <vector>
 
-#include <imgui.h>
 #include <nvutils/bounding_box.hpp>
 #include <nvutils/logger.hpp>
 
@@ -28,354 +31,9 @@
 // Helper functions
 //------------------
 
-std::string Scene::PrimTypeToString(shaderio::PrimType type) {
-  return PrimTypeNames[(int)type];
-}
-
-std::string Scene::getLabel(Node *n) {
-  return PrimTypeToString(n->gp.type) + "##" + std::to_string(n->id);
-}
-
-std::string Scene::getLabel(Material  mat) {
-  return mat.name + "##" + std::to_string(mat.id);
-}
-
 uint32_t Scene::getNextId() { return m_nextID++; }
 
 
-//------------------
-// Draw functions
-//------------------
-
-void Scene::draw() {
-  ImGui::Begin("Scene");
-
-  if (ImGui::BeginTabBar("Scene")){
-    if (ImGui::BeginTabItem("Objects")){
-      drawButtonGroup();
-      ImGui::Separator();
-      drawPrimitives();
-      drawNodeParams();
-      ImGui::EndTabItem();
-    }
-
-    if (ImGui::BeginTabItem("Materials")){
-      drawMaterials();
-      drawMaterialParams();
-      ImGui::EndTabItem();
-    }
-
-    ImGui::EndTabBar();
-  }
-  
-  ImGui::End();
-}
-
-void Scene::drawButtonGroup() {
-  if (ImGui::Button("Add"))
-    ImGui::OpenPopup("AddNodePopup");
-
-  ImGui::SameLine();
-
-  if (ImGui::Button("Delete")) {
-    deleteSelected();
-  }
-
-  if (ImGui::BeginPopup("AddNodePopup")) {
-    for (int i = 0; i < IM_ARRAYSIZE(PrimTypeNames); ++i) {
-      if (ImGui::MenuItem(PrimTypeToString((shaderio::PrimType)i).c_str()))
-        addNode((shaderio::PrimType)i);
-    }
-
-    ImGui::EndPopup();
-  }
-}
-
-void Scene::drawPrimitives() {
-  ImGuiSelectableFlags selectableFlags = 0;
-
-  bool clickedOnItem = false;
-
-  for (int idx = 0; idx < m_root.size(); idx++) {
-    auto& node = m_root[idx];
-    bool isSelected = idx == m_selected;
-    std::string label = getLabel(&node).c_str();
-
-    // Draw primitive
-    if (ImGui::Selectable(label.c_str(), isSelected, selectableFlags)) {
-      m_selected = idx;
-      clickedOnItem = true;
-    }
-
-    // Drag source
-    if (ImGui::BeginDragDropSource()) {
-      ImGui::SetDragDropPayload("DND_SCENE_NODE", &idx, sizeof(int));
-      ImGui::Text("%s", label.c_str());
-      ImGui::EndDragDropSource();
-    }
-
-    if (ImGui::BeginDragDropTarget()) {
-      if (const ImGuiPayload *payload =
-              ImGui::AcceptDragDropPayload("DND_SCENE_NODE")) {
-        int sourceIdx = *(const int *)payload->Data;
-
-        if (sourceIdx != idx) {
-          auto movedItem = std::move(m_root[sourceIdx]);
-          m_root.erase(m_root.begin() + sourceIdx);
-          m_root.insert(m_root.begin() + idx, std::move(movedItem));
-
-          m_selected = idx;
-          updateNodeData(&m_root[m_selected]);
-        }
-      }
-      ImGui::EndDragDropTarget();
-    }
-  }
-
-  if (!clickedOnItem && ImGui::IsMouseClicked(0) && ImGui::IsWindowHovered()) {
-    m_selected = -1;
-  }
-}
-
-template<typename T>
-bool ComboVector(const char* label, int* current_item, std::vector<T>& vec){
-  auto getter = [](void* data, int idx, const char** out_text) -> bool
-  {
-    auto& v = *static_cast<std::vector<T>*>(data);
-    if (idx < 0 || idx >= (int)v.size()) return false;
-    *out_text = v[idx].name.c_str();
-    return true;
-  };
-
-  return ImGui::Combo(label, current_item, getter, &vec, (int)vec.size());
-}
-
-
-void Scene::drawNodeParams(){
-  
-
-  if (m_selected != -1) {
-    ImGui::Begin("Object");
-
-    Node &selectedNode = m_root[m_selected];
-
-    const std::string id = "##" + std::to_string(selectedNode.id);
-    bool dirty = false;
-    int combOpUI = selectedNode.sdp.combOp >= 2 ? selectedNode.sdp.combOp - 2
-                                              : selectedNode.sdp.combOp;
-
-    dirty |= ComboVector("Material", &selectedNode.gp.mat, m_mat);
-
-    if (ImGui::IsKeyPressed(ImGuiKey_T))
-        selectedNode.gzp.guizmoOp = ImGuizmo::TRANSLATE;
-    if (ImGui::IsKeyPressed(ImGuiKey_R))
-        selectedNode.gzp.guizmoOp = ImGuizmo::ROTATE;
-    if (ImGui::IsKeyPressed(ImGuiKey_E))
-        selectedNode.gzp.guizmoOp = ImGuizmo::SCALE;
-    if (ImGui::RadioButton("Translate", selectedNode.gzp.guizmoOp == ImGuizmo::TRANSLATE))
-        selectedNode.gzp.guizmoOp = ImGuizmo::TRANSLATE;
-    ImGui::SameLine();
-    if (ImGui::RadioButton("Rotate", selectedNode.gzp.guizmoOp == ImGuizmo::ROTATE))
-        selectedNode.gzp.guizmoOp = ImGuizmo::ROTATE;
-    ImGui::SameLine();
-    if (ImGui::RadioButton("Scale", selectedNode.gzp.guizmoOp == ImGuizmo::SCALE))
-        selectedNode.gzp.guizmoOp = ImGuizmo::SCALE;
- 
-
-    dirty |= ImGui::InputFloat3(("Position" + id).c_str(),
-                                &selectedNode.gp.position.x);
-    dirty |= ImGui::InputFloat3(("Rotation" + id).c_str(),
-                                &selectedNode.gp.rotation.x);
-    dirty |= ImGui::InputFloat(("Scale" + id).c_str(), &selectedNode.gp.scale);
-
-    ImGui::Separator();
-    dirty |= ImGui::Checkbox("Physics active", &selectedNode.pyp.physicsActive);
-    dirty |= ImGui::SliderFloat("Density", &selectedNode.pyp.density, 0.01f, 50.0f);
-
-    ImGui::Separator();
-    dirty |= ImGui::SliderFloat(("Roundness" + id).c_str(),
-                                &selectedNode.sdp.roundness, 0.0f,
-                                selectedNode.gp.scale * 0.25);
-    ImGui::Separator();
-
-    dirty |= ImGui::Combo(("Combination operation" + id).c_str(), &combOpUI,
-                          CombinationOpNames, IM_ARRAYSIZE(CombinationOpNames));
-    dirty |= ImGui::SliderFloat(("Smoothness" + id).c_str(),
-                                &selectedNode.sdp.smoothness, 0.0f,
-                                0.04);
-    ImGui::Separator();
-
-    dirty |= ImGui::Combo(("Morphing primitive" + id).c_str(),
-                          &selectedNode.sdp.morphPrim, MorphPrimNames,
-                          IM_ARRAYSIZE(MorphPrimNames));
-
-    dirty |= ImGui::SliderFloat(("Morphing" + id).c_str(),
-                                &selectedNode.sdp.morph, 0.0f, 1.0f);
-
-    ImGui::Separator();
-
-
-    dirty |= ImGui::Combo(("Deformation operation" + id).c_str(),
-                          &selectedNode.sdp.defOp, DeformationOpNames,
-                          IM_ARRAYSIZE(DeformationOpNames));
-    if (selectedNode.sdp.defOp == (int)DeformationOp::Elongate) {
-      dirty |= ImGui::InputFloat3(("Elongation" + id).c_str(),
-                                  &selectedNode.sdp.defP.x);
-    }
-
-    ImGui::Separator();
-
-    dirty |= ImGui::Combo(("Repetition operation" + id).c_str(),
-                          &selectedNode.sdp.repOp, RepetitionOpnames,
-                          IM_ARRAYSIZE(RepetitionOpnames));
-
-    if ((RepetitionOp)selectedNode.sdp.repOp != RepetitionOp::NoneOP) {
-      dirty |= ImGui::InputFloat3(("Spacing" + id).c_str(),
-                                  &selectedNode.sdp.spacing.x);
-      if ((RepetitionOp)selectedNode.sdp.repOp == RepetitionOp::LimRepetition)
-        dirty |= ImGui::DragInt3(("Limit" + id).c_str(),
-                                 &selectedNode.sdp.limit.x, 0.1f, 0, INT_MAX);
-    }
-
-    ImGui::Separator();
-
-    dirty |= ImGui::SliderInt(("Terrain octaves" + id).c_str(),
-                                    &selectedNode.sdp.octaves,0,20);
-    if(selectedNode.sdp.octaves > 0){
-      dirty |= ImGui::SliderFloat(("Initial size" + id).c_str(),
-                                    &selectedNode.sdp.terrain.x,0.001,2.0);
-      dirty |= ImGui::SliderFloat(("Size increase" + id).c_str(),
-                                    &selectedNode.sdp.terrain.y,0.001,0.75);
-      dirty |= ImGui::SliderFloat(("Inflation" + id).c_str(),
-                                    &selectedNode.sdp.terrain.z,0.001,1);
-      dirty |= ImGui::SliderFloat(("Erosion" + id).c_str(),
-                                    &selectedNode.sdp.terrain.w,0.001,1);
-    }
-
-    if(dirty) {
-      // If smoothness != 0 then apply the smooth combination operations (3,4,5)
-      // if not use the faster version (0,1,2)
-      if (selectedNode.sdp.smoothness > 0.0f) {
-        selectedNode.sdp.combOp = combOpUI + 2;
-      } else {
-        selectedNode.sdp.combOp = combOpUI;
-      }
-      // Update the transformation matrix and bounding box
-      updateNodeData(&selectedNode);
-      // Flag to render engine that scene needs grid regeneration
-      m_needsRefresh = true;
-    }
-
-    ImGui::End();
-  }
-}
-
-void Scene::drawMaterials(){
-  if(ImGui::Button("Add material"))
-    addMaterial(createMaterial());
-  
-  ImGuiSelectableFlags selectableFlags = 0;
-
-  bool clickedOnItem = false;
-
-  for (int idx = 0; idx < m_mat.size(); idx++) {
-    auto& mat = m_mat[idx];
-    bool isSelected = idx == m_selectedMat;
-    std::string label = getLabel(mat).c_str();
-
-    // Draw material
-    if (ImGui::Selectable(label.c_str(), isSelected, selectableFlags)) {
-      m_selectedMat = idx;
-      clickedOnItem = true;
-    }
-  }
-
-  if (!clickedOnItem && ImGui::IsMouseClicked(0) && ImGui::IsWindowHovered()) {
-    m_selectedMat = -1;
-  }
-
-}
-
-void Scene::drawMaterialParams(){
-  if (m_selectedMat != -1) {
-    ImGui::Begin("Material");
-
-    Material& mat = m_mat[m_selectedMat];
-
-    const std::string id = "##" + std::to_string(mat.id);
-    bool dirty = false;
-
-    char buffer[256];
-    strncpy(buffer, mat.name.c_str(), sizeof(buffer));
-    buffer[sizeof(buffer) - 1] = '\0';
-    if (ImGui::InputText(("Name" + id).c_str(), buffer, sizeof(buffer)))
-      mat.name = std::string(buffer);
-
-    dirty |= ImGui::ColorEdit3(("Albedo" + id).c_str(),
-                                &mat.albedo.x);
-
-    dirty |= ImGui::SliderFloat(("Shininess" + id).c_str(),
-                                &mat.shininess, 0.0f, MAX_SHININESS);
-
-    dirty |= ImGui::SliderFloat(("Roughness" + id).c_str(),
-                                &mat.roughness, 0.0f, 1.0f);
-
-    dirty |= ImGui::SliderFloat(("Metalness" + id).c_str(),
-                                &mat.metalness, 0.0f, 1.0f);
-
-    dirty |= ImGui::Combo(("Type" + id).c_str(),
-                          &mat.type, MaterialTypeNames,
-                          IM_ARRAYSIZE(MaterialTypeNames));                   
-
-    if (dirty) {
-      m_needsRefresh = true;
-    }
-
-    ImGui::End();
-  }
-}
-
-void Scene::drawGuizmo(ImVec2 viewportPos, ImVec2 viewportSize, glm::mat4 cameraView, glm::mat4 cameraProjection){
-  if(m_selected != -1){ 
-    ImGuizmo::BeginFrame();
-
-    ImGuizmo::SetDrawlist();
-
-    ImGuizmo::SetRect(
-      viewportPos.x,
-      viewportPos.y,
-      viewportSize.x,
-      viewportSize.y
-    );
-
-    Node &selectedNode = m_root[m_selected];
-    GuizmoParams& gzP = selectedNode.gzp;
-
-    cameraProjection[1][1] *= -1.0f;
-    ImGuizmo::Manipulate(
-      glm::value_ptr(cameraView), 
-      glm::value_ptr(cameraProjection), 
-      gzP.guizmoOp, 
-      gzP.guizmoMode, 
-      glm::value_ptr(gzP.matrix),
-      NULL, NULL);
-
-
-    m_usingGuizmo = ImGuizmo::IsUsing();
-
-    if(m_usingGuizmo){
-      float& scale = selectedNode.gp.scale;
-      glm::vec3 scale_vec, rot_deg;
-      ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(gzP.matrix), &selectedNode.gp.position.x, &rot_deg.x, &scale_vec.x);
-      selectedNode.gp.rotation = glm::radians(rot_deg);
-      selectedNode.gp.scale = scale_vec[0];
-      updateNodeData(&selectedNode);
-      m_needsRefresh = true;
-    }
-  }
-}
-
-
 //------------------
 // Tree functions
 //------------------
@@ -387,7 +45,7 @@ void Scene::deleteSelected() {
 
   m_root[m_selected].needsRemoval = true;
   m_needsRefresh = true;
-  m_removeList.push_back(m_root[m_selected].gp.bbox);
+  m_removeList.push_back({m_root[m_selected].gp.bbox, nodeLattice(m_root[m_selected])});
   m_selected = -1;
 }
 
@@ -399,8 +57,23 @@ void Scene::flushDeletedNodes(){
       }),
     m_root.end()
   );
+  releaseUnusedVolumes();
+}
+
+// Volumes outlive their node until the node is flushed
+void Scene::releaseUnusedVolumes(){
+  for(int v = 0; v < MAX_VOLUMES; v++){
+    if(!m_volumes.valid(v))
+      continue;
+    const bool used = std::any_of(m_root.begin(), m_root.end(), [&](const Node& n){
+      return n.gp.type == shaderio::PrimType::Volume && n.sdp.volume == v;
+    });
+    if(!used)
+      m_volumes.release(v);
+  }
 }
 
+
 Scene::Node *Scene::createNode(shaderio::PrimType t) {
   Node *node = new Node({
       .id = getNextId(),
@@ -418,8 +91,8 @@ Scene::Node *Scene::createNode(shaderio::PrimType t) {
         .density = 1.0,
       },
       .gzp = {
-        ImGuizmo::TRANSLATE,
-        ImGuizmo::WORLD,
+        GUIZMO_TRANSLATE,
+        GUIZMO_WORLD,
         glm::mat4(1.0)
       },
   });
@@ -484,8 +157,10 @@ void Scene::updateNodeData(Node *n) {
 }
 
 void Scene::markRefresh(Node* n){
+  m_tapeDirty.insert(n->id);
   if(!n->needsRefresh){
     n->gp.prevBbox = nvutils::Bbox(n->gp.bbox);
+    n->gp.prevLattice = nodeLattice(*n);
     n->needsRefresh = true;
     m_needsRefresh = true;
   }
@@ -502,26 +177,57 @@ void Scene::generateMatrix(Node *n) {
     transform4x4 *= rotMatrix;
   }
 
-  glm::vec3 scale_vec(n->gp.scale);
-  glm::vec3 rot_deg(glm::degrees(glm::eulerAngles(n->gp.rotation)));
-  ImGuizmo::RecomposeMatrixFromComponents(
-    glm::value_ptr(n->gp.position), 
-    glm::value_ptr(rot_deg),
-    glm::value_ptr(scale_vec),
-    glm::value_ptr(n->gzp.matrix));
-
   n->gp.tInv = glm::inverse(transform4x4);
 }
 
-void Scene::generateBBox(Node *n) {
-  const glm::vec3 worldMin(-1000.0);
-  const glm::vec3 worldMax(1000.0);
+// Node bounding boxes are clamped to these
+static const glm::vec3 worldMin(-1000.0);
+static const glm::vec3 worldMax(1000.0);
+
+// FNV-1a, fields are hashed one by one so struct padding never leaks in
+static void hashBytes(uint64_t& h, const void* data, size_t size){
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for(size_t i = 0; i < size; i++){
+    h ^= bytes[i];
+    h *= 0x100000001b3ull;
+  }
+}
 
+template <typename T>
+static void hashValue(uint64_t& h, const T& v){
+  hashBytes(h, &v, sizeof(T));
+}
+
+// Hash of the parameters the local shape of a node depends on
+static uint64_t shapeHash(const Scene::Node& n){
+  uint64_t h = 0xcbf29ce484222325ull;
+  hashValue(h, n.gp.type);
+  hashValue(h, n.gp.scale);
+  hashValue(h, n.sdp.roundness);
+  hashValue(h, n.sdp.combOp);
+  hashValue(h, n.sdp.smoothness);
+  hashValue(h, n.sdp.repOp);
+  hashValue(h, n.sdp.spacing);
+  hashValue(h, n.sdp.limit);
+  hashValue(h, n.sdp.defOp);
+  hashValue(h, n.sdp.defP);
+  hashValue(h, n.sdp.octaves);
+  hashValue(h, n.sdp.terrain);
+  hashValue(h, n.sdp.morphPrim);
+  hashValue(h, n.sdp.morph);
+  hashValue(h, n.sdp.volume);
+  return h;
+}
+
+void Scene::generateBBox(Node *n) {
   glm::vec3 min, max;
   if(n->gp.type == shaderio::PrimType::Plane){
     min = worldMin;
     max = worldMax;
     max.y = 0.1;
+  }else if(n->gp.type == shaderio::PrimType::Volume && m_volumes.valid(n->sdp.volume)){
+    min = m_volumes.bounds(n->sdp.volume).min();
+    max = m_volumes.bounds(n->sdp.volume).max();
   }else{
     min = glm::vec3(-0.5);
     max = glm::vec3(0.5);
@@ -548,17 +254,35 @@ void Scene::generateBBox(Node *n) {
     max += n->sdp.defP;
   }
 
-  glm::vec3 repOffset = glm::vec3(0.0);
   if (n->sdp.repOp == (int)RepetitionOp::LimRepetition) {
-    repOffset = n->sdp.spacing * glm::vec3(n->sdp.limit);
-  } else if (n->sdp.repOp == (int)RepetitionOp::IlimRepetition) {
-    repOffset =
-        glm::step(0.0001f, n->sdp.spacing) * std::numeric_limits<float>::max();
+    min -= n->sdp.spacing * glm::vec3(n->sdp.limit);
+    max += n->sdp.spacing * glm::vec3(n->sdp.limit);
   }
-  min -= repOffset;
-  max += repOffset;
 
+  // The box above only bounds the fit. Moving or rotating a node reuses the
+  // fitted box.
   nvutils::Bbox bboxt(min, max);
+  uint64_t key = shapeHash(*n);
+  if (n->gp.type == shaderio::PrimType::Volume)
+    hashValue(key, m_volumes.hash(n->sdp.volume));
+  if (key != n->gp.shapeKey) {
+    n->gp.localBbox = fitLocalBBox(*n, bboxt);
+    n->gp.shapeKey = key;
+  }
+  bboxt = n->gp.localBbox;
+
+  // Unlimited repetitions fit one copy, the world box spans the repeated axes
+  if (n->sdp.repOp == (int)RepetitionOp::IlimRepetition) {
+    min = bboxt.min();
+    max = bboxt.max();
+    for (int i = 0; i < 3; i++) {
+      if (n->sdp.spacing[i] > 0.0f) {
+        min[i] = -std::numeric_limits<float>::max();
+        max[i] = std::numeric_limits<float>::max();
+      }
+    }
+    bboxt = nvutils::Bbox(min, max);
+  }
   bboxt = bboxt.transform(glm::inverse(n->gp.tInv));
 
   min = glm::max(bboxt.min(), worldMin);
@@ -567,6 +291,244 @@ void Scene::generateBBox(Node *n) {
   n->gp.bbox = nvutils::Bbox(min, max);
 }
 
+// Fitted boxes keep every point whose distance is below this slack, relative
+// to the node scale, so boxes stay conservative where the SDF underestimates
+static const float BOUND_SLACK = 0.05f;
+// Precision of the fitted faces, relative to the node scale
+static const float BOUND_CELL = 0.02f;
+// Cells are split across a face down to this fraction of the box
+static const float BOUND_CROSS_CELLS = 8.0f;
+// Interval evaluations spent per face, the face stops at the farthest cell
+// left when they run out
+static const int BOUND_FACE_BUDGET = 256;
+
+// Moves the min or max face of box along axis inwards, up to the farthest cell
+// where the distance can be at most margin. Cells are visited farthest first
+// so the search stops at the first one that can't be split further.
+// False if no cell of the box gets that close.
+static bool fitFace(const SdfTape& tape, IntervalBox& box, int axis, bool max, float margin, float minCell){
+  glm::vec3 res = (box.hi - box.lo) / BOUND_CROSS_CELLS;
+  res[axis] = minCell;
+
+  auto face = [&](const IntervalBox& b){ return max ? b.hi[axis] : b.lo[axis]; };
+  auto closer = [&](const IntervalBox& a, const IntervalBox& b){ return max ? a.hi[axis] < b.hi[axis] : a.lo[axis] > b.lo[axis]; };
+  std::priority_queue<IntervalBox, std::vector<IntervalBox>, decltype(closer)> cells(closer);
+  cells.push(box);
+
+  for(int budget = BOUND_FACE_BUDGET; !cells.empty(); budget--){
+    const IntervalBox b = cells.top();
+    cells.pop();
+    if(budget <= 0){
+      (max ? box.hi[axis] : box.lo[axis]) = face(b);
+      return true;
+    }
+
+    Interval d = tape.evalInterval(b);
+    const float pad = roundingPad(d);
+    if(d.lo - pad > margin)
+      continue;
+
+    int split = -1;
+    float ratio = 1.0f;
+    for(int i = 0; i < 3; i++){
+      const float r = (b.hi[i] - b.lo[i]) / res[i];
+      if(r > ratio){
+        split = i;
+        ratio = r;
+      }
+    }
+    if(d.hi + pad <= margin || split < 0 || b.hi[axis] - b.lo[axis] <= minCell){
+      (max ? box.hi[axis] : box.lo[axis]) = face(b);
+      return true;
+    }
+
+    const float mid = 0.5f * (b.lo[split] + b.hi[split]);
+    IntervalBox first = b, second = b;
+    first.hi[split] = mid;
+    second.lo[split] = mid;
+    cells.push(first);
+    cells.push(second);
+  }
+  return false;
+}
+
+// Box around the points of loose where the node SDF, without its transform,
+// reaches below the slack or the smooth combination range. Every face is
+// fitted by interval subdivision inside the faces fitted before it.
+// Unlimited repetitions fit the copy at the origin inside its cell.
+nvutils::Bbox Scene::fitLocalBBox(const Node& n, const nvutils::Bbox& loose) {
+  Node local = n;
+  local.gp.tInv = glm::mat4(1.0f);
+  local.gp.bbox = loose;
+  local.sdp.combOp = (int)CombinationOp::Union;
+
+  IntervalBox box = {loose.min(), loose.max()};
+  if (n.sdp.repOp == (int)RepetitionOp::IlimRepetition) {
+    local.sdp.repOp = (int)RepetitionOp::NoneOP;
+    for (int i = 0; i < 3; i++) {
+      if (n.sdp.spacing[i] > 0.0f) {
+        box.lo[i] = glm::max(box.lo[i], -0.5f * n.sdp.spacing[i]);
+        box.hi[i] = glm::min(box.hi[i], 0.5f * n.sdp.spacing[i]);
+      }
+    }
+  }
+  SdfTape tape;
+  tape.setVolumes(&m_volumes);
+  compileNode(local, tape);
+
+  const bool smooth = n.sdp.combOp >= 2;
+  const float margin = BOUND_SLACK * n.gp.scale + (smooth ? 4.0f * n.sdp.smoothness : 0.0f);
+  const float minCell = BOUND_CELL * n.gp.scale;
+
+  const IntervalBox domain = box;
+  for(int face = 0; face < 6; face++){
+    // Nothing is close to the surface, keep the whole domain
+    if(!fitFace(tape, box, face / 2, face % 2 == 1, margin, minCell))
+      return nvutils::Bbox(domain.lo, domain.hi);
+  }
+  return nvutils::Bbox(box.lo, box.hi);
+}
+
+Scene::Lattice Scene::nodeLattice(const Node& n) const {
+  if (n.sdp.repOp != (int)RepetitionOp::IlimRepetition)
+    return {};
+  return {n.gp.localBbox, glm::max(n.sdp.spacing, glm::vec3(0.0f)), n.gp.tInv};
+}
+
+//------------------
+// SDF tape
+//------------------
+
+// Flattens a node into a tape segment, stages that do nothing are left out
+void Scene::compileNode(const Node& n, SdfTape& tape) {
+  const GeneralParams& gp = n.gp;
+  const SDFParams& sdp = n.sdp;
+
+  // The BVH may skip a node when its box is farther than the current distance,
+  // which only matches the unculled result when the SDF never goes below the
+  // distance to the box. Clamped boxes can be closer than their box says, and
+  // terrain, morphs and the smooth unions inside the snowman are bounds that
+  // may return less than the distance.
+  const glm::vec3 bMin = gp.bbox.min();
+  const glm::vec3 bMax = gp.bbox.max();
+  const bool cullable =
+    glm::all(glm::greaterThan(bMin, worldMin)) && glm::all(glm::lessThan(bMax, worldMax)) &&
+    glm::all(glm::lessThanEqual(bMin, bMax)) &&
+    sdp.octaves == 0 && sdp.morph <= 0.0 && gp.type != shaderio::PrimType::Snowman;
+
+  tape.beginSegment(n.id, sdp.octaves > 0, n.pyp.physicsActive, gp.bbox, cullable);
+
+  if (gp.tInv != glm::mat4(1.0f)) {
+    const glm::mat4& m = gp.tInv;
+    tape.emit(TapeOp::Transform, {
+      m[0][0], m[0][1], m[0][2],
+      m[1][0], m[1][1], m[1][2],
+      m[2][0], m[2][1], m[2][2],
+      m[3][0], m[3][1], m[3][2],
+    });
+  }
+
+  if (sdp.repOp == (int)RepetitionOp::LimRepetition) {
+    tape.emit(TapeOp::LimRepetition, {
+      sdp.spacing.x, sdp.spacing.y, sdp.spacing.z,
+      float(sdp.limit.x), float(sdp.limit.y), float(sdp.limit.z),
+    });
+  } else if (sdp.repOp == (int)RepetitionOp::IlimRepetition) {
+    tape.emit(TapeOp::IlimRepetition, {sdp.spacing.x, sdp.spacing.y, sdp.spacing.z});
+    // Only the nearest copy is evaluated, it is culled against its cell box
+    const glm::vec3 cMin = gp.localBbox.min();
+    const glm::vec3 cMax = gp.localBbox.max();
+    if (sdp.combOp == (int)CombinationOp::Union && glm::all(glm::lessThanEqual(cMin, cMax))) {
+      tape.emit(TapeOp::CellCull, {cMin.x, cMin.y, cMin.z, cMax.x, cMax.y, cMax.z});
+    }
+  }
+
+  if (sdp.defOp == (int)DeformationOp::Elongate) {
+    tape.emit(TapeOp::Elongate, {sdp.defP.x, sdp.defP.y, sdp.defP.z});
+  }
+
+  if (gp.scale != 1.0f) {
+    tape.emit(TapeOp::Scale, {gp.scale});
+  }
+
+  switch (gp.type) {
+    case shaderio::PrimType::Box:     tape.emit(TapeOp::Box, {sdp.roundness}); break;
+    case shaderio::PrimType::Sphere:  tape.emit(TapeOp::Sphere, {sdp.roundness}); break;
+    case shaderio::PrimType::Torus:   tape.emit(TapeOp::Torus, {sdp.roundness}); break;
+    case shaderio::PrimType::Snowman: tape.emit(TapeOp::Snowman, {sdp.roundness}); break;
+    case shaderio::PrimType::Plane:   tape.emit(TapeOp::Plane, {sdp.roundness}); break;
+    case shaderio::PrimType::Volume:  tape.emit(TapeOp::Volume, {sdp.volume, sdp.roundness}); break;
+    default:                          tape.emit(TapeOp::Empty, {sdp.roundness}); break;
+  }
+
+  if (sdp.octaves > 0) {
+    tape.emit(TapeOp::Terrain, {
+      sdp.octaves,
+      sdp.terrain.x, sdp.terrain.y, sdp.terrain.z, sdp.terrain.w,
+      float(shaderio::VOXEL_SIZES[0]/10.0),
+    });
+  }
+
+  if (sdp.morph > 0.0) {
+    tape.emit(TapeOp::Morph, {sdp.morphPrim, sdp.morph, sdp.roundness});
+  }
+
+  switch (sdp.combOp) {
+    case 1:  tape.emit(TapeOp::Substraction, {gp.scale}); break;
+    case 2:  tape.emit(TapeOp::SmoothUnion, {gp.scale, sdp.smoothness}); break;
+    case 3:  tape.emit(TapeOp::SmoothSubstraction, {gp.scale, sdp.smoothness}); break;
+    default: tape.emit(TapeOp::Union, {gp.scale}); break;
+  }
+
+  tape.endSegment();
+}
+
+// Brings the tape up to date with m_root. Nodes flagged by markRefresh are
+// recompiled in place, added, removed or reordered nodes rebuild the tape.
+void Scene::updateTape() {
+  const std::vector<SdfTape::Segment>& segments = m_tape.segments();
+  if (m_tapeDirty.empty() && segments.size() == m_root.size()) {
+    m_tape.updateBvh();
+    return;
+  }
+
+  bool rebuild = segments.size() != m_root.size();
+  for (size_t i = 0; !rebuild && i < m_root.size(); i++) {
+    rebuild = segments[i].nodeId != m_root[i].id;
+  }
+
+  if (!rebuild) {
+    SdfTape program;
+    for (size_t i = 0; !rebuild && i < m_root.size(); i++) {
+      if (!m_tapeDirty.count(m_root[i].id))
+        continue;
+      m_sdfCache.invalidate(segments[i].bbox);
+      m_sdfCache.invalidate(m_root[i].gp.bbox);
+      program.clear();
+      compileNode(m_root[i], program);
+      rebuild = !m_tape.replaceSegment(i, program);
+    }
+  }
+
+  if (rebuild) {
+    m_sdfCache.clear();
+    m_tape.clear();
+    for (auto &node : m_root) {
+      compileNode(node, m_tape);
+    }
+  }
+
+  m_tapeDirty.clear();
+  m_tape.updateBvh();
+}
+
+const SdfTape& Scene::getTape(bool waitBvh) {
+  updateTape();
+  if (waitBvh)
+    m_tape.updateBvh(true);
+  return m_tape;
+}
+
 std::vector<nvutils::Bbox> Scene::getAllBboxes() {
   std::vector<nvutils::Bbox> out;
 
@@ -606,6 +568,8 @@ std::vector<shaderio::SceneObject> Scene::getObjects(){
       .defP=glm::vec4(sdp.defP,0),
       .terrain=glm::vec4(sdp.terrain),
       .limit_octaves=glm::ivec4(sdp.limit,sdp.octaves),
+      .cellMin=glm::vec4(p.localBbox.min(),0),
+      .cellMax=glm::vec4(p.localBbox.max(),0),
       .type=int(p.type),
       .combOp=sdp.combOp,
       .repOp=sdp.repOp,
@@ -616,7 +580,8 @@ std::vector<shaderio::SceneObject> Scene::getObjects(){
       .smoothness=sdp.smoothness,
       .morph=sdp.morph,
       .mat=uint(p.mat),
-      .physicsActive=node.pyp.physicsActive
+      .physicsActive=node.pyp.physicsActive,
+      .volume=sdp.volume
     });
   }
 
@@ -700,7 +665,7 @@ void Scene::processDynamicObjects(std::vector<shaderio::DynamicObject> data){
       updateNodeData(&node);
 
       const bool LOG_Y_POS = false;
-      float now = static_cast<float>(ImGui::GetTime());
+      float now = std::chrono::duration<float>(std::chrono::steady_clock::now().time_since_epoch()).count();
       float pos = node.gp.position.y;
       if(pos<3.5 && LOG_Y_POS){
         LOGI("%f, %f\n",now-time,pos);
@@ -713,198 +678,163 @@ void Scene::processDynamicObjects(std::vector<shaderio::DynamicObject> data){
 }
 
 
-bool pointInBBox(const glm::vec3& p, const nvutils::Bbox& bbox) {
-  glm::vec3 min = bbox.min();
-  glm::vec3 max = bbox.max();
-
-  return glm::all(glm::greaterThanEqual(p, min)) &&
-           glm::all(glm::lessThanEqual(p, max));
+// Same as the per-node map() of sdf.slang up to float rounding, the Transform
+// op sums the matrix columns in another order than glm's mat4 * vec4
+float Scene::map(glm::vec3 point, int objIdxExcluded) const {
+  return m_tape.eval(point, objIdxExcluded);
 }
 
-
-float Scene::map(glm::vec3 point, int objIdxExcluded) {
-  const float iniD = 10000.0f;
-  float result = iniD;
-
-  for(int obIdx = 0; obIdx < m_root.size(); obIdx++) {
-    if(obIdx == objIdxExcluded)
-      continue;
-    
-    glm::vec3 p = glm::vec3(point);
-    Node& n = m_root[obIdx];
-    nvutils::Bbox& bbox = n.gp.bbox;
-    Scene::GeneralParams& gp = n.gp;
-    Scene::SDFParams& sdp = n.sdp;
-
-    p = gp.tInv * glm::vec4(p, 1.0);
-
-    p = applyRepOp(sdp.repOp, p, sdp.spacing, sdp.limit);
-
-    p = applyDefOp(sdp.defOp, p, sdp.defP);
-
-    p /= gp.scale;
-
-    float d = evalPrimitive(int(gp.type), p) - sdp.roundness;
-
-    d = d>0.0 ? applyTerrainOp(p, d, sdp.octaves, sdp.terrain, shaderio::VOXEL_SIZES[0]/10.0): d;
-
-    d = sdp.morph>0.0 ? applyMorphOp(p,d,sdp.morphPrim,sdp.morph,sdp.roundness) : d;
-
-    d *= gp.scale;
-
-    result = evalCombOp(sdp.combOp, d, result, sdp.smoothness);
-  }
-
-  return result;
+// Same value as map() plus its exact gradient, one forward mode pass
+float Scene::mapWithGradient(glm::vec3 point, glm::vec3& grad, int objIdxExcluded) const {
+  return m_tape.evalWithGradient(point, grad, objIdxExcluded);
 }
 
-float Scene::mapTerrain(glm::vec3 point) {
-  const float iniD = 10000.0f;
-  float result = iniD;
+// mapWithGradient() through the query cache when it is enabled
+float Scene::mapWithGradientCached(glm::vec3 point, glm::vec3& grad, int objIdxExcluded) {
+  if (!m_useSdfCache)
+    return mapWithGradient(point, grad, objIdxExcluded);
 
-  for(int obIdx = 0; obIdx < m_root.size(); obIdx++) {
-    Node& n = m_root[obIdx];
+  float d;
+  if (m_sdfCache.lookup(point, objIdxExcluded, d, grad))
+    return d;
 
-    if(n.sdp.octaves <= 0)
-      continue;
-    
-    glm::vec3 p = glm::vec3(point);
-    nvutils::Bbox& bbox = n.gp.bbox;
-    Scene::GeneralParams& gp = n.gp;
-    Scene::SDFParams& sdp = n.sdp;
-
-    p = gp.tInv * glm::vec4(p, 1.0);
+  d = m_tape.evalWithGradient(point, grad, objIdxExcluded);
+  m_sdfCache.insert(point, objIdxExcluded, d, grad);
+  return d;
+}
 
-    p = applyRepOp(sdp.repOp, p, sdp.spacing, sdp.limit);
+void Scene::setSdfCache(bool enabled, float tolerance) {
+  if (!enabled)
+    m_sdfCache.clear();
+  m_useSdfCache = enabled;
+  m_sdfCache.setTolerance(tolerance);
+}
 
-    p = applyDefOp(sdp.defOp, p, sdp.defP);
+float Scene::mapTerrain(glm::vec3 point) const {
+  return m_tape.evalTerrain(point);
+}
 
-    p /= gp.scale;
+// Job for the bricks of bbox inside the level window, if any. Voxels closer
+// to the box than their clamp value change with it too.
+static void appendLevelBuildJob(const nvutils::Bbox& bbox, const ClipmapCenters& centers, int level, std::vector<shaderio::BuildJob>& jobs){
+  const glm::ivec3 zeros(0);
+  const glm::ivec3 max_index(NUM_BRICKS_PER_AXIS-1);
 
-    float d = evalPrimitive(int(gp.type), p) - sdp.roundness;
+  const float reach = shaderio::MAX_VOXEL_VALUES[level];
+  glm::ivec3 min_id = glm::floor((bbox.min()-reach)/shaderio::BRICK_SIZES[level]);
+  glm::ivec3 max_id = glm::floor((bbox.max()+reach)/shaderio::BRICK_SIZES[level]);
 
-    d = d>0.0 ? applyTerrainOp(p, d, sdp.octaves, sdp.terrain, shaderio::VOXEL_SIZES[0]/10.0): d;
+  glm::ivec3 min_rel_id = centers.relId(min_id, level);
+  glm::ivec3 max_rel_id = centers.relId(max_id, level);
 
-    d = sdp.morph>0.0 ? applyMorphOp(p,d,sdp.morphPrim,sdp.morph,sdp.roundness) : d;
+  // Completly out of range check
+  if(glm::any(glm::lessThan(max_rel_id,zeros)) || glm::any(glm::greaterThan(min_rel_id,max_index)))
+    return;
 
-    d *= gp.scale;
+  // Clamp min and max to relative ids bounds
+  min_rel_id = glm::max(min_rel_id,zeros);
+  max_rel_id = glm::min(max_rel_id,max_index);
 
-    result = evalCombOp(sdp.combOp, d, result, sdp.smoothness);
-  }
+  // Calculate number of bricks
+  glm::ivec3 num_b = glm::abs(min_rel_id - max_rel_id) + glm::ivec3(1);
 
-  return result;
-}
+  // Convert back to global id
+  min_id = min_rel_id + centers[level] - (NUM_BRICKS_PER_AXIS/2);
 
-glm::vec3 Scene::evalNormal(glm::vec3 p, int objIdxExcluded) {
-  const float h = 0.0001f;
-  const glm::vec2 k = glm::vec2(1.0f, -1.0f);
-  
-  return glm::normalize(
-      glm::vec3(k.x, k.y, k.y) * map(p + glm::vec3(k.x, k.y, k.y) * h, objIdxExcluded) +
-      glm::vec3(k.y, k.y, k.x) * map(p + glm::vec3(k.y, k.y, k.x) * h, objIdxExcluded) +
-      glm::vec3(k.y, k.x, k.y) * map(p + glm::vec3(k.y, k.x, k.y) * h, objIdxExcluded) +
-      glm::vec3(k.x, k.x, k.x) * map(p + glm::vec3(k.x, k.x, k.x) * h, objIdxExcluded)
-  );
+  jobs.push_back({
+    .min_id_level=glm::ivec4(min_id,level),
+    .num_b=glm::ivec4(num_b,0)
+  });
 }
 
-std::vector<float> Scene::generateDenseGrid() {
-  glm::vec3 center = glm::vec3(0.5, 0.5, 0.5);
-  const int num_values_per_axis = shaderio::NUM_VALUES_PER_AXIS;
-  int total_voxels =
-      num_values_per_axis * num_values_per_axis * num_values_per_axis;
-  std::vector<float> data(total_voxels);
-
-  int axis_size = num_values_per_axis;
-  int axis_size_sq = axis_size * axis_size;
-  float voxel_size = 1 / float(axis_size);
-  float max_d = glm::sqrt(3.0 * 2.5 * 2.5 * voxel_size * voxel_size);
-
-  // If empty scene
-  if (m_root.size() <= 0) {
-    for (int i = 0; i < total_voxels; i++) {
-      data[i] = 10000.f;
-    }
-  } else {
-#pragma omp parallel for schedule(static)
-    for (int i = 0; i < total_voxels; i++) {
-      int z = i / axis_size_sq;
-      int y = (i % axis_size_sq) / axis_size;
-      int x = i % axis_size;
-      glm::vec3 point = (glm::vec3(x,y,z) * voxel_size - center);
-
-      float d = glm::min(map(point), max_d);
+std::vector<shaderio::BuildJob> Scene::createBaseBuildJobs(nvutils::Bbox bbox, const ClipmapCenters& centers){
+  std::vector<shaderio::BuildJob> jobs;
 
-      data[z * axis_size_sq + y * axis_size + x] = d;
-    }
+  //for(int level=CLIPMAP_LEVELS-1 ; level>=0; level--){
+  for(int level=0 ; level<CLIPMAP_LEVELS; level++){
+    appendLevelBuildJob(bbox, centers, level, jobs);
   }
 
-  return data;
+  return jobs;
 }
 
-std::vector<shaderio::BuildJob> Scene::createBaseBuildJobs(nvutils::Bbox bbox, glm::ivec3 camId0){
-  const glm::ivec3 zeros(0);
-  const glm::ivec3 max_index(NUM_BRICKS_PER_AXIS-1);
-  const glm::ivec3 hole_min(NUM_BRICKS_PER_AXIS/4+1);
-  const glm::ivec3 hole_max(NUM_BRICKS_PER_AXIS*3/4);
-  
-  std::vector<shaderio::BuildJob> jobs;
-  
-  //for(int level=CLIPMAP_LEVELS-1 ; level>=0; level--){
-  for(int level=0 ; level<CLIPMAP_LEVELS; level++){
-    glm::ivec3 camId = camId0>>level;
-
-    glm::ivec3 min_id = glm::floor(bbox.min()/shaderio::BRICK_SIZES[level]);
-    glm::ivec3 max_id = glm::floor(bbox.max()/shaderio::BRICK_SIZES[level]);
+// Most copies a level is rebuilt one by one with
+static const int64_t MAX_LATTICE_COPIES = 512;
 
-    glm::ivec3 min_rel_id = min_id - camId + (NUM_BRICKS_PER_AXIS/2);
-    glm::ivec3 max_rel_id = max_id - camId + (NUM_BRICKS_PER_AXIS/2);
+// Builds the copies of the lattice inside bbox and each level window only.
+// Levels with too many copies, or copies covering more bricks than the
+// window, rebuild the whole window instead.
+std::vector<shaderio::BuildJob> Scene::createLatticeBuildJobs(const nvutils::Bbox& bbox, const Lattice& lattice, const ClipmapCenters& centers){
+  std::vector<shaderio::BuildJob> jobs;
+  const glm::mat4 toWorld = glm::inverse(lattice.tInv);
+  const glm::vec3 cellMin = lattice.cell.min();
+  const glm::vec3 cellMax = lattice.cell.max();
+  const glm::vec3 copyExtent = nvutils::Bbox(cellMin, cellMax).transform(toWorld).extents();
 
-    // Completly out of range check
-    if(glm::any(glm::lessThan(max_rel_id,zeros)) || glm::any(glm::greaterThan(min_rel_id,max_index)))
+  for(int level=0 ; level<CLIPMAP_LEVELS; level++){
+    const float brickSize = shaderio::BRICK_SIZES[level];
+    const glm::ivec3 center = centers[level];
+    const glm::vec3 windowMin = glm::max(glm::vec3(center - NUM_BRICKS_PER_AXIS/2) * brickSize, bbox.min());
+    const glm::vec3 windowMax = glm::min(glm::vec3(center + NUM_BRICKS_PER_AXIS/2) * brickSize, bbox.max());
+    if(glm::any(glm::greaterThan(windowMin, windowMax)))
       continue;
-
-    // Completly inside the hole in levels > 0
-    if(
-      level > 0 &&
-      glm::all(glm::greaterThanEqual(min_rel_id,hole_min)) &&
-      glm::all(glm::lessThan(max_rel_id,hole_max))
-    )
+    const nvutils::Bbox window(windowMin, windowMax);
+
+    // Copies whose cell box touches the window in node space
+    const nvutils::Bbox local = window.transform(lattice.tInv);
+    glm::ivec3 kMin(0), kMax(0);
+    int64_t copies = 1;
+    for(int i = 0; i < 3; i++){
+      if(lattice.spacing[i] > 0.0f){
+        const float lo = glm::ceil((local.min()[i] - cellMax[i]) / lattice.spacing[i]);
+        const float hi = glm::floor((local.max()[i] - cellMin[i]) / lattice.spacing[i]);
+        if(hi - lo + 1.0f > float(MAX_LATTICE_COPIES)){
+          copies = MAX_LATTICE_COPIES + 1;
+          break;
+        }
+        kMin[i] = int(lo);
+        kMax[i] = int(hi);
+      }else if(cellMax[i] < local.min()[i] || cellMin[i] > local.max()[i]){
+        kMax[i] = -1;
+      }
+      copies *= glm::max(kMax[i] - kMin[i] + 1, 0);
+    }
+    if(copies == 0)
       continue;
 
-    // Clamp min and max to relative ids bounds
-    min_rel_id = glm::max(min_rel_id,zeros);
-    max_rel_id = glm::min(max_rel_id,max_index);
-
-    // Calculate number of bricks
-    glm::ivec3 num_b = glm::abs(min_rel_id - max_rel_id) + glm::ivec3(1);
-
-    // Convert back to global id
-    min_id = min_rel_id + camId - (NUM_BRICKS_PER_AXIS/2);
+    const glm::vec3 copyBricks = glm::floor(copyExtent / brickSize) + 2.0f;
+    const glm::vec3 windowBricks = glm::floor(window.extents() / brickSize) + 1.0f;
+    if(copies > MAX_LATTICE_COPIES ||
+       double(copies) * copyBricks.x * copyBricks.y * copyBricks.z >= double(windowBricks.x) * windowBricks.y * windowBricks.z){
+      appendLevelBuildJob(window, centers, level, jobs);
+      continue;
+    }
 
-    jobs.push_back({
-      .min_id_level=glm::ivec4(min_id,level),
-      .num_b=glm::ivec4(num_b,0)
-    });
+    for(int z = kMin.z; z <= kMax.z; z++)
+      for(int y = kMin.y; y <= kMax.y; y++)
+        for(int x = kMin.x; x <= kMax.x; x++){
+          const glm::vec3 offset = glm::vec3(x, y, z) * lattice.spacing;
+          appendLevelBuildJob(nvutils::Bbox(cellMin + offset, cellMax + offset).transform(toWorld), centers, level, jobs);
+        }
   }
 
   return jobs;
 }
 
-std::vector<shaderio::BuildJob> Scene::createCamBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0){
+// Windows and holes move on their own, a hole follows the center of the
+// level below. Bricks entering or leaving a hole are rebuilt for their RTX
+// instance mask, their payload stays.
+std::vector<shaderio::BuildJob> Scene::createCamBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters){
   std::vector<shaderio::BuildJob> out;
 
   for(int level=0; level<CLIPMAP_LEVELS; level++){
-    glm::ivec3 currCamId = currCamId0>>level;
+    glm::ivec3 currCamId = currCenters[level];
     glm::ivec3 currMinId = currCamId - NUM_BRICKS_PER_AXIS/2;
     glm::ivec3 currMaxId = currCamId + NUM_BRICKS_PER_AXIS/2;
-    glm::ivec3 currHMinId = currCamId - NUM_BRICKS_PER_AXIS/4 + 1;
-    glm::ivec3 currHMaxId = currCamId + NUM_BRICKS_PER_AXIS/4;
 
-    glm::ivec3 prevCamId = prevCamId0>>level;
+    glm::ivec3 prevCamId = prevCenters[level];
     glm::ivec3 prevMinId = prevCamId - NUM_BRICKS_PER_AXIS/2;
     glm::ivec3 prevMaxId = prevCamId + NUM_BRICKS_PER_AXIS/2;
-    glm::ivec3 prevHMinId = prevCamId - NUM_BRICKS_PER_AXIS/4 + 1;
-    glm::ivec3 prevHMaxId = prevCamId + NUM_BRICKS_PER_AXIS/4;
 
     for(int axis = 0; axis < 3; ++axis){
       if(prevCamId[axis] == currCamId[axis])
@@ -926,42 +856,56 @@ std::vector<shaderio::BuildJob> Scene::createCamBuildJobs(glm::ivec3 currCamId0,
         .min_id_level=glm::ivec4(minId,level),
         .num_b=glm::ivec4(num_b,0)
       });
+    }
 
-      if(level > 0){
-        // Hole area -> Grid inner reach
-        minId = prevHMinId;
-        maxId = prevHMaxId;
+    if(level == 0)
+      continue;
 
-        if(prevCamId[axis] <= currCamId[axis]){
-          maxId[axis] = currHMinId[axis];
-        }else{
-          minId[axis] = currHMaxId[axis];
-        }
+    glm::ivec3 currHoleId = currCenters.holeCenter(level);
+    glm::ivec3 currHMinId = currHoleId - NUM_BRICKS_PER_AXIS/4 + 1;
+    glm::ivec3 currHMaxId = currHoleId + NUM_BRICKS_PER_AXIS/4;
 
-        num_b = glm::abs(minId - maxId);
+    glm::ivec3 prevHoleId = prevCenters.holeCenter(level);
+    glm::ivec3 prevHMinId = prevHoleId - NUM_BRICKS_PER_AXIS/4 + 1;
+    glm::ivec3 prevHMaxId = prevHoleId + NUM_BRICKS_PER_AXIS/4;
 
-        out.push_back({
-          .min_id_level=glm::ivec4(minId,level),
-          .num_b=glm::ivec4(num_b,0)
-        });
+    for(int axis = 0; axis < 3; ++axis){
+      if(prevHoleId[axis] == currHoleId[axis])
+        continue;
 
-        // Grid inner reach -> Hole area
-        minId = currHMinId;
-        maxId = currHMaxId;
+      // Hole area -> Grid inner reach
+      glm::ivec3 minId = prevHMinId;
+      glm::ivec3 maxId = prevHMaxId;
 
-        if(prevCamId[axis] <= currCamId[axis]){
-          minId[axis] = prevHMaxId[axis];
-        }else{
-          maxId[axis] = prevHMinId[axis];
-        }
+      if(prevHoleId[axis] <= currHoleId[axis]){
+        maxId[axis] = currHMinId[axis];
+      }else{
+        minId[axis] = currHMaxId[axis];
+      }
+
+      glm::ivec3 num_b = glm::abs(minId - maxId);
+
+      out.push_back({
+        .min_id_level=glm::ivec4(minId,level),
+        .num_b=glm::ivec4(num_b,0)
+      });
 
-        num_b = glm::abs(minId - maxId);
+      // Grid inner reach -> Hole area
+      minId = currHMinId;
+      maxId = currHMaxId;
 
-        out.push_back({
-          .min_id_level=glm::ivec4(minId,level),
-          .num_b=glm::ivec4(num_b,0)
-        });
+      if(prevHoleId[axis] <= currHoleId[axis]){
+        minId[axis] = prevHMaxId[axis];
+      }else{
+        maxId[axis] = prevHMinId[axis];
       }
+
+      num_b = glm::abs(minId - maxId);
+
+      out.push_back({
+        .min_id_level=glm::ivec4(minId,level),
+        .num_b=glm::ivec4(num_b,0)
+      });
     }
   }
 
@@ -998,40 +942,57 @@ std::vector<shaderio::BuildJob> Scene::splitBuildJob(shaderio::BuildJob buildJ){
   return out;
 }
 
-std::vector<shaderio::BuildJob> Scene::getBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0){
-  std::vector<nvutils::Bbox> aabbs;
+static uint64_t jobBricks(std::span<const shaderio::BuildJob> jobs){
+  uint64_t bricks = 0;
+  for(const shaderio::BuildJob& job : jobs)
+    bricks += uint64_t(glm::max(job.num_b.x, 0)) * uint64_t(glm::max(job.num_b.y, 0)) * uint64_t(glm::max(job.num_b.z, 0));
+  return bricks;
+}
+
+// Replaces the jobs of every level by disjoint ones covering the same bricks,
+// so bricks in several regions are only dispatched once
+std::vector<shaderio::BuildJob> Scene::coalesceBuildJobs(const std::vector<shaderio::BuildJob>& jobs){
+  std::vector<shaderio::BuildJob> out = BuildQueue::coalesce(jobs);
+  m_buildJobStats.requestedBricks += jobBricks(jobs);
+  m_buildJobStats.uniqueBricks += jobBricks(out);
+  return out;
+}
+
+std::vector<shaderio::BuildJob> Scene::getBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters){
+  std::vector<std::pair<nvutils::Bbox, Lattice>> regions;
   std::vector<shaderio::BuildJob> out, baseJobs, levelSplitted;
 
   for (auto &node : m_root) {
     if(node.needsRefresh){
-      aabbs.push_back(node.gp.bbox);
-      aabbs.push_back(node.gp.prevBbox);
+      regions.push_back({node.gp.bbox, nodeLattice(node)});
+      regions.push_back({node.gp.prevBbox, node.gp.prevLattice});
       node.gp.prevBbox = nvutils::Bbox(node.gp.bbox);
+      node.gp.prevLattice = nodeLattice(node);
       node.needsRefresh = false;
     }
   }
+  regions.insert(regions.end(), m_removeList.begin(), m_removeList.end());
+  m_removeList.clear();
 
-  out.reserve(aabbs.size()*4+3);
-  baseJobs = createCamBuildJobs(currCamId0,prevCamId0);
-  
-  for(auto& bbox: aabbs){
-    // Negative volume build job check
-    if(glm::any(glm::lessThan(bbox.max(),bbox.min())))
-      continue;
-
-    levelSplitted = createBaseBuildJobs(bbox, currCamId0);
-    baseJobs.insert(baseJobs.end(),levelSplitted.begin(),levelSplitted.end());
-  }
+  m_changedRegions.clear();
+  for(auto& region: regions)
+    m_changedRegions.push_back(region.first);
 
-  for(auto& bbox: m_removeList){
+  out.reserve(regions.size()*4+3);
+  baseJobs = createCamBuildJobs(currCenters,prevCenters);
+  
+  for(auto& [bbox, lattice]: regions){
     // Negative volume build job check
     if(glm::any(glm::lessThan(bbox.max(),bbox.min())))
       continue;
 
-    levelSplitted = createBaseBuildJobs(bbox, currCamId0);
+    if(glm::any(glm::greaterThan(lattice.spacing, glm::vec3(0.0f))) && !lattice.cell.isEmpty())
+      levelSplitted = createLatticeBuildJobs(bbox, lattice, currCenters);
+    else
+      levelSplitted = createBaseBuildJobs(bbox, currCenters);
     baseJobs.insert(baseJobs.end(),levelSplitted.begin(),levelSplitted.end());
   }
-  m_removeList.clear();
+  baseJobs = coalesceBuildJobs(baseJobs);
 
   for(auto& buildJob: baseJobs){
     auto splited = splitBuildJob(buildJob);
@@ -1041,11 +1002,109 @@ std::vector<shaderio::BuildJob> Scene::getBuildJobs(glm::ivec3 currCamId0, glm::
   return out;
 }
 
-std::vector<shaderio::BuildJob> Scene::getDenseBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0){
+std::vector<uint32_t> Scene::getBuildJobObjects(std::span<shaderio::BuildJob> jobs){
+  // Boxes axis by axis so the overlap test vectorizes
+  const uint32_t numObjects = uint32_t(m_root.size());
+  std::vector<float> boxes(6 * size_t(numObjects));
+  for(uint32_t i = 0; i < numObjects; i++){
+    for(int axis = 0; axis < 3; axis++){
+      boxes[(2 * axis) * numObjects + i] = m_root[i].gp.bbox.min()[axis];
+      boxes[(2 * axis + 1) * numObjects + i] = m_root[i].gp.bbox.max()[axis];
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> lists(jobs.size());
+  m_workerPool.parallelFor(uint32_t(jobs.size()), [&](uint32_t j){
+    const shaderio::BuildJob& job = jobs[j];
+    // Release jobs evaluate nothing
+    if(job.min_id_level.w & RELEASE_JOB)
+      return;
+    const int level = job.min_id_level.w & ((1 << BRICK_JOB_LEVEL_BITS) - 1);
+    const float brickSize = shaderio::BRICK_SIZES[level];
+    // map() culls with MAX_BRICK_VALUES, one more voxel covers rounding
+    const float reach = shaderio::MAX_BRICK_VALUES[level] + shaderio::VOXEL_SIZES[level];
+    const glm::vec3 jobMin = glm::vec3(glm::ivec3(job.min_id_level)) * brickSize - reach;
+    const glm::vec3 jobMax = glm::vec3(glm::ivec3(job.min_id_level) + glm::ivec3(job.num_b)) * brickSize + reach;
+
+    std::vector<uint8_t> near(numObjects, 1);
+    for(int axis = 0; axis < 3; axis++){
+      const float* mins = boxes.data() + (2 * axis) * numObjects;
+      const float* maxs = boxes.data() + (2 * axis + 1) * numObjects;
+      for(uint32_t i = 0; i < numObjects; i++)
+        near[i] &= uint8_t(mins[i] <= jobMax[axis]) & uint8_t(jobMin[axis] <= maxs[i]);
+    }
+
+    std::vector<uint32_t>& list = lists[j];
+    list.push_back(0);
+    for(uint32_t i = 0; i < numObjects; i++){
+      if(near[i])
+        list.push_back(i);
+    }
+    list[0] = uint32_t(list.size() - 1);
+  });
+
+  std::vector<uint32_t> out;
+  for(size_t j = 0; j < jobs.size(); j++){
+    if(lists[j].empty() || out.size() + lists[j].size() > size_t(MAX_BUILD_JOB_OBJECTS)){
+      jobs[j].num_b.w = ALL_OBJECTS;
+      continue;
+    }
+    jobs[j].num_b.w = int(out.size());
+    out.insert(out.end(), lists[j].begin(), lists[j].end());
+  }
+  return out;
+}
+
+std::vector<Scene::NodeKey> Scene::getNodeKeys(){
+  std::vector<NodeKey> keys;
+  keys.reserve(m_root.size());
+  for(const Node& n : m_root){
+    uint64_t h = 0xcbf29ce484222325ull;
+    hashValue(h, n.gp.type);
+    hashValue(h, n.gp.mat);
+    hashValue(h, n.gp.position);
+    hashValue(h, n.gp.rotation);
+    hashValue(h, n.gp.scale);
+    hashValue(h, n.sdp.roundness);
+    hashValue(h, n.sdp.combOp);
+    hashValue(h, n.sdp.smoothness);
+    hashValue(h, n.sdp.repOp);
+    hashValue(h, n.sdp.spacing);
+    hashValue(h, n.sdp.limit);
+    hashValue(h, n.sdp.defOp);
+    hashValue(h, n.sdp.defP);
+    hashValue(h, n.sdp.octaves);
+    hashValue(h, n.sdp.terrain);
+    hashValue(h, n.sdp.morphPrim);
+    hashValue(h, n.sdp.morph);
+    if(n.gp.type == shaderio::PrimType::Volume)
+      hashValue(h, m_volumes.hash(n.sdp.volume));
+    keys.push_back({h, n.gp.bbox});
+  }
+  // The edit layer is keyed as one more node
+  if(!m_edits.empty())
+    keys.push_back({m_edits.hash(), m_edits.bounds()});
+  return keys;
+}
+
+void Scene::setRefreshRegions(std::span<const nvutils::Bbox> regions){
+  for(Node& n : m_root){
+    n.needsRefresh = false;
+    n.gp.prevBbox = nvutils::Bbox(n.gp.bbox);
+    n.gp.prevLattice = nodeLattice(n);
+  }
+  // Removals queued before the restore are covered by the restored bricks
+  m_removeList.clear();
+  for(const nvutils::Bbox& bbox : regions)
+    m_removeList.push_back({bbox, Lattice{}});
+  m_needsRefresh = true;
+}
+
+std::vector<shaderio::BuildJob> Scene::getDenseBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters){
   std::vector<shaderio::BuildJob> out, baseJobs;
 
   nvutils::Bbox bbox(glm::vec3(-100000.0),glm::vec3(100000.0));
-  baseJobs = createBaseBuildJobs(bbox,currCamId0);
+  baseJobs = createBaseBuildJobs(bbox,currCenters);
 
   for(auto& buildJob: baseJobs){
     auto splited = splitBuildJob(buildJob);
@@ -1056,10 +1115,109 @@ std::vector<shaderio::BuildJob> Scene::getDenseBuildJobs(glm::ivec3 currCamId0,
 }
 
 
+//------------------
+// Freezing
+//------------------
+
+// Voxel size halvings freezeNodes tries to meet the error bound
+static const int MAX_FREEZE_REFINES = 3;
+
+bool Scene::freezeNodes(int first, int count, float voxelSize, float maxError){
+  if(first < 0 || count < 1 || first + count > int(m_root.size())){
+    LOGW("Can't freeze nodes [%d, %d), the scene has %zu\n", first, first + count, m_root.size());
+    return false;
+  }
+
+  // The range alone, its first node starts it as a plain union
+  SdfTape tape;
+  tape.setVolumes(&m_volumes);
+  nvutils::Bbox box;
+  for(int i = first; i < first + count; i++){
+    Node n = m_root[i];
+    const bool bounded = glm::all(glm::greaterThan(n.gp.bbox.min(), worldMin)) && glm::all(glm::lessThan(n.gp.bbox.max(), worldMax));
+    if(n.needsRemoval || n.pyp.physicsActive || !bounded){
+      LOGW("Node %u can't be frozen, only static nodes with bounded boxes can\n", n.id);
+      return false;
+    }
+    // The frozen node keeps a single material
+    if(n.gp.mat != m_root[first].gp.mat){
+      LOGW("Node %u can't be frozen with node %u, their materials differ\n", n.id, m_root[first].id);
+      return false;
+    }
+    // Inside the range a subtraction only carves the range, the scene nodes
+    // before it would lose the carve
+    const bool subtracts = n.sdp.combOp == (int)CombinationOp::Substraction || n.sdp.combOp == (int)CombinationOp::Substraction + 2;
+    if(i != first && subtracts){
+      LOGW("Node %u can't be frozen after node %u, it subtracts\n", n.id, m_root[first].id);
+      return false;
+    }
+    if(i == first)
+      n.sdp.combOp = (int)CombinationOp::Union;
+    compileNode(n, tape);
+    box.insert(n.gp.bbox);
+  }
+
+  float voxel = voxelSize;
+  float error = 0.0f;
+  int volume = -1;
+  for(int refine = 0; ; refine++){
+    volume = m_volumes.bake(tape, box, voxel, m_workerPool, error);
+    if(volume < 0 || error <= maxError)
+      break;
+    m_volumes.release(volume);
+    volume = -1;
+    if(refine == MAX_FREEZE_REFINES)
+      break;
+    voxel *= 0.5f;
+  }
+  if(volume < 0){
+    if(error > maxError)
+      LOGW("Freezing %d nodes stays %f away from them at voxel size %f, above %f\n", count, error, voxel, maxError);
+    else
+      LOGW("The volume of %d nodes at voxel size %f doesn't fit in the volume buffers\n", count, voxel);
+    return false;
+  }
+  LOGI("Froze %d nodes into volume %d, voxel size %f, error %f\n", count, volume, voxel, error);
+
+  const Node& firstNode = m_root[first];
+  Node frozen = firstNode;
+  frozen.id = getNextId();
+  frozen.needsRefresh = false;
+  frozen.gp.type = shaderio::PrimType::Volume;
+  frozen.gp.position = box.center();
+  frozen.gp.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  frozen.gp.scale = 1.0f;
+  frozen.gp.shapeKey = 0;
+  frozen.sdp = {
+    .combOp = firstNode.sdp.combOp,
+    .smoothness = firstNode.sdp.smoothness,
+    .terrain = glm::vec4(1.0,0.5,0.1,0.3),
+    .volume = volume,
+  };
+  frozen.pyp = {
+    .density = 1.0,
+  };
+
+  for(int i = first; i < first + count; i++)
+    m_removeList.push_back({m_root[i].gp.bbox, nodeLattice(m_root[i])});
+  m_root.erase(m_root.begin() + first, m_root.begin() + first + count);
+  m_root.insert(m_root.begin() + first, frozen);
+  updateNodeData(&m_root[first]);
+  releaseUnusedVolumes();
+
+  m_selected = first;
+  m_needsRefresh = true;
+  return true;
+}
+
+
 //------------------
 // Constructor
 //------------------
 Scene::Scene() {
+  m_tape.setEdits(&m_edits);
+  m_tape.setVolumes(&m_volumes);
+
   Material mat = createMaterial();
   mat.name = "Default";
   mat.shininess = 1.0;
@@ -5,15 +5,22 @@
 #include <glm/ext/vector_int3_sized.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include "nvutils/bounding_box.hpp"
-#include <imgui.h>
+#include <functional>
+#include <span>
 #include <string>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include "../shaders/shaderio.h"
-#include <nvvk/profiler_vk.hpp>
-#include "ImGuizmo.h"
+#include "clipmap_centers.hpp"
+#include "edit_layer.hpp"
+#include "sampled_volumes.hpp"
+#include "sdf_cache.hpp"
+#include "sdf_tape.hpp"
+#include "thread_pool.hpp"
 
 static constexpr const char * PrimTypeNames[] = {
-    "Empty", "Box", "Sphere", "Torus", "Snowman", "Plane"
+    "Empty", "Box", "Sphere", "Torus", "Snowman", "Plane", "Volume"
 };
 
 static constexpr const char *CombinationOpNames[] = {
@@ -47,6 +54,14 @@ public:
   enum class DeformationOp { NoneOP, Elongate };
   enum class UserAction { NoneAction, Launch, Carve, Tunnel };
 
+  // Unlimited repetition of a node: copies of cell, a box in node space, every
+  // spacing along the axes with a non zero spacing. No spacing, no copies.
+  struct Lattice {
+    nvutils::Bbox cell;
+    glm::vec3 spacing{0.0f};
+    glm::mat4 tInv{1.0f};
+  };
+
   struct GeneralParams{
     shaderio::PrimType type;
     int mat;
@@ -56,11 +71,19 @@ public:
     float scale;
     nvutils::Bbox bbox;
     nvutils::Bbox prevBbox;
+    nvutils::Bbox localBbox;  // Bounds fitted to the SDF before the transform, one copy for unlimited repetitions
+    uint64_t shapeKey;        // Hash of the parameters localBbox was fitted for
+    Lattice prevLattice;      // Copies prevBbox was built for
   };
 
+  // Editor gizmo state saved with the node. Op and mode hold ImGuizmo
+  // OPERATION and MODE values, the core only sets the defaults.
+  static constexpr int GUIZMO_TRANSLATE = 7;
+  static constexpr int GUIZMO_WORLD = 1;
+
   struct GuizmoParams{
-    ImGuizmo::OPERATION guizmoOp;
-    ImGuizmo::MODE guizmoMode;
+    int guizmoOp;
+    int guizmoMode;
     glm::mat4 matrix;
   };
 
@@ -92,6 +115,7 @@ public:
     glm::vec4 terrain;
     int morphPrim;
     float morph;
+    int volume;         // Sampled volume of Volume nodes
   };
 
   struct Node {
@@ -116,42 +140,137 @@ public:
 
   Scene();
 
-  void draw();
-  void drawGuizmo(ImVec2 viewportPos, ImVec2 viewportSize, glm::mat4 cameraView, glm::mat4 cameraProjection);
-
   void simulate(float dts, int substeps);
   void processDynamicObjects(std::vector<shaderio::DynamicObject> data);
 
-  void userAction(glm::vec3 pos, glm::vec3 dir, float dts);
-  void drawUserActionMenu();
+  // Runs the configured user action from pos along dir, at most once every
+  // m_userActionDelay seconds of time
+  void userAction(glm::vec3 pos, glm::vec3 dir, float dts, float time);
 
   bool saveToFile(const std::string& path);
   bool loadFromFile(const std::string& path);
 
+  // Distance grid of NUM_VALUES_PER_AXIS³ samples over [-0.5, 0.5)³. Values
+  // are clamped to ±2.5 voxel diagonals, blocks of the grid farther than that
+  // from the surface are found with interval bounds and never evaluated.
+  struct SparseGrid {
+    static constexpr int BLOCK_SIZE = 8;
+    static constexpr int BLOCKS_PER_AXIS = shaderio::NUM_VALUES_PER_AXIS / BLOCK_SIZE;
+    static constexpr int32_t UNIFORM_POSITIVE = -1;
+    static constexpr int32_t UNIFORM_NEGATIVE = -2;
+
+    float positiveValue;                  // Value of every far outside sample
+    float negativeValue;                  // Value of every far inside sample
+    std::vector<int32_t> blocks;          // BLOCKS_PER_AXIS³, index of the block in values or UNIFORM_*
+    std::vector<float> values;            // BLOCK_SIZE³ per stored block, x fastest
+
+    float sample(glm::ivec3 v) const {
+      glm::ivec3 b = v / BLOCK_SIZE;
+      int32_t block = blocks[(b.z * BLOCKS_PER_AXIS + b.y) * BLOCKS_PER_AXIS + b.x];
+      if(block == UNIFORM_POSITIVE) return positiveValue;
+      if(block == UNIFORM_NEGATIVE) return negativeValue;
+      glm::ivec3 o = v % BLOCK_SIZE;
+      return values[size_t(block) * BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE + (o.z * BLOCK_SIZE + o.y) * BLOCK_SIZE + o.x];
+    }
+  };
+
+  // Receives the dense grid one z slice at a time, in increasing z
+  using GridSliceSink = std::function<void(int z, std::span<const float> slice)>;
+
+  SparseGrid generateSparseGrid();
+  void generateDenseGrid(const GridSliceSink& sink);
   std::vector<float> generateDenseGrid();
   void flushDeletedNodes();
   std::vector<nvutils::Bbox> getAllBboxes();
   std::vector<shaderio::SceneObject> getObjects();
   std::vector<shaderio::DynamicObject> getDynamicObjects();
   std::vector<shaderio::Material> getMaterials();
-  std::vector<shaderio::BuildJob> getBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0);
-  std::vector<shaderio::BuildJob> getDenseBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0);
+  std::vector<shaderio::BuildJob> getBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters);
+  std::vector<shaderio::BuildJob> getDenseBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters);
+  // Object lists the brick evaluation of each job loops over instead of every
+  // object: the count, then the indices of the nodes whose box is within the
+  // voxel reach of the job bricks, in scene order. num_b.w of every job gets
+  // the first word of its list, or ALL_OBJECTS once MAX_BUILD_JOB_OBJECTS
+  // words are used. RELEASE_JOB jobs get ALL_OBJECTS and no list.
+  std::vector<uint32_t> getBuildJobObjects(std::span<shaderio::BuildJob> jobs);
+
+  // Bricks covered by the regions getBuildJobs was asked to rebuild, and the
+  // distinct ones left after merging the overlapping regions of every level
+  struct BuildJobStats {
+    uint64_t requestedBricks;
+    uint64_t uniqueBricks;
+  };
+  const BuildJobStats& getBuildJobStats() const { return m_buildJobStats; }
+  void resetBuildJobStats() { m_buildJobStats = {}; }
+
+  // World boxes of the regions the last getBuildJobs rebuilt, camera moves
+  // not included
+  const std::vector<nvutils::Bbox>& getChangedRegions() const { return m_changedRegions; }
+
+  // Hash of the parameters of a node that change its distance field, and its
+  // bounds, the edit layer counts as one last node. Baked bricks stay valid
+  // while the keys of the scene match.
+  struct NodeKey {
+    uint64_t hash;
+    nvutils::Bbox bbox;
+  };
+  std::vector<NodeKey> getNodeKeys();
+
+  // Replaces the full build of the next getBuildJobs with builds of the given
+  // regions only, for when the bricks elsewhere were restored from a cache
+  void setRefreshRegions(std::span<const nvutils::Bbox> regions);
+
+  // Compiles pending edits. The tape can be evaluated from several threads
+  // until the scene changes, its segments follow the order of getObjects().
+  // waitBvh blocks until the union run BVHs are built.
+  const SdfTape& getTape(bool waitBvh = false);
+
+  // Sphere tracing limits shared by every tracer of the scene
+  static constexpr int   TRACE_MAX_ITERATIONS = shaderio::NUM_VOXELS_PER_AXIS * int(CLIPMAP_LEVELS*0.5);
+  static constexpr float TRACE_MIN_DIST = 0.0001f;
+  static constexpr float TRACE_MAX_DEPTH = 100.0f;
+
+  struct Ray {
+    glm::vec3 orig;
+    glm::vec3 dir;                        // Normalized
+    float maxDepth = TRACE_MAX_DEPTH;
+  };
+
+  struct Hit {
+    float depth;                          // Distance along the ray, -1 on miss
+    uint32_t steps;                       // SDF evaluations spent on the ray
+  };
+
+  // Sphere traces every ray against map(), or mapTerrain() when terrainOnly.
+  // Rays are traced in packets of SDF_BATCH_WIDTH on the worker thread pool,
+  // consecutive rays should be coherent. Hits use the sphereTrace criteria.
+  void traceRays(std::span<const Ray> rays, std::span<Hit> hits, bool terrainOnly = false);
+
+  // Frame scoped cache of the distance queries made by the simulation. Hits
+  // are extrapolated from a query less than tolerance away on every axis.
+  void setSdfCache(bool enabled, float tolerance);
+  const SdfCache::Stats& getSdfCacheStats() const { return m_sdfCache.stats(); }
+
+  // Carves of the user actions, applied over the static nodes
+  const EditLayer& getEdits() const { return m_edits; }
+
+  // Bakes the nodes [first, first + count) into a Volume node that takes their
+  // place, sampled every voxelSize. Combination ops inside the range only
+  // combine the range, the new node keeps the combination op and material of
+  // the first node. The voxels are halved until the volume is within maxError
+  // of the nodes. False, with the nodes left as they were, when the range has
+  // dynamic or unbounded nodes, mixes materials, subtracts after its first
+  // node or no volume within maxError fits in the volume buffers.
+  bool freezeNodes(int first, int count, float voxelSize, float maxError);
+  const SampledVolumes& getVolumes() const { return m_volumes; }
 
   bool m_needsRefresh = true;
-  bool m_usingGuizmo = false;
 
 private:
-  std::string PrimTypeToString(shaderio::PrimType type);
-  std::string getLabel(Node *n);
-  std::string getLabel(Material mat);
-  uint32_t getNextId();
-
-  void drawPrimitives();
-  void drawButtonGroup();
-  void drawNodeParams();
+  // The editor UI edits the scene through the private interface
+  friend class SceneEditor;
 
-  void drawMaterials();
-  void drawMaterialParams();
+  uint32_t getNextId();
 
   void deleteSelected();
   void addNode(shaderio::PrimType t);
@@ -162,27 +281,51 @@ private:
   int addMaterial(Material mat);
 
   void solveCollisionConstraint(int nodeIdx, float compliance, float dt);
-  float sphereTrace(glm::vec3 orig, glm::vec3 dir);
-  float sphereTraceTerrain(glm::vec3 orig, glm::vec3 dir);
+  float sphereTrace(glm::vec3 orig, glm::vec3 dir) const;
+  float sphereTraceTerrain(glm::vec3 orig, glm::vec3 dir) const;
+  void applyEdit(Node& shape);
+  void releaseUnusedVolumes();
+  void tracePacket(const SdfTape& tape, const nvutils::Bbox& bounds, std::span<const Ray> rays, std::span<Hit> hits, bool terrainOnly) const;
 
   void updateNodeData(Node *n);
   void updateNodePysicsData(Node *n);
   void markRefresh(Node* n);
   void generateMatrix(Node *n);
   void generateBBox(Node *n);
-  float map(glm::vec3 p, int objIdxExcluded = -1);
-  float mapTerrain(glm::vec3 p);
-  glm::vec3 evalNormal(glm::vec3 p, int objIdxExcluded = -1);
-
-  std::vector<shaderio::BuildJob> createBaseBuildJobs(nvutils::Bbox aabb, glm::ivec3 camId0);
-  std::vector<shaderio::BuildJob> createCamBuildJobs(glm::ivec3 currCamId0, glm::ivec3 prevCamId0);
+  nvutils::Bbox fitLocalBBox(const Node& n, const nvutils::Bbox& loose);
+  Lattice nodeLattice(const Node& n) const;
+  // The map functions only read the tape, call updateTape() once before a
+  // batch of queries so concurrent callers never rebuild it
+  float map(glm::vec3 p, int objIdxExcluded = -1) const;
+  float mapWithGradient(glm::vec3 p, glm::vec3& grad, int objIdxExcluded = -1) const;
+  float mapWithGradientCached(glm::vec3 p, glm::vec3& grad, int objIdxExcluded = -1);
+  float mapTerrain(glm::vec3 p) const;
+
+  void updateTape();
+  void compileNode(const Node& n, SdfTape& tape);
+
+  std::vector<int8_t> classifyGridBlocks(float clampValue);
+  void fillGridBlock(const SdfTape& tape, glm::ivec3 block, float clampValue, float* out, size_t rowStride, size_t sliceStride) const;
+
+  std::vector<shaderio::BuildJob> createBaseBuildJobs(nvutils::Bbox aabb, const ClipmapCenters& centers);
+  std::vector<shaderio::BuildJob> createLatticeBuildJobs(const nvutils::Bbox& aabb, const Lattice& lattice, const ClipmapCenters& centers);
+  std::vector<shaderio::BuildJob> createCamBuildJobs(const ClipmapCenters& currCenters, const ClipmapCenters& prevCenters);
   std::vector<shaderio::BuildJob> splitBuildJob(shaderio::BuildJob);
+  std::vector<shaderio::BuildJob> coalesceBuildJobs(const std::vector<shaderio::BuildJob>& jobs);
 
   std::vector<Node> m_root;
   std::vector<Material> m_mat;
-  std::vector<nvutils::Bbox> m_removeList;
+  std::vector<std::pair<nvutils::Bbox, Lattice>> m_removeList;
+  std::vector<nvutils::Bbox> m_changedRegions;
+  SdfTape m_tape;
+  std::unordered_set<uint32_t> m_tapeDirty;  // Ids of the nodes to recompile, once each
+  EditLayer m_edits;
+  SampledVolumes m_volumes;
+  ThreadPool m_workerPool;                // traceRays and the grid generators
+  SdfCache m_sdfCache;
+  bool m_useSdfCache = false;
+  BuildJobStats m_buildJobStats{};
   int m_selected = -1;
-  int m_selectedMat = -1;
   uint32_t m_nextID = 1;
 
   int m_userAction = int(UserAction::Launch);
@@ -0,0 +1,429 @@
+#include "scene_editor.hpp"
+
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <imgui.h>
+
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <glm/trigonometric.hpp>
+
+static_assert(Scene::GUIZMO_TRANSLATE == int(ImGuizmo::TRANSLATE));
+static_assert(Scene::GUIZMO_WORLD == int(ImGuizmo::WORLD));
+
+//------------------
+// Helper functions
+//------------------
+
+static std::string PrimTypeToString(shaderio::PrimType type) {
+  return PrimTypeNames[(int)type];
+}
+
+static std::string getLabel(Scene::Node *n) {
+  return PrimTypeToString(n->gp.type) + "##" + std::to_string(n->id);
+}
+
+static std::string getLabel(Scene::Material mat) {
+  return mat.name + "##" + std::to_string(mat.id);
+}
+
+SceneEditor::SceneEditor(Scene& scene) : m_scene(scene) {}
+
+void SceneEditor::userAction(glm::vec3 pos, glm::vec3 dir, float dts){
+  if(ImGui::IsKeyDown(ImGuiKey_Space))
+    m_scene.userAction(pos, dir, dts, static_cast<float>(ImGui::GetTime()));
+}
+
+
+//------------------
+// Draw functions
+//------------------
+
+void SceneEditor::draw() {
+  ImGui::Begin("Scene");
+
+  if (ImGui::BeginTabBar("Scene")){
+    if (ImGui::BeginTabItem("Objects")){
+      drawButtonGroup();
+      ImGui::Separator();
+      drawPrimitives();
+      drawNodeParams();
+      ImGui::EndTabItem();
+    }
+
+    if (ImGui::BeginTabItem("Materials")){
+      drawMaterials();
+      drawMaterialParams();
+      ImGui::EndTabItem();
+    }
+
+    ImGui::EndTabBar();
+  }
+  
+  ImGui::End();
+}
+
+void SceneEditor::drawButtonGroup() {
+  if (ImGui::Button("Add"))
+    ImGui::OpenPopup("AddNodePopup");
+
+  ImGui::SameLine();
+
+  if (ImGui::Button("Delete")) {
+    m_scene.deleteSelected();
+  }
+
+  if (m_scene.m_selected != -1) {
+    ImGui::SameLine();
+    if (ImGui::Button("Freeze"))
+      ImGui::OpenPopup("FreezeNodesPopup");
+  }
+
+  // Volume nodes are only made by freezing
+  if (ImGui::BeginPopup("AddNodePopup")) {
+    for (int i = 0; i < int(shaderio::PrimType::Volume); ++i) {
+      if (ImGui::MenuItem(PrimTypeToString((shaderio::PrimType)i).c_str()))
+        m_scene.addNode((shaderio::PrimType)i);
+    }
+
+    ImGui::EndPopup();
+  }
+
+  if (m_scene.m_selected != -1 && ImGui::BeginPopup("FreezeNodesPopup")) {
+    const int maxCount = int(m_scene.m_root.size()) - m_scene.m_selected;
+    ImGui::SliderInt("Nodes", &m_freezeCount, 1, glm::max(maxCount, 1));
+    ImGui::SliderFloat("Voxel size", &m_freezeVoxelSize, 0.005f, 0.1f);
+    ImGui::SliderFloat("Max error", &m_freezeMaxError, 0.001f, 0.05f);
+    if (ImGui::Button("Freeze selected")) {
+      m_scene.freezeNodes(m_scene.m_selected, glm::min(m_freezeCount, maxCount), m_freezeVoxelSize, m_freezeMaxError);
+      ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+  }
+}
+
+void SceneEditor::drawPrimitives() {
+  ImGuiSelectableFlags selectableFlags = 0;
+
+  bool clickedOnItem = false;
+
+  for (int idx = 0; idx < m_scene.m_root.size(); idx++) {
+    auto& node = m_scene.m_root[idx];
+    bool isSelected = idx == m_scene.m_selected;
+    std::string label = getLabel(&node).c_str();
+
+    // Draw primitive
+    if (ImGui::Selectable(label.c_str(), isSelected, selectableFlags)) {
+      m_scene.m_selected = idx;
+      clickedOnItem = true;
+    }
+
+    // Drag source
+    if (ImGui::BeginDragDropSource()) {
+      ImGui::SetDragDropPayload("DND_SCENE_NODE", &idx, sizeof(int));
+      ImGui::Text("%s", label.c_str());
+      ImGui::EndDragDropSource();
+    }
+
+    if (ImGui::BeginDragDropTarget()) {
+      if (const ImGuiPayload *payload =
+              ImGui::AcceptDragDropPayload("DND_SCENE_NODE")) {
+        int sourceIdx = *(const int *)payload->Data;
+
+        if (sourceIdx != idx) {
+          auto movedItem = std::move(m_scene.m_root[sourceIdx]);
+          m_scene.m_root.erase(m_scene.m_root.begin() + sourceIdx);
+          m_scene.m_root.insert(m_scene.m_root.begin() + idx, std::move(movedItem));
+
+          m_scene.m_selected = idx;
+          m_scene.updateNodeData(&m_scene.m_root[m_scene.m_selected]);
+        }
+      }
+      ImGui::EndDragDropTarget();
+    }
+  }
+
+  if (!clickedOnItem && ImGui::IsMouseClicked(0) && ImGui::IsWindowHovered()) {
+    m_scene.m_selected = -1;
+  }
+}
+
+template<typename T>
+bool ComboVector(const char* label, int* current_item, std::vector<T>& vec){
+  auto getter = [](void* data, int idx, const char** out_text) -> bool
+  {
+    auto& v = *static_cast<std::vector<T>*>(data);
+    if (idx < 0 || idx >= (int)v.size()) return false;
+    *out_text = v[idx].name.c_str();
+    return true;
+  };
+
+  return ImGui::Combo(label, current_item, getter, &vec, (int)vec.size());
+}
+
+
+void SceneEditor::drawNodeParams(){
+  
+
+  if (m_scene.m_selected != -1) {
+    ImGui::Begin("Object");
+
+    Scene::Node &selectedNode = m_scene.m_root[m_scene.m_selected];
+
+    const std::string id = "##" + std::to_string(selectedNode.id);
+    bool dirty = false;
+    int combOpUI = selectedNode.sdp.combOp >= 2 ? selectedNode.sdp.combOp - 2
+                                              : selectedNode.sdp.combOp;
+
+    dirty |= ComboVector("Material", &selectedNode.gp.mat, m_scene.m_mat);
+
+    if (ImGui::IsKeyPressed(ImGuiKey_T))
+        selectedNode.gzp.guizmoOp = ImGuizmo::TRANSLATE;
+    if (ImGui::IsKeyPressed(ImGuiKey_R))
+        selectedNode.gzp.guizmoOp = ImGuizmo::ROTATE;
+    if (ImGui::IsKeyPressed(ImGuiKey_E))
+        selectedNode.gzp.guizmoOp = ImGuizmo::SCALE;
+    if (ImGui::RadioButton("Translate", selectedNode.gzp.guizmoOp == ImGuizmo::TRANSLATE))
+        selectedNode.gzp.guizmoOp = ImGuizmo::TRANSLATE;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Rotate", selectedNode.gzp.guizmoOp == ImGuizmo::ROTATE))
+        selectedNode.gzp.guizmoOp = ImGuizmo::ROTATE;
+    ImGui::SameLine();
+    if (ImGui::RadioButton("Scale", selectedNode.gzp.guizmoOp == ImGuizmo::SCALE))
+        selectedNode.gzp.guizmoOp = ImGuizmo::SCALE;
+ 
+
+    dirty |= ImGui::InputFloat3(("Position" + id).c_str(),
+                                &selectedNode.gp.position.x);
+    dirty |= ImGui::InputFloat3(("Rotation" + id).c_str(),
+                                &selectedNode.gp.rotation.x);
+    dirty |= ImGui::InputFloat(("Scale" + id).c_str(), &selectedNode.gp.scale);
+
+    ImGui::Separator();
+    dirty |= ImGui::Checkbox("Physics active", &selectedNode.pyp.physicsActive);
+    dirty |= ImGui::SliderFloat("Density", &selectedNode.pyp.density, 0.01f, 50.0f);
+
+    ImGui::Separator();
+    dirty |= ImGui::SliderFloat(("Roundness" + id).c_str(),
+                                &selectedNode.sdp.roundness, 0.0f,
+                                selectedNode.gp.scale * 0.25);
+    ImGui::Separator();
+
+    dirty |= ImGui::Combo(("Combination operation" + id).c_str(), &combOpUI,
+                          CombinationOpNames, IM_ARRAYSIZE(CombinationOpNames));
+    dirty |= ImGui::SliderFloat(("Smoothness" + id).c_str(),
+                                &selectedNode.sdp.smoothness, 0.0f,
+                                0.04);
+    ImGui::Separator();
+
+    dirty |= ImGui::Combo(("Morphing primitive" + id).c_str(),
+                          &selectedNode.sdp.morphPrim, MorphPrimNames,
+                          IM_ARRAYSIZE(MorphPrimNames));
+
+    dirty |= ImGui::SliderFloat(("Morphing" + id).c_str(),
+                                &selectedNode.sdp.morph, 0.0f, 1.0f);
+
+    ImGui::Separator();
+
+
+    dirty |= ImGui::Combo(("Deformation operation" + id).c_str(),
+                          &selectedNode.sdp.defOp, DeformationOpNames,
+                          IM_ARRAYSIZE(DeformationOpNames));
+    if (selectedNode.sdp.defOp == (int)Scene::DeformationOp::Elongate) {
+      dirty |= ImGui::InputFloat3(("Elongation" + id).c_str(),
+                                  &selectedNode.sdp.defP.x);
+    }
+
+    ImGui::Separator();
+
+    dirty |= ImGui::Combo(("Repetition operation" + id).c_str(),
+                          &selectedNode.sdp.repOp, RepetitionOpnames,
+                          IM_ARRAYSIZE(RepetitionOpnames));
+
+    if ((Scene::RepetitionOp)selectedNode.sdp.repOp != Scene::RepetitionOp::NoneOP) {
+      dirty |= ImGui::InputFloat3(("Spacing" + id).c_str(),
+                                  &selectedNode.sdp.spacing.x);
+      if ((Scene::RepetitionOp)selectedNode.sdp.repOp == Scene::RepetitionOp::LimRepetition)
+        dirty |= ImGui::DragInt3(("Limit" + id).c_str(),
+                                 &selectedNode.sdp.limit.x, 0.1f, 0, INT_MAX);
+    }
+
+    ImGui::Separator();
+
+    dirty |= ImGui::SliderInt(("Terrain octaves" + id).c_str(),
+                                    &selectedNode.sdp.octaves,0,20);
+    if(selectedNode.sdp.octaves > 0){
+      dirty |= ImGui::SliderFloat(("Initial size" + id).c_str(),
+                                    &selectedNode.sdp.terrain.x,0.001,2.0);
+      dirty |= ImGui::SliderFloat(("Size increase" + id).c_str(),
+                                    &selectedNode.sdp.terrain.y,0.001,0.75);
+      dirty |= ImGui::SliderFloat(("Inflation" + id).c_str(),
+                                    &selectedNode.sdp.terrain.z,0.001,1);
+      dirty |= ImGui::SliderFloat(("Erosion" + id).c_str(),
+                                    &selectedNode.sdp.terrain.w,0.001,1);
+    }
+
+    if(dirty) {
+      // If smoothness != 0 then apply the smooth combination operations (3,4,5)
+      // if not use the faster version (0,1,2)
+      if (selectedNode.sdp.smoothness > 0.0f) {
+        selectedNode.sdp.combOp = combOpUI + 2;
+      } else {
+        selectedNode.sdp.combOp = combOpUI;
+      }
+      // Update the transformation matrix and bounding box
+      m_scene.updateNodeData(&selectedNode);
+      // Flag to render engine that scene needs grid regeneration
+      m_scene.m_needsRefresh = true;
+    }
+
+    ImGui::End();
+  }
+}
+
+void SceneEditor::drawMaterials(){
+  if(ImGui::Button("Add material"))
+    m_scene.addMaterial(m_scene.createMaterial());
+  
+  ImGuiSelectableFlags selectableFlags = 0;
+
+  bool clickedOnItem = false;
+
+  for (int idx = 0; idx < m_scene.m_mat.size(); idx++) {
+    auto& mat = m_scene.m_mat[idx];
+    bool isSelected = idx == m_selectedMat;
+    std::string label = getLabel(mat).c_str();
+
+    // Draw material
+    if (ImGui::Selectable(label.c_str(), isSelected, selectableFlags)) {
+      m_selectedMat = idx;
+      clickedOnItem = true;
+    }
+  }
+
+  if (!clickedOnItem && ImGui::IsMouseClicked(0) && ImGui::IsWindowHovered()) {
+    m_selectedMat = -1;
+  }
+
+}
+
+void SceneEditor::drawMaterialParams(){
+  if (m_selectedMat != -1) {
+    ImGui::Begin("Material");
+
+    Scene::Material& mat = m_scene.m_mat[m_selectedMat];
+
+    const std::string id = "##" + std::to_string(mat.id);
+    bool dirty = false;
+
+    char buffer[256];
+    strncpy(buffer, mat.name.c_str(), sizeof(buffer));
+    buffer[sizeof(buffer) - 1] = '\0';
+    if (ImGui::InputText(("Name" + id).c_str(), buffer, sizeof(buffer)))
+      mat.name = std::string(buffer);
+
+    dirty |= ImGui::ColorEdit3(("Albedo" + id).c_str(),
+                                &mat.albedo.x);
+
+    dirty |= ImGui::SliderFloat(("Shininess" + id).c_str(),
+                                &mat.shininess, 0.0f, MAX_SHININESS);
+
+    dirty |= ImGui::SliderFloat(("Roughness" + id).c_str(),
+                                &mat.roughness, 0.0f, 1.0f);
+
+    dirty |= ImGui::SliderFloat(("Metalness" + id).c_str(),
+                                &mat.metalness, 0.0f, 1.0f);
+
+    dirty |= ImGui::Combo(("Type" + id).c_str(),
+                          &mat.type, MaterialTypeNames,
+                          IM_ARRAYSIZE(MaterialTypeNames));                   
+
+    if (dirty) {
+      m_scene.m_needsRefresh = true;
+    }
+
+    ImGui::End();
+  }
+}
+
+void SceneEditor::drawGuizmo(ImVec2 viewportPos, ImVec2 viewportSize, glm::mat4 cameraView, glm::mat4 cameraProjection){
+  if(m_scene.m_selected != -1){ 
+    ImGuizmo::BeginFrame();
+
+    ImGuizmo::SetDrawlist();
+
+    ImGuizmo::SetRect(
+      viewportPos.x,
+      viewportPos.y,
+      viewportSize.x,
+      viewportSize.y
+    );
+
+    Scene::Node &selectedNode = m_scene.m_root[m_scene.m_selected];
+    Scene::GuizmoParams& gzP = selectedNode.gzp;
+
+    glm::vec3 scale_vec(selectedNode.gp.scale);
+    glm::vec3 rot_deg(glm::degrees(glm::eulerAngles(selectedNode.gp.rotation)));
+    ImGuizmo::RecomposeMatrixFromComponents(
+      glm::value_ptr(selectedNode.gp.position),
+      glm::value_ptr(rot_deg),
+      glm::value_ptr(scale_vec),
+      glm::value_ptr(gzP.matrix));
+
+    cameraProjection[1][1] *= -1.0f;
+    ImGuizmo::Manipulate(
+      glm::value_ptr(cameraView), 
+      glm::value_ptr(cameraProjection), 
+      ImGuizmo::OPERATION(gzP.guizmoOp), 
+      ImGuizmo::MODE(gzP.guizmoMode), 
+      glm::value_ptr(gzP.matrix),
+      NULL, NULL);
+
+
+    m_usingGuizmo = ImGuizmo::IsUsing();
+
+    if(m_usingGuizmo){
+      float& scale = selectedNode.gp.scale;
+      glm::vec3 scale_vec, rot_deg;
+      ImGuizmo::DecomposeMatrixToComponents(glm::value_ptr(gzP.matrix), &selectedNode.gp.position.x, &rot_deg.x, &scale_vec.x);
+      selectedNode.gp.rotation = glm::radians(rot_deg);
+      selectedNode.gp.scale = scale_vec[0];
+      m_scene.updateNodeData(&selectedNode);
+      m_scene.m_needsRefresh = true;
+    }
+  }
+}
+
+
+void SceneEditor::drawSdfCacheMenu(){
+  bool enabled = m_scene.m_useSdfCache;
+  float tolerance = m_scene.m_sdfCache.tolerance();
+  bool changed = ImGui::Checkbox("Query cache", &enabled);
+  changed |= ImGui::SliderFloat("Cache tolerance", &tolerance, 0.0001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+  if(changed)
+    m_scene.setSdfCache(enabled, tolerance);
+
+  const SdfCache::Stats& stats = m_scene.getSdfCacheStats();
+  uint64_t queries = stats.hits + stats.misses;
+  ImGui::Text("Hits %llu / %llu (%.1f%%), invalidated %llu",
+    (unsigned long long)stats.hits, (unsigned long long)queries,
+    queries > 0 ? 100.0 * double(stats.hits) / double(queries) : 0.0,
+    (unsigned long long)stats.invalidated);
+  if(ImGui::Button("Reset stats"))
+    m_scene.m_sdfCache.resetStats();
+}
+
+void SceneEditor::drawUserActionMenu(){
+  if(ImGui::CollapsingHeader("User action")){
+    ImGui::Combo("Action", &m_scene.m_userAction, UserActionNames, IM_ARRAYSIZE(UserActionNames));
+    ImGui::SliderFloat("Delay", &m_scene.m_userActionDelay, 0.0, 1.0);
+    ImGui::Combo("Primitive", &m_scene.m_userActionPrimitive, PrimTypeNames, int(shaderio::PrimType::Volume));
+    ImGui::SliderFloat("Size", &m_scene.m_userActionSize, 0.0, 2.0);
+    if(m_scene.m_userAction == int(Scene::UserAction::Launch))
+      ImGui::SliderFloat("Force", &m_scene.m_launchForce, 0.0, 30.0);
+
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/ext/matrix_float4x4.hpp>
+#include <glm/ext/vector_float3.hpp>
+#include <imgui.h>
+#include "ImGuizmo.h"
+#include "scene.hpp"
+
+// ImGui/ImGuizmo editor for a Scene. Holds the UI only state, every edit goes
+// through the scene so the core stays usable without a window.
+class SceneEditor {
+public:
+  explicit SceneEditor(Scene& scene);
+
+  void draw();
+  void drawGuizmo(ImVec2 viewportPos, ImVec2 viewportSize, glm::mat4 cameraView, glm::mat4 cameraProjection);
+  void drawUserActionMenu();
+  void drawSdfCacheMenu();
+
+  // Triggers the scene user action while space is held
+  void userAction(glm::vec3 pos, glm::vec3 dir, float dts);
+
+  bool m_usingGuizmo = false;
+
+private:
+  void drawPrimitives();
+  void drawButtonGroup();
+  void drawNodeParams();
+
+  void drawMaterials();
+  void drawMaterialParams();
+
+  Scene& m_scene;
+  int m_selectedMat = -1;
+
+  // Freeze popup, the range starts at the selected node
+  int m_freezeCount = 1;
+  float m_freezeVoxelSize = 0.02f;
+  float m_freezeMaxError = 0.01f;
+};
@@ -0,0 +1,188 @@
+#include "scene.hpp"
+
+#include "sdf_batch.hpp"
+#include "sdf_tape.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glm/common.hpp>
+
+using Grid = Scene::SparseGrid;
+
+static const int AXIS_SIZE = shaderio::NUM_VALUES_PER_AXIS;
+static const float VOXEL_SIZE = 1.0f / float(AXIS_SIZE);
+static const glm::vec3 GRID_CENTER(0.5f);
+
+// Size in blocks of the subtrees classified by one pool job
+static const int CLASSIFY_ROOT_SIZE = 8;
+
+static const int8_t BLOCK_BAND = 0;
+static const int8_t BLOCK_POSITIVE = 1;
+static const int8_t BLOCK_NEGATIVE = -1;
+
+static size_t blockIndex(glm::ivec3 b){
+  return (size_t(b.z) * Grid::BLOCKS_PER_AXIS + size_t(b.y)) * Grid::BLOCKS_PER_AXIS + size_t(b.x);
+}
+
+// Marks every block of the cube of size blocks at origin. Cubes whose interval
+// bound stays beyond ±clampValue are uniform, the rest split down to blocks.
+static void classifyNode(const SdfTape& tape, glm::ivec3 origin, int size, float clampValue, std::vector<int8_t>& out){
+  IntervalBox box;
+  box.lo = glm::vec3(origin * Grid::BLOCK_SIZE) * VOXEL_SIZE - GRID_CENTER;
+  box.hi = glm::vec3((origin + size) * Grid::BLOCK_SIZE - 1) * VOXEL_SIZE - GRID_CENTER;
+  Interval d = tape.evalInterval(box);
+
+  const float pad = roundingPad(d);
+  int8_t type = BLOCK_BAND;
+  if(d.lo - pad > clampValue)
+    type = BLOCK_POSITIVE;
+  else if(d.hi + pad < -clampValue)
+    type = BLOCK_NEGATIVE;
+
+  if(type != BLOCK_BAND || size == 1){
+    for(int z = 0; z < size; z++)
+      for(int y = 0; y < size; y++)
+        for(int x = 0; x < size; x++)
+          out[blockIndex(origin + glm::ivec3(x, y, z))] = type;
+    return;
+  }
+
+  const int half = size / 2;
+  for(int c = 0; c < 8; c++){
+    glm::ivec3 child = origin + glm::ivec3(c & 1, (c >> 1) & 1, c >> 2) * half;
+    classifyNode(tape, child, half, clampValue, out);
+  }
+}
+
+std::vector<int8_t> Scene::classifyGridBlocks(float clampValue){
+  const int roots = Grid::BLOCKS_PER_AXIS / CLASSIFY_ROOT_SIZE;
+  std::vector<int8_t> out(size_t(Grid::BLOCKS_PER_AXIS) * Grid::BLOCKS_PER_AXIS * Grid::BLOCKS_PER_AXIS);
+  const SdfTape& tape = getTape();
+
+  m_workerPool.parallelFor(uint32_t(roots * roots * roots), [&](uint32_t job){
+    glm::ivec3 root(int(job) % roots, (int(job) / roots) % roots, int(job) / (roots * roots));
+    classifyNode(tape, root * CLASSIFY_ROOT_SIZE, CLASSIFY_ROOT_SIZE, clampValue, out);
+  });
+
+  return out;
+}
+
+// Evaluates the BLOCK_SIZE³ samples of a block, one row per batch
+void Scene::fillGridBlock(const SdfTape& tape, glm::ivec3 block, float clampValue, float* out, size_t rowStride, size_t sliceStride) const {
+  static_assert(Grid::BLOCK_SIZE == SDF_BATCH_WIDTH, "One block row per batch");
+
+  const glm::ivec3 v0 = block * Grid::BLOCK_SIZE;
+  PointBatch point;
+  alignas(32) float dist[SDF_BATCH_WIDTH];
+  for(int x = 0; x < Grid::BLOCK_SIZE; x++)
+    point.x[x] = float(v0.x + x) * VOXEL_SIZE - GRID_CENTER.x;
+
+  for(int z = 0; z < Grid::BLOCK_SIZE; z++){
+    for(int y = 0; y < Grid::BLOCK_SIZE; y++){
+      const float py = float(v0.y + y) * VOXEL_SIZE - GRID_CENTER.y;
+      const float pz = float(v0.z + z) * VOXEL_SIZE - GRID_CENTER.z;
+      for(int x = 0; x < Grid::BLOCK_SIZE; x++){
+        point.y[x] = py;
+        point.z[x] = pz;
+      }
+      tape.evalBatch(point, dist);
+
+      float* row = out + z * sliceStride + y * rowStride;
+      for(int x = 0; x < Grid::BLOCK_SIZE; x++)
+        row[x] = glm::clamp(dist[x], -clampValue, clampValue);
+    }
+  }
+}
+
+// Distance where the grid values saturate, 2.5 voxel diagonals
+static float gridClampValue(){
+  return glm::sqrt(3.0f * 2.5f * 2.5f * VOXEL_SIZE * VOXEL_SIZE);
+}
+
+Scene::SparseGrid Scene::generateSparseGrid(){
+  const float maxD = gridClampValue();
+  const size_t numBlocks = size_t(Grid::BLOCKS_PER_AXIS) * Grid::BLOCKS_PER_AXIS * Grid::BLOCKS_PER_AXIS;
+  const size_t blockValues = size_t(Grid::BLOCK_SIZE) * Grid::BLOCK_SIZE * Grid::BLOCK_SIZE;
+
+  SparseGrid grid;
+  grid.positiveValue = maxD;
+  grid.negativeValue = -maxD;
+  grid.blocks.assign(numBlocks, Grid::UNIFORM_POSITIVE);
+
+  // If empty scene
+  if(m_root.empty()){
+    grid.positiveValue = 10000.0f;
+    return grid;
+  }
+
+  std::vector<int8_t> type = classifyGridBlocks(maxD);
+  std::vector<glm::ivec3> band;
+  for(size_t i = 0; i < numBlocks; i++){
+    if(type[i] == BLOCK_NEGATIVE){
+      grid.blocks[i] = Grid::UNIFORM_NEGATIVE;
+    }else if(type[i] == BLOCK_BAND){
+      grid.blocks[i] = int32_t(band.size());
+      band.emplace_back(int(i % Grid::BLOCKS_PER_AXIS), int((i / Grid::BLOCKS_PER_AXIS) % Grid::BLOCKS_PER_AXIS), int(i / (size_t(Grid::BLOCKS_PER_AXIS) * Grid::BLOCKS_PER_AXIS)));
+    }
+  }
+
+  grid.values.resize(band.size() * blockValues);
+  const SdfTape& tape = getTape();
+  m_workerPool.parallelFor(uint32_t(band.size()), [&](uint32_t i){
+    fillGridBlock(tape, band[i], maxD, grid.values.data() + i * blockValues, Grid::BLOCK_SIZE, size_t(Grid::BLOCK_SIZE) * Grid::BLOCK_SIZE);
+  });
+
+  return grid;
+}
+
+// Works through one z slab of blocks at a time, only BLOCK_SIZE slices of the
+// grid are in memory
+void Scene::generateDenseGrid(const GridSliceSink& sink){
+  const float maxD = gridClampValue();
+  const size_t sliceSize = size_t(AXIS_SIZE) * AXIS_SIZE;
+  std::vector<float> slab(sliceSize * Grid::BLOCK_SIZE);
+
+  // If empty scene
+  if(m_root.empty()){
+    std::fill(slab.begin(), slab.begin() + sliceSize, 10000.0f);
+    for(int z = 0; z < AXIS_SIZE; z++)
+      sink(z, std::span<const float>(slab.data(), sliceSize));
+    return;
+  }
+
+  std::vector<int8_t> type = classifyGridBlocks(maxD);
+  const SdfTape& tape = getTape();
+
+  for(int bz = 0; bz < Grid::BLOCKS_PER_AXIS; bz++){
+    // One row of blocks per job
+    m_workerPool.parallelFor(uint32_t(Grid::BLOCKS_PER_AXIS), [&](uint32_t by){
+      for(int bx = 0; bx < Grid::BLOCKS_PER_AXIS; bx++){
+        const glm::ivec3 block(bx, int(by), bz);
+        float* out = slab.data() + size_t(by) * Grid::BLOCK_SIZE * AXIS_SIZE + size_t(bx) * Grid::BLOCK_SIZE;
+        const int8_t t = type[blockIndex(block)];
+        if(t == BLOCK_BAND){
+          fillGridBlock(tape, block, maxD, out, AXIS_SIZE, sliceSize);
+          continue;
+        }
+
+        const float value = t == BLOCK_POSITIVE ? maxD : -maxD;
+        for(int z = 0; z < Grid::BLOCK_SIZE; z++)
+          for(int y = 0; y < Grid::BLOCK_SIZE; y++)
+            std::fill_n(out + z * sliceSize + y * AXIS_SIZE, Grid::BLOCK_SIZE, value);
+      }
+    });
+
+    for(int z = 0; z < Grid::BLOCK_SIZE; z++)
+      sink(bz * Grid::BLOCK_SIZE + z, std::span<const float>(slab.data() + z * sliceSize, sliceSize));
+  }
+}
+
+std::vector<float> Scene::generateDenseGrid(){
+  const size_t sliceSize = size_t(AXIS_SIZE) * AXIS_SIZE;
+  std::vector<float> data(sliceSize * AXIS_SIZE);
+  generateDenseGrid([&](int z, std::span<const float> slice){
+    std::memcpy(data.data() + size_t(z) * sliceSize, slice.data(), slice.size_bytes());
+  });
+  return data;
+}
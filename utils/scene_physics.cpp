@@ -2,7 +2,6 @@
 #include "glm/ext/vector_float3.hpp"
 #include "glm/geometric.hpp"
 #include "glm/matrix.hpp"
-#include "imgui.h"
 #include "scene.hpp"
 #include "nvutils/logger.hpp"
 #include <numbers>
@@ -200,14 +199,15 @@ void Scene::solveCollisionConstraint(int nodeIdx, float compliance, float dt){
   Scene::GeneralParams& gp = n.gp;
   Scene::PhysicsParams& pyp = n.pyp;
   
-  float sdValue = map(gp.position, nodeIdx);
+  glm::vec3 grad;
+  float sdValue = mapWithGradientCached(gp.position, grad, nodeIdx);
   float radius = gp.scale/2.0;
   float C = radius - sdValue;
   
-  if(C <= 0)
+  if(C <= 0 || grad == glm::vec3(0.0f))
     return;
 
-  glm::vec3 normal = evalNormal(gp.position,nodeIdx); 
+  glm::vec3 normal = glm::normalize(grad);
   glm::vec3 corr = normal*C;
 
   float force = applyCorrection(
@@ -274,6 +274,10 @@ void Scene::simulate(float dts, int substeps){
 
   int lastIdx = m_root.size()-1;
 
+  // Cached queries only live for one frame
+  m_sdfCache.clear();
+  updateTape();
+
   for(int sub_step = 0; sub_step < substeps; sub_step++){
     if(m_root[lastIdx].pyp.physicsActive){
       //LOGI("====================\n");
@@ -296,23 +300,10 @@ void Scene::simulate(float dts, int substeps){
   }
 }
 
-void Scene::drawUserActionMenu(){
-  if(ImGui::CollapsingHeader("User action")){
-    ImGui::Combo("Action", &m_userAction, UserActionNames, IM_ARRAYSIZE(UserActionNames));
-    ImGui::SliderFloat("Delay", &m_userActionDelay, 0.0, 1.0);
-    ImGui::Combo("Primitive", &m_userActionPrimitive, PrimTypeNames, IM_ARRAYSIZE(PrimTypeNames));
-    ImGui::SliderFloat("Size", &m_userActionSize, 0.0, 2.0);
-    if(m_userAction == int(UserAction::Launch))
-      ImGui::SliderFloat("Force", &m_launchForce, 0.0, 30.0);
-
-  }
-}
-
-
-float Scene::sphereTrace(glm::vec3 orig, glm::vec3 dir){
-  const int MAX_ITERATIONS = shaderio::NUM_VOXELS_PER_AXIS * int(CLIPMAP_LEVELS*0.5);
-  const float MIN_DIST = 0.0001;
-  const float maxDepth = 100.0;
+float Scene::sphereTrace(glm::vec3 orig, glm::vec3 dir) const {
+  const int MAX_ITERATIONS = TRACE_MAX_ITERATIONS;
+  const float MIN_DIST = TRACE_MIN_DIST;
+  const float maxDepth = TRACE_MAX_DEPTH;
   
   float depth = 0.0;
 
@@ -332,10 +323,10 @@ float Scene::sphereTrace(glm::vec3 orig, glm::vec3 dir){
   return -1.0;
 }
 
-float Scene::sphereTraceTerrain(glm::vec3 orig, glm::vec3 dir){
-  const int MAX_ITERATIONS = shaderio::NUM_VOXELS_PER_AXIS * int(CLIPMAP_LEVELS*0.5);
-  const float MIN_DIST = 0.0001;
-  const float maxDepth = 100.0;
+float Scene::sphereTraceTerrain(glm::vec3 orig, glm::vec3 dir) const {
+  const int MAX_ITERATIONS = TRACE_MAX_ITERATIONS;
+  const float MIN_DIST = TRACE_MIN_DIST;
+  const float maxDepth = TRACE_MAX_DEPTH;
   
   float depth = 0.0;
 
@@ -378,74 +369,114 @@ glm::vec3 randomVec3(){
   return glm::vec3(randomFloat2(),randomFloat2(),randomFloat2());
 }
 
-void Scene::userAction(glm::vec3 pos, glm::vec3 dir, float dts){
-  if(ImGui::IsKeyDown(ImGuiKey_Space)){
+// Length of a tunnel, in user action sizes
+static const float TUNNEL_LENGTH = 4.0f;
 
-    float curr_time = static_cast<float>(ImGui::GetTime());
-    if(curr_time >= m_lastUserAction+m_userActionDelay || m_lastUserAction < 0.0){
-      m_lastUserAction = curr_time;
+// Planes and empty nodes have no bounded solid to edit with, volumes belong
+// to frozen nodes
+static shaderio::PrimType editPrimitive(int primitive){
+  shaderio::PrimType type = shaderio::PrimType(primitive);
+  if(type == shaderio::PrimType::Plane || type == shaderio::PrimType::Empty || type == shaderio::PrimType::Volume)
+    return shaderio::PrimType::Sphere;
+  return type;
+}
 
-      switch (UserAction(m_userAction)) {
-        default:
-        case UserAction::NoneAction:
-          // Do nothing
-          break;
-        
-        case UserAction::Launch:{
+// Carves the solid of shape into the edit layer, the bricks it changed are
+// rebuilt like the ones of a removed node
+void Scene::applyEdit(Node& shape){
+  generateMatrix(&shape);
+  generateBBox(&shape);
+
+  SdfTape tape;
+  compileNode(shape, tape);
+  const SdfTape& scene = getTape();
+  nvutils::Bbox changed = m_edits.carve(tape, shape.gp.bbox, scene);
+  if(changed.isEmpty())
+    return;
+
+  m_sdfCache.invalidate(changed);
+  m_removeList.push_back({changed, Lattice{}});
+  m_needsRefresh = true;
+}
 
-          m_selected = m_root.size()-1;
-          Node *body = createNode(shaderio::PrimType(m_userActionPrimitive));
+void Scene::userAction(glm::vec3 pos, glm::vec3 dir, float dts, float time){
+  if(time >= m_lastUserAction+m_userActionDelay || m_lastUserAction < 0.0){
+    m_lastUserAction = time;
+    updateTape();
 
-          dir += glm::normalize(randomVec3())*0.05f;
-          dir = glm::normalize(dir);
+    switch (UserAction(m_userAction)) {
+      default:
+      case UserAction::NoneAction:
+        // Do nothing
+        break;
       
-          body->gp.scale = m_userActionSize;
-          body->gp.position = pos + dir*(m_userActionSize+0.15f);
-          body->gp.mat = m_mat.size()-1;
-          updateNodeData(body);
-          body->pyp.physicsActive = true;
-          body->pyp.density = 5.0;
-          body->pyp.vel = dir*m_launchForce + randomFloat2()*0.5f;
-          body->pyp.prev_position = body->gp.position - body->pyp.vel*dts;
-          body->pyp.omega = randomVec3()*4.0f;
-          body->gp.rotation = randomQuaternion();
-          glm::vec3 neg_omega = -body->pyp.omega;
-          float angle = glm::length(neg_omega) * dts;
-          if (angle > 0.0f){
-            glm::vec3 axis = glm::normalize(neg_omega);
-            glm::quat dq = glm::angleAxis(angle, axis);
-            body->pyp.prev_rotation = glm::normalize(dq * body->gp.rotation);
-          }
-          updateNodeData(body);
-          addNode(body);
-          m_selected = -1;
+      case UserAction::Launch:{
 
-          break;
+        m_selected = m_root.size()-1;
+        Node *body = createNode(shaderio::PrimType(m_userActionPrimitive));
 
+        dir += glm::normalize(randomVec3())*0.05f;
+        dir = glm::normalize(dir);
+    
+        body->gp.scale = m_userActionSize;
+        body->gp.position = pos + dir*(m_userActionSize+0.15f);
+        body->gp.mat = m_mat.size()-1;
+        updateNodeData(body);
+        body->pyp.physicsActive = true;
+        body->pyp.density = 5.0;
+        body->pyp.vel = dir*m_launchForce + randomFloat2()*0.5f;
+        body->pyp.prev_position = body->gp.position - body->pyp.vel*dts;
+        body->pyp.omega = randomVec3()*4.0f;
+        body->gp.rotation = randomQuaternion();
+        glm::vec3 neg_omega = -body->pyp.omega;
+        float angle = glm::length(neg_omega) * dts;
+        if (angle > 0.0f){
+          glm::vec3 axis = glm::normalize(neg_omega);
+          glm::quat dq = glm::angleAxis(angle, axis);
+          body->pyp.prev_rotation = glm::normalize(dq * body->gp.rotation);
         }
+        updateNodeData(body);
+        addNode(body);
+        m_selected = -1;
+
+        break;
+
+      }
 
-        case UserAction::Carve:{
-          float depth = sphereTraceTerrain(pos,dir);
+      case UserAction::Carve:{
+        float depth = sphereTraceTerrain(pos,dir);
+        if(depth < 0.0)
+          break;
 
-          glm::vec3 p = pos + dir*depth;
+        Node shape = {};
+        shape.gp.type = editPrimitive(m_userActionPrimitive);
+        shape.gp.scale = m_userActionSize;
+        shape.gp.position = pos + dir*depth;
+        shape.gp.rotation = randomQuaternion();
+        applyEdit(shape);
 
-          m_selected = m_root.size()-1;
-          Node *body = createNode(shaderio::PrimType(m_userActionPrimitive));
+        break;
+      }
 
-          body->gp.scale = m_userActionSize;
-          body->gp.position = p;
-          body->gp.mat = m_mat.size()-1;
-          body->gp.rotation = randomQuaternion();
-          body->sdp.combOp = (int)CombinationOp::Substraction + 3;
-          body->sdp.smoothness = 0.01;
-          updateNodeData(body);
-          addNode(body);
-          m_selected = -1;
-          
+      case UserAction::Tunnel:{
+        float depth = sphereTraceTerrain(pos,dir);
+        if(depth < 0.0)
           break;
-        }
 
+        // The primitive stretched along dir, from the hit point inwards
+        const float halfLength = 0.5f*TUNNEL_LENGTH*m_userActionSize;
+        Node shape = {};
+        shape.gp.type = editPrimitive(m_userActionPrimitive);
+        shape.gp.scale = m_userActionSize;
+        shape.gp.position = pos + dir*(depth + halfLength);
+        shape.gp.rotation = glm::rotation(glm::vec3(0.0f,0.0f,1.0f), dir);
+        shape.sdp.defOp = (int)DeformationOp::Elongate;
+        shape.sdp.defP = glm::vec3(0.0f,0.0f,halfLength);
+        applyEdit(shape);
+
+        break;
       }
+
     }
   }
 }
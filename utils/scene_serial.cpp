@@ -4,6 +4,8 @@
 #include <cereal/types/vector.hpp>
 #include <fstream>
 
+#include <nvutils/logger.hpp>
+
 //------------------------------
 // Math types
 //------------------------------
@@ -120,6 +122,28 @@ bool Scene::saveToFile(const std::string &path) {
   ar(m_root);
   ar(m_mat);
 
+  // Edit bricks as base64 blobs, the values alone are 1 KiB per brick
+  EditLayer::Snapshot edits = m_edits.snapshot();
+  uint64_t numBrickWords = edits.bricks.size();
+  uint64_t numValues = edits.values.size();
+  ar(cereal::make_nvp("editBrickWords", numBrickWords), cereal::make_nvp("editValues", numValues));
+  ar.saveBinaryValue(edits.bricks.data(), edits.bricks.size() * sizeof(int32_t), "editBrickData");
+  ar.saveBinaryValue(edits.values.data(), edits.values.size(), "editValueData");
+
+  // Sampled volumes of frozen nodes, node params predate them
+  std::vector<int32_t> nodeVolumes;
+  for(const auto& n:m_root)
+    nodeVolumes.push_back(n.sdp.volume);
+  SampledVolumes::Snapshot volumes = m_volumes.snapshot();
+  uint64_t numVolumes = volumes.headers.size();
+  uint64_t numVolumeBricks = volumes.bricks.size();
+  uint64_t numVolumeValues = volumes.values.size();
+  ar(cereal::make_nvp("nodeVolumes", nodeVolumes));
+  ar(cereal::make_nvp("volumes", numVolumes), cereal::make_nvp("volumeBricks", numVolumeBricks), cereal::make_nvp("volumeValues", numVolumeValues));
+  ar.saveBinaryValue(volumes.headers.data(), volumes.headers.size() * sizeof(SampledVolumes::Header), "volumeHeaderData");
+  ar.saveBinaryValue(volumes.bricks.data(), volumes.bricks.size() * sizeof(int32_t), "volumeBrickData");
+  ar.saveBinaryValue(volumes.values.data(), volumes.values.size(), "volumeValueData");
+
   return true;
 }
 
@@ -129,17 +153,62 @@ bool Scene::loadFromFile(const std::string &path) {
     return false;
 
   for(auto n:m_root){
-    m_removeList.push_back(n.gp.bbox);
+    m_removeList.push_back({n.gp.bbox, nodeLattice(n)});
   }
 
+  if(!m_edits.empty())
+    m_removeList.push_back({m_edits.bounds(), Lattice{}});
+
   cereal::JSONInputArchive ar(file);
 
   ar(m_root);
   ar(m_mat);
 
+  // Files saved before the edit layer have no edits
+  EditLayer::Snapshot edits;
+  try{
+    uint64_t numBrickWords = 0, numValues = 0;
+    ar(cereal::make_nvp("editBrickWords", numBrickWords), cereal::make_nvp("editValues", numValues));
+    edits.bricks.resize(numBrickWords);
+    edits.values.resize(numValues);
+    ar.loadBinaryValue(edits.bricks.data(), edits.bricks.size() * sizeof(int32_t), "editBrickData");
+    ar.loadBinaryValue(edits.values.data(), edits.values.size(), "editValueData");
+  }catch(const cereal::Exception&){
+    edits = {};
+  }
+  if(!m_edits.restore(edits))
+    LOGW("Discarded the inconsistent edit layer of %s\n", path.c_str());
+  if(!m_edits.empty())
+    m_removeList.push_back({m_edits.bounds(), Lattice{}});
+
+  // Files saved before frozen nodes have no volumes
+  std::vector<int32_t> nodeVolumes;
+  SampledVolumes::Snapshot volumes;
+  try{
+    uint64_t numVolumes = 0, numVolumeBricks = 0, numVolumeValues = 0;
+    ar(cereal::make_nvp("nodeVolumes", nodeVolumes));
+    ar(cereal::make_nvp("volumes", numVolumes), cereal::make_nvp("volumeBricks", numVolumeBricks), cereal::make_nvp("volumeValues", numVolumeValues));
+    volumes.headers.resize(numVolumes);
+    volumes.bricks.resize(numVolumeBricks);
+    volumes.values.resize(numVolumeValues);
+    ar.loadBinaryValue(volumes.headers.data(), volumes.headers.size() * sizeof(SampledVolumes::Header), "volumeHeaderData");
+    ar.loadBinaryValue(volumes.bricks.data(), volumes.bricks.size() * sizeof(int32_t), "volumeBrickData");
+    ar.loadBinaryValue(volumes.values.data(), volumes.values.size(), "volumeValueData");
+  }catch(const cereal::Exception&){
+    nodeVolumes = {};
+    volumes = {};
+  }
+  if(!m_volumes.restore(volumes))
+    LOGW("Discarded the inconsistent volumes of %s\n", path.c_str());
+  for(size_t i = 0; i < m_root.size(); i++)
+    m_root[i].sdp.volume = i < nodeVolumes.size() ? nodeVolumes[i] : -1;
+  m_sdfCache.clear();
+
   uint max_id = 0;
+  // Boxes are refitted, files may hold looser ones
   for(auto& n:m_root){
     markRefresh(&n);
+    generateBBox(&n);
     max_id = glm::max(max_id,n.id);
   }
   m_nextID = max_id + 1;
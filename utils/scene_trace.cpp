@@ -0,0 +1,154 @@
+#include "scene.hpp"
+
+#include "sdf_batch.hpp"
+#include "sdf_tape.hpp"
+
+#include <algorithm>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+// Over-relaxation of the sphere tracing step. Once a relaxed step overshoots
+// the ray goes back to the last safe point and continues with plain steps.
+static const float RELAXATION = 1.6f;
+
+// Packets handed to a pool worker at a time
+static const uint32_t PACKETS_PER_JOB = 4;
+
+// Range of t where the ray is inside box and [0, maxDepth]
+static bool clipRay(const Scene::Ray& ray, const nvutils::Bbox& box, float& t0, float& t1){
+  t0 = 0.0f;
+  t1 = ray.maxDepth;
+  for(int a = 0; a < 3; a++){
+    if(glm::abs(ray.dir[a]) < 1e-12f){
+      if(ray.orig[a] < box.min()[a] || ray.orig[a] > box.max()[a])
+        return false;
+      continue;
+    }
+    float ta = (box.min()[a] - ray.orig[a]) / ray.dir[a];
+    float tb = (box.max()[a] - ray.orig[a]) / ray.dir[a];
+    t0 = glm::max(t0, glm::min(ta, tb));
+    t1 = glm::min(t1, glm::max(ta, tb));
+  }
+  return t0 <= t1;
+}
+
+void Scene::traceRays(std::span<const Ray> rays, std::span<Hit> hits, bool terrainOnly){
+  const size_t count = std::min(rays.size(), hits.size());
+  if(count == 0)
+    return;
+
+  // Compile before the pool runs, the workers only read the tape
+  const SdfTape& tape = getTape();
+
+  // Every surface lies inside the boxes of the nodes that add material,
+  // (smooth) subtractions only remove it
+  nvutils::Bbox bounds;
+  for(auto& node : m_root){
+    if(terrainOnly && node.sdp.octaves <= 0)
+      continue;
+    if(node.sdp.combOp == 1 || node.sdp.combOp == 3)
+      continue;
+    bounds.insert(node.gp.bbox);
+  }
+  // Fills can add surfaces outside every node
+  if(!m_edits.empty())
+    bounds.insert(m_edits.bounds());
+
+  if(bounds.isEmpty()){
+    for(size_t i = 0; i < count; i++)
+      hits[i] = {-1.0f, 0};
+    return;
+  }
+
+  const uint32_t numPackets = uint32_t((count + SDF_BATCH_WIDTH - 1) / SDF_BATCH_WIDTH);
+  const uint32_t numJobs = (numPackets + PACKETS_PER_JOB - 1) / PACKETS_PER_JOB;
+  m_workerPool.parallelFor(numJobs, [&](uint32_t job){
+    const uint32_t end = std::min((job + 1) * PACKETS_PER_JOB, numPackets);
+    for(uint32_t packet = job * PACKETS_PER_JOB; packet < end; packet++){
+      const size_t base = size_t(packet) * SDF_BATCH_WIDTH;
+      const size_t lanes = std::min(count - base, size_t(SDF_BATCH_WIDTH));
+      tracePacket(tape, bounds, rays.subspan(base, lanes), hits.subspan(base, lanes), terrainOnly);
+    }
+  });
+}
+
+// Relaxed sphere tracing of up to SDF_BATCH_WIDTH rays, one lane per ray
+void Scene::tracePacket(const SdfTape& tape, const nvutils::Bbox& bounds, std::span<const Ray> rays, std::span<Hit> hits, bool terrainOnly) const {
+  const int lanes = int(rays.size());
+
+  float depth[SDF_BATCH_WIDTH], depthEnd[SDF_BATCH_WIDTH];
+  float omega[SDF_BATCH_WIDTH], prevRadius[SDF_BATCH_WIDTH], prevStep[SDF_BATCH_WIDTH];
+  bool active[SDF_BATCH_WIDTH] = {};
+  int numActive = 0;
+
+  for(int l = 0; l < lanes; l++){
+    hits[l] = {-1.0f, 0};
+    if(!clipRay(rays[l], bounds, depth[l], depthEnd[l]))
+      continue;
+    omega[l] = RELAXATION;
+    prevRadius[l] = 0.0f;
+    prevStep[l] = 0.0f;
+    active[l] = true;
+    numActive++;
+  }
+
+  PointBatch point;
+  alignas(32) float dist[SDF_BATCH_WIDTH];
+
+  // The whole packet misses the scene bounds when no lane is left
+  for(int i = 0; i < TRACE_MAX_ITERATIONS && numActive > 0; i++){
+    // Finished lanes repeat an active one so the packet bounds stay tight
+    int first = 0;
+    while(!active[first])
+      first++;
+    for(int l = 0; l < SDF_BATCH_WIDTH; l++){
+      int src = (l < lanes && active[l]) ? l : first;
+      glm::vec3 p = rays[src].orig + rays[src].dir * depth[src];
+      point.x[l] = p.x;
+      point.y[l] = p.y;
+      point.z[l] = p.z;
+    }
+
+    if(terrainOnly){
+      for(int l = 0; l < lanes; l++)
+        dist[l] = active[l] ? tape.evalTerrain(glm::vec3(point.x[l], point.y[l], point.z[l])) : 0.0f;
+    }else{
+      tape.evalBatch(point, dist);
+    }
+
+    for(int l = 0; l < lanes; l++){
+      if(!active[l])
+        continue;
+      hits[l].steps++;
+      float d = dist[l];
+
+      // The spheres of the last two points don't overlap, the relaxed step
+      // may have jumped over the surface
+      if(omega[l] > 1.0f && glm::abs(d) + prevRadius[l] < prevStep[l]){
+        depth[l] += prevRadius[l] - prevStep[l];
+        omega[l] = 1.0f;
+        prevStep[l] = 0.0f;
+        continue;
+      }
+
+      if(glm::abs(d) < TRACE_MIN_DIST){
+        hits[l].depth = depth[l];  // Hit
+        active[l] = false;
+        numActive--;
+        continue;
+      }
+
+      if(depth[l] >= depthEnd[l]){
+        active[l] = false;  // No hit
+        numActive--;
+        continue;
+      }
+
+      float step = d > 0.0f ? d * omega[l] : d;
+      prevRadius[l] = glm::abs(d);
+      prevStep[l] = step;
+      depth[l] += step;
+    }
+  }
+}
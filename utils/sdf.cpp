@@ -5,6 +5,8 @@
 #include <glm/matrix.hpp>
 #include "../shaders/shaderio.h"
 
+#include <vector>
+
 glm::vec3 hash3(glm::vec3 p){
   p = glm::fract(p * 0.1031f);
   p += glm::dot(p,glm::vec3(p.y,p.z,p.x) + 33.33f);
@@ -142,17 +144,51 @@ float sdSnowMan(glm::vec3 point){
   return r * scale;
 }
 
-float sphSphere(glm::vec3 i,glm::vec3 f,glm::vec3 c){
-  glm::vec3 p = 17.0f*glm::fract(hash3(i+c)+glm::vec3(0.11,0.17,0.13));
+static float hashCellRadius(glm::vec3 cell){
+  glm::vec3 p = 17.0f*glm::fract(hash3(cell)+glm::vec3(0.11,0.17,0.13));
   float w = glm::fract( p.x*p.y*p.z*(p.x+p.y+p.z) );
-  float r = 0.7*w*w;
+  return 0.7*w*w;
+}
+
+// Hashed radius of every cell in [0,TERRAIN_LATTICE_PERIOD)^3, x major
+static const std::vector<float> s_terrainLattice = []{
+  const int P = TERRAIN_LATTICE_PERIOD;
+  std::vector<float> table(shaderio::TERRAIN_LATTICE_SIZE);
+  for(int z = 0; z < P; z++)
+    for(int y = 0; y < P; y++)
+      for(int x = 0; x < P; x++)
+        table[(z*P + y)*P + x] = hashCellRadius(glm::vec3(x,y,z));
+  return table;
+}();
+
+std::span<const float> terrainLattice(){
+  return s_terrainLattice;
+}
+
+float cellRadius(glm::vec3 cell){
+#if TERRAIN_LATTICE_EXACT
+  return hashCellRadius(cell);
+#else
+  // Same tile shift and wrap as the shader, the masks keep negative cells in range
+  const glm::ivec3 icell(cell);
+  const glm::ivec3 tile = icell & ~(TERRAIN_LATTICE_PERIOD-1);
+  uint32_t h = uint32_t(tile.x) * 73856093u ^ uint32_t(tile.y) * 19349663u ^ uint32_t(tile.z) * 83492791u;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  const glm::ivec3 shift = glm::ivec3(glm::uvec3(h, h >> 10, h >> 20) & uint32_t(TERRAIN_LATTICE_PERIOD-1));
+  glm::ivec3 c = (icell + shift) & (TERRAIN_LATTICE_PERIOD-1);
+  return s_terrainLattice[(c.z*TERRAIN_LATTICE_PERIOD + c.y)*TERRAIN_LATTICE_PERIOD + c.x];
+#endif
+}
+
+float sphSphere(glm::vec3 i,glm::vec3 f,glm::vec3 c){
+  float r = cellRadius(i+c);
   return length(f-c) - r; 
 }
 
 float sphOctahedron(glm::vec3 i,glm::vec3 f,glm::vec3 c){
-  glm::vec3 p = 17.0f*glm::fract(hash3(i+c)+glm::vec3(0.11,0.17,0.13));
-  float w = glm::fract( p.x*p.y*p.z*(p.x+p.y+p.z) );
-  float r = 0.7*w*w;
+  float r = cellRadius(i+c);
   return sdOctahedron(f-c,r);
 }
 
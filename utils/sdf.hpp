@@ -1,6 +1,34 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <span>
+
+float opUnion(float a, float b);
+float opSmoothUnion(float a, float b, float k);
+float opSubtraction(float a, float b);
+float opSmoothSubtraction(float a, float b, float k);
+
+glm::vec3 opRepetition(glm::vec3 p, glm::vec3 spacing);
+glm::vec3 opLimRepetition(glm::vec3 p, glm::vec3 spacing, glm::vec3 limit);
+glm::vec3 opElongate(glm::vec3 p, glm::vec3 defP);
+
+float smin(float a, float b, float k);
+float smax(float a, float b, float k);
+
+float sdEmpty(glm::vec3 p);
+float sdBox(glm::vec3 p);
+float sdSphere(glm::vec3 p);
+float sdTorus(glm::vec3 p);
+float sdSnowMan(glm::vec3 point);
+float sdPlane(glm::vec3 p);
+float sdCapsule(glm::vec3 p, glm::vec3 a, glm::vec3 b, float r);
+float sdOctahedron(glm::vec3 p, float s);
+
+// Radius of the terrain noise sphere at a lattice point
+float cellRadius(glm::vec3 cell);
+
+// Lattice radius table read by cellRadius, uploaded as is to the GPU
+std::span<const float> terrainLattice();
 
 float evalPrimitive(int primType, glm::vec3 p);
 
@@ -0,0 +1,450 @@
+#include "sdf_batch.hpp"
+#include "sdf.hpp"
+#include "../shaders/shaderio.h"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SDF_BATCH_SSE2
+#endif
+
+//---------------------------------------
+// Lane types
+//---------------------------------------
+// Every backend works on SDF_BATCH_WIDTH floats at a time. min/max keep the
+// operand order of glm::min/glm::max so NaN lanes behave like the scalar path
+// and round is half away from zero like std::round.
+
+static_assert(SDF_BATCH_WIDTH == 8, "Lane backends are written for 8 wide batches");
+
+#if defined(__AVX2__)
+
+struct Lanes { __m256 v; };
+
+static inline Lanes load(const float* p){ return {_mm256_load_ps(p)}; }
+static inline void store(float* p, Lanes a){ _mm256_store_ps(p, a.v); }
+static inline Lanes splat(float s){ return {_mm256_set1_ps(s)}; }
+
+static inline Lanes operator+(Lanes a, Lanes b){ return {_mm256_add_ps(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a, Lanes b){ return {_mm256_sub_ps(a.v, b.v)}; }
+static inline Lanes operator*(Lanes a, Lanes b){ return {_mm256_mul_ps(a.v, b.v)}; }
+static inline Lanes operator/(Lanes a, Lanes b){ return {_mm256_div_ps(a.v, b.v)}; }
+static inline Lanes operator-(Lanes a){ return {_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))}; }
+
+static inline Lanes lmin(Lanes a, Lanes b){ return {_mm256_min_ps(b.v, a.v)}; }
+static inline Lanes lmax(Lanes a, Lanes b){ return {_mm256_max_ps(b.v, a.v)}; }
+static inline Lanes labs(Lanes a){ return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+static inline Lanes lsqrt(Lanes a){ return {_mm256_sqrt_ps(a.v)}; }
+
+static inline Lanes lfloor(Lanes a){ return {_mm256_floor_ps(a.v)}; }
+
+struct Mask { __m256 v; };
+
+static inline Mask operator<(Lanes a, Lanes b){ return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+static inline Mask operator>(Lanes a, Lanes b){ return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+static inline Mask operator|(Mask a, Mask b){ return {_mm256_or_ps(a.v, b.v)}; }
+static inline bool anyLane(Mask m){ return _mm256_movemask_ps(m.v) != 0; }
+static inline Lanes lselect(Mask m, Lanes a, Lanes b){ return {_mm256_blendv_ps(b.v, a.v, m.v)}; }
+
+static inline Lanes lround(Lanes a){
+  __m256 t = _mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+  __m256 half = _mm256_cmp_ps(labs({_mm256_sub_ps(a.v, t)}).v, _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+  __m256 one = _mm256_or_ps(_mm256_and_ps(a.v, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(1.0f));
+  return {_mm256_add_ps(t, _mm256_and_ps(half, one))};
+}
+
+#elif defined(SDF_BATCH_SSE2)
+
+struct Lanes { __m128 lo, hi; };
+
+static inline Lanes load(const float* p){ return {_mm_load_ps(p), _mm_load_ps(p + 4)}; }
+static inline void store(float* p, Lanes a){ _mm_store_ps(p, a.lo); _mm_store_ps(p + 4, a.hi); }
+static inline Lanes splat(float s){ return {_mm_set1_ps(s), _mm_set1_ps(s)}; }
+
+static inline Lanes operator+(Lanes a, Lanes b){ return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)}; }
+static inline Lanes operator-(Lanes a, Lanes b){ return {_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)}; }
+static inline Lanes operator*(Lanes a, Lanes b){ return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)}; }
+static inline Lanes operator/(Lanes a, Lanes b){ return {_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)}; }
+static inline Lanes operator-(Lanes a){
+  __m128 s = _mm_set1_ps(-0.0f);
+  return {_mm_xor_ps(a.lo, s), _mm_xor_ps(a.hi, s)};
+}
+
+static inline Lanes lmin(Lanes a, Lanes b){ return {_mm_min_ps(b.lo, a.lo), _mm_min_ps(b.hi, a.hi)}; }
+static inline Lanes lmax(Lanes a, Lanes b){ return {_mm_max_ps(b.lo, a.lo), _mm_max_ps(b.hi, a.hi)}; }
+static inline Lanes labs(Lanes a){
+  __m128 s = _mm_set1_ps(-0.0f);
+  return {_mm_andnot_ps(s, a.lo), _mm_andnot_ps(s, a.hi)};
+}
+static inline Lanes lsqrt(Lanes a){ return {_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)}; }
+
+static inline __m128 round4(__m128 a){
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 mag = _mm_andnot_ps(sign, a);
+  // Values >= 2^23 (and inf/nan) are already integral
+  __m128 small = _mm_cmplt_ps(mag, _mm_set1_ps(8388608.0f));
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+  __m128 half = _mm_cmpge_ps(_mm_andnot_ps(sign, _mm_sub_ps(a, t)), _mm_set1_ps(0.5f));
+  __m128 one = _mm_or_ps(_mm_and_ps(a, sign), _mm_set1_ps(1.0f));
+  t = _mm_add_ps(t, _mm_and_ps(half, one));
+  return _mm_or_ps(_mm_and_ps(small, t), _mm_andnot_ps(small, a));
+}
+static inline Lanes lround(Lanes a){ return {round4(a.lo), round4(a.hi)}; }
+
+static inline __m128 floor4(__m128 a){
+  __m128 small = _mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(8388608.0f));
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+  t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+  return _mm_or_ps(_mm_and_ps(small, t), _mm_andnot_ps(small, a));
+}
+static inline Lanes lfloor(Lanes a){ return {floor4(a.lo), floor4(a.hi)}; }
+
+struct Mask { __m128 lo, hi; };
+
+static inline Mask operator<(Lanes a, Lanes b){ return {_mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi)}; }
+static inline Mask operator>(Lanes a, Lanes b){ return {_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi)}; }
+static inline Mask operator|(Mask a, Mask b){ return {_mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi)}; }
+static inline bool anyLane(Mask m){ return (_mm_movemask_ps(m.lo) | _mm_movemask_ps(m.hi)) != 0; }
+static inline Lanes lselect(Mask m, Lanes a, Lanes b){
+  return {_mm_or_ps(_mm_and_ps(m.lo, a.lo), _mm_andnot_ps(m.lo, b.lo)),
+          _mm_or_ps(_mm_and_ps(m.hi, a.hi), _mm_andnot_ps(m.hi, b.hi))};
+}
+
+#else
+
+struct Lanes { float v[SDF_BATCH_WIDTH]; };
+
+#define LANE_LOOP(expr) Lanes r; for(int l = 0; l < SDF_BATCH_WIDTH; l++) r.v[l] = (expr); return r;
+
+static inline Lanes load(const float* p){ LANE_LOOP(p[l]) }
+static inline void store(float* p, Lanes a){ for(int l = 0; l < SDF_BATCH_WIDTH; l++) p[l] = a.v[l]; }
+static inline Lanes splat(float s){ LANE_LOOP(s) }
+
+static inline Lanes operator+(Lanes a, Lanes b){ LANE_LOOP(a.v[l] + b.v[l]) }
+static inline Lanes operator-(Lanes a, Lanes b){ LANE_LOOP(a.v[l] - b.v[l]) }
+static inline Lanes operator*(Lanes a, Lanes b){ LANE_LOOP(a.v[l] * b.v[l]) }
+static inline Lanes operator/(Lanes a, Lanes b){ LANE_LOOP(a.v[l] / b.v[l]) }
+static inline Lanes operator-(Lanes a){ LANE_LOOP(-a.v[l]) }
+
+static inline Lanes lmin(Lanes a, Lanes b){ LANE_LOOP(glm::min(a.v[l], b.v[l])) }
+static inline Lanes lmax(Lanes a, Lanes b){ LANE_LOOP(glm::max(a.v[l], b.v[l])) }
+static inline Lanes labs(Lanes a){ LANE_LOOP(std::fabs(a.v[l])) }
+static inline Lanes lsqrt(Lanes a){ LANE_LOOP(std::sqrt(a.v[l])) }
+static inline Lanes lround(Lanes a){ LANE_LOOP(std::round(a.v[l])) }
+static inline Lanes lfloor(Lanes a){ LANE_LOOP(std::floor(a.v[l])) }
+
+struct Mask { bool v[SDF_BATCH_WIDTH]; };
+
+#define MASK_LOOP(expr) Mask r; for(int l = 0; l < SDF_BATCH_WIDTH; l++) r.v[l] = (expr); return r;
+
+static inline Mask operator<(Lanes a, Lanes b){ MASK_LOOP(a.v[l] < b.v[l]) }
+static inline Mask operator>(Lanes a, Lanes b){ MASK_LOOP(a.v[l] > b.v[l]) }
+static inline Mask operator|(Mask a, Mask b){ MASK_LOOP(a.v[l] || b.v[l]) }
+static inline bool anyLane(Mask m){ for(int l = 0; l < SDF_BATCH_WIDTH; l++) if(m.v[l]) return true; return false; }
+static inline Lanes lselect(Mask m, Lanes a, Lanes b){ LANE_LOOP(m.v[l] ? a.v[l] : b.v[l]) }
+
+#undef MASK_LOOP
+#undef LANE_LOOP
+
+#endif
+
+struct Lanes3 { Lanes x, y, z; };
+
+static inline Lanes3 load(const PointBatch& p){ return {load(p.x), load(p.y), load(p.z)}; }
+static inline void store(PointBatch& p, const Lanes3& a){ store(p.x, a.x); store(p.y, a.y); store(p.z, a.z); }
+
+static inline Lanes lclamp(Lanes a, Lanes lo, Lanes hi){ return lmin(lmax(a, lo), hi); }
+static inline Lanes lfract(Lanes a){ return a - lfloor(a); }
+static inline Lanes llength(Lanes a, Lanes b){ return lsqrt(a * a + b * b); }
+static inline Lanes llength(Lanes a, Lanes b, Lanes c){ return lsqrt(a * a + b * b + c * c); }
+
+//---------------------------------------
+// Operations
+//---------------------------------------
+
+static Lanes opSmoothUnion(Lanes a, Lanes b, float k){
+  k *= 4.0;
+  Lanes h = lmax(splat(k) - labs(a - b), splat(0.0f));
+  return lmin(a, b) - h * h * splat(0.25f) / splat(k);
+}
+
+static Lanes smin(Lanes a, Lanes b, float k){
+  Lanes h = lmax(splat(k) - labs(a - b), splat(0.0f));
+  return lmin(a, b) - h * h * splat(0.25f) / splat(k);
+}
+
+static Lanes smax(Lanes a, Lanes b, float k){
+  Lanes h = lmax(splat(k) - labs(a - b), splat(0.0f));
+  return lmax(a, b) + h * h * splat(0.25f) / splat(k);
+}
+
+#if TERRAIN_LATTICE_EXACT
+static Lanes3 hash3(Lanes3 p){
+  const Lanes c = splat(0.1031f);
+  p = {lfract(p.x * c), lfract(p.y * c), lfract(p.z * c)};
+  const Lanes o = splat(33.33f);
+  Lanes dt = p.x * (p.y + o) + p.y * (p.z + o) + p.z * (p.x + o);
+  p = {p.x + dt, p.y + dt, p.z + dt};
+  return {lfract((p.x + p.y) * p.z), lfract((p.x + p.z) * p.y), lfract((p.y + p.z) * p.x)};
+}
+#endif
+
+static Lanes opRepetition(Lanes p, float spacing){
+  return p - splat(spacing) * lround(p / splat(glm::max(spacing, 0.00001f)));
+}
+
+static Lanes opLimRepetition(Lanes p, float spacing, float limit){
+  return p - splat(spacing) * lclamp(lround(p / splat(spacing)), splat(-limit), splat(limit));
+}
+
+static Lanes opElongate(Lanes p, float defP){
+  return p - lclamp(p, splat(-defP), splat(defP));
+}
+
+//---------------------------------------
+// 3D SDF Primitives
+//---------------------------------------
+
+static Lanes sdSphere(const Lanes3& p){
+  return llength(p.x, p.y, p.z) - splat(0.5f);
+}
+
+static Lanes sdBox(const Lanes3& p){
+  const Lanes b = splat(0.5f), zero = splat(0.0f);
+  Lanes qx = labs(p.x) - b, qy = labs(p.y) - b, qz = labs(p.z) - b;
+  return llength(lmax(qx, zero), lmax(qy, zero), lmax(qz, zero)) +
+         lmin(lmax(qx, lmax(qy, qz)), zero);
+}
+
+static Lanes sdTorus(const Lanes3& p){
+  Lanes qx = llength(p.x, p.z) - splat(0.275f);
+  return llength(qx, p.y) - splat(0.15f);
+}
+
+static Lanes sdSphere(const Lanes3& p, glm::vec3 c, float s){
+  return llength(p.x - splat(c.x), p.y - splat(c.y), p.z - splat(c.z)) - splat(s);
+}
+
+static Lanes sdCapsule(const Lanes3& p, glm::vec3 a, glm::vec3 b, float r){
+  glm::vec3 ba = b - a;
+  Lanes pax = p.x - splat(a.x), pay = p.y - splat(a.y), paz = p.z - splat(a.z);
+  Lanes dt = pax * splat(ba.x) + pay * splat(ba.y) + paz * splat(ba.z);
+  Lanes h = lclamp(dt / splat(glm::dot(ba, ba)), splat(0.0f), splat(1.0f));
+  return llength(pax - splat(ba.x) * h, pay - splat(ba.y) * h, paz - splat(ba.z) * h) - splat(r);
+}
+
+static Lanes sdRoundedCylinder(const Lanes3& p, float cy, float ra, float rb, float h){
+  const Lanes zero = splat(0.0f);
+  Lanes dx = llength(p.x, p.z) - splat(ra) + splat(rb);
+  Lanes dy = labs(p.y - splat(cy)) - splat(h) + splat(rb);
+  return lmin(lmax(dx, dy), zero) + llength(lmax(dx, zero), lmax(dy, zero)) - splat(rb);
+}
+
+static Lanes sdOctahedron(const Lanes3& point, Lanes s){
+  Lanes3 p = {labs(point.x), labs(point.y), labs(point.z)};
+  Lanes m = p.x + p.y + p.z - s;
+  const Lanes three = splat(3.0f);
+  Mask cx = three * p.x < m, cy = three * p.y < m, cz = three * p.z < m;
+
+  // Branchless version of the axis selection of the scalar primitive
+  Lanes3 q = {lselect(cx, p.x, lselect(cy, p.y, p.z)),
+              lselect(cx, p.y, lselect(cy, p.z, p.x)),
+              lselect(cx, p.z, lselect(cy, p.x, p.y))};
+  Lanes k = lclamp(splat(0.5f) * (q.z - q.y + s), splat(0.0f), s);
+  Lanes inside = llength(q.x, q.y - s + k, q.z - k);
+  return lselect(cx | cy | cz, inside, m * splat(0.57735027f));
+}
+
+static Lanes sdSnowMan(const Lanes3& point){
+  const float scale = 0.23f;
+  const glm::vec3 pos = glm::vec3(0.0, -0.25, 0.0);
+  const Lanes s = splat(scale);
+  Lanes3 p = {(point.x - splat(pos.x)) / s, (point.y - splat(pos.y)) / s, (point.z - splat(pos.z)) / s};
+  Lanes r = sdSphere(p, glm::vec3(0.0f), 1.0);
+  r = opSmoothUnion(r, sdSphere(p, glm::vec3(0,1.5,0), 0.6), 0.1);
+  r = opSmoothUnion(r, sdSphere(p, glm::vec3(0.3,1.6,0.5), 0.1), 0.01);
+  r = opSmoothUnion(r, sdSphere(p, glm::vec3(-0.3,1.6,0.5), 0.1), 0.01);
+  r = opSmoothUnion(r, sdCapsule(p, glm::vec3(0.0), glm::vec3(1.6,0.8,0.0), 0.15), 0.05);
+  r = opSmoothUnion(r, sdCapsule(p, glm::vec3(0.0), glm::vec3(-1.6,0.8,0.0), 0.15), 0.05);
+  r = opSmoothUnion(r, sdCapsule(p, glm::vec3(0.0,1.4,0.0), glm::vec3(0.0,1.3,0.8), 0.05), 0.01);
+  r = lmin(r, sdRoundedCylinder(p, 2.1, 0.7, 0.05, 0.1));
+  r = lmin(r, sdRoundedCylinder(p, 2.5, 0.4, 0.05, 0.5));
+  return r * s;
+}
+
+// Random radius of the noise sphere/octahedron placed on lattice corner i+c
+static Lanes cellRadius(const Lanes3& i, glm::vec3 c){
+#if !TERRAIN_LATTICE_EXACT
+  // Table lookups are a gather, done lane by lane
+  alignas(32) float x[SDF_BATCH_WIDTH], y[SDF_BATCH_WIDTH], z[SDF_BATCH_WIDTH], r[SDF_BATCH_WIDTH];
+  store(x, i.x + splat(c.x));
+  store(y, i.y + splat(c.y));
+  store(z, i.z + splat(c.z));
+  for(int l = 0; l < SDF_BATCH_WIDTH; l++)
+    r[l] = cellRadius(glm::vec3(x[l], y[l], z[l]));
+  return load(r);
+#else
+  Lanes3 h = hash3({i.x + splat(c.x), i.y + splat(c.y), i.z + splat(c.z)});
+  const Lanes k = splat(17.0f);
+  Lanes px = k * lfract(h.x + splat(0.11f));
+  Lanes py = k * lfract(h.y + splat(0.17f));
+  Lanes pz = k * lfract(h.z + splat(0.13f));
+  Lanes w = lfract(px * py * pz * (px + py + pz));
+  return splat(0.7f) * w * w;
+#endif
+}
+
+static Lanes sdBaseSphere(const Lanes3& p){
+  Lanes3 i = {lfloor(p.x), lfloor(p.y), lfloor(p.z)};
+  Lanes3 f = {p.x - i.x, p.y - i.y, p.z - i.z};
+  Lanes r = splat(1e20f);
+  for(int c = 0; c < 8; c++){
+    glm::vec3 corner = glm::vec3((c >> 2) & 1, (c >> 1) & 1, c & 1);
+    Lanes d = llength(f.x - splat(corner.x), f.y - splat(corner.y), f.z - splat(corner.z)) - cellRadius(i, corner);
+    r = lmin(r, d);
+  }
+  return r;
+}
+
+static Lanes sdBaseOctahedron(const Lanes3& p){
+  Lanes3 i = {lfloor(p.x), lfloor(p.y), lfloor(p.z)};
+  Lanes3 f = {p.x - i.x, p.y - i.y, p.z - i.z};
+  Lanes r = splat(1e20f);
+  for(int c = 0; c < 8; c++){
+    glm::vec3 corner = glm::vec3((c >> 2) & 1, (c >> 1) & 1, c & 1);
+    Lanes3 q = {f.x - splat(corner.x), f.y - splat(corner.y), f.z - splat(corner.z)};
+    r = lmin(r, sdOctahedron(q, cellRadius(i, corner)));
+  }
+  return r;
+}
+
+//---------------------------------------
+// Int to sdf op/primitive
+//---------------------------------------
+
+void batchTransform(PointBatch& p, const float* m){
+  Lanes3 a = load(p);
+  Lanes3 r;
+  r.x = splat(m[0]) * a.x + splat(m[3]) * a.y + splat(m[6]) * a.z + splat(m[9]);
+  r.y = splat(m[1]) * a.x + splat(m[4]) * a.y + splat(m[7]) * a.z + splat(m[10]);
+  r.z = splat(m[2]) * a.x + splat(m[5]) * a.y + splat(m[8]) * a.z + splat(m[11]);
+  store(p, r);
+}
+
+void batchScale(PointBatch& p, float scale){
+  Lanes3 a = load(p);
+  Lanes s = splat(scale);
+  store(p, {a.x / s, a.y / s, a.z / s});
+}
+
+void batchPrimitive(int primType, const PointBatch& p, float* d){
+  switch(primType)
+  {
+    default:
+    case 0: store(d, splat(1000000.0f)); break;
+    case 1: store(d, sdBox(load(p))); break;
+    case 2: store(d, sdSphere(load(p))); break;
+    case 3: store(d, sdTorus(load(p))); break;
+    case 4: store(d, sdSnowMan(load(p))); break;
+    case 5: store(d, load(p.y)); break;
+  }
+}
+
+void batchCombOp(int opIndex, const float* d, float* result, float smoothness){
+  Lanes a = load(d), b = load(result);
+  switch(opIndex)
+  {
+    default:
+    case 0: store(result, lmin(a, b)); break;
+    case 1: store(result, lmax(-a, b)); break;
+    case 2: store(result, opSmoothUnion(a, b, smoothness)); break;
+    case 3: store(result, -opSmoothUnion(a, -b, smoothness)); break;
+  }
+}
+
+void batchRepOp(int opIndex, PointBatch& p, glm::vec3 spacing, glm::ivec3 limit){
+  Lanes3 a = load(p);
+  switch(opIndex)
+  {
+    default:
+    case 0: return;
+    case 1:
+      a = {opLimRepetition(a.x, spacing.x, float(limit.x)),
+           opLimRepetition(a.y, spacing.y, float(limit.y)),
+           opLimRepetition(a.z, spacing.z, float(limit.z))};
+      break;
+    case 2:
+      a = {opRepetition(a.x, spacing.x),
+           opRepetition(a.y, spacing.y),
+           opRepetition(a.z, spacing.z)};
+      break;
+  }
+  store(p, a);
+}
+
+void batchDefOp(int opIndex, PointBatch& p, glm::vec3 defP){
+  switch(opIndex)
+  {
+    default:
+    case 0: return;
+    case 1: {
+      Lanes3 a = load(p);
+      store(p, {opElongate(a.x, defP.x), opElongate(a.y, defP.y), opElongate(a.z, defP.z)});
+      break;
+    }
+  }
+}
+
+void batchMorphOp(const PointBatch& p, float* d, int morphPrim, float morph, float roundness){
+  alignas(32) float mD[SDF_BATCH_WIDTH];
+  batchPrimitive(morphPrim, p, mD);
+  Lanes prev = load(d);
+  Lanes m = load(mD) - splat(roundness);
+  store(d, prev * splat(1.0f - morph) + m * splat(morph));
+}
+
+// Noise octaves only apply to the lanes outside the primitive, like the scalar path
+void batchTerrainOp(const PointBatch& point, float* dOut, int octaves, glm::vec4 terrain, float minD){
+  if(octaves <= 0)
+    return;
+
+  const Lanes d0 = load(dOut);
+  const Mask outside = d0 > splat(0.0f);
+  if(!anyLane(outside))
+    return;
+
+  const glm::mat3 kernel = glm::mat3(
+      0.00f,-1.60f,-1.20f,
+      1.60f,  0.72f, -0.96f,
+      1.20f, -0.96f,  1.28f
+  );
+
+  Lanes3 p = load(point);
+  Lanes d = d0, n;
+  float s = terrain.x;
+  for(int i=0; i<octaves; i++){
+
+    if(i==0){
+      n = splat(s) * sdBaseOctahedron(p);
+      n = smax(n, d - splat(terrain.z * s*2), terrain.w * s);
+      d = smin(n, d,                          terrain.w/4.0 * s);
+    }else{
+      n = splat(s) * sdBaseSphere(p);
+      n = smax(n, d - splat(terrain.z * s), terrain.w * s);
+      d = smin(n, d,                        terrain.w * s);
+    }
+
+    // prepare next octave
+    p = {splat(kernel[0][0]) * p.x + splat(kernel[1][0]) * p.y + splat(kernel[2][0]) * p.z,
+         splat(kernel[0][1]) * p.x + splat(kernel[1][1]) * p.y + splat(kernel[2][1]) * p.z,
+         splat(kernel[0][2]) * p.x + splat(kernel[1][2]) * p.y + splat(kernel[2][2]) * p.z};
+    s = terrain.y*s;
+
+    if(s<minD) break;
+  }
+
+  store(dOut, lselect(outside, d, d0));
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Number of points evaluated together by the batched SDF kernels
+#define SDF_BATCH_WIDTH 8
+
+// Structure of arrays block of points, one lane per point
+struct PointBatch {
+  alignas(32) float x[SDF_BATCH_WIDTH];
+  alignas(32) float y[SDF_BATCH_WIDTH];
+  alignas(32) float z[SDF_BATCH_WIDTH];
+};
+
+// Lane group versions of the functions in sdf.hpp. Distance arrays must hold
+// SDF_BATCH_WIDTH floats aligned to 32 bytes. Results match the scalar path up
+// to float rounding, the scalar path evaluates a few terms in double.
+
+// m holds the 3x4 affine part of a transform, column by column
+void batchTransform(PointBatch& p, const float* m);
+
+void batchScale(PointBatch& p, float scale);
+
+void batchPrimitive(int primType, const PointBatch& p, float* d);
+
+void batchCombOp(int opIndex, const float* d, float* result, float smoothness);
+
+void batchRepOp(int opIndex, PointBatch& p, glm::vec3 spacing, glm::ivec3 limit);
+
+void batchDefOp(int opIndex, PointBatch& p, glm::vec3 defP);
+
+void batchMorphOp(const PointBatch& p, float* d, int morphPrim, float morph, float roundness);
+
+void batchTerrainOp(const PointBatch& p, float* d, int octaves, glm::vec4 terrain, float minD);
@@ -0,0 +1,58 @@
+#include "sdf_cache.hpp"
+
+#include "bvh.hpp"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+void SdfCache::setTolerance(float tolerance){
+  tolerance = glm::max(tolerance, 1e-6f);
+  if(tolerance != m_tolerance){
+    m_tolerance = tolerance;
+    m_entries.clear();
+  }
+}
+
+void SdfCache::clear(){
+  m_entries.clear();
+}
+
+SdfCache::Key SdfCache::makeKey(glm::vec3 p, int objIdxExcluded) const {
+  return {glm::ivec3(glm::floor(p / m_tolerance)), objIdxExcluded};
+}
+
+bool SdfCache::lookup(glm::vec3 p, int objIdxExcluded, float& d, glm::vec3& grad){
+  auto it = m_entries.find(makeKey(p, objIdxExcluded));
+  if(it == m_entries.end()){
+    m_stats.misses++;
+    return false;
+  }
+
+  const Entry& e = it->second;
+  d = e.d + glm::dot(e.grad, p - e.p);
+  grad = e.grad;
+  m_stats.hits++;
+  return true;
+}
+
+void SdfCache::insert(glm::vec3 p, int objIdxExcluded, float d, glm::vec3 grad){
+  m_entries[makeKey(p, objIdxExcluded)] = {p, d, grad};
+}
+
+void SdfCache::invalidate(const nvutils::Bbox& box){
+  if(m_entries.empty() || box.isEmpty())
+    return;
+
+  // A union can't move the distance at a point by more than the distance to
+  // its box, so only entries closer to the box than their own value change
+  const float cellDiag = m_tolerance * 1.7320508f;
+  for(auto it = m_entries.begin(); it != m_entries.end();){
+    const Entry& e = it->second;
+    if(boxDistance(e.p, box.min(), box.max()) <= glm::abs(e.d) + cellDiag){
+      it = m_entries.erase(it);
+      m_stats.invalidated++;
+    }else{
+      ++it;
+    }
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <unordered_map>
+
+#include "nvutils/bounding_box.hpp"
+
+// Distance and gradient results of the scene SDF, keyed by the cell of a
+// tolerance sized grid the query point falls in. A hit returns the cached
+// value moved to the query point along the cached gradient, so the error is
+// second order in the tolerance.
+class SdfCache {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidated;                 // Entries dropped by invalidate()
+  };
+
+  void setTolerance(float tolerance);
+  float tolerance() const { return m_tolerance; }
+
+  // Drops every entry, stats are kept
+  void clear();
+  void resetStats() { m_stats = {}; }
+  const Stats& stats() const { return m_stats; }
+  size_t size() const { return m_entries.size(); }
+
+  bool lookup(glm::vec3 p, int objIdxExcluded, float& d, glm::vec3& grad);
+  void insert(glm::vec3 p, int objIdxExcluded, float d, glm::vec3 grad);
+
+  // Drops the entries whose value a surface inside box could change
+  void invalidate(const nvutils::Bbox& box);
+
+private:
+  struct Key {
+    glm::ivec3 cell;
+    int objIdxExcluded;
+    bool operator==(const Key& o) const { return cell == o.cell && objIdxExcluded == o.objIdxExcluded; }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      uint64_t h = uint64_t(uint32_t(k.cell.x)) * 73856093u
+                 ^ uint64_t(uint32_t(k.cell.y)) * 19349663u
+                 ^ uint64_t(uint32_t(k.cell.z)) * 83492791u
+                 ^ uint64_t(uint32_t(k.objIdxExcluded)) * 2654435761u;
+      return size_t(h);
+    }
+  };
+
+  struct Entry {
+    glm::vec3 p;                          // Point the value was computed at
+    float d;
+    glm::vec3 grad;
+  };
+
+  Key makeKey(glm::vec3 p, int objIdxExcluded) const;
+
+  std::unordered_map<Key, Entry, KeyHash> m_entries;
+  float m_tolerance = 0.001f;
+  Stats m_stats{};
+};
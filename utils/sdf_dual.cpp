@@ -0,0 +1,268 @@
+#include "sdf_dual.hpp"
+#include "sdf.hpp"
+
+#include <cmath>
+
+//---------------------------------------
+// Dual arithmetic
+//---------------------------------------
+// min/max keep the operand order of glm::min/glm::max so ties pick the same
+// branch as the scalar path
+
+static inline Dual constant(float v){ return {v, glm::vec3(0.0f)}; }
+
+static inline Dual operator+(Dual a, Dual b){ return {a.v + b.v, a.g + b.g}; }
+static inline Dual operator-(Dual a, Dual b){ return {a.v - b.v, a.g - b.g}; }
+static inline Dual operator*(Dual a, Dual b){ return {a.v * b.v, a.g * b.v + b.g * a.v}; }
+static inline Dual operator-(Dual a){ return {-a.v, -a.g}; }
+
+static inline Dual operator+(Dual a, float s){ return {a.v + s, a.g}; }
+static inline Dual operator-(Dual a, float s){ return {a.v - s, a.g}; }
+static inline Dual operator-(float s, Dual a){ return {s - a.v, -a.g}; }
+static inline Dual operator*(Dual a, float s){ return {a.v * s, a.g * s}; }
+static inline Dual operator*(float s, Dual a){ return {s * a.v, s * a.g}; }
+static inline Dual operator/(Dual a, float s){ return {a.v / s, a.g / s}; }
+
+static inline Dual dmin(Dual a, Dual b){ return b.v < a.v ? b : a; }
+static inline Dual dmax(Dual a, Dual b){ return a.v < b.v ? b : a; }
+static inline Dual dmin(Dual a, float b){ return dmin(a, constant(b)); }
+static inline Dual dmax(Dual a, float b){ return dmax(a, constant(b)); }
+static inline Dual dclamp(Dual x, float lo, float hi){ return dmin(dmax(x, lo), hi); }
+static inline Dual dabs(Dual a){ return a.v < 0.0f ? -a : a; }
+
+// The gradient is left at 0 where sqrt is not differentiable
+static inline Dual dsqrt(Dual a){
+  float s = std::sqrt(a.v);
+  return {s, s > 0.0f ? a.g * (0.5f / s) : glm::vec3(0.0f)};
+}
+
+static inline Dual3 operator-(const Dual3& p, glm::vec3 c){ return {p.x - c.x, p.y - c.y, p.z - c.z}; }
+static inline Dual3 dabs(const Dual3& p){ return {dabs(p.x), dabs(p.y), dabs(p.z)}; }
+
+static inline Dual dlength(Dual x, Dual y){ return dsqrt(x * x + y * y); }
+static inline Dual dlength(const Dual3& p){ return dsqrt(p.x * p.x + p.y * p.y + p.z * p.z); }
+
+static inline glm::vec3 value(const Dual3& p){ return glm::vec3(p.x.v, p.y.v, p.z.v); }
+
+//---------------------------------------
+// Operations
+//---------------------------------------
+
+// Shared shape of smin and opSmoothUnion, the derivative of h*h*0.25/k is
+// h*0.5/k times the one of h
+static Dual dsmin(Dual a, Dual b, float k){
+  Dual h = dmax(k - dabs(a - b), 0.0f);
+  Dual m = dmin(a, b);
+  return {float(m.v - h.v*h.v*0.25/k), m.g - h.g * float(h.v*0.5/k)};
+}
+
+static Dual dsmax(Dual a, Dual b, float k){
+  Dual h = dmax(k - dabs(a - b), 0.0f);
+  Dual m = dmax(a, b);
+  return {float(m.v + h.v*h.v*0.25/k), m.g + h.g * float(h.v*0.5/k)};
+}
+
+static Dual dOpUnion(Dual a, Dual b){
+  return dmin(a, b);
+}
+static Dual dOpSmoothUnion(Dual a, Dual b, float k){
+  k *= 4.0;
+  return dsmin(a, b, k);
+}
+
+static Dual dOpSubtraction(Dual a, Dual b){
+  return dmax(-a, b);
+}
+static Dual dOpSmoothSubtraction(Dual a, Dual b, float k){
+  return -dOpSmoothUnion(a, -b, k);
+}
+
+//---------------------------------------
+// 3D SDF Primitives
+//---------------------------------------
+
+static Dual dSphere(const Dual3& p, float s){
+  return dlength(p) - s;
+}
+
+static Dual dBox(const Dual3& p, glm::vec3 b){
+  Dual3 q = dabs(p) - b;
+  Dual3 outside = {dmax(q.x, 0.0f), dmax(q.y, 0.0f), dmax(q.z, 0.0f)};
+  return dlength(outside) + dmin(dmax(q.x, dmax(q.y, q.z)), 0.0f);
+}
+
+static Dual dPlane(const Dual3& p){
+  return p.y;
+}
+
+static Dual dCapsule(const Dual3& p, glm::vec3 a, glm::vec3 b, float r){
+  Dual3 pa = p - a;
+  glm::vec3 ba = b - a;
+  Dual h = dclamp((pa.x * ba.x + pa.y * ba.y + pa.z * ba.z) / glm::dot(ba, ba), 0.0f, 1.0f);
+  return dlength({pa.x - ba.x * h, pa.y - ba.y * h, pa.z - ba.z * h}) - r;
+}
+
+static Dual dRoundedCylinder(const Dual3& p, float ra, float rb, float h){
+  Dual dx = dlength(p.x, p.z) - ra + rb;
+  Dual dy = dabs(p.y) - h + rb;
+  return dmin(dmax(dx, dy), 0.0f) + dlength(dmax(dx, 0.0f), dmax(dy, 0.0f)) - rb;
+}
+
+static Dual dTorus(const Dual3& p, glm::vec2 t){
+  Dual qx = dlength(p.x, p.z) - t.x;
+  return dlength(qx, p.y) - t.y;
+}
+
+static Dual dOctahedron(Dual3 p, float s){
+  p = dabs(p);
+  Dual m = p.x + p.y + p.z - s;
+  Dual3 q;
+  if( 3.0*p.x.v < m.v ) q = p;
+  else if( 3.0*p.y.v < m.v ) q = {p.y, p.z, p.x};
+  else if( 3.0*p.z.v < m.v ) q = {p.z, p.x, p.y};
+  else return {float(m.v*0.57735027), m.g*0.57735027f};
+
+  Dual k = dclamp(0.5f*(q.z - q.y + s), 0.0f, s);
+  return dlength({q.x, q.y - s + k, q.z - k});
+}
+
+// Same construction as sdSnowMan
+static Dual dSnowMan(const Dual3& point){
+  const float scale = 0.23f;
+  const glm::vec3 pos = glm::vec3(0.0, -0.25, 0.0);
+  Dual3 p = point - pos;
+  p = {p.x / scale, p.y / scale, p.z / scale};
+  Dual r = dSphere(p, 1.0);
+  r = dOpSmoothUnion(r, dSphere(p - glm::vec3(0, 1.5, 0), 0.6), 0.1);
+  r = dOpSmoothUnion(r, dSphere(p - glm::vec3(0.3, 1.6, 0.5), 0.1), 0.01);
+  r = dOpSmoothUnion(r, dSphere(p - glm::vec3(-0.3, 1.6, 0.5), 0.1), 0.01);
+  r = dOpSmoothUnion(r, dCapsule(p, glm::vec3(0.0), glm::vec3(1.6, 0.8, 0.0), 0.15), 0.05);
+  r = dOpSmoothUnion(r, dCapsule(p, glm::vec3(0.0), glm::vec3(-1.6, 0.8, 0.0), 0.15), 0.05);
+  r = dOpSmoothUnion(r, dCapsule(p, glm::vec3(0.0, 1.4, 0.0), glm::vec3(0.0, 1.3, 0.8), 0.05), 0.01);
+  r = dOpUnion(r, dRoundedCylinder(p - glm::vec3(0.0, 2.1, 0.0), 0.7, 0.05, 0.1));
+  r = dOpUnion(r, dRoundedCylinder(p - glm::vec3(0.0, 2.5, 0.0), 0.4, 0.05, 0.5));
+  return r * scale;
+}
+
+// Cell radii are constant inside a cell, only the offset to the corner moves.
+// The 8 corners are compared with plain floats and only the nearest one is
+// differentiated.
+static Dual dBaseNoise(const Dual3& p, bool octahedron){
+  glm::vec3 i = glm::vec3(glm::ivec3(glm::floor(value(p))));
+  glm::vec3 fv = glm::fract(value(p));
+
+  float d[8], r[8];
+  for(int k = 0; k < 8; k++){
+    glm::vec3 c(k >> 2 & 1, k >> 1 & 1, k & 1);
+    r[k] = cellRadius(i + c);
+    d[k] = octahedron ? sdOctahedron(fv - c, r[k]) : glm::length(fv - c) - r[k];
+  }
+
+  // Same nesting as sdBaseSphere and sdBaseOctahedron
+  auto pick = [&](int a, int b){ return d[b] < d[a] ? b : a; };
+  int k = pick(pick(pick(0, 1), pick(2, 3)), pick(pick(4, 5), pick(6, 7)));
+
+  glm::vec3 c(k >> 2 & 1, k >> 1 & 1, k & 1);
+  Dual3 f = {{fv.x, p.x.g}, {fv.y, p.y.g}, {fv.z, p.z.g}};
+  Dual n = octahedron ? dOctahedron(f - c, r[k]) : dlength(f - c) - r[k];
+  return {d[k], n.g};
+}
+
+//---------------------------------------
+// Int to sdf op/primitive
+//---------------------------------------
+
+void dualTransform(Dual3& p, const float* m){
+  Dual3 o = p;
+  p.x = m[0] * o.x + m[3] * o.y + m[6] * o.z + m[9];
+  p.y = m[1] * o.x + m[4] * o.y + m[7] * o.z + m[10];
+  p.z = m[2] * o.x + m[5] * o.y + m[8] * o.z + m[11];
+}
+
+void dualScale(Dual3& p, float scale){
+  p = {p.x / scale, p.y / scale, p.z / scale};
+}
+
+Dual dualPrimitive(int primType, const Dual3& p){
+  switch(primType)
+  {
+    default:
+    case 0: return constant(sdEmpty(value(p)));
+    case 1: return dBox(p, glm::vec3(0.5));
+    case 2: return dSphere(p, 0.5f);
+    case 3: return dTorus(p, glm::vec2(0.275, 0.15));
+    case 4: return dSnowMan(p);
+    case 5: return dPlane(p);
+  }
+}
+
+Dual dualCombOp(int opIndex, Dual d, Dual result, float smoothness){
+  switch(opIndex)
+  {
+    default:
+    case 0: return dOpUnion(d, result);
+    case 1: return dOpSubtraction(d, result);
+    case 2: return dOpSmoothUnion(d, result, smoothness);
+    case 3: return dOpSmoothSubtraction(d, result, smoothness);
+  }
+}
+
+// Repetition only shifts the point by whole cells, the gradient passes through
+void dualRepOp(int opIndex, Dual3& p, glm::vec3 spacing, glm::vec3 limit){
+  glm::vec3 q = value(p);
+  switch(opIndex)
+  {
+    default:
+    case 0: return;
+    case 1: q = opLimRepetition(q, spacing, limit); break;
+    case 2: q = opRepetition(q, spacing); break;
+  }
+  p.x.v = q.x;
+  p.y.v = q.y;
+  p.z.v = q.z;
+}
+
+void dualDefOp(int opIndex, Dual3& p, glm::vec3 defP){
+  switch(opIndex)
+  {
+    default:
+    case 0: return;
+    case 1:
+      p.x = p.x - dclamp(p.x, -defP.x, defP.x);
+      p.y = p.y - dclamp(p.y, -defP.y, defP.y);
+      p.z = p.z - dclamp(p.z, -defP.z, defP.z);
+      return;
+  }
+}
+
+Dual dualMorphOp(const Dual3& p, Dual d, int morphPrim, float morph, float roundness){
+  Dual mD = dualPrimitive(morphPrim, p) - roundness;
+  return d * (1.0f - morph) + mD * morph;
+}
+
+Dual dualTerrainOp(Dual3 p, Dual d, int octaves, glm::vec4 terrain, float minD){
+  float s = terrain.x;
+  Dual n;
+  for(int i=0; i<octaves; i++){
+
+    if(i==0){
+      n = s*dBaseNoise(p, true);
+      n = dsmax(n, d - terrain.z * s*2, terrain.w * s);
+      d = dsmin(n, d,               terrain.w/4.0 * s);
+    }else{
+      n = s*dBaseNoise(p, false);
+      n = dsmax(n, d - terrain.z * s, terrain.w * s);
+      d = dsmin(n, d,               terrain.w * s);
+    }
+
+    // prepare next octave, same kernel as applyTerrainOp
+    Dual3 o = p;
+    p.x = 0.00f * o.x + 1.60f * o.y + 1.20f * o.z;
+    p.y = -1.60f * o.x + 0.72f * o.y + -0.96f * o.z;
+    p.z = -1.20f * o.x + -0.96f * o.y + 1.28f * o.z;
+    s = terrain.y*s;
+
+    if(s<minD) break;
+  }
+  return d;
+}
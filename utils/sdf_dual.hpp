@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Value and gradient with respect to the query point
+struct Dual {
+  float v;
+  glm::vec3 g;
+};
+
+// Point being transformed, every component carries its own gradient
+struct Dual3 {
+  Dual x, y, z;
+};
+
+// Forward mode versions of the functions in sdf.hpp. Values are computed with
+// the same expressions as the scalar path so they match map() exactly, the
+// gradient is the derivative of the branch the scalar path takes.
+
+// m holds the 3x4 affine part of a transform, column by column
+void dualTransform(Dual3& p, const float* m);
+
+void dualScale(Dual3& p, float scale);
+
+Dual dualPrimitive(int primType, const Dual3& p);
+
+Dual dualCombOp(int opIndex, Dual d, Dual result, float smoothness);
+
+void dualRepOp(int opIndex, Dual3& p, glm::vec3 spacing, glm::vec3 limit);
+
+void dualDefOp(int opIndex, Dual3& p, glm::vec3 defP);
+
+Dual dualMorphOp(const Dual3& p, Dual d, int morphPrim, float morph, float roundness);
+
+Dual dualTerrainOp(Dual3 p, Dual d, int octaves, glm::vec4 terrain, float minD);
@@ -0,0 +1,302 @@
+#include "sdf_interval.hpp"
+#include "sdf.hpp"
+
+#include <cmath>
+#include <limits>
+
+// Range of sdBaseSphere and sdBaseOctahedron. Cell radii stay below 0.7 and
+// the nearest lattice point is at most half a cell diagonal away.
+static const float NOISE_MIN = -0.7f;
+static const float NOISE_MAX = 0.8661f;
+// Larger boxes use the range above instead of visiting every lattice cell
+static const float MAX_NOISE_CELLS = 64.0f;
+
+//---------------------------------------
+// Interval helpers
+//---------------------------------------
+
+static Interval add(Interval a, Interval b){ return {a.lo + b.lo, a.hi + b.hi}; }
+static Interval add(Interval a, float s){ return {a.lo + s, a.hi + s}; }
+static Interval mul(Interval a, float s){
+  return s >= 0.0f ? Interval{a.lo * s, a.hi * s} : Interval{a.hi * s, a.lo * s};
+}
+static Interval hull(Interval a, Interval b){ return {glm::min(a.lo, b.lo), glm::max(a.hi, b.hi)}; }
+static Interval iabs(Interval a){
+  if(a.lo >= 0.0f) return a;
+  if(a.hi <= 0.0f) return {-a.hi, -a.lo};
+  return {0.0f, glm::max(-a.lo, a.hi)};
+}
+
+static Interval axis(const IntervalBox& p, int i){ return {p.lo[i], p.hi[i]}; }
+static IntervalBox translate(const IntervalBox& p, glm::vec3 c){ return {p.lo - c, p.hi - c}; }
+
+// length() grows with the absolute value of every component
+static Interval lengthRange(Interval x, Interval y){
+  Interval ax = iabs(x), ay = iabs(y);
+  return {glm::length(glm::vec2(ax.lo, ay.lo)), glm::length(glm::vec2(ax.hi, ay.hi))};
+}
+static Interval lengthRange(const IntervalBox& p){
+  Interval ax = iabs(axis(p, 0)), ay = iabs(axis(p, 1)), az = iabs(axis(p, 2));
+  return {glm::length(glm::vec3(ax.lo, ay.lo, az.lo)), glm::length(glm::vec3(ax.hi, ay.hi, az.hi))};
+}
+
+// Bound for 1-Lipschitz functions from their value at the box center
+static Interval lipschitzRange(float center, const IntervalBox& p){
+  float r = 0.5f * glm::length(p.hi - p.lo);
+  return {center - r, center + r};
+}
+
+//---------------------------------------
+// Operations
+//---------------------------------------
+
+// Union and the smooth unions grow with both operands, the ends of the
+// inputs give the ends of the result
+static Interval iUnion(Interval a, Interval b){
+  return {opUnion(a.lo, b.lo), opUnion(a.hi, b.hi)};
+}
+static Interval iSmoothUnion(Interval a, Interval b, float k){
+  return {opSmoothUnion(a.lo, b.lo, k), opSmoothUnion(a.hi, b.hi, k)};
+}
+
+// Subtractions shrink as a grows
+static Interval iSubtraction(Interval a, Interval b){
+  return {opSubtraction(a.hi, b.lo), opSubtraction(a.lo, b.hi)};
+}
+static Interval iSmoothSubtraction(Interval a, Interval b, float k){
+  return {opSmoothSubtraction(a.hi, b.lo, k), opSmoothSubtraction(a.lo, b.hi, k)};
+}
+
+// p - s*clamp(round(p/div), -l, l) over [lo, hi]. The cell index is monotone
+// in p, so the ends give the extreme offsets. When the box covers several
+// cells the inner ones fold into half a spacing around the origin.
+static Interval repAxis(float lo, float hi, float s, float div, float l){
+  if(s == 0.0f)
+    return {lo, hi};
+
+  float kLo = glm::clamp(std::round(lo / div), -l, l);
+  float kHi = glm::clamp(std::round(hi / div), -l, l);
+  if(kLo == kHi)
+    return {lo - s * kLo, hi - s * kLo};
+
+  if(s > 0.0f && div == s)
+    return {glm::min(lo - s * kLo, -0.5f * s), glm::max(hi - s * kHi, 0.5f * s)};
+
+  return {lo - glm::max(s * kLo, s * kHi), hi - glm::min(s * kLo, s * kHi)};
+}
+
+//---------------------------------------
+// 3D SDF Primitives
+//---------------------------------------
+
+static Interval iSphere(const IntervalBox& p, float s){
+  return add(lengthRange(p), -s);
+}
+
+static Interval iBox(const IntervalBox& p, glm::vec3 b){
+  glm::vec3 qLo, qHi;
+  for(int i = 0; i < 3; i++){
+    Interval a = iabs(axis(p, i));
+    qLo[i] = a.lo - b[i];
+    qHi[i] = a.hi - b[i];
+  }
+  Interval outside = {glm::length(glm::max(qLo, glm::vec3(0.0f))), glm::length(glm::max(qHi, glm::vec3(0.0f)))};
+  Interval inside = {
+    glm::min(glm::max(qLo.x, glm::max(qLo.y, qLo.z)), 0.0f),
+    glm::min(glm::max(qHi.x, glm::max(qHi.y, qHi.z)), 0.0f),
+  };
+  return add(outside, inside);
+}
+
+static Interval iPlane(const IntervalBox& p){
+  return axis(p, 1);
+}
+
+static Interval iTorus(const IntervalBox& p, glm::vec2 t){
+  Interval q = add(lengthRange(axis(p, 0), axis(p, 2)), -t.x);
+  return add(lengthRange(q, axis(p, 1)), -t.y);
+}
+
+static Interval iRoundedCylinder(const IntervalBox& p, float ra, float rb, float h){
+  Interval dx = add(lengthRange(axis(p, 0), axis(p, 2)), -ra + rb);
+  Interval dy = add(iabs(axis(p, 1)), -h + rb);
+  Interval inside = {glm::min(glm::max(dx.lo, dy.lo), 0.0f), glm::min(glm::max(dx.hi, dy.hi), 0.0f)};
+  Interval outside = {
+    glm::length(glm::max(glm::vec2(dx.lo, dy.lo), 0.0f)),
+    glm::length(glm::max(glm::vec2(dx.hi, dy.hi), 0.0f)),
+  };
+  return add(add(inside, outside), -rb);
+}
+
+static Interval iCapsule(const IntervalBox& p, glm::vec3 a, glm::vec3 b, float r){
+  return lipschitzRange(sdCapsule(0.5f * (p.lo + p.hi), a, b, r), p);
+}
+
+// Same construction as sdSnowMan
+static Interval iSnowMan(const IntervalBox& point){
+  const float scale = 0.23f;
+  const glm::vec3 pos = glm::vec3(0.0, -0.25, 0.0);
+  IntervalBox p = {(point.lo - pos) / scale, (point.hi - pos) / scale};
+  Interval r = iSphere(p, 1.0);
+  r = iSmoothUnion(r, iSphere(translate(p, glm::vec3(0, 1.5, 0)), 0.6), 0.1);
+  r = iSmoothUnion(r, iSphere(translate(p, glm::vec3(0.3, 1.6, 0.5)), 0.1), 0.01);
+  r = iSmoothUnion(r, iSphere(translate(p, glm::vec3(-0.3, 1.6, 0.5)), 0.1), 0.01);
+  r = iSmoothUnion(r, iCapsule(p, glm::vec3(0.0), glm::vec3(1.6, 0.8, 0.0), 0.15), 0.05);
+  r = iSmoothUnion(r, iCapsule(p, glm::vec3(0.0), glm::vec3(-1.6, 0.8, 0.0), 0.15), 0.05);
+  r = iSmoothUnion(r, iCapsule(p, glm::vec3(0.0, 1.4, 0.0), glm::vec3(0.0, 1.3, 0.8), 0.05), 0.01);
+  r = iUnion(r, iRoundedCylinder(translate(p, glm::vec3(0.0, 2.1, 0.0)), 0.7, 0.05, 0.1));
+  r = iUnion(r, iRoundedCylinder(translate(p, glm::vec3(0.0, 2.5, 0.0)), 0.4, 0.05, 0.5));
+  return mul(r, scale);
+}
+
+// Range of sdBaseSphere, or sdBaseOctahedron, over [lo, hi]. Each lattice
+// cell the box touches only sees the spheres on its 8 corners.
+static Interval iNoise(glm::vec3 lo, glm::vec3 hi, bool octahedron){
+  glm::vec3 cLo = glm::floor(lo);
+  glm::vec3 cHi = glm::floor(hi);
+  glm::vec3 cells = cHi - cLo + 1.0f;
+  if(cells.x * cells.y * cells.z > MAX_NOISE_CELLS)
+    return {NOISE_MIN, NOISE_MAX};
+
+  const float invSqrt3 = 0.57735027f;
+  Interval out = {std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()};
+  for(float z = cLo.z; z <= cHi.z; z++)
+  for(float y = cLo.y; y <= cHi.y; y++)
+  for(float x = cLo.x; x <= cHi.x; x++){
+    glm::vec3 i(x, y, z);
+    glm::vec3 fLo = glm::max(lo, i) - i;
+    glm::vec3 fHi = glm::min(hi, i + 1.0f) - i;
+
+    Interval cell = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    for(int k = 0; k < 8; k++){
+      glm::vec3 c(k >> 2 & 1, k >> 1 & 1, k & 1);
+      float r = cellRadius(i + c);
+      float near = glm::length(glm::max(glm::max(fLo - c, c - fHi), glm::vec3(0.0f)));
+      float far = glm::length(glm::max(glm::abs(fLo - c), glm::abs(fHi - c)));
+      // The octahedron lies between its inscribed sphere and the radius r one
+      Interval d = octahedron
+        ? Interval{glm::max(near - r, -r * invSqrt3), far - r * invSqrt3}
+        : Interval{near - r, far - r};
+      cell = {glm::min(cell.lo, d.lo), glm::min(cell.hi, d.hi)};
+    }
+    out = hull(out, cell);
+  }
+  return out;
+}
+
+//---------------------------------------
+// Int to sdf op/primitive
+//---------------------------------------
+
+IntervalBox intervalTransform(const IntervalBox& p, const float* m){
+  IntervalBox out;
+  for(int i = 0; i < 3; i++){
+    Interval acc = {m[9 + i], m[9 + i]};
+    for(int j = 0; j < 3; j++)
+      acc = add(acc, mul(axis(p, j), m[3 * j + i]));
+    out.lo[i] = acc.lo;
+    out.hi[i] = acc.hi;
+  }
+  return out;
+}
+
+IntervalBox intervalScale(const IntervalBox& p, float scale){
+  IntervalBox out = {p.lo / scale, p.hi / scale};
+  if(scale < 0.0f)
+    std::swap(out.lo, out.hi);
+  return out;
+}
+
+Interval intervalPrimitive(int primType, const IntervalBox& p){
+  switch(primType)
+  {
+    default:
+    case 0: return {sdEmpty(p.lo), sdEmpty(p.lo)};
+    case 1: return iBox(p, glm::vec3(0.5));
+    case 2: return iSphere(p, 0.5f);
+    case 3: return iTorus(p, glm::vec2(0.275, 0.15));
+    case 4: return iSnowMan(p);
+    case 5: return iPlane(p);
+  }
+}
+
+Interval intervalCombOp(int opIndex, Interval d, Interval result, float smoothness){
+  switch(opIndex)
+  {
+    default:
+    case 0: return iUnion(d, result);
+    case 1: return iSubtraction(d, result);
+    case 2: return iSmoothUnion(d, result, smoothness);
+    case 3: return iSmoothSubtraction(d, result, smoothness);
+  }
+}
+
+IntervalBox intervalRepOp(int opIndex, const IntervalBox& p, glm::vec3 spacing, glm::vec3 limit){
+  if(opIndex != 1 && opIndex != 2)
+    return p;
+
+  const float unlimited = std::numeric_limits<float>::max();
+  IntervalBox out;
+  for(int i = 0; i < 3; i++){
+    Interval a = opIndex == 1
+      ? repAxis(p.lo[i], p.hi[i], spacing[i], spacing[i], limit[i])
+      : repAxis(p.lo[i], p.hi[i], spacing[i], glm::max(spacing[i], 0.00001f), unlimited);
+    out.lo[i] = a.lo;
+    out.hi[i] = a.hi;
+  }
+  return out;
+}
+
+IntervalBox intervalDefOp(int opIndex, const IntervalBox& p, glm::vec3 defP){
+  switch(opIndex)
+  {
+    default:
+    case 0: return p;
+    // Elongation is monotone along every axis
+    case 1: return {opElongate(p.lo, defP), opElongate(p.hi, defP)};
+  }
+}
+
+Interval intervalMorphOp(const IntervalBox& p, Interval d, int morphPrim, float morph, float roundness){
+  Interval mD = add(intervalPrimitive(morphPrim, p), -roundness);
+  return add(mul(d, 1.0f - morph), mul(mD, morph));
+}
+
+Interval intervalTerrainOp(const IntervalBox& p, Interval d, int octaves, glm::vec4 terrain, float minD){
+  if(d.hi <= 0.0f)
+    return d;
+
+  // The octave kernel is twice a rotation, later octaves track the box as a
+  // bounding sphere so it only doubles instead of compounding the AABB
+  glm::vec3 center = 0.5f * (p.lo + p.hi);
+  float radius = 0.5f * glm::length(p.hi - p.lo);
+  const glm::mat3 kernel = glm::mat3(
+      0.00f,-1.60f,-1.20f,
+      1.60f,  0.72f, -0.96f,
+      1.20f, -0.96f,  1.28f
+  );
+
+  // Noise only applies where d > 0, smin and smax grow with both operands so
+  // the ends of d give the ends of the result
+  Interval t = {glm::max(d.lo, 0.0f), d.hi};
+  float s = terrain.x;
+  for(int i=0; i<octaves; i++){
+
+    if(i==0){
+      Interval n = mul(iNoise(p.lo, p.hi, true), s);
+      n = {smax(n.lo, t.lo - terrain.z * s*2, terrain.w * s), smax(n.hi, t.hi - terrain.z * s*2, terrain.w * s)};
+      t = {smin(n.lo, t.lo, terrain.w/4.0 * s), smin(n.hi, t.hi, terrain.w/4.0 * s)};
+    }else{
+      Interval n = mul(iNoise(center - radius, center + radius, false), s);
+      n = {smax(n.lo, t.lo - terrain.z * s, terrain.w * s), smax(n.hi, t.hi - terrain.z * s, terrain.w * s)};
+      t = {smin(n.lo, t.lo, terrain.w * s), smin(n.hi, t.hi, terrain.w * s)};
+    }
+
+    center = kernel*center;
+    radius = 2.0f*radius;
+    s = terrain.y*s;
+    if(s<minD) break;
+  }
+
+  return d.lo <= 0.0f ? hull({d.lo, 0.0f}, t) : t;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Closed range of values [lo, hi]
+struct Interval {
+  float lo;
+  float hi;
+};
+
+// Interval functions don't track float rounding, [d.lo - pad, d.hi + pad]
+// covers it
+inline float roundingPad(Interval d){
+  return 1e-4f * (1.0f + glm::max(glm::abs(d.lo), glm::abs(d.hi)));
+}
+
+// Axis aligned box of points, one interval per axis
+struct IntervalBox {
+  glm::vec3 lo;
+  glm::vec3 hi;
+};
+
+// Interval versions of the functions in sdf.hpp. Every result contains the
+// value of the scalar function for every point of the input box, they are
+// usually wider than the true range since axes are treated as independent.
+// Float rounding is not tracked, callers pad the final result
+// with roundingPad().
+
+// m holds the 3x4 affine part of a transform, column by column
+IntervalBox intervalTransform(const IntervalBox& p, const float* m);
+
+IntervalBox intervalScale(const IntervalBox& p, float scale);
+
+Interval intervalPrimitive(int primType, const IntervalBox& p);
+
+Interval intervalCombOp(int opIndex, Interval d, Interval result, float smoothness);
+
+IntervalBox intervalRepOp(int opIndex, const IntervalBox& p, glm::vec3 spacing, glm::vec3 limit);
+
+IntervalBox intervalDefOp(int opIndex, const IntervalBox& p, glm::vec3 defP);
+
+Interval intervalMorphOp(const IntervalBox& p, Interval d, int morphPrim, float morph, float roundness);
+
+// Includes the d > 0 test done before applyTerrainOp
+Interval intervalTerrainOp(const IntervalBox& p, Interval d, int octaves, glm::vec4 terrain, float minD);
@@ -0,0 +1,648 @@
+#include "sdf_tape.hpp"
+#include "edit_layer.hpp"
+#include "sampled_volumes.hpp"
+#include "sdf.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+static_assert(sizeof(TapeWord) == sizeof(float), "Tape words must stay 32 bits");
+
+static const float iniD = 10000.0f;
+
+//---------------------------------------
+// Tape building
+//---------------------------------------
+
+void SdfTape::clear(){
+  m_code.clear();
+  m_segments.clear();
+  m_dynamic.clear();
+  m_runs.clear();
+  m_runsStale = true;
+}
+
+void SdfTape::beginSegment(uint32_t nodeId, bool terrain, bool dynamic, const nvutils::Bbox& bbox, bool cullable){
+  // Dynamic segments are visited apart from the union runs
+  m_segments.push_back({
+    .begin = uint32_t(m_code.size()),
+    .end = uint32_t(m_code.size()),
+    .nodeId = nodeId,
+    .terrain = terrain,
+    .dynamic = dynamic,
+    .cullable = cullable && !dynamic,
+    .bbox = bbox,
+  });
+}
+
+void SdfTape::emit(TapeOp op, std::initializer_list<TapeWord> params){
+  m_code.push_back(op);
+  m_code.insert(m_code.end(), params.begin(), params.end());
+
+  // Only plain unions commute with their neighbours
+  if(op > TapeOp::Union)
+    m_segments.back().cullable = false;
+}
+
+void SdfTape::endSegment(){
+  m_segments.back().end = uint32_t(m_code.size());
+  if(m_segments.back().dynamic)
+    m_dynamic.push_back(uint32_t(m_segments.size() - 1));
+}
+
+bool SdfTape::replaceSegment(size_t idx, const SdfTape& src){
+  Segment& dst = m_segments[idx];
+  const Segment& seg = src.m_segments[0];
+
+  if(dst.end - dst.begin != seg.end - seg.begin || dst.dynamic != seg.dynamic || dst.cullable != seg.cullable)
+    return false;
+
+  std::copy(src.m_code.begin() + seg.begin, src.m_code.begin() + seg.end, m_code.begin() + dst.begin);
+  dst.nodeId = seg.nodeId;
+  dst.terrain = seg.terrain;
+  dst.bbox = seg.bbox;
+
+  if(!dst.cullable)
+    return true;
+
+  // Moved boxes are picked up by the next refit
+  for(UnionRun& run : m_runs){
+    if(idx >= run.begin && idx < run.end){
+      if(!run.bvh.empty())
+        run.bvh.setBox(uint32_t(idx - run.begin), dst.bbox);
+      m_movedItems++;
+      break;
+    }
+  }
+  return true;
+}
+
+//---------------------------------------
+// Union run BVH
+//---------------------------------------
+
+void SdfTape::launchBvhBuild(){
+  std::vector<std::vector<nvutils::Bbox>> boxes(m_runs.size());
+  for(size_t r = 0; r < m_runs.size(); r++){
+    for(uint32_t s = m_runs[r].begin; s < m_runs[r].end; s++)
+      boxes[r].push_back(m_segments[s].bbox);
+  }
+
+  // Assigning over a pending std::async future waits for it, builds take a
+  // few milliseconds even for thousands of nodes
+  m_pendingBvh = std::async(std::launch::async, [boxes = std::move(boxes)](){
+    std::vector<Bvh> out(boxes.size());
+    for(size_t r = 0; r < boxes.size(); r++)
+      out[r].build(boxes[r]);
+    return out;
+  });
+  m_movedItems = 0;
+}
+
+void SdfTape::updateBvh(bool wait){
+  if(m_runsStale){
+    m_runs.clear();
+    for(uint32_t s = 0; s < m_segments.size();){
+      if(!m_segments[s].cullable){
+        s++;
+        continue;
+      }
+      uint32_t end = s;
+      while(end < m_segments.size() && m_segments[end].cullable)
+        end++;
+      if(end - s >= MIN_BVH_RUN)
+        m_runs.push_back({.begin = s, .end = end});
+      s = end;
+    }
+    m_runsStale = false;
+
+    if(!m_runs.empty())
+      launchBvhBuild();
+    if(!wait)
+      return;
+  }
+
+  if(m_pendingBvh.valid() &&
+     (wait || m_pendingBvh.wait_for(std::chrono::seconds(0)) == std::future_status::ready)){
+    std::vector<Bvh> built = m_pendingBvh.get();
+    for(size_t r = 0; r < m_runs.size(); r++){
+      UnionRun& run = m_runs[r];
+      run.bvh = std::move(built[r]);
+      // Boxes may have moved while the build was running
+      for(uint32_t s = run.begin; s < run.end; s++)
+        run.bvh.setBox(s - run.begin, m_segments[s].bbox);
+    }
+  }
+
+  uint32_t runItems = 0;
+  for(UnionRun& run : m_runs){
+    if(run.bvh.needsRefit())
+      run.bvh.refit();
+    runItems += run.end - run.begin;
+  }
+
+  // Refitting keeps the culling exact but the tree degrades as boxes wander,
+  // rebuild it once half of the boxes moved
+  if(!m_pendingBvh.valid() && m_movedItems > runItems / 2)
+    launchBvhBuild();
+}
+
+//---------------------------------------
+// Interpreter
+//---------------------------------------
+
+float SdfTape::evalSegment(const Segment& seg, glm::vec3 p, float result) const {
+  const TapeWord* c = m_code.data() + seg.begin;
+  const TapeWord* end = m_code.data() + seg.end;
+  float d = 0.0f;
+
+  while(c < end){
+    switch(TapeOp(c->op))
+    {
+      case TapeOp::Transform:
+        p = glm::vec3(c[1].f, c[2].f, c[3].f) * p.x +
+            glm::vec3(c[4].f, c[5].f, c[6].f) * p.y +
+            glm::vec3(c[7].f, c[8].f, c[9].f) * p.z +
+            glm::vec3(c[10].f, c[11].f, c[12].f);
+        c += 13;
+        break;
+      case TapeOp::LimRepetition:
+        p = opLimRepetition(p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(c[4].f, c[5].f, c[6].f));
+        c += 7;
+        break;
+      case TapeOp::IlimRepetition:
+        p = opRepetition(p, glm::vec3(c[1].f, c[2].f, c[3].f));
+        c += 4;
+        break;
+      case TapeOp::CellCull: {
+        // Outside its box the copy can't lower the result below the distance to it
+        const float boxD = boxDistance(p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(c[4].f, c[5].f, c[6].f));
+        if(boxD > 0.0f && boxD >= result)
+          return result;
+        c += 7;
+        break;
+      }
+      case TapeOp::Elongate:
+        p = opElongate(p, glm::vec3(c[1].f, c[2].f, c[3].f));
+        c += 4;
+        break;
+      case TapeOp::Scale:
+        p /= c[1].f;
+        c += 2;
+        break;
+      case TapeOp::Empty:   d = sdEmpty(p) - c[1].f;   c += 2; break;
+      case TapeOp::Box:     d = sdBox(p) - c[1].f;     c += 2; break;
+      case TapeOp::Sphere:  d = sdSphere(p) - c[1].f;  c += 2; break;
+      case TapeOp::Torus:   d = sdTorus(p) - c[1].f;   c += 2; break;
+      case TapeOp::Snowman: d = sdSnowMan(p) - c[1].f; c += 2; break;
+      case TapeOp::Plane:   d = sdPlane(p) - c[1].f;   c += 2; break;
+      case TapeOp::Volume:  d = m_volumes->eval(c[1].i, p) - c[2].f; c += 3; break;
+      case TapeOp::Terrain:
+        d = d>0.0 ? applyTerrainOp(p, d, c[1].i, glm::vec4(c[2].f, c[3].f, c[4].f, c[5].f), c[6].f) : d;
+        c += 7;
+        break;
+      case TapeOp::Morph:
+        d = applyMorphOp(p, d, c[1].i, c[2].f, c[3].f);
+        c += 4;
+        break;
+      case TapeOp::Union:
+        result = opUnion(d * c[1].f, result);
+        c += 2;
+        break;
+      case TapeOp::Substraction:
+        result = opSubtraction(d * c[1].f, result);
+        c += 2;
+        break;
+      case TapeOp::SmoothUnion:
+        result = opSmoothUnion(d * c[1].f, result, c[2].f);
+        c += 3;
+        break;
+      case TapeOp::SmoothSubstraction:
+        result = opSmoothSubtraction(d * c[1].f, result, c[2].f);
+        c += 3;
+        break;
+    }
+  }
+
+  return result;
+}
+
+void SdfTape::evalSegmentBatch(const Segment& seg, const PointBatch& point, float* result) const {
+  const TapeWord* c = m_code.data() + seg.begin;
+  const TapeWord* end = m_code.data() + seg.end;
+  PointBatch p = point;
+  alignas(32) float d[SDF_BATCH_WIDTH];
+
+  while(c < end){
+    const TapeOp op = TapeOp(c->op);
+    switch(op)
+    {
+      case TapeOp::Transform: {
+        float m[12];
+        for(int i = 0; i < 12; i++)
+          m[i] = c[1 + i].f;
+        batchTransform(p, m);
+        c += 13;
+        break;
+      }
+      case TapeOp::LimRepetition:
+        batchRepOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::ivec3(c[4].f, c[5].f, c[6].f));
+        c += 7;
+        break;
+      case TapeOp::IlimRepetition:
+        batchRepOp(2, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::ivec3(0));
+        c += 4;
+        break;
+      case TapeOp::CellCull: {
+        const glm::vec3 cellMin(c[1].f, c[2].f, c[3].f);
+        const glm::vec3 cellMax(c[4].f, c[5].f, c[6].f);
+        bool far = true;
+        for(int l = 0; l < SDF_BATCH_WIDTH && far; l++){
+          const float boxD = boxDistance(glm::vec3(p.x[l], p.y[l], p.z[l]), cellMin, cellMax);
+          far = boxD > 0.0f && boxD >= result[l];
+        }
+        if(far)
+          return;
+        c += 7;
+        break;
+      }
+      case TapeOp::Elongate:
+        batchDefOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f));
+        c += 4;
+        break;
+      case TapeOp::Scale:
+        batchScale(p, c[1].f);
+        c += 2;
+        break;
+      case TapeOp::Empty:
+      case TapeOp::Box:
+      case TapeOp::Sphere:
+      case TapeOp::Torus:
+      case TapeOp::Snowman:
+      case TapeOp::Plane:
+        batchPrimitive(int(op) - int(TapeOp::Empty), p, d);
+        for(int l = 0; l < SDF_BATCH_WIDTH; l++)
+          d[l] -= c[1].f;
+        c += 2;
+        break;
+      case TapeOp::Volume:
+        for(int l = 0; l < SDF_BATCH_WIDTH; l++)
+          d[l] = m_volumes->eval(c[1].i, glm::vec3(p.x[l], p.y[l], p.z[l])) - c[2].f;
+        c += 3;
+        break;
+      case TapeOp::Terrain:
+        batchTerrainOp(p, d, c[1].i, glm::vec4(c[2].f, c[3].f, c[4].f, c[5].f), c[6].f);
+        c += 7;
+        break;
+      case TapeOp::Morph:
+        batchMorphOp(p, d, c[1].i, c[2].f, c[3].f);
+        c += 4;
+        break;
+      case TapeOp::Union:
+      case TapeOp::Substraction:
+      case TapeOp::SmoothUnion:
+      case TapeOp::SmoothSubstraction: {
+        const bool smooth = op == TapeOp::SmoothUnion || op == TapeOp::SmoothSubstraction;
+        for(int l = 0; l < SDF_BATCH_WIDTH; l++)
+          d[l] *= c[1].f;
+        batchCombOp(int(op) - int(TapeOp::Union), d, result, smooth ? c[2].f : 0.0f);
+        c += smooth ? 3 : 2;
+        break;
+      }
+    }
+  }
+}
+
+Dual SdfTape::evalSegmentDual(const Segment& seg, Dual3 p, Dual result) const {
+  const TapeWord* c = m_code.data() + seg.begin;
+  const TapeWord* end = m_code.data() + seg.end;
+  Dual d = {0.0f, glm::vec3(0.0f)};
+
+  while(c < end){
+    const TapeOp op = TapeOp(c->op);
+    switch(op)
+    {
+      case TapeOp::Transform: {
+        float m[12];
+        for(int i = 0; i < 12; i++)
+          m[i] = c[1 + i].f;
+        dualTransform(p, m);
+        c += 13;
+        break;
+      }
+      case TapeOp::LimRepetition:
+        dualRepOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(c[4].f, c[5].f, c[6].f));
+        c += 7;
+        break;
+      case TapeOp::IlimRepetition:
+        dualRepOp(2, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(0.0f));
+        c += 4;
+        break;
+      case TapeOp::CellCull: {
+        const float boxD = boxDistance(glm::vec3(p.x.v, p.y.v, p.z.v), glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(c[4].f, c[5].f, c[6].f));
+        if(boxD > 0.0f && boxD >= result.v)
+          return result;
+        c += 7;
+        break;
+      }
+      case TapeOp::Elongate:
+        dualDefOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f));
+        c += 4;
+        break;
+      case TapeOp::Scale:
+        dualScale(p, c[1].f);
+        c += 2;
+        break;
+      case TapeOp::Empty:
+      case TapeOp::Box:
+      case TapeOp::Sphere:
+      case TapeOp::Torus:
+      case TapeOp::Snowman:
+      case TapeOp::Plane:
+        d = dualPrimitive(int(op) - int(TapeOp::Empty), p);
+        d.v -= c[1].f;
+        c += 2;
+        break;
+      case TapeOp::Volume:
+        d = m_volumes->eval(c[1].i, p);
+        d.v -= c[2].f;
+        c += 3;
+        break;
+      case TapeOp::Terrain:
+        d = d.v>0.0 ? dualTerrainOp(p, d, c[1].i, glm::vec4(c[2].f, c[3].f, c[4].f, c[5].f), c[6].f) : d;
+        c += 7;
+        break;
+      case TapeOp::Morph:
+        d = dualMorphOp(p, d, c[1].i, c[2].f, c[3].f);
+        c += 4;
+        break;
+      case TapeOp::Union:
+      case TapeOp::Substraction:
+      case TapeOp::SmoothUnion:
+      case TapeOp::SmoothSubstraction: {
+        const bool smooth = op == TapeOp::SmoothUnion || op == TapeOp::SmoothSubstraction;
+        d = {d.v * c[1].f, d.g * c[1].f};
+        result = dualCombOp(int(op) - int(TapeOp::Union), d, result, smooth ? c[2].f : 0.0f);
+        c += smooth ? 3 : 2;
+        break;
+      }
+    }
+  }
+
+  return result;
+}
+
+Interval SdfTape::evalSegmentInterval(const Segment& seg, IntervalBox p, Interval result) const {
+  const TapeWord* c = m_code.data() + seg.begin;
+  const TapeWord* end = m_code.data() + seg.end;
+  Interval d = {0.0f, 0.0f};
+
+  while(c < end){
+    const TapeOp op = TapeOp(c->op);
+    switch(op)
+    {
+      case TapeOp::Transform: {
+        float m[12];
+        for(int i = 0; i < 12; i++)
+          m[i] = c[1 + i].f;
+        p = intervalTransform(p, m);
+        c += 13;
+        break;
+      }
+      case TapeOp::LimRepetition:
+        p = intervalRepOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(c[4].f, c[5].f, c[6].f));
+        c += 7;
+        break;
+      case TapeOp::IlimRepetition:
+        p = intervalRepOp(2, p, glm::vec3(c[1].f, c[2].f, c[3].f), glm::vec3(0.0f));
+        c += 4;
+        break;
+      case TapeOp::CellCull: {
+        // Distance between the boxes, once above the result upper end the
+        // copy changes neither end
+        const glm::vec3 cellMin(c[1].f, c[2].f, c[3].f);
+        const glm::vec3 cellMax(c[4].f, c[5].f, c[6].f);
+        const float boxD = boxDistance(glm::vec3(0.0f), cellMin - p.hi, cellMax - p.lo);
+        if(boxD > 0.0f && boxD >= result.hi)
+          return result;
+        c += 7;
+        break;
+      }
+      case TapeOp::Elongate:
+        p = intervalDefOp(1, p, glm::vec3(c[1].f, c[2].f, c[3].f));
+        c += 4;
+        break;
+      case TapeOp::Scale:
+        p = intervalScale(p, c[1].f);
+        c += 2;
+        break;
+      case TapeOp::Empty:
+      case TapeOp::Box:
+      case TapeOp::Sphere:
+      case TapeOp::Torus:
+      case TapeOp::Snowman:
+      case TapeOp::Plane:
+        d = intervalPrimitive(int(op) - int(TapeOp::Empty), p);
+        d = {d.lo - c[1].f, d.hi - c[1].f};
+        c += 2;
+        break;
+      case TapeOp::Volume:
+        d = m_volumes->eval(c[1].i, p);
+        d = {d.lo - c[2].f, d.hi - c[2].f};
+        c += 3;
+        break;
+      case TapeOp::Terrain:
+        d = intervalTerrainOp(p, d, c[1].i, glm::vec4(c[2].f, c[3].f, c[4].f, c[5].f), c[6].f);
+        c += 7;
+        break;
+      case TapeOp::Morph:
+        d = intervalMorphOp(p, d, c[1].i, c[2].f, c[3].f);
+        c += 4;
+        break;
+      case TapeOp::Union:
+      case TapeOp::Substraction:
+      case TapeOp::SmoothUnion:
+      case TapeOp::SmoothSubstraction: {
+        const bool smooth = op == TapeOp::SmoothUnion || op == TapeOp::SmoothSubstraction;
+        const float scale = c[1].f;
+        d = scale >= 0.0f ? Interval{d.lo * scale, d.hi * scale} : Interval{d.hi * scale, d.lo * scale};
+        result = intervalCombOp(int(op) - int(TapeOp::Union), d, result, smooth ? c[2].f : 0.0f);
+        c += smooth ? 3 : 2;
+        break;
+      }
+    }
+  }
+
+  return result;
+}
+
+float SdfTape::eval(glm::vec3 p, int segExcluded) const {
+  float result = iniD;
+  size_t r = 0;
+  for(int s = 0; s < int(m_segments.size()); s++){
+    if(r < m_runs.size() && s == int(m_runs[r].begin)){
+      const UnionRun& run = m_runs[r++];
+      if(!run.bvh.empty()){
+        // A segment can't lower the result below the distance to its box
+        run.bvh.traverse(
+          [&](glm::vec3 bMin, glm::vec3 bMax){
+            float boxD = boxDistance(p, bMin, bMax);
+            return boxD < result ? boxD : -1.0f;
+          },
+          [&](uint32_t item){
+            int seg = int(run.begin + item);
+            if(seg != segExcluded)
+              result = evalSegment(m_segments[seg], p, result);
+          });
+        s = int(run.end) - 1;
+        continue;
+      }
+    }
+
+    if(s == segExcluded || m_segments[s].dynamic)
+      continue;
+    result = evalSegment(m_segments[s], p, result);
+  }
+  if(m_edits)
+    result = m_edits->apply(p, result);
+
+  for(uint32_t s : m_dynamic){
+    if(int(s) != segExcluded)
+      result = evalSegment(m_segments[s], p, result);
+  }
+  return result;
+}
+
+float SdfTape::evalWithGradient(glm::vec3 p, glm::vec3& grad, int segExcluded) const {
+  const Dual3 point = {
+    {p.x, glm::vec3(1.0f, 0.0f, 0.0f)},
+    {p.y, glm::vec3(0.0f, 1.0f, 0.0f)},
+    {p.z, glm::vec3(0.0f, 0.0f, 1.0f)},
+  };
+  Dual result = {iniD, glm::vec3(0.0f)};
+
+  size_t r = 0;
+  for(int s = 0; s < int(m_segments.size()); s++){
+    if(r < m_runs.size() && s == int(m_runs[r].begin)){
+      const UnionRun& run = m_runs[r++];
+      if(!run.bvh.empty()){
+        run.bvh.traverse(
+          [&](glm::vec3 bMin, glm::vec3 bMax){
+            float boxD = boxDistance(p, bMin, bMax);
+            return boxD < result.v ? boxD : -1.0f;
+          },
+          [&](uint32_t item){
+            int seg = int(run.begin + item);
+            if(seg != segExcluded)
+              result = evalSegmentDual(m_segments[seg], point, result);
+          });
+        s = int(run.end) - 1;
+        continue;
+      }
+    }
+
+    if(s == segExcluded || m_segments[s].dynamic)
+      continue;
+    result = evalSegmentDual(m_segments[s], point, result);
+  }
+  if(m_edits)
+    result = m_edits->apply(p, result);
+
+  for(uint32_t s : m_dynamic){
+    if(int(s) != segExcluded)
+      result = evalSegmentDual(m_segments[s], point, result);
+  }
+
+  grad = result.g;
+  return result.v;
+}
+
+float SdfTape::evalTerrain(glm::vec3 p) const {
+  float result = iniD;
+  for(const Segment& seg : m_segments){
+    if(seg.terrain && !seg.dynamic)
+      result = evalSegment(seg, p, result);
+  }
+  return m_edits ? m_edits->apply(p, result) : result;
+}
+
+void SdfTape::evalBatch(const PointBatch& p, float* result, int segExcluded) const {
+  glm::vec3 lanesMin(p.x[0], p.y[0], p.z[0]);
+  glm::vec3 lanesMax = lanesMin;
+  for(int l = 0; l < SDF_BATCH_WIDTH; l++){
+    result[l] = iniD;
+    lanesMin = glm::min(lanesMin, glm::vec3(p.x[l], p.y[l], p.z[l]));
+    lanesMax = glm::max(lanesMax, glm::vec3(p.x[l], p.y[l], p.z[l]));
+  }
+
+  size_t r = 0;
+  for(int s = 0; s < int(m_segments.size()); s++){
+    if(r < m_runs.size() && s == int(m_runs[r].begin)){
+      const UnionRun& run = m_runs[r++];
+      if(!run.bvh.empty()){
+        // Boxes are skipped when they are farther from the lanes bounds than
+        // the worst lane result
+        run.bvh.traverse(
+          [&](glm::vec3 bMin, glm::vec3 bMax){
+            float worst = result[0];
+            for(int l = 1; l < SDF_BATCH_WIDTH; l++)
+              worst = glm::max(worst, result[l]);
+            float boxD = boxDistance(glm::vec3(0.0f), bMin - lanesMax, bMax - lanesMin);
+            return boxD < worst ? boxD : -1.0f;
+          },
+          [&](uint32_t item){
+            int seg = int(run.begin + item);
+            if(seg != segExcluded)
+              evalSegmentBatch(m_segments[seg], p, result);
+          });
+        s = int(run.end) - 1;
+        continue;
+      }
+    }
+
+    if(s == segExcluded || m_segments[s].dynamic)
+      continue;
+    evalSegmentBatch(m_segments[s], p, result);
+  }
+  if(m_edits)
+    m_edits->applyBatch(p, result);
+
+  for(uint32_t s : m_dynamic){
+    if(int(s) != segExcluded)
+      evalSegmentBatch(m_segments[s], p, result);
+  }
+}
+
+Interval SdfTape::evalInterval(const IntervalBox& p) const {
+  Interval result = {iniD, iniD};
+
+  size_t r = 0;
+  for(int s = 0; s < int(m_segments.size()); s++){
+    if(r < m_runs.size() && s == int(m_runs[r].begin)){
+      const UnionRun& run = m_runs[r++];
+      if(!run.bvh.empty()){
+        // A segment can't go below the distance between the boxes, once that
+        // is above the result upper end it changes neither end
+        run.bvh.traverse(
+          [&](glm::vec3 bMin, glm::vec3 bMax){
+            float boxD = boxDistance(glm::vec3(0.0f), bMin - p.hi, bMax - p.lo);
+            return boxD < result.hi ? boxD : -1.0f;
+          },
+          [&](uint32_t item){
+            result = evalSegmentInterval(m_segments[run.begin + item], p, result);
+          });
+        s = int(run.end) - 1;
+        continue;
+      }
+    }
+
+    if(!m_segments[s].dynamic)
+      result = evalSegmentInterval(m_segments[s], p, result);
+  }
+  if(m_edits)
+    result = m_edits->apply(p, result);
+
+  for(uint32_t s : m_dynamic)
+    result = evalSegmentInterval(m_segments[s], p, result);
+  return result;
+}
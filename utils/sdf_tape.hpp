@@ -0,0 +1,130 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <future>
+#include <initializer_list>
+#include <vector>
+
+#include "bvh.hpp"
+#include "sdf_batch.hpp"
+#include "sdf_dual.hpp"
+#include "sdf_interval.hpp"
+
+// Opcodes of the compiled scene. Every node becomes one segment of ops that
+// ends with a combination op, parameters are packed right after each opcode.
+enum class TapeOp : uint32_t {
+  Transform,          // 3x4 affine inverse transform, column by column (12)
+  LimRepetition,      // spacing (3), limit (3)
+  IlimRepetition,     // spacing (3)
+  CellCull,           // cell min (3), cell max (3), ends Union segments farther than the result
+  Elongate,           // defP (3)
+  Scale,              // scale (1)
+  Empty,              // roundness (1)
+  Box,                // roundness (1)
+  Sphere,             // roundness (1)
+  Torus,              // roundness (1)
+  Snowman,            // roundness (1)
+  Plane,              // roundness (1)
+  Volume,             // volume (1), roundness (1)
+  Terrain,            // octaves (1), terrain (4), minD (1)
+  Morph,              // morphPrim (1), morph (1), roundness (1)
+  Union,              // scale (1)
+  Substraction,       // scale (1)
+  SmoothUnion,        // scale (1), smoothness (1)
+  SmoothSubstraction, // scale (1), smoothness (1)
+};
+
+class EditLayer;
+class SampledVolumes;
+
+union TapeWord {
+  uint32_t op;
+  int32_t i;
+  float f;
+
+  TapeWord(TapeOp o) : op(uint32_t(o)) {}
+  TapeWord(int32_t v) : i(v) {}
+  TapeWord(float v) : f(v) {}
+};
+
+class SdfTape {
+public:
+  struct Segment {
+    uint32_t begin;
+    uint32_t end;
+    uint32_t nodeId;
+    bool terrain;
+    bool dynamic;       // Physics bodies, combined after the edit layer
+    bool cullable;      // Unions whose distance never goes below the one to bbox
+    nvutils::Bbox bbox; // World space bounds of the node
+  };
+
+  // Consecutive cullable segments. Union is a plain min so they can be visited
+  // in any order and skipped when their box is farther than the current result.
+  struct UnionRun {
+    uint32_t begin;
+    uint32_t end;
+    Bvh bvh;            // Empty until the background build is adopted
+  };
+
+  // Shortest run worth a BVH
+  static const uint32_t MIN_BVH_RUN = 8;
+
+  void clear();
+
+  // cullable is only honoured for static segments that end in a Union
+  void beginSegment(uint32_t nodeId, bool terrain, bool dynamic, const nvutils::Bbox& bbox, bool cullable);
+  void emit(TapeOp op, std::initializer_list<TapeWord> params = {});
+  void endSegment();
+
+  // Overwrites segment idx with the single segment program in src.
+  // Returns false if the program sizes, the dynamic or the cullable flag
+  // differ and the tape must be rebuilt.
+  bool replaceSegment(size_t idx, const SdfTape& src);
+
+  // Builds the union run BVHs in the background after the tape is rebuilt,
+  // adopts them once ready and refits them after in place edits. Evaluation
+  // falls back to visiting every segment of a run while its BVH is missing.
+  // Not thread safe, call it before evaluating from several threads. wait
+  // blocks until a pending build is done and adopts it.
+  void updateBvh(bool wait = false);
+
+  // Layer applied over the static segments of every evaluation, terrain
+  // included. Dynamic segments are combined after it in scene order, edits
+  // don't cut the bodies moving through them. Not owned, clear() keeps it.
+  void setEdits(const EditLayer* edits) { m_edits = edits; }
+  // Volumes read by the Volume ops, not owned either
+  void setVolumes(const SampledVolumes* volumes) { m_volumes = volumes; }
+
+  float eval(glm::vec3 p, int segExcluded = -1) const;
+  float evalTerrain(glm::vec3 p) const;
+  void evalBatch(const PointBatch& p, float* result, int segExcluded = -1) const;
+  // Same value as eval() plus its gradient
+  float evalWithGradient(glm::vec3 p, glm::vec3& grad, int segExcluded = -1) const;
+  // Range of eval() over every point of the box, before float rounding
+  Interval evalInterval(const IntervalBox& p) const;
+  // Combines segment idx alone with result, without any culling
+  float evalSegment(size_t idx, glm::vec3 p, float result) const { return evalSegment(m_segments[idx], p, result); }
+
+  const std::vector<Segment>& segments() const { return m_segments; }
+  size_t size() const { return m_code.size(); }
+
+private:
+  float evalSegment(const Segment& seg, glm::vec3 p, float result) const;
+  void evalSegmentBatch(const Segment& seg, const PointBatch& point, float* result) const;
+  Dual evalSegmentDual(const Segment& seg, Dual3 p, Dual result) const;
+  Interval evalSegmentInterval(const Segment& seg, IntervalBox p, Interval result) const;
+  void launchBvhBuild();
+
+  std::vector<TapeWord> m_code;
+  std::vector<Segment> m_segments;
+
+  std::vector<uint32_t> m_dynamic;  // Dynamic segments in scene order
+  std::vector<UnionRun> m_runs;
+  std::future<std::vector<Bvh>> m_pendingBvh;
+  bool m_runsStale = true;     // Segment layout changed since m_runs was computed
+  uint32_t m_movedItems = 0;   // Boxes refitted since the last build
+  const EditLayer* m_edits = nullptr;
+  const SampledVolumes* m_volumes = nullptr;
+};
@@ -0,0 +1,83 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t numThreads)
+  : m_numThreads(numThreads > 0 ? numThreads : std::max(std::thread::hardware_concurrency(), 1u)) {
+}
+
+ThreadPool::~ThreadPool(){
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for(auto& t : m_workers)
+    t.join();
+}
+
+void ThreadPool::start(){
+  // The calling thread is the last worker
+  for(uint32_t t = 1; t < m_numThreads; t++)
+    m_workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn){
+  if(count == 0)
+    return;
+
+  std::lock_guard<std::mutex> call(m_callMutex);
+
+  // Not worth waking anyone up
+  if(count == 1 || m_numThreads == 1){
+    for(uint32_t i = 0; i < count; i++)
+      fn(i);
+    return;
+  }
+
+  if(m_workers.empty())
+    start();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fn = &fn;
+    m_count = count;
+    m_next = 0;
+    m_busyWorkers = uint32_t(m_workers.size());
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  runJobs();
+
+  // fn must outlive every worker that may still be inside it
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [&]{ return m_busyWorkers == 0; });
+  m_fn = nullptr;
+}
+
+void ThreadPool::runJobs(){
+  for(uint32_t i = m_next++; i < m_count; i = m_next++)
+    (*m_fn)(i);
+}
+
+void ThreadPool::workerLoop(){
+  uint64_t seen = 0;
+  while(true){
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&]{ return m_quit || m_generation != seen; });
+      if(m_quit)
+        return;
+      seen = m_generation;
+    }
+
+    runJobs();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busyWorkers--;
+    }
+    m_done.notify_one();
+  }
+}
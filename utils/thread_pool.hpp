@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops. Workers are started on
+// the first parallelFor and sleep between calls.
+class ThreadPool {
+public:
+  // 0 uses every hardware thread
+  explicit ThreadPool(uint32_t numThreads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Calls fn(i) for every i in [0, count) and returns once all are done. The
+  // calling thread takes jobs too. Calls from several threads are serialized.
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+  uint32_t numThreads() const { return m_numThreads; }
+
+private:
+  void start();
+  void workerLoop();
+  void runJobs();
+
+  uint32_t m_numThreads;
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_callMutex;                 // One parallelFor at a time
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+
+  const std::function<void(uint32_t)>* m_fn = nullptr;
+  uint32_t m_count = 0;
+  uint64_t m_generation = 0;              // Bumped for every parallelFor
+  uint32_t m_busyWorkers = 0;
+  std::atomic<uint32_t> m_next{0};
+  bool m_quit = false;
+};